@@ -0,0 +1,248 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "lockstep.h"          // ロックステップモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  ロックステップモジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static void sendFrame(Lockstep *ls, int s, unsigned char *frame, int len);
+static void compareHash(Lockstep *ls, int tick);
+static void putInt(unsigned char *p, unsigned value);
+static unsigned getInt(unsigned char *p);
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * ロックステップの状態を初期化する
+ * 引数 :
+ *   ls    - ロックステップの状態へのポインタ
+ *   delay - 入力遅延(ティック, 1 ～ LOCKSTEP_MAX_DELAY)
+ */
+void initLockstep(Lockstep *ls, int delay)
+{
+  memset(ls, 0, sizeof(Lockstep));
+  ls->delay = delay;
+}
+
+/*
+ * 次の自分の入力を送る(ティック tick に押したキーは tick + delay に使う)
+ * 引数 :
+ *   ls  - ロックステップの状態へのポインタ
+ *   s   - 相手との会話用ファイルデスクリプタ
+ *   key - 押されたキー(無ければ 0)
+ */
+void sendLockstepInput(Lockstep *ls, int s, int key)
+{
+  unsigned char frame[3];
+  int           tick = ls->delay + 1 + ls->localFrames;   // この入力を使うティック
+
+  ls->localKey[tick % LOCKSTEP_WINDOW] = key;
+  ls->localFrames++;
+
+  // キーは curses のキーコード(16 ビットに収まる)
+  frame[0] = LOCKSTEP_INPUT;
+  frame[1] = key & 0xff;
+  frame[2] = (key >> 8) & 0xff;
+  sendFrame(ls, s, frame, 3);
+}
+
+/*
+ * 届いているフレームを読む(読めるデータがあるときに呼ぶ)
+ * 途中までのフレームは読んで覚えておき, 残りが届いたら続きから処理する.
+ * 終わりのフレームより後のバイトはソケットに残す
+ * 引数 :
+ *   ls - ロックステップの状態へのポインタ
+ *   s  - 相手との会話用ファイルデスクリプタ
+ * 戻値 :
+ *   切断されていれば -1, そうでなければ 0
+ */
+int receiveLockstepFrames(Lockstep *ls, int s)
+{
+  unsigned char  buf[LOCKSTEP_FRAME_MAX * 16];
+  unsigned char *p;
+  int            len, peeked, taken, used = 0, tick;
+
+  // 前に途中まで届いたフレームの続きに, 届いているバイトを覗いて並べ,
+  // そろっているフレームを順に処理する
+  // (終わりのフレームの後には別の形式のメッセージが続くので, 読み過ぎてはいけない)
+  memcpy(buf, ls->pending, ls->pendingLen);
+  if ((peeked = recv(s, buf + ls->pendingLen, sizeof(buf) - ls->pendingLen, MSG_PEEK)) <= 0)
+    return -1;
+  len = ls->pendingLen + peeked;
+  while (used < len && !ls->remoteEnded) {
+    p = buf + used;
+    if (p[0] == LOCKSTEP_INPUT) {
+      if (len - used < 3)
+        break;
+      tick = ls->delay + 1 + ls->remoteFrames;
+      ls->remoteKey[tick % LOCKSTEP_WINDOW] = p[1] | (p[2] << 8);
+      ls->remoteFrames++;
+      used += 3;
+    }
+    else if (p[0] == LOCKSTEP_HASH) {
+      if (len - used < 9)
+        break;
+      tick = getInt(p + 1);
+      ls->remoteHash[tick % LOCKSTEP_WINDOW]     = getInt(p + 5);
+      ls->remoteHashTick[tick % LOCKSTEP_WINDOW] = tick;
+      compareHash(ls, tick);
+      used += 9;
+    }
+    else if (p[0] == LOCKSTEP_END) {
+      // 相手はこの後フレームを送らない
+      ls->remoteEnded = 1;
+      used += 1;
+    }
+    else {
+      // 知らないフレームが来たら, 相手とはもう話が通じない
+      return -1;
+    }
+  }
+
+  // 覗いた分のうち, 処理した分と途中までのフレームを読む(覗いた分なので必ず読める)
+  // 途中までのフレームをソケットに残すと, 残りが届くまで読めるデータがあり続けて空回りする
+  if (ls->remoteEnded) {
+    taken = used - ls->pendingLen;
+    ls->pendingLen = 0;
+  }
+  else {
+    taken = peeked;
+    ls->pendingLen = len - used;
+    memcpy(ls->pending, buf + used, ls->pendingLen);
+  }
+  if (taken > 0 && recv(s, buf, taken, 0) != taken)
+    return -1;
+  ls->bytesReceived += taken;
+
+  return 0;
+}
+
+/*
+ * ティック tick の両方の入力がそろっているか
+ * 引数 :
+ *   ls   - ロックステップの状態へのポインタ
+ *   tick - ティック
+ * 戻値 :
+ *   そろっていれば 1
+ */
+int hasLockstepInputs(Lockstep *ls, int tick)
+{
+  // 最初の delay ティックは誰も入力していない
+  if (tick <= ls->delay)
+    return 1;
+  return ls->localFrames >= tick - ls->delay && ls->remoteFrames >= tick - ls->delay;
+}
+
+/*
+ * ティック tick の入力を得る(hasLockstepInputs() が 1 のときだけ呼ぶ)
+ * 引数 :
+ *   ls        - ロックステップの状態へのポインタ
+ *   tick      - ティック
+ *   localKey  - 自分のキー(出力)
+ *   remoteKey - 相手のキー(出力)
+ */
+void getLockstepInputs(Lockstep *ls, int tick, int *localKey, int *remoteKey)
+{
+  if (tick <= ls->delay) {
+    *localKey = *remoteKey = 0;
+    return;
+  }
+  *localKey  = ls->localKey[tick % LOCKSTEP_WINDOW];
+  *remoteKey = ls->remoteKey[tick % LOCKSTEP_WINDOW];
+}
+
+/*
+ * ティック tick の状態のハッシュを覚え, ハッシュを比べるティックなら相手に送る
+ * 引数 :
+ *   ls   - ロックステップの状態へのポインタ
+ *   s    - 相手との会話用ファイルデスクリプタ
+ *   tick - ティック
+ *   hash - 状態のハッシュ(両方の端末で同じ順番で計算したもの)
+ */
+void sendLockstepHash(Lockstep *ls, int s, int tick, unsigned hash)
+{
+  unsigned char frame[9];
+
+  if (tick % LOCKSTEP_HASH_TICKS != 0)
+    return;
+
+  ls->localHash[tick % LOCKSTEP_WINDOW]     = hash;
+  ls->localHashTick[tick % LOCKSTEP_WINDOW] = tick;
+  compareHash(ls, tick);
+
+  frame[0] = LOCKSTEP_HASH;
+  putInt(frame + 1, tick);
+  putInt(frame + 5, hash);
+  sendFrame(ls, s, frame, 9);
+}
+
+/*
+ * 終わりのフレームを送る(この後は入力もハッシュも送らない)
+ * 引数 :
+ *   ls - ロックステップの状態へのポインタ
+ *   s  - 相手との会話用ファイルデスクリプタ
+ */
+void sendLockstepEnd(Lockstep *ls, int s)
+{
+  unsigned char frame[1];
+
+  frame[0] = LOCKSTEP_END;
+  sendFrame(ls, s, frame, 1);
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * フレームを送り, 送ったバイト数を数える
+ */
+static void sendFrame(Lockstep *ls, int s, unsigned char *frame, int len)
+{
+  if (write(s, frame, len) == len)
+    ls->bytesSent += len;
+}
+
+/*
+ * ティック tick の自分と相手のハッシュがそろっていれば比べる
+ * 最初に食い違ったティックを desyncTick に残す
+ */
+static void compareHash(Lockstep *ls, int tick)
+{
+  int slot = tick % LOCKSTEP_WINDOW;
+
+  if (ls->localHashTick[slot] != tick || ls->remoteHashTick[slot] != tick)
+    return;
+
+  if (ls->localHash[slot] != ls->remoteHash[slot]) {
+    if (ls->desyncTick == 0)
+      ls->desyncTick = tick;
+  }
+  else if (tick > ls->checkedTick) {
+    ls->checkedTick = tick;
+  }
+}
+
+/*
+ * 32 ビットの値をリトルエンディアンで書く
+ */
+static void putInt(unsigned char *p, unsigned value)
+{
+  p[0] = value & 0xff;
+  p[1] = (value >> 8) & 0xff;
+  p[2] = (value >> 16) & 0xff;
+  p[3] = (value >> 24) & 0xff;
+}
+
+/*
+ * 32 ビットの値をリトルエンディアンで読む
+ */
+static unsigned getInt(unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
@@ -0,0 +1,123 @@
+/********************************************************************
+                       ロックステップモジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+//--------------------------------------------------------------------
+//   ロックステップモジュールにおける定数・型の定義
+//--------------------------------------------------------------------
+#define LOCKSTEP_WINDOW      64   // 覚えておくティックの数(2 * 入力遅延より大きくする)
+#define LOCKSTEP_MAX_DELAY   16   // 入力遅延の上限(ティック)
+#define LOCKSTEP_HASH_TICKS  10   // 状態のハッシュを比べる間隔(ティック)
+
+// フレームの種類(先頭 1 バイト)
+#define LOCKSTEP_INPUT       'K'  // 入力: 'K' + キー(2 バイト)
+#define LOCKSTEP_HASH        'H'  // ハッシュ: 'H' + ティック(4 バイト) + ハッシュ(4 バイト)
+#define LOCKSTEP_END         'E'  // 終わり: 'E' だけ(この後はフレームを送らない)
+#define LOCKSTEP_FRAME_MAX   9    // フレームの最大長
+
+/*
+ * ロックステップの状態
+ * 両方の端末が同じ入力で同じシミュレーションを動かし, 入力だけを交換する.
+ * ティック t に押したキーはティック t + delay に使う(1 ～ delay ティック目の入力は無し).
+ * 入力のフレームにはティックを入れない(TCP は順番通りに届くので, k 番目のフレームが
+ * ティック delay + 1 + k の入力). 状態のハッシュは LOCKSTEP_HASH_TICKS ごとに交換し,
+ * 食い違ったら同期が外れた(desync)とする.
+ * ラウンドが終わったら終わりのフレームを送る. 相手の終わりのフレームより後には
+ * 何も届かないので, その後は同じ接続で別の形式のメッセージをやり取りできる
+ */
+typedef struct {
+  int      delay;                // 入力遅延(ティック)
+  int      localKey[LOCKSTEP_WINDOW];    // 自分の入力(ティック % LOCKSTEP_WINDOW)
+  int      remoteKey[LOCKSTEP_WINDOW];   // 相手の入力
+  int      localFrames;          // 送った入力のフレーム数
+  int      remoteFrames;         // 受け取った入力のフレーム数
+  unsigned localHash[LOCKSTEP_WINDOW];   // 自分の状態のハッシュ
+  unsigned remoteHash[LOCKSTEP_WINDOW];  // 相手の状態のハッシュ
+  int      localHashTick[LOCKSTEP_WINDOW];   // localHash のティック(0 なら無し)
+  int      remoteHashTick[LOCKSTEP_WINDOW];  // remoteHash のティック(0 なら無し)
+  int      checkedTick;          // ハッシュが一致した最後のティック
+  int      desyncTick;           // ハッシュが食い違ったティック(0 なら同期している)
+  int      stalls;               // 相手の入力が間に合わず待ったティックの数
+  int      remoteEnded;          // 相手の終わりのフレームが届いたら 1
+  unsigned char pending[LOCKSTEP_FRAME_MAX];  // 途中まで届いたフレーム
+  int      pendingLen;           // pending のバイト数
+  long     bytesSent;            // 送ったバイト数
+  long     bytesReceived;        // 受け取ったバイト数
+} Lockstep;
+
+
+//--------------------------------------------------------------------
+//   ロックステップモジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * ロックステップの状態を初期化する
+ * 引数 :
+ *   ls    - ロックステップの状態へのポインタ
+ *   delay - 入力遅延(ティック, 1 ～ LOCKSTEP_MAX_DELAY)
+ */
+void initLockstep(Lockstep *ls, int delay);
+
+/*
+ * 次の自分の入力を送る(ティック tick に押したキーは tick + delay に使う)
+ * 引数 :
+ *   ls  - ロックステップの状態へのポインタ
+ *   s   - 相手との会話用ファイルデスクリプタ
+ *   key - 押されたキー(無ければ 0)
+ */
+void sendLockstepInput(Lockstep *ls, int s, int key);
+
+/*
+ * 届いているフレームを読む(読めるデータがあるときに呼ぶ)
+ * 途中までのフレームは読んで覚えておき, 残りが届いたら続きから処理する.
+ * 終わりのフレームより後のバイトはソケットに残す
+ * 引数 :
+ *   ls - ロックステップの状態へのポインタ
+ *   s  - 相手との会話用ファイルデスクリプタ
+ * 戻値 :
+ *   切断されていれば -1, そうでなければ 0
+ */
+int receiveLockstepFrames(Lockstep *ls, int s);
+
+/*
+ * ティック tick の両方の入力がそろっているか
+ * 引数 :
+ *   ls   - ロックステップの状態へのポインタ
+ *   tick - ティック
+ * 戻値 :
+ *   そろっていれば 1
+ */
+int hasLockstepInputs(Lockstep *ls, int tick);
+
+/*
+ * ティック tick の入力を得る(hasLockstepInputs() が 1 のときだけ呼ぶ)
+ * 引数 :
+ *   ls        - ロックステップの状態へのポインタ
+ *   tick      - ティック
+ *   localKey  - 自分のキー(出力)
+ *   remoteKey - 相手のキー(出力)
+ */
+void getLockstepInputs(Lockstep *ls, int tick, int *localKey, int *remoteKey);
+
+/*
+ * ティック tick の状態のハッシュを覚え, ハッシュを比べるティックなら相手に送る
+ * 引数 :
+ *   ls   - ロックステップの状態へのポインタ
+ *   s    - 相手との会話用ファイルデスクリプタ
+ *   tick - ティック
+ *   hash - 状態のハッシュ(両方の端末で同じ順番で計算したもの)
+ */
+void sendLockstepHash(Lockstep *ls, int s, int tick, unsigned hash);
+
+/*
+ * 終わりのフレームを送る(この後は入力もハッシュも送らない)
+ * 引数 :
+ *   ls - ロックステップの状態へのポインタ
+ *   s  - 相手との会話用ファイルデスクリプタ
+ */
+void sendLockstepEnd(Lockstep *ls, int s);
+
+#endif
@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "mapChunk.h"          // マップチャンクキャッシュモジュールヘッダファイル
+#include "tagMap.h"            // 鬼ごっこマップモジュールヘッダファイル
+
+#define CHUNK_HASH_SIZE   (MAP_CHUNK_CACHE_SLOTS * 2)   // ハッシュ表の大きさ(2 のべき乗)
+
+//--------------------------------------------------------------------
+//  マップチャンクキャッシュモジュール内部で使用する構造体の定義
+//--------------------------------------------------------------------
+
+// キャッシュ上のチャンク 1 つ分
+typedef struct {
+  int            fileId;         // チャンクファイルの番号(-1 なら空き)
+  int            chunk;          // ファイル内のチャンク番号
+  int            size;           // data に確保したバイト数
+  unsigned char *data;           // チャンクの中身
+  int            loading;        // ファイルから読み込み中(読み終わるまで中身を使わない)
+  int            prev;           // LRU リストの前(より最近使った方)
+  int            next;           // LRU リストの次(より昔に使った方)
+  int            hashNext;       // ハッシュ表の同じバケツの次
+} ChunkSlot;
+
+//--------------------------------------------------------------------
+//  マップチャンクキャッシュモジュール内部で使用する変数
+//  キャッシュは同じマップを使うすべてのゲームで共有する
+//--------------------------------------------------------------------
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cacheLoaded = PTHREAD_COND_INITIALIZER;  // 読み込みが終わったことを知らせる
+static ChunkSlot      slots[MAP_CHUNK_CACHE_SLOTS];
+static int            buckets[CHUNK_HASH_SIZE];
+static int            lruHead = -1;       // 最後に使ったチャンク
+static int            lruTail = -1;       // 最も昔に使ったチャンク
+static int            usedSlots = 0;      // 一度でも使ったスロットの数
+static int            freeHead = -1;      // 空きスロットのリスト(hashNext でつなぐ)
+static int            initialized = 0;
+static MapChunkFile  *openFiles = NULL;   // 開いているチャンクファイルのリスト
+static int            nextFileId = 0;
+static MapChunkStats  cacheStats;
+
+//--------------------------------------------------------------------
+//  マップチャンクキャッシュモジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static void initCache();
+static int  hashChunk(int fileId, int chunk);
+static void unlinkLru(int i);
+static void pushLru(int i);
+static void unlinkHash(int i);
+static int  lookupChunk(MapChunkFile *file, int chunk);
+static int  takeSlot();
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * チャンクファイルを開く(すでに開いていれば共有する)
+ * 同じ名前でも書き換えられたファイルは別のファイルとして開く
+ * 引数 :
+ *   path - ファイル名
+ * 戻値 :
+ *   チャンクファイルへのポインタ. チャンクファイルでなければ NULL
+ */
+MapChunkFile* openMapChunkFile(char *path)
+{
+  MapChunkFile  *file;
+  MapChunkHeader header;
+  struct stat    st;
+  int            fd;
+
+  pthread_mutex_lock(&cacheLock);
+  initCache();
+
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    if (fd >= 0)
+      close(fd);
+    pthread_mutex_unlock(&cacheLock);
+    return NULL;
+  }
+
+  // 同じファイルの同じ版をすでに開いていれば共有する
+  for (file = openFiles; file != NULL; file = file->next) {
+    if (strcmp(file->path, path) == 0 && file->dev == st.st_dev && file->ino == st.st_ino &&
+        file->mtime == st.st_mtim.tv_sec * 1000000000L + st.st_mtim.tv_nsec) {
+      file->refCount++;
+      close(fd);
+      pthread_mutex_unlock(&cacheLock);
+      return file;
+    }
+  }
+
+  // ヘッダを読んでチャンクファイルかどうか調べる
+  // (チャンクの大きさを抑え, 全チャンクがファイルに収まっていることも確かめる)
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      memcmp(header.magic, MAP_CHUNK_MAGIC, 8) != 0 ||
+      header.lines <= 0 || header.colums <= 0 ||
+      header.chunkSize <= 0 || header.chunkSize > MAP_CHUNK_MAX_SIZE ||
+      header.chunksY != (header.lines + header.chunkSize - 1) / header.chunkSize ||
+      header.chunksX != (header.colums + header.chunkSize - 1) / header.chunkSize ||
+      st.st_size < (off_t)sizeof(header) +
+                   (off_t)header.chunksY * header.chunksX * header.chunkSize * header.chunkSize) {
+    close(fd);
+    pthread_mutex_unlock(&cacheLock);
+    return NULL;
+  }
+
+  file = (MapChunkFile *)malloc(sizeof(MapChunkFile));
+  if (file == NULL || (file->path = strdup(path)) == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  file->fd       = fd;
+  file->dev      = st.st_dev;
+  file->ino      = st.st_ino;
+  file->mtime    = st.st_mtim.tv_sec * 1000000000L + st.st_mtim.tv_nsec;
+  file->id       = nextFileId++;
+  file->refCount = 1;
+  file->header   = header;
+  file->next     = openFiles;
+  openFiles      = file;
+
+  pthread_mutex_unlock(&cacheLock);
+
+  return file;
+}
+
+/*
+ * チャンクファイルを閉じる(最後の参照が無くなったらキャッシュからも消す)
+ * 引数 :
+ *   file - チャンクファイルへのポインタ
+ */
+void closeMapChunkFile(MapChunkFile *file)
+{
+  MapChunkFile **p;
+  int            i;
+
+  if (file == NULL)
+    return;
+
+  pthread_mutex_lock(&cacheLock);
+
+  if (--file->refCount > 0) {
+    pthread_mutex_unlock(&cacheLock);
+    return;
+  }
+
+  // このファイルのチャンクをキャッシュから取り除く
+  for (i = 0; i < usedSlots; i++) {
+    if (slots[i].fileId != file->id)
+      continue;
+    unlinkHash(i);
+    unlinkLru(i);
+    slots[i].fileId = -1;
+    cacheStats.residentChunks--;
+    cacheStats.residentBytes -= slots[i].size;
+    free(slots[i].data);
+    slots[i].data = NULL;
+    slots[i].size = 0;
+    slots[i].hashNext = freeHead;
+    freeHead = i;
+  }
+
+  for (p = &openFiles; *p != NULL; p = &(*p)->next) {
+    if (*p == file) {
+      *p = file->next;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&cacheLock);
+
+  close(file->fd);
+  free(file->path);
+  free(file);
+}
+
+/*
+ * マスの値を得る. チャンクがキャッシュに無ければファイルから読み込む
+ * ファイルを読むあいだはロックを放すので, 他のチャンクを読むスレッドは待たない
+ * 引数 :
+ *   file - チャンクファイルへのポインタ
+ *   y    - Y 座標(マップの範囲内であること)
+ *   x    - X 座標(マップの範囲内であること)
+ * 戻値 :
+ *   マスの値
+ */
+int getMapChunkCell(MapChunkFile *file, int y, int x)
+{
+  int size  = file->header.chunkSize;
+  int chunk = (y / size) * file->header.chunksX + x / size;
+  int cell;
+
+  pthread_mutex_lock(&cacheLock);
+  cell = slots[lookupChunk(file, chunk)].data[(y % size) * size + x % size];
+  pthread_mutex_unlock(&cacheLock);
+
+  return cell;
+}
+
+/*
+ * 移動方向の先にあるチャンクをカーネルに先読みさせる(呼んだスレッドは読み込みを待たない)
+ * 引数 :
+ *   file - チャンクファイルへのポインタ
+ *   y    - 現在の Y 座標
+ *   x    - 現在の X 座標
+ *   dy   - Y 方向の移動量
+ *   dx   - X 方向の移動量
+ */
+void prefetchMapChunks(MapChunkFile *file, int y, int x, int dy, int dx)
+{
+  MapChunkHeader *h = &file->header;
+  int size = h->chunkSize;
+  int sy = dy > 0 ? 1 : (dy < 0 ? -1 : 0);
+  int sx = dx > 0 ? 1 : (dx < 0 ? -1 : 0);
+  int ty = y + sy * MAP_CHUNK_PREFETCH;     // 少し先の位置
+  int tx = x + sx * MAP_CHUNK_PREFETCH;
+  int ny = y + sy * (MAP_CHUNK_PREFETCH + size);
+  int nx = x + sx * (MAP_CHUNK_PREFETCH + size);
+  long bytes = (long)size * size;
+  int hints = 0;
+
+  if (sy == 0 && sx == 0)
+    return;
+
+  // 少し先が別のチャンクなら, そのチャンクとさらに 1 チャンク先をカーネルに非同期で読ませておく
+  // (ここで読み込むとティックや描画のスレッドがディスクを待つので, キャッシュに入れるのは使うとき)
+  if (ty >= 0 && ty < h->lines && tx >= 0 && tx < h->colums &&
+      (ty / size != y / size || tx / size != x / size)) {
+    posix_fadvise(file->fd, sizeof(MapChunkHeader) +
+                  ((long)(ty / size) * h->chunksX + tx / size) * bytes,
+                  bytes, POSIX_FADV_WILLNEED);
+    hints++;
+  }
+  if (ny >= 0 && ny < h->lines && nx >= 0 && nx < h->colums) {
+    posix_fadvise(file->fd, sizeof(MapChunkHeader) +
+                  ((long)(ny / size) * h->chunksX + nx / size) * bytes,
+                  bytes, POSIX_FADV_WILLNEED);
+    hints++;
+  }
+
+  if (hints > 0) {
+    pthread_mutex_lock(&cacheLock);
+    cacheStats.prefetches += hints;
+    pthread_mutex_unlock(&cacheLock);
+  }
+}
+
+/*
+ * キャッシュの統計を得る
+ * 引数 :
+ *   stats - 統計を格納する構造体へのポインタ(出力)
+ */
+void getMapChunkStats(MapChunkStats *stats)
+{
+  pthread_mutex_lock(&cacheLock);
+  *stats = cacheStats;
+  pthread_mutex_unlock(&cacheLock);
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義(すべて cacheLock を取った状態で呼ぶ)
+//--------------------------------------------------------------------
+
+/*
+ * キャッシュの初期化
+ */
+static void initCache()
+{
+  int i;
+
+  if (initialized)
+    return;
+  for (i = 0; i < CHUNK_HASH_SIZE; i++)
+    buckets[i] = -1;
+  for (i = 0; i < MAP_CHUNK_CACHE_SLOTS; i++)
+    slots[i].fileId = -1;
+  initialized = 1;
+}
+
+/*
+ * チャンクのハッシュ値
+ */
+static int hashChunk(int fileId, int chunk)
+{
+  unsigned int h = (unsigned int)chunk * 2654435761u ^ (unsigned int)fileId * 40503u;
+  return (h >> 7) & (CHUNK_HASH_SIZE - 1);
+}
+
+/*
+ * LRU リストから外す
+ */
+static void unlinkLru(int i)
+{
+  if (slots[i].prev >= 0) slots[slots[i].prev].next = slots[i].next;
+  else                    lruHead = slots[i].next;
+  if (slots[i].next >= 0) slots[slots[i].next].prev = slots[i].prev;
+  else                    lruTail = slots[i].prev;
+  slots[i].prev = slots[i].next = -1;
+}
+
+/*
+ * LRU リストの先頭(最後に使った側)に入れる
+ */
+static void pushLru(int i)
+{
+  slots[i].prev = -1;
+  slots[i].next = lruHead;
+  if (lruHead >= 0) slots[lruHead].prev = i;
+  lruHead = i;
+  if (lruTail < 0) lruTail = i;
+}
+
+/*
+ * ハッシュ表から外す
+ */
+static void unlinkHash(int i)
+{
+  int *p = &buckets[hashChunk(slots[i].fileId, slots[i].chunk)];
+
+  while (*p != i)
+    p = &slots[*p].hashNext;
+  *p = slots[i].hashNext;
+}
+
+/*
+ * チャンクを探し, 無ければ最も昔に使ったチャンクを追い出して読み込む
+ * ファイルを読むあいだはスロットを読み込み中にしてロックを放す.
+ * 同じチャンクを欲しいスレッドは読み終わるのを待ち, 他のチャンクは待たずに使える
+ * 引数 :
+ *   file  - チャンクファイルへのポインタ
+ *   chunk - チャンク番号
+ * 戻値 :
+ *   スロット番号(中身を読み終えたもの)
+ */
+static int lookupChunk(MapChunkFile *file, int chunk)
+{
+  int   h = hashChunk(file->id, chunk);
+  int   size = file->header.chunkSize * file->header.chunkSize;
+  off_t offset = sizeof(MapChunkHeader) + (off_t)chunk * size;
+  int   i, done;
+
+ retry:
+  for (i = buckets[h]; i >= 0; i = slots[i].hashNext) {
+    if (slots[i].fileId == file->id && slots[i].chunk == chunk) {
+      // 他のスレッドが読み込み中なら, 読み終わってから探し直す(その間に追い出されることもある)
+      if (slots[i].loading) {
+        pthread_cond_wait(&cacheLoaded, &cacheLock);
+        goto retry;
+      }
+      cacheStats.hits++;
+      if (lruHead != i) {
+        unlinkLru(i);
+        pushLru(i);
+      }
+      return i;
+    }
+  }
+
+  // 空いているスロットが無ければ(全部が読み込み中なら), どれかが読み終わるのを待つ
+  if ((i = takeSlot()) < 0) {
+    pthread_cond_wait(&cacheLoaded, &cacheLock);
+    goto retry;
+  }
+
+  if (slots[i].size != size) {
+    free(slots[i].data);
+    slots[i].data = (unsigned char *)malloc(size);
+    if (slots[i].data == NULL) {
+      fprintf(stderr, "Error: out of memory\n");
+      exit(1);
+    }
+    slots[i].size = size;
+  }
+
+  // 読み込み中として登録してから, ロックを放してファイルから読む
+  slots[i].fileId   = file->id;
+  slots[i].chunk    = chunk;
+  slots[i].loading  = 1;
+  slots[i].hashNext = buckets[h];
+  buckets[h] = i;
+  pushLru(i);
+  cacheStats.misses++;
+  cacheStats.residentChunks++;
+  cacheStats.residentBytes += size;
+  pthread_mutex_unlock(&cacheLock);
+
+  // 読めなかった部分は壁にする
+  for (done = 0; done < size; ) {
+    ssize_t n = pread(file->fd, slots[i].data + done, size - done, offset + done);
+    if (n <= 0)
+      break;
+    done += n;
+  }
+  if (done < size)
+    memset(slots[i].data + done, CELL_WALL, size - done);
+
+  pthread_mutex_lock(&cacheLock);
+  slots[i].loading = 0;
+  pthread_cond_broadcast(&cacheLoaded);
+
+  return i;
+}
+
+/*
+ * 新しいチャンクを入れるスロットを得る. 空きが無ければ, 読み込み中でないうち
+ * 最も昔に使ったチャンクを追い出す
+ * 戻値 :
+ *   スロット番号. すべて読み込み中なら -1
+ */
+static int takeSlot()
+{
+  int i;
+
+  if (freeHead >= 0) {
+    i = freeHead;
+    freeHead = slots[i].hashNext;
+    return i;
+  }
+  if (usedSlots < MAP_CHUNK_CACHE_SLOTS)
+    return usedSlots++;
+
+  for (i = lruTail; i >= 0 && slots[i].loading; i = slots[i].prev)
+    ;
+  if (i < 0)
+    return -1;
+  unlinkHash(i);
+  unlinkLru(i);
+  cacheStats.evictions++;
+  cacheStats.residentChunks--;
+  cacheStats.residentBytes -= slots[i].size;
+  return i;
+}
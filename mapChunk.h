@@ -0,0 +1,118 @@
+/********************************************************************
+                       マップチャンクキャッシュモジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef MAP_CHUNK_H
+#define MAP_CHUNK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+//--------------------------------------------------------------------
+//   マップチャンクキャッシュモジュールにおける定数・型の定義
+//--------------------------------------------------------------------
+#define MAP_CHUNK_MAGIC       "TAGMAPC1"  // チャンクファイルの先頭 8 バイト
+#define MAP_CHUNK_SIZE        64          // チャンク 1 辺のマス数(既定値)
+#define MAP_CHUNK_MAX_SIZE    1024        // チャンク 1 辺のマス数の上限(ヘッダを調べるときに使う)
+#define MAP_CHUNK_CACHE_SLOTS 256         // キャッシュに置けるチャンクの数
+#define MAP_CHUNK_PREFETCH    8           // チャンク境界までこのマス数以内に来たら先読みする
+
+/*
+ * チャンクファイルのヘッダ
+ * ヘッダの後ろにチャンクが行優先で並ぶ. 1 チャンクは chunkSize * chunkSize バイトで,
+ * マップの端からはみ出した部分は壁で埋める
+ */
+typedef struct {
+  char     magic[8];             // MAP_CHUNK_MAGIC
+  int32_t  lines;                // マップの行数
+  int32_t  colums;               // マップの列数
+  int32_t  arriveX;              // このマップへワープしてきたときの到着 X 座標(-1 なら既定値)
+  int32_t  arriveY;              // このマップへワープしてきたときの到着 Y 座標(-1 なら既定値)
+  int32_t  chunkSize;            // チャンク 1 辺のマス数
+  int32_t  chunksY;              // 縦方向のチャンク数
+  int32_t  chunksX;              // 横方向のチャンク数
+  uint32_t checksum;             // 書き出したチャンク全体のハッシュ(FNV-1a. マップの版の区別に使う)
+} MapChunkHeader;
+
+/*
+ * 開いているチャンクファイル
+ * 同じファイルを使うゲーム(部屋)は同じオブジェクトを共有し,
+ * キャッシュ上のチャンクも共有する. ファイルが置き換えられた場合は
+ * 古い版を開いたまま, 新しい版を別のオブジェクトとして開く
+ */
+typedef struct MapChunkFile {
+  char           *path;          // ファイル名
+  int             fd;            // ファイルデスクリプタ
+  dev_t           dev;           // ファイルのあるデバイス  (版の区別に使う)
+  ino_t           ino;           // ファイルの i ノード番号 (版の区別に使う)
+  long            mtime;         // ファイルの更新時刻(ns)  (版の区別に使う)
+  int             id;            // キャッシュのキーに使う番号
+  int             refCount;      // 参照しているマップの数
+  MapChunkHeader  header;        // ヘッダ
+  struct MapChunkFile *next;     // 開いているファイルのリスト
+} MapChunkFile;
+
+/*
+ * キャッシュの統計
+ */
+typedef struct {
+  unsigned long hits;            // キャッシュにあったチャンクの参照回数
+  unsigned long misses;          // ファイルから読んだチャンクの数
+  unsigned long prefetches;      // カーネルに先読みを頼んだチャンクの数
+  unsigned long evictions;       // 追い出したチャンクの数
+  int           residentChunks;  // キャッシュにあるチャンクの数
+  long          residentBytes;   // キャッシュが使っているメモリ量
+} MapChunkStats;
+
+
+//--------------------------------------------------------------------
+//   マップチャンクキャッシュモジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * チャンクファイルを開く(すでに開いていれば共有する)
+ * 同じ名前でも書き換えられたファイルは別のファイルとして開く
+ * 引数 :
+ *   path - ファイル名
+ * 戻値 :
+ *   チャンクファイルへのポインタ. チャンクファイルでなければ NULL
+ */
+MapChunkFile* openMapChunkFile(char *path);
+
+/*
+ * チャンクファイルを閉じる(最後の参照が無くなったらキャッシュからも消す)
+ * 引数 :
+ *   file - チャンクファイルへのポインタ
+ */
+void closeMapChunkFile(MapChunkFile *file);
+
+/*
+ * マスの値を得る. チャンクがキャッシュに無ければファイルから読み込む
+ * 引数 :
+ *   file - チャンクファイルへのポインタ
+ *   y    - Y 座標(マップの範囲内であること)
+ *   x    - X 座標(マップの範囲内であること)
+ * 戻値 :
+ *   マスの値
+ */
+int getMapChunkCell(MapChunkFile *file, int y, int x);
+
+/*
+ * 移動方向の先にあるチャンクをカーネルに先読みさせる(呼んだスレッドは読み込みを待たない)
+ * 引数 :
+ *   file - チャンクファイルへのポインタ
+ *   y    - 現在の Y 座標
+ *   x    - 現在の X 座標
+ *   dy   - Y 方向の移動量
+ *   dx   - X 方向の移動量
+ */
+void prefetchMapChunks(MapChunkFile *file, int y, int x, int dy, int dx);
+
+/*
+ * キャッシュの統計を得る
+ * 引数 :
+ *   stats - 統計を格納する構造体へのポインタ(出力)
+ */
+void getMapChunkStats(MapChunkStats *stats);
+
+#endif
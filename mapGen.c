@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "mapGen.h"            // マップ生成モジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  マップ生成モジュール内部で使用する定数・型の定義
+//--------------------------------------------------------------------
+#define CELL_REACHED   4       // 塗りつぶしで (1,1) から行けると分かった床(生成中だけ使う)
+#define WARP_TRIES     1000    // ワープポイント 1 つを置く場所を探す回数
+
+/*
+ * 乱数(xorshift64*. 種が同じなら, どの環境でも同じ列になる)
+ */
+typedef struct {
+  unsigned long long state;
+} GenRandom;
+
+//--------------------------------------------------------------------
+//  マップ生成モジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static void     carveMaze(Map *map, GenRandom *rnd);
+static long     growRooms(Map *map, GenRandom *rnd, int roomPercent);
+static void     growRoom(Map *map, GenRandom *rnd, int top, int left, int h, int w);
+static void     fillUnreached(Map *map, MapGenStats *stats);
+static long     placeJumps(Map *map, GenRandom *rnd, int jumpPermille);
+static int      placeWarps(Map *map, GenRandom *rnd, int warps);
+static void     chooseArrival(Map *map, GenRandom *rnd);
+static void     initRandom(GenRandom *rnd, unsigned seed);
+static unsigned nextRandom(GenRandom *rnd);
+static int      randomInt(GenRandom *rnd, int n);
+static double   nowMsec();
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * マップ生成のパラメータを既定値で初期化する
+ * 引数 :
+ *   params - パラメータを格納する構造体(出力)
+ *   lines  - マップの行数
+ *   colums - マップの列数
+ *   seed   - 乱数の種
+ */
+void initMapGenParams(MapGenParams *params, int lines, int colums, unsigned seed)
+{
+  params->lines        = lines;
+  params->colums       = colums;
+  params->seed         = seed;
+  params->roomPercent  = 25;
+  params->jumpPermille = 20;
+  params->warps        = 0;
+}
+
+/*
+ * マップを生成する
+ * 引数 :
+ *   params - パラメータ(大きさが MAPGEN_MIN_SIZE より小さければ終了する)
+ *   stats  - 統計を格納する構造体(出力. NULL でもよい)
+ * 戻値 :
+ *   マップへのポインタ(destroyMap() で解放する)
+ */
+Map* generateMap(MapGenParams *params, MapGenStats *stats)
+{
+  MapGenStats dummy;
+  GenRandom   rnd;
+  Map        *map;
+  double      start, lap;
+  int         y, x;
+
+  if (params->lines < MAPGEN_MIN_SIZE || params->colums < MAPGEN_MIN_SIZE ||
+      (long)params->lines * params->colums > INT_MAX) {
+    fprintf(stderr, "Error: map size must be from %d x %d to %d cells\n",
+            MAPGEN_MIN_SIZE, MAPGEN_MIN_SIZE, INT_MAX);
+    exit(1);
+  }
+  if (stats == NULL)
+    stats = &dummy;
+  memset(stats, 0, sizeof(MapGenStats));
+  start = nowMsec();
+
+  map = (Map *)malloc(sizeof(Map));
+  if (map == NULL ||
+      (map->cells = (unsigned char *)malloc((size_t)params->lines * params->colums)) == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  map->lines   = params->lines;
+  map->colums  = params->colums;
+  map->arriveX = 1;
+  map->arriveY = 1;
+  map->chunks  = NULL;
+  memset(map->cells, CELL_WALL, (size_t)map->lines * map->colums);
+  initRandom(&rnd, params->seed);
+
+  // 迷路を掘る
+  carveMaze(map, &rnd);
+  lap = nowMsec();
+  stats->mazeMsec = lap - start;
+
+  // 部屋を作り, 開始位置のまわりを開ける
+  stats->rooms = growRooms(map, &rnd, params->roomPercent);
+  for (y = 1; y < MAPGEN_SPAWN_SIZE && y < map->lines - 1; y++)
+    for (x = 1; x < MAPGEN_SPAWN_SIZE && x < map->colums - 1; x++)
+      map->cells[(long)y * map->colums + x] = CELL_FLOOR;
+  stats->roomMsec = nowMsec() - lap;
+  lap = nowMsec();
+
+  // 行けない床を埋めてから, 近道(飛び越え壁)とワープポイントを置く
+  fillUnreached(map, stats);
+  stats->jumps = placeJumps(map, &rnd, params->jumpPermille);
+  stats->warps = placeWarps(map, &rnd, params->warps);
+  chooseArrival(map, &rnd);
+  stats->connectMsec = nowMsec() - lap;
+  stats->totalMsec   = nowMsec() - start;
+
+  return map;
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * 奇数座標のマスを部屋として, 再帰的バックトラッキングで迷路を掘る
+ * 再帰の代わりに明示的なスタックを使うので, 大きなマップでもスタックはあふれない.
+ * 掘ったマスは床になるので, 訪れたかどうかはマップそのもので分かる
+ */
+static void carveMaze(Map *map, GenRandom *rnd)
+{
+  static const int dy[4] = { -1, 1, 0, 0 };
+  static const int dx[4] = { 0, 0, -1, 1 };
+  unsigned char *cells = map->cells;
+  int  cellsY = (map->lines - 1) / 2;    // 迷路の部屋の行数
+  int  cellsX = (map->colums - 1) / 2;   // 迷路の部屋の列数
+  int *stack, top = 0;
+  int  next[4], n, d, cy, cx, ny, nx;
+
+  if ((stack = (int *)malloc(sizeof(int) * cellsY * cellsX)) == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+
+  cells[1L * map->colums + 1] = CELL_FLOOR;
+  stack[top++] = 0;
+  while (top > 0) {
+    cy = stack[top - 1] / cellsX;
+    cx = stack[top - 1] % cellsX;
+
+    // まだ掘っていない隣の部屋を集める
+    for (n = 0, d = 0; d < 4; d++) {
+      ny = cy + dy[d];
+      nx = cx + dx[d];
+      if (ny >= 0 && ny < cellsY && nx >= 0 && nx < cellsX &&
+          cells[(long)(ny * 2 + 1) * map->colums + nx * 2 + 1] == CELL_WALL)
+        next[n++] = d;
+    }
+    if (n == 0) {
+      top--;
+      continue;
+    }
+
+    // 1 つを選んで, 間の壁ごと掘り進む
+    d  = next[randomInt(rnd, n)];
+    ny = cy + dy[d];
+    nx = cx + dx[d];
+    cells[(long)(cy * 2 + 1 + dy[d]) * map->colums + cx * 2 + 1 + dx[d]] = CELL_FLOOR;
+    cells[(long)(ny * 2 + 1) * map->colums + nx * 2 + 1]                 = CELL_FLOOR;
+    stack[top++] = ny * cellsX + nx;
+  }
+
+  free(stack);
+}
+
+/*
+ * マップの面積の roomPercent % になるまで, ランダムな位置に部屋を作る
+ * 戻値 :
+ *   作った部屋の数
+ */
+static long growRooms(Map *map, GenRandom *rnd, int roomPercent)
+{
+  long area = (long)(map->lines - 2) * (map->colums - 2) * roomPercent / 100;
+  long covered = 0, rooms = 0;
+  int  maxH = map->lines - 2 < MAPGEN_ROOM_MAX ? map->lines - 2 : MAPGEN_ROOM_MAX;
+  int  maxW = map->colums - 2 < MAPGEN_ROOM_MAX ? map->colums - 2 : MAPGEN_ROOM_MAX;
+  int  h, w;
+
+  while (covered < area) {
+    h = MAPGEN_ROOM_MIN + randomInt(rnd, maxH - MAPGEN_ROOM_MIN + 1);
+    w = MAPGEN_ROOM_MIN + randomInt(rnd, maxW - MAPGEN_ROOM_MIN + 1);
+    growRoom(map, rnd,
+             1 + randomInt(rnd, map->lines - 1 - h), 1 + randomInt(rnd, map->colums - 1 - w), h, w);
+    covered += (long)h * w;
+    rooms++;
+  }
+
+  return rooms;
+}
+
+/*
+ * セルオートマトンで洞窟のような部屋を 1 つ作る
+ * 内側をランダムに壁で埋め, 周り 3x3 の壁が 5 つ以上なら壁, そうでなければ床にする
+ * ことを繰り返す. 部屋の外周は床にしておくので, 部屋に入ってくる迷路の通路や,
+ * 先に作った部屋の外周は必ずこの部屋の外周でつながる(内側の閉じた床は後で埋める)
+ */
+static void growRoom(Map *map, GenRandom *rnd, int top, int left, int h, int w)
+{
+  unsigned char buf[2][MAPGEN_ROOM_MAX][MAPGEN_ROOM_MAX];
+  unsigned char col[MAPGEN_ROOM_MAX];
+  int cur = 0, step, y, x, sum;
+
+  for (y = 0; y < h; y++)
+    for (x = 0; x < w; x++)
+      buf[0][y][x] = buf[1][y][x] =
+        (y > 0 && y < h - 1 && x > 0 && x < w - 1 && randomInt(rnd, 100) < MAPGEN_CA_FILL);
+
+  for (step = 0; step < MAPGEN_CA_STEPS; step++) {
+    for (y = 1; y < h - 1; y++) {
+      // 縦 3 マスの和を先に求めておき, 横に 3 つ足して 3x3 の和にする
+      for (x = 0; x < w; x++)
+        col[x] = buf[cur][y - 1][x] + buf[cur][y][x] + buf[cur][y + 1][x];
+      for (x = 1; x < w - 1; x++) {
+        sum = col[x - 1] + col[x] + col[x + 1];
+        buf[1 - cur][y][x] = sum >= 5;
+      }
+    }
+    cur = 1 - cur;
+  }
+
+  for (y = 0; y < h; y++) {
+    unsigned char *row = &map->cells[(long)(top + y) * map->colums + left];
+    for (x = 0; x < w; x++)
+      row[x] = buf[cur][y][x] ? CELL_WALL : CELL_FLOOR;
+  }
+}
+
+/*
+ * (1,1) から塗りつぶし, 行けない床を壁にする
+ */
+static void fillUnreached(Map *map, MapGenStats *stats)
+{
+  unsigned char *cells = map->cells;
+  int  colums = map->colums;
+  long total = (long)map->lines * colums, i;
+  int *stack, top = 0, p;
+
+  if ((stack = (int *)malloc(sizeof(int) * total)) == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+
+  // 積むときに印を付けるので, 同じマスを 2 度積むことはない(外周は壁なので範囲は調べない)
+  p = colums + 1;
+  cells[p] = CELL_REACHED;
+  stack[top++] = p;
+  while (top > 0) {
+    p = stack[--top];
+    if (cells[p - colums] == CELL_FLOOR) { cells[p - colums] = CELL_REACHED; stack[top++] = p - colums; }
+    if (cells[p + colums] == CELL_FLOOR) { cells[p + colums] = CELL_REACHED; stack[top++] = p + colums; }
+    if (cells[p - 1] == CELL_FLOOR)      { cells[p - 1] = CELL_REACHED;      stack[top++] = p - 1; }
+    if (cells[p + 1] == CELL_FLOOR)      { cells[p + 1] = CELL_REACHED;      stack[top++] = p + 1; }
+  }
+  free(stack);
+
+  for (i = 0; i < total; i++) {
+    if (cells[i] == CELL_REACHED) {
+      cells[i] = CELL_FLOOR;
+      stats->floorCells++;
+    }
+    else if (cells[i] == CELL_FLOOR) {
+      cells[i] = CELL_WALL;
+      stats->removedCells++;
+    }
+  }
+}
+
+/*
+ * 左右か上下を床にはさまれた壁を, jumpPermille ‰ の割合で飛び越え壁にする
+ * 床はすべてつながっているので, 飛び越え壁は近道を増やすだけである
+ * 戻値 :
+ *   置いた飛び越え壁の数
+ */
+static long placeJumps(Map *map, GenRandom *rnd, int jumpPermille)
+{
+  unsigned char *cells = map->cells;
+  int  colums = map->colums;
+  long jumps = 0, p;
+  int  y, x;
+
+  if (jumpPermille <= 0)
+    return 0;
+
+  for (y = 1; y < map->lines - 1; y++) {
+    for (x = 1; x < colums - 1; x++) {
+      p = (long)y * colums + x;
+      if (cells[p] == CELL_WALL &&
+          ((cells[p - 1] == CELL_FLOOR && cells[p + 1] == CELL_FLOOR) ||
+           (cells[p - colums] == CELL_FLOOR && cells[p + colums] == CELL_FLOOR)) &&
+          randomInt(rnd, 1000) < jumpPermille) {
+        cells[p] = CELL_JUMP;
+        jumps++;
+      }
+    }
+  }
+
+  return jumps;
+}
+
+/*
+ * 床に面した内側の壁にワープポイントを置く
+ * 戻値 :
+ *   置いたワープポイントの数(場所が見つからなければ warps より少ない)
+ */
+static int placeWarps(Map *map, GenRandom *rnd, int warps)
+{
+  unsigned char *cells = map->cells;
+  int  colums = map->colums;
+  int  placed = 0, tries, y, x;
+  long p;
+
+  while (placed < warps) {
+    for (tries = 0; tries < WARP_TRIES; tries++) {
+      y = 1 + randomInt(rnd, map->lines - 2);
+      x = 1 + randomInt(rnd, colums - 2);
+      p = (long)y * colums + x;
+      if (cells[p] == CELL_WALL &&
+          (cells[p - 1] == CELL_FLOOR || cells[p + 1] == CELL_FLOOR ||
+           cells[p - colums] == CELL_FLOOR || cells[p + colums] == CELL_FLOOR))
+        break;
+    }
+    if (tries == WARP_TRIES)
+      break;
+    cells[p] = CELL_WARP;
+    placed++;
+  }
+
+  return placed;
+}
+
+/*
+ * 到着座標を床からランダムに選ぶ(見つからなければ (1,1) のまま)
+ */
+static void chooseArrival(Map *map, GenRandom *rnd)
+{
+  int tries, y, x;
+
+  for (tries = 0; tries < WARP_TRIES; tries++) {
+    y = 1 + randomInt(rnd, map->lines - 2);
+    x = 1 + randomInt(rnd, map->colums - 2);
+    if (map->cells[(long)y * map->colums + x] == CELL_FLOOR) {
+      map->arriveY = y;
+      map->arriveX = x;
+      return;
+    }
+  }
+}
+
+/*
+ * 乱数を種で初期化する(種が 0 でも状態が 0 にならないようにかき混ぜる)
+ */
+static void initRandom(GenRandom *rnd, unsigned seed)
+{
+  rnd->state = (seed + 1ULL) * 0x9E3779B97F4A7C15ULL;
+  nextRandom(rnd);
+}
+
+/*
+ * 32bit の乱数
+ */
+static unsigned nextRandom(GenRandom *rnd)
+{
+  unsigned long long x = rnd->state;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  rnd->state = x;
+  return (unsigned)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/*
+ * 0 以上 n 未満の乱数(割り算をせず, 掛け算で範囲を縮める)
+ */
+static int randomInt(GenRandom *rnd, int n)
+{
+  return (int)(((unsigned long long)nextRandom(rnd) * n) >> 32);
+}
+
+/*
+ * 現在時刻(ms)
+ */
+static double nowMsec()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
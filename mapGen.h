@@ -0,0 +1,80 @@
+/********************************************************************
+                       マップ生成モジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef MAP_GEN_H
+#define MAP_GEN_H
+
+#include "tagMap.h"            // 鬼ごっこマップモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//   マップ生成モジュールにおける定数・型の定義
+//--------------------------------------------------------------------
+#define MAPGEN_MIN_SIZE     16     // 作れるマップの最小の行数・列数
+#define MAPGEN_SPAWN_SIZE   12     // 左上の必ず床にする範囲の 1 辺(開始位置 (1,1), (10,10) を含む)
+#define MAPGEN_ROOM_MIN     8      // セルオートマトンで作る部屋の最小の 1 辺
+#define MAPGEN_ROOM_MAX     40     // セルオートマトンで作る部屋の最大の 1 辺
+#define MAPGEN_CA_FILL      45     // 部屋の内側を最初に壁にする割合(%)
+#define MAPGEN_CA_STEPS     3      // セルオートマトンを進める回数
+
+/*
+ * マップ生成のパラメータ
+ * 同じパラメータからは, いつも同じマップができる
+ */
+typedef struct {
+  int      lines;                // マップの行数
+  int      colums;               // マップの列数
+  unsigned seed;                 // 乱数の種
+  int      roomPercent;          // セルオートマトンの部屋で覆う面積の割合(%)
+  int      jumpPermille;         // 床にはさまれた壁を飛び越え壁にする割合(‰)
+  int      warps;                // ワープポイントの数(0 ならワープしない)
+} MapGenParams;
+
+/*
+ * マップ生成の統計
+ */
+typedef struct {
+  double   mazeMsec;             // 迷路を掘るのにかかった時間(ms)
+  double   roomMsec;             // 部屋を作るのにかかった時間(ms)
+  double   connectMsec;          // つながっていない床を埋め, 飛び越え壁とワープを置くのにかかった時間(ms)
+  double   totalMsec;            // 全体の時間(ms)
+  long     rooms;                // 作った部屋の数
+  long     floorCells;           // 床マスの数
+  long     removedCells;         // (1,1) から行けないので壁にした床マスの数
+  long     jumps;                // 置いた飛び越え壁の数
+  int      warps;                // 置いたワープポイントの数
+} MapGenStats;
+
+
+//--------------------------------------------------------------------
+//   マップ生成モジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * マップ生成のパラメータを既定値で初期化する
+ * 引数 :
+ *   params - パラメータを格納する構造体(出力)
+ *   lines  - マップの行数
+ *   colums - マップの列数
+ *   seed   - 乱数の種
+ */
+void initMapGenParams(MapGenParams *params, int lines, int colums, unsigned seed);
+
+/*
+ * マップを生成する
+ * 種から決まる迷路(再帰的バックトラッキング)をすき間なく掘り, ところどころを
+ * セルオートマトンの洞窟のような部屋にしてから, (1,1) から行けない床を壁で埋める.
+ * そのあと床にはさまれた壁の一部を飛び越え壁にし, 床に面した壁にワープポイントを置く.
+ * すべての床は (1,1) から歩いて行けるので, 同じマップの中なら必ず出会える.
+ * ワープポイントは相手のマップの到着座標へ飛ぶので, 2 枚のマップの両方に
+ * ワープポイントを置けば, 2 枚を合わせても強連結になる.
+ * 到着座標は (1,1) から行ける床からランダムに選ぶ
+ * 引数 :
+ *   params - パラメータ(大きさが MAPGEN_MIN_SIZE より小さければ終了する)
+ *   stats  - 統計を格納する構造体(出力. NULL でもよい)
+ * 戻値 :
+ *   マップへのポインタ(destroyMap() で解放する)
+ */
+Map* generateMap(MapGenParams *params, MapGenStats *stats);
+
+#endif
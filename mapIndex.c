@@ -0,0 +1,618 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapIndex.h"          // マップ連結性インデックスモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  マップ連結性インデックスモジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static int  findRoot(int *parent, int v);
+static void unite(int *parent, int *size, int a, int b);
+static int  sccOf(MapIndex *index, int inMain, int x, int y);
+static void uniteMap(Map *map, int offset, int *parent, int *size);
+static int  addWarpEdges(Map *map, int offset, Map *dest, int destOffset,
+                         int *comp, int *from, int *to, int edges);
+static int  findScc(int count, int *start, int *adj, int *sccOfComp);
+static unsigned long long *reachOf(MapIndex *index, int k, unsigned long long **temp);
+static void *allocOrDie(size_t size);
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * マップ連結性インデックスの構築
+ * 引数 :
+ *   mainMap - メインマップの情報
+ *   subMap  - サブマップの情報
+ * 戻値 :
+ *   マップ連結性インデックスへのポインタ
+ */
+MapIndex* buildMapIndex(Map *mainMap, Map *subMap)
+{
+  MapIndex *index = (MapIndex *)allocOrDie(sizeof(MapIndex));
+  int  mainCells = mainMap->lines * mainMap->colums;
+  int  nodes     = mainCells + subMap->lines * subMap->colums;
+  int *parent    = (int *)allocOrDie(sizeof(int) * nodes);
+  int *size      = (int *)allocOrDie(sizeof(int) * nodes);
+  int *comp      = (int *)allocOrDie(sizeof(int) * nodes);
+  int  compCount = 0;
+  int  warps = 0;
+  int  edges, i, s, w;
+
+  bzero(index, sizeof(MapIndex));
+  index->mainColums = mainMap->colums;
+  index->subColums  = subMap->colums;
+  index->mainCells  = mainCells;
+  index->nodes      = nodes;
+
+  //
+  // 歩く・飛び越えるの双方向移動で床マスを連結成分にまとめる
+  //
+  for (i = 0; i < nodes; i++) {
+    parent[i] = i;
+    size[i]   = 1;
+  }
+  uniteMap(mainMap, 0, parent, size);
+  uniteMap(subMap, mainCells, parent, size);
+  free(size);
+
+  // 連結成分に 0 から順に番号を付け, マスごとの番号にする(床以外は -1)
+  // 番号は根の位置に置くので, 根より後ろのマスを書き換えても根の番号は変わらない
+  // (ワープ辺の数を見積もるため, ついでにワープポイントも数える)
+  for (i = 0; i < nodes; i++)
+    comp[i] = -1;
+  for (i = 0; i < nodes; i++) {
+    int inMain = i < mainCells;
+    Map *map = inMain ? mainMap : subMap;
+    int local = inMain ? i : i - mainCells;
+    int root;
+    int  cell = getMapCell(map, local / map->colums, local % map->colums);
+    if (cell == CELL_WARP)
+      warps++;
+    if (cell != CELL_FLOOR)
+      continue;
+    index->floorCells++;
+    root = findRoot(parent, i);
+    if (comp[root] < 0)
+      comp[root] = compCount++;
+    comp[i] = comp[root];
+  }
+
+  // union-find はもう使わない(ここから先は連結成分の数だけの配列で済む)
+  free(parent);
+
+  //
+  // ワープは一方通行なので連結成分間の有向辺にする
+  // (辺はワープポイントに面した床マスの数だけなので, ワープポイント 1 つにつき高々 4 本.
+  //  マップをもう一度なめて数えるより安い. チャンクマップでは全チャンクの読み直しになる)
+  //
+  int *from = (int *)allocOrDie(sizeof(int) * ((size_t)warps * 4 + 1));
+  int *to   = (int *)allocOrDie(sizeof(int) * ((size_t)warps * 4 + 1));
+  edges = addWarpEdges(mainMap, 0, subMap, mainCells, comp, from, to, 0);
+  edges = addWarpEdges(subMap, mainCells, mainMap, 0, comp, from, to, edges);
+
+  // 隣接リスト(CSR 形式)に変換
+  int *start = (int *)allocOrDie(sizeof(int) * (compCount + 1));
+  int *adj   = (int *)allocOrDie(sizeof(int) * (edges + 1));
+  bzero(start, sizeof(int) * (compCount + 1));
+  for (i = 0; i < edges; i++)
+    start[from[i] + 1]++;
+  for (i = 0; i < compCount; i++)
+    start[i + 1] += start[i];
+  int *fill = (int *)allocOrDie(sizeof(int) * (compCount + 1));
+  memcpy(fill, start, sizeof(int) * (compCount + 1));
+  for (i = 0; i < edges; i++)
+    adj[fill[from[i]]++] = to[i];
+  free(from);
+  free(to);
+
+  //
+  // 強連結成分分解と到達可能集合の計算
+  //
+  int *sccOfComp = (int *)allocOrDie(sizeof(int) * (compCount + 1));
+  index->sccCount = findScc(compCount, start, adj, sccOfComp);
+
+  // ワープの辺が出入りする強連結成分にだけ番号を付ける
+  // それ以外の成分(ワープに面していない囲まれた区画など)は自分自身にしか到達できず,
+  // 他の成分からも到達されない行き止まりなので到達可能集合を持たない
+  // (番号は強連結成分の番号順に付けるので, Tarjan 法と同じく後続成分の方が小さくなる)
+  index->linkedOf = (int *)allocOrDie(sizeof(int) * (index->sccCount + 1));
+  for (s = 0; s < index->sccCount; s++)
+    index->linkedOf[s] = -1;
+  int linkedEdges = 0;
+  for (i = 0; i < compCount; i++) {
+    int e;
+    for (e = start[i]; e < start[i + 1]; e++) {
+      if (sccOfComp[i] == sccOfComp[adj[e]])
+        continue;
+      index->linkedOf[sccOfComp[i]]      = 0;
+      index->linkedOf[sccOfComp[adj[e]]] = 0;
+      linkedEdges++;
+    }
+  }
+  for (s = 0; s < index->sccCount; s++)
+    if (index->linkedOf[s] == 0)
+      index->linkedOf[s] = index->linkedCount++;
+    else
+      index->linkedOf[s] = -1;
+
+  // ワープでつながる成分の間の隣接リスト(CSR 形式)
+  index->linkedStart = (int *)allocOrDie(sizeof(int) * (index->linkedCount + 1));
+  index->linkedAdj   = (int *)allocOrDie(sizeof(int) * (linkedEdges + 1));
+  bzero(index->linkedStart, sizeof(int) * (index->linkedCount + 1));
+  for (i = 0; i < compCount; i++) {
+    int e;
+    for (e = start[i]; e < start[i + 1]; e++)
+      if (sccOfComp[i] != sccOfComp[adj[e]])
+        index->linkedStart[index->linkedOf[sccOfComp[i]] + 1]++;
+  }
+  for (s = 0; s < index->linkedCount; s++)
+    index->linkedStart[s + 1] += index->linkedStart[s];
+  memcpy(fill, index->linkedStart, sizeof(int) * (index->linkedCount + 1));
+  for (i = 0; i < compCount; i++) {
+    int e;
+    for (e = start[i]; e < start[i + 1]; e++)
+      if (sccOfComp[i] != sccOfComp[adj[e]])
+        index->linkedAdj[fill[index->linkedOf[sccOfComp[i]]]++] =
+            index->linkedOf[sccOfComp[adj[e]]];
+  }
+
+  // ワープでつながる成分が多すぎなければ到達可能集合の表を作る(多すぎれば問い合わせごとに探索する)
+  // 後続成分の方が番号が小さいので, 番号順に和を取ればよい
+  index->words = (index->linkedCount + 63) / 64;
+  if (index->linkedCount <= MAP_INDEX_REACH_MAX) {
+    size_t tableWords = (size_t)index->words * (index->linkedCount + 1);
+    index->reach = (unsigned long long *)allocOrDie(sizeof(unsigned long long) * tableWords);
+    bzero(index->reach, sizeof(unsigned long long) * tableWords);
+    for (s = 0; s < index->linkedCount; s++) {
+      unsigned long long *r = &index->reach[(size_t)s * index->words];
+      int e;
+      r[s / 64] |= 1ULL << (s % 64);
+      for (e = index->linkedStart[s]; e < index->linkedStart[s + 1]; e++) {
+        unsigned long long *succ = &index->reach[(size_t)index->linkedAdj[e] * index->words];
+        for (w = 0; w < index->words; w++)
+          r[w] |= succ[w];
+      }
+    }
+  }
+
+  // 成分の組ごとに, 共通に到達できる成分があるかを表にしておく
+  if (index->reach != NULL && index->linkedCount <= MAP_INDEX_MEET_MAX) {
+    size_t tableWords = (size_t)index->words * (index->linkedCount + 1);
+    index->meet = (unsigned long long *)allocOrDie(sizeof(unsigned long long) * tableWords);
+    bzero(index->meet, sizeof(unsigned long long) * tableWords);
+    for (s = 0; s < index->linkedCount; s++) {
+      unsigned long long *r = &index->reach[(size_t)s * index->words];
+      int t;
+      for (t = 0; t < index->linkedCount; t++) {
+        unsigned long long *u = &index->reach[(size_t)t * index->words];
+        for (w = 0; w < index->words; w++) {
+          if (r[w] & u[w]) {
+            index->meet[(size_t)s * index->words + t / 64] |= 1ULL << (t % 64);
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  // マスごとの強連結成分番号(マスごとの連結成分番号の配列をそのまま書き換える)
+  for (i = 0; i < nodes; i++)
+    if (comp[i] >= 0)
+      comp[i] = sccOfComp[comp[i]];
+  index->scc = comp;
+
+  free(start);
+  free(adj);
+  free(fill);
+  free(sccOfComp);
+
+  return index;
+}
+
+/*
+ * ある位置から別の位置へ到達できるか
+ * 引数 :
+ *   index      - マップ連結性インデックスへのポインタ(NULL なら調べずに到達できるとみなす)
+ *   fromInMain - 出発位置がメインマップか
+ *   fromX      - 出発位置の X 座標
+ *   fromY      - 出発位置の Y 座標
+ *   toInMain   - 目的位置がメインマップか
+ *   toX        - 目的位置の X 座標
+ *   toY        - 目的位置の Y 座標
+ * 戻値 :
+ *   到達できれば 1, できなければ 0
+ */
+int canReach(MapIndex *index, int fromInMain, int fromX, int fromY,
+             int toInMain, int toX, int toY)
+{
+  unsigned long long *temp = NULL;
+  unsigned long long *r;
+  int a, b, reached;
+
+  if (index == NULL)
+    return 1;
+
+  a = sccOf(index, fromInMain, fromX, fromY);
+  b = sccOf(index, toInMain, toX, toY);
+  if (a < 0 || b < 0)
+    return 0;
+  if (a == b)
+    return 1;
+
+  // ワープでつながらない成分は自分自身にしか到達できず, 他からも到達されない
+  a = index->linkedOf[a];
+  b = index->linkedOf[b];
+  if (a < 0 || b < 0)
+    return 0;
+
+  r = reachOf(index, a, &temp);
+  reached = (r[b / 64] >> (b % 64)) & 1;
+  free(temp);
+
+  return reached;
+}
+
+/*
+ * 2 つの位置にいるプレイヤーが同じマスで出会う可能性があるか
+ * 引数 :
+ *   index  - マップ連結性インデックスへのポインタ(NULL なら調べずに出会えるとみなす)
+ *   aInMain, aX, aY - 1 人目の位置
+ *   bInMain, bX, bY - 2 人目の位置
+ * 戻値 :
+ *   出会う可能性があれば 1, なければ 0
+ */
+int canMeet(MapIndex *index, int aInMain, int aX, int aY,
+            int bInMain, int bX, int bY)
+{
+  unsigned long long *tempA = NULL, *tempB = NULL;
+  unsigned long long *ra, *rb;
+  int a, b, met = 0;
+  int w;
+
+  if (index == NULL)
+    return 1;
+
+  a = sccOf(index, aInMain, aX, aY);
+  b = sccOf(index, bInMain, bX, bY);
+  if (a < 0 || b < 0)
+    return 0;
+  if (a == b)
+    return 1;
+
+  // 片方がワープでつながらない成分なら, もう片方がそこへ来ることはない
+  a = index->linkedOf[a];
+  b = index->linkedOf[b];
+  if (a < 0 || b < 0)
+    return 0;
+
+  if (index->meet != NULL)
+    return (index->meet[(size_t)a * index->words + b / 64] >> (b % 64)) & 1;
+
+  // 成分が多すぎて表を作らなかった場合は到達可能集合の積を調べる
+  ra = reachOf(index, a, &tempA);
+  rb = reachOf(index, b, &tempB);
+  for (w = 0; w < index->words; w++) {
+    if (ra[w] & rb[w]) {
+      met = 1;
+      break;
+    }
+  }
+  free(tempA);
+  free(tempB);
+
+  return met;
+}
+
+/*
+ * 指定した 2 つの位置のどちらからも到達できない床マスの数
+ * 引数 :
+ *   index  - マップ連結性インデックスへのポインタ(NULL なら調べずに 0 を返す)
+ *   aInMain, aX, aY - 1 つ目の位置
+ *   bInMain, bX, bY - 2 つ目の位置
+ * 戻値 :
+ *   到達できない床マスの数
+ */
+int countUnreachableCells(MapIndex *index, int aInMain, int aX, int aY,
+                          int bInMain, int bX, int bY)
+{
+  unsigned long long *tempA = NULL, *tempB = NULL;
+  unsigned long long *ra = NULL, *rb = NULL;
+  int a, b;
+  int count = 0;
+  int i;
+
+  if (index == NULL)
+    return 0;
+
+  a = sccOf(index, aInMain, aX, aY);
+  b = sccOf(index, bInMain, bX, bY);
+  if (a >= 0 && index->linkedOf[a] >= 0)
+    ra = reachOf(index, index->linkedOf[a], &tempA);
+  if (b >= 0 && index->linkedOf[b] >= 0)
+    rb = reachOf(index, index->linkedOf[b], &tempB);
+
+  for (i = 0; i < index->nodes; i++) {
+    int s = index->scc[i];
+    int k;
+    if (s < 0 || s == a || s == b)
+      continue;
+    k = index->linkedOf[s];
+    if (k >= 0 && ra != NULL && ((ra[k / 64] >> (k % 64)) & 1))
+      continue;
+    if (k >= 0 && rb != NULL && ((rb[k / 64] >> (k % 64)) & 1))
+      continue;
+    count++;
+  }
+  free(tempA);
+  free(tempB);
+
+  return count;
+}
+
+/*
+ * マップ連結性インデックスの後始末
+ * 引数 :
+ *   index - マップ連結性インデックスへのポインタ
+ */
+void destroyMapIndex(MapIndex *index)
+{
+  if (index == NULL)
+    return;
+  free(index->scc);
+  free(index->linkedOf);
+  free(index->linkedStart);
+  free(index->linkedAdj);
+  free(index->reach);
+  free(index->meet);
+  free(index);
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * union-find: 根を探す(経路半減)
+ */
+static int findRoot(int *parent, int v)
+{
+  while (parent[v] != v) {
+    parent[v] = parent[parent[v]];
+    v = parent[v];
+  }
+  return v;
+}
+
+/*
+ * union-find: 2 つの集合を併合する(サイズの小さい方を下に付ける)
+ */
+static void unite(int *parent, int *size, int a, int b)
+{
+  a = findRoot(parent, a);
+  b = findRoot(parent, b);
+  if (a == b)
+    return;
+  if (size[a] < size[b]) {
+    int t = a; a = b; b = t;
+  }
+  parent[b] = a;
+  size[a] += size[b];
+}
+
+/*
+ * 座標から強連結成分番号を得る(床でなければ -1)
+ */
+static int sccOf(MapIndex *index, int inMain, int x, int y)
+{
+  int colums = inMain ? index->mainColums : index->subColums;
+  int cells  = inMain ? index->mainCells : index->nodes - index->mainCells;
+  int node;
+
+  if (x < 0 || y < 0 || x >= colums || y * colums + x >= cells)
+    return -1;
+  node = (inMain ? 0 : index->mainCells) + y * colums + x;
+
+  return index->scc[node];
+}
+
+/*
+ * 1 枚のマップの中で, 歩く・飛び越えるで行き来できる床マスを併合する
+ * 移動できる範囲は updatePlayerStatus() と同じく外周の内側のみ
+ */
+static void uniteMap(Map *map, int offset, int *parent, int *size)
+{
+  int y, x;
+
+  for (y = 1; y <= map->lines - 2; y++) {
+    for (x = 1; x <= map->colums - 2; x++) {
+      int v = offset + y * map->colums + x;
+      if (getMapCell(map, y, x) != CELL_FLOOR)
+        continue;
+
+      // 右と下へ歩ける場合
+      if (x + 1 <= map->colums - 2 && getMapCell(map, y, x + 1) == CELL_FLOOR)
+        unite(parent, size, v, v + 1);
+      if (y + 1 <= map->lines - 2 && getMapCell(map, y + 1, x) == CELL_FLOOR)
+        unite(parent, size, v, v + map->colums);
+
+      // 右と下へ飛び越えられる場合
+      if (x + 2 <= map->colums - 2 && getMapCell(map, y, x + 1) == CELL_JUMP &&
+          getMapCell(map, y, x + 2) == CELL_FLOOR)
+        unite(parent, size, v, v + 2);
+      if (y + 2 <= map->lines - 2 && getMapCell(map, y + 1, x) == CELL_JUMP &&
+          getMapCell(map, y + 2, x) == CELL_FLOOR)
+        unite(parent, size, v, v + 2 * map->colums);
+    }
+  }
+}
+
+/*
+ * ワープポイントに隣接する床マスから, ワープ先の到着マスへの辺を追加する
+ * 戻値 :
+ *   追加後の辺の数
+ */
+static int addWarpEdges(Map *map, int offset, Map *dest, int destOffset,
+                        int *comp, int *from, int *to, int edges)
+{
+  static const int dy[4] = { -1, 1, 0, 0 };
+  static const int dx[4] = { 0, 0, -1, 1 };
+  int arrive, y, x, d;
+
+  if (getMapCell(dest, dest->arriveY, dest->arriveX) != CELL_FLOOR)
+    return edges;
+  arrive = comp[destOffset + dest->arriveY * dest->colums + dest->arriveX];
+
+  for (y = 1; y <= map->lines - 2; y++) {
+    for (x = 1; x <= map->colums - 2; x++) {
+      if (getMapCell(map, y, x) != CELL_FLOOR)
+        continue;
+      for (d = 0; d < 4; d++) {
+        if (getMapCell(map, y + dy[d], x + dx[d]) != CELL_WARP)
+          continue;
+        from[edges] = comp[offset + y * map->colums + x];
+        to[edges]   = arrive;
+        edges++;
+        break;
+      }
+    }
+  }
+
+  return edges;
+}
+
+/*
+ * Tarjan 法による強連結成分分解(再帰を使わない版)
+ * 引数 :
+ *   count     - 頂点数
+ *   start     - 隣接リストの開始位置
+ *   adj       - 隣接リスト
+ *   sccOfComp - 頂点ごとの強連結成分番号(出力)
+ * 戻値 :
+ *   強連結成分の数
+ */
+static int findScc(int count, int *start, int *adj, int *sccOfComp)
+{
+  int *order   = (int *)allocOrDie(sizeof(int) * (count + 1));
+  int *low     = (int *)allocOrDie(sizeof(int) * (count + 1));
+  int *onStack = (int *)allocOrDie(sizeof(int) * (count + 1));
+  int *stack   = (int *)allocOrDie(sizeof(int) * (count + 1));
+  int *call    = (int *)allocOrDie(sizeof(int) * (count + 1));
+  int *edge    = (int *)allocOrDie(sizeof(int) * (count + 1));
+  int  counter = 0, sp = 0, sccCount = 0;
+  int  root, i;
+
+  for (i = 0; i < count; i++) {
+    order[i]   = -1;
+    onStack[i] = 0;
+  }
+
+  for (root = 0; root < count; root++) {
+    int depth = 0;
+    if (order[root] >= 0)
+      continue;
+
+    call[depth] = root;
+    edge[depth] = start[root];
+    order[root] = low[root] = counter++;
+    stack[sp++] = root;
+    onStack[root] = 1;
+
+    while (depth >= 0) {
+      int v = call[depth];
+
+      if (edge[depth] < start[v + 1]) {
+        int w = adj[edge[depth]++];
+        if (order[w] < 0) {
+          // 未訪問の頂点へ進む
+          depth++;
+          call[depth] = w;
+          edge[depth] = start[w];
+          order[w] = low[w] = counter++;
+          stack[sp++] = w;
+          onStack[w] = 1;
+        }
+        else if (onStack[w] && order[w] < low[v]) {
+          low[v] = order[w];
+        }
+        continue;
+      }
+
+      // v の探索が終わった. v が根なら強連結成分を取り出す
+      if (low[v] == order[v]) {
+        int w;
+        do {
+          w = stack[--sp];
+          onStack[w] = 0;
+          sccOfComp[w] = sccCount;
+        } while (w != v);
+        sccCount++;
+      }
+      depth--;
+      if (depth >= 0 && low[v] < low[call[depth]])
+        low[call[depth]] = low[v];
+    }
+  }
+
+  free(order);
+  free(low);
+  free(onStack);
+  free(stack);
+  free(call);
+  free(edge);
+
+  return sccCount;
+}
+
+/*
+ * ワープでつながる成分 k の到達可能集合を得る
+ * 表があればその行を返し, なければ隣接リストをたどって *temp に確保した集合を返す
+ * (*temp は呼び出し側で解放する)
+ */
+static unsigned long long *reachOf(MapIndex *index, int k, unsigned long long **temp)
+{
+  unsigned long long *seen;
+  int *stack;
+  int  sp = 0;
+
+  if (index->reach != NULL)
+    return &index->reach[(size_t)k * index->words];
+
+  seen  = (unsigned long long *)allocOrDie(sizeof(unsigned long long) * (index->words + 1));
+  stack = (int *)allocOrDie(sizeof(int) * (index->linkedCount + 1));
+  bzero(seen, sizeof(unsigned long long) * (index->words + 1));
+
+  seen[k / 64] |= 1ULL << (k % 64);
+  stack[sp++] = k;
+  while (sp > 0) {
+    int v = stack[--sp], e;
+    for (e = index->linkedStart[v]; e < index->linkedStart[v + 1]; e++) {
+      int w = index->linkedAdj[e];
+      if ((seen[w / 64] >> (w % 64)) & 1)
+        continue;
+      seen[w / 64] |= 1ULL << (w % 64);
+      stack[sp++] = w;
+    }
+  }
+  free(stack);
+
+  *temp = seen;
+  return seen;
+}
+
+/*
+ * メモリを確保する. 確保できなければ終了する
+ */
+static void *allocOrDie(size_t size)
+{
+  void *p = malloc(size);
+
+  if (p == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  return p;
+}
@@ -0,0 +1,112 @@
+/********************************************************************
+                       マップ連結性インデックスモジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef MAP_INDEX_H
+#define MAP_INDEX_H
+
+#include "tagMap.h"            // 鬼ごっこマップモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//   マップ連結性インデックスモジュールにおける型の定義
+//--------------------------------------------------------------------
+
+/*
+ * マップ連結性インデックス構造体の定義
+ *
+ * 床マス・飛び越え('+')は双方向の移動なので union-find で連結成分にまとめ,
+ * 一方通行のワープ('W')は連結成分間の有向辺として強連結成分分解する.
+ * ワープの辺が出入りする強連結成分ごとに到達可能集合をビット集合で持つので,
+ * 「A から B へ到達できるか」は O(1) で答えられる.
+ * ワープに面していない成分は自分自身にしか到達できない行き止まりなので集合を持たない
+ * (囲まれた小部屋がいくら多くても表は大きくならない).
+ */
+typedef struct {
+  int      mainColums;           // メインマップの列数
+  int      subColums;            // サブマップの列数
+  int      mainCells;            // メインマップのマス数(サブマップの番号の開始位置)
+  int      nodes;                // 全マス数
+  int     *scc;                  // マスごとの強連結成分番号(床以外は -1)
+  int      sccCount;             // 強連結成分の数
+  int     *linkedOf;             // 強連結成分ごとの, ワープでつながる成分としての番号(なければ -1)
+  int      linkedCount;          // ワープでつながる成分の数
+  int     *linkedStart;          // ワープでつながる成分の隣接リストの開始位置
+  int     *linkedAdj;            // ワープでつながる成分の隣接リスト
+  int      words;                // 到達可能集合 1 つ分の 64bit 語数
+  unsigned long long *reach;     // ワープでつながる成分ごとの到達可能集合(多すぎれば NULL)
+  unsigned long long *meet;      // 2 つの成分から共通に到達できるマスがあるか(多すぎれば NULL)
+  int      floorCells;           // 床マスの数
+} MapIndex;
+
+// 到達可能集合の表を作る成分数の上限(これを超えると問い合わせごとに隣接リストをたどる)
+// 表は上限の 2 乗ビット, 8192 なら 8MB
+#define MAP_INDEX_REACH_MAX  8192
+
+// 共通到達表(meet)を作る成分数の上限(これを超えると都度計算する)
+#define MAP_INDEX_MEET_MAX  4096
+
+
+//--------------------------------------------------------------------
+//   マップ連結性インデックスモジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * マップ連結性インデックスの構築
+ * 全マスを 4 回なめ, 構築中は 1 マス 12 バイトほど, 構築後も 1 マス 4 バイトを使う.
+ * チャンクマップ(.tmc)では全チャンクを何度も読み込むので, 大きなマップでは数秒かかる
+ * 引数 :
+ *   mainMap - メインマップの情報
+ *   subMap  - サブマップの情報
+ * 戻値 :
+ *   マップ連結性インデックスへのポインタ
+ */
+MapIndex* buildMapIndex(Map *mainMap, Map *subMap);
+
+/*
+ * ある位置から別の位置へ到達できるか
+ * 引数 :
+ *   index      - マップ連結性インデックスへのポインタ(NULL なら調べずに到達できるとみなす)
+ *   fromInMain - 出発位置がメインマップか
+ *   fromX      - 出発位置の X 座標
+ *   fromY      - 出発位置の Y 座標
+ *   toInMain   - 目的位置がメインマップか
+ *   toX        - 目的位置の X 座標
+ *   toY        - 目的位置の Y 座標
+ * 戻値 :
+ *   到達できれば 1, できなければ 0
+ */
+int canReach(MapIndex *index, int fromInMain, int fromX, int fromY,
+             int toInMain, int toX, int toY);
+
+/*
+ * 2 つの位置にいるプレイヤーが同じマスで出会う可能性があるか
+ * 引数 :
+ *   index  - マップ連結性インデックスへのポインタ(NULL なら調べずに出会えるとみなす)
+ *   aInMain, aX, aY - 1 人目の位置
+ *   bInMain, bX, bY - 2 人目の位置
+ * 戻値 :
+ *   出会う可能性があれば 1, なければ 0
+ */
+int canMeet(MapIndex *index, int aInMain, int aX, int aY,
+            int bInMain, int bX, int bY);
+
+/*
+ * 指定した 2 つの位置のどちらからも到達できない床マスの数
+ * 引数 :
+ *   index  - マップ連結性インデックスへのポインタ(NULL なら調べずに 0 を返す)
+ *   aInMain, aX, aY - 1 つ目の位置
+ *   bInMain, bX, bY - 2 つ目の位置
+ * 戻値 :
+ *   到達できない床マスの数
+ */
+int countUnreachableCells(MapIndex *index, int aInMain, int aX, int aY,
+                          int bInMain, int bX, int bY);
+
+/*
+ * マップ連結性インデックスの後始末
+ * 引数 :
+ *   index - マップ連結性インデックスへのポインタ
+ */
+void destroyMapIndex(MapIndex *index);
+
+#endif
@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#include "mapStore.h"          // マップストアモジュールヘッダファイル
+
+#define EVENT_BUF_LEN   4096   // inotify のイベントを読むバッファの大きさ
+
+//--------------------------------------------------------------------
+//  マップストアモジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static MapSet* createMapSet(MapStore *store, Map *mainMap, Map *subMap);
+static void    destroyMapSet(MapSet *set);
+static int     reloadMapStore(MapStore *store);
+static void    reclaimMapSets(MapStore *store);
+static void*   watchMapFiles(void *arg);
+static int     readMapEvents(MapStore *store);
+static char*   baseName(char *path);
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * マップストアを作り, 最初の版を読み込む(読めなければ終了する)
+ * 引数 :
+ *   mainName    - メインマップのファイル名
+ *   mainArriveX - メインマップの既定の到着 X 座標
+ *   mainArriveY - メインマップの既定の到着 Y 座標
+ *   subName     - サブマップのファイル名
+ *   subArriveX  - サブマップの既定の到着 X 座標
+ *   subArriveY  - サブマップの既定の到着 Y 座標
+ *   indexChunked - チャンクマップ(.tmc)にも連結性インデックスを作るか
+ * 戻値 :
+ *   マップストアへのポインタ
+ */
+MapStore* openMapStore(char *mainName, int mainArriveX, int mainArriveY,
+                       char *subName, int subArriveX, int subArriveY, int indexChunked)
+{
+  MapStore *store = (MapStore *)malloc(sizeof(MapStore));
+
+  if (store == NULL ||
+      (store->mainName = strdup(mainName)) == NULL ||
+      (store->subName = strdup(subName)) == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  store->mainArriveX = mainArriveX;
+  store->mainArriveY = mainArriveY;
+  store->subArriveX  = subArriveX;
+  store->subArriveY  = subArriveY;
+  store->indexChunked = indexChunked;
+  store->readers     = 0;
+  store->retired     = NULL;
+  store->check       = NULL;
+  store->checkArg    = NULL;
+  store->watching    = 0;
+  store->inotifyFd   = -1;
+  memset(&store->stats, 0, sizeof(MapStoreStats));
+  pthread_mutex_init(&store->lock, NULL);
+
+  // 最初の版(ストア自身が 1 つ参照を持つ)
+  store->current = createMapSet(store, loadMap(mainName, mainArriveX, mainArriveY),
+                                       loadMap(subName, subArriveX, subArriveY));
+  store->current->version = store->stats.version = 1;
+
+  return store;
+}
+
+/*
+ * マップファイルの監視を始める. 変更されると別スレッドで読み直し,
+ * check が認めた版を公開する
+ * 引数 :
+ *   store - マップストアへのポインタ
+ *   check - 新しい版を公開してよいかを調べる関数(NULL なら調べない)
+ *   arg   - check に渡す引数
+ * 戻値 :
+ *   監視を始められれば 0, できなければ -1
+ */
+int watchMapStore(MapStore *store, MapSetCheck check, void *arg)
+{
+  char *names[2] = { store->mainName, store->subName };
+  char *dir, *slash;
+  int   i;
+
+  if (store->watching)
+    return 0;
+  store->check    = check;
+  store->checkArg = arg;
+
+  if ((store->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+    return -1;
+
+  // エディタやツールは別名で書いてから置き換えるので, ファイルではなくディレクトリを見る
+  for (i = 0; i < 2; i++) {
+    if ((dir = strdup(names[i])) == NULL) {
+      fprintf(stderr, "Error: out of memory\n");
+      exit(1);
+    }
+    if ((slash = strrchr(dir, '/')) != NULL)
+      *(slash == dir ? slash + 1 : slash) = '\0';
+    if (inotify_add_watch(store->inotifyFd, slash != NULL ? dir : ".",
+                          IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+      free(dir);
+      close(store->inotifyFd);
+      store->inotifyFd = -1;
+      return -1;
+    }
+    free(dir);
+  }
+
+  if (pipe(store->stopPipe) < 0) {
+    close(store->inotifyFd);
+    store->inotifyFd = -1;
+    return -1;
+  }
+  if (pthread_create(&store->thread, NULL, watchMapFiles, store) != 0) {
+    close(store->stopPipe[0]);
+    close(store->stopPipe[1]);
+    close(store->inotifyFd);
+    store->inotifyFd = -1;
+    return -1;
+  }
+  store->watching = 1;
+
+  return 0;
+}
+
+/*
+ * 現在の版を参照する(ロックを取らない)
+ * readers を増やしている間に読んだ版は, readers が 0 に戻るまで解放されない
+ * 引数 :
+ *   store - マップストアへのポインタ
+ * 戻値 :
+ *   マップの版へのポインタ. releaseMapSet() で手放すまで解放されない
+ */
+MapSet* acquireMapSet(MapStore *store)
+{
+  MapSet *set;
+
+  __atomic_add_fetch(&store->readers, 1, __ATOMIC_SEQ_CST);
+  set = __atomic_load_n(&store->current, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&set->refCount, 1, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch(&store->readers, 1, __ATOMIC_SEQ_CST);
+
+  return set;
+}
+
+/*
+ * 参照していた版を手放す
+ * 引数 :
+ *   store - マップストアへのポインタ
+ *   set   - acquireMapSet() で得た版
+ */
+void releaseMapSet(MapStore *store, MapSet *set)
+{
+  if (set == NULL)
+    return;
+
+  // 最後の参照が無くなった古い版はすぐに解放する
+  if (__atomic_sub_fetch(&set->refCount, 1, __ATOMIC_SEQ_CST) == 0)
+    reclaimMapSets(store);
+}
+
+/*
+ * マップストアの統計を得る
+ * 引数 :
+ *   store - マップストアへのポインタ
+ *   stats - 統計を格納する構造体(出力)
+ */
+void getMapStoreStats(MapStore *store, MapStoreStats *stats)
+{
+  pthread_mutex_lock(&store->lock);
+  *stats = store->stats;
+  pthread_mutex_unlock(&store->lock);
+}
+
+/*
+ * マップストアの後始末(監視を止め, すべての版を解放する)
+ * すべてのゲームが版を手放してから呼ぶこと
+ * 引数 :
+ *   store - マップストアへのポインタ
+ */
+void closeMapStore(MapStore *store)
+{
+  MapSet *set;
+
+  if (store == NULL)
+    return;
+
+  // 監視スレッドを止める
+  if (store->watching) {
+    write(store->stopPipe[1], "", 1);
+    pthread_join(store->thread, NULL);
+    close(store->stopPipe[0]);
+    close(store->stopPipe[1]);
+    close(store->inotifyFd);
+  }
+
+  while ((set = store->retired) != NULL) {
+    store->retired = set->next;
+    destroyMapSet(set);
+  }
+  destroyMapSet(store->current);
+  pthread_mutex_destroy(&store->lock);
+  free(store->mainName);
+  free(store->subName);
+  free(store);
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * マップの版を作る(連結性インデックスと視界もここで作る)
+ * チャンクマップの連結性インデックスは全マスを何度も読むので, 頼まれたときだけ作る
+ */
+static MapSet* createMapSet(MapStore *store, Map *mainMap, Map *subMap)
+{
+  MapSet *set = (MapSet *)malloc(sizeof(MapSet));
+
+  if (set == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  set->mainMap  = mainMap;
+  set->subMap   = subMap;
+  if ((mainMap->chunks == NULL && subMap->chunks == NULL) || store->indexChunked)
+    set->index  = buildMapIndex(mainMap, subMap);
+  else
+    set->index  = NULL;
+  set->mainVision = buildMapVision(mainMap);
+  set->subVision  = buildMapVision(subMap);
+  set->version  = 0;
+  set->refCount = 1;
+  set->next     = NULL;
+
+  return set;
+}
+
+/*
+ * マップの版を解放する
+ */
+static void destroyMapSet(MapSet *set)
+{
+  destroyMapIndex(set->index);
+  destroyMapVision(set->mainVision);
+  destroyMapVision(set->subVision);
+  destroyMap(set->mainMap);
+  destroyMap(set->subMap);
+  free(set);
+}
+
+/*
+ * マップファイルを読み直し, 遊べるマップなら新しい版として公開する
+ * (監視スレッドからだけ呼ぶ)
+ * 戻値 :
+ *   公開すれば 0, しなければ -1
+ */
+static int reloadMapStore(MapStore *store)
+{
+  char    error[MAP_ERROR_LEN];
+  Map    *mainMap, *subMap = NULL;
+  MapSet *set, *old;
+
+  // 読めない・遊べないマップは公開しない(今の版を使い続ける)
+  if ((mainMap = tryLoadMap(store->mainName, store->mainArriveX, store->mainArriveY, error)) == NULL ||
+      (subMap = tryLoadMap(store->subName, store->subArriveX, store->subArriveY, error)) == NULL) {
+    destroyMap(mainMap);
+    set = NULL;
+  }
+  else {
+    set = createMapSet(store, mainMap, subMap);
+    if (store->check != NULL && !store->check(set, store->checkArg)) {
+      snprintf(error, MAP_ERROR_LEN, "map is unsound (players can never meet)");
+      destroyMapSet(set);
+      set = NULL;
+    }
+  }
+  if (set == NULL) {
+    pthread_mutex_lock(&store->lock);
+    store->stats.rejected++;
+    strcpy(store->stats.lastError, error);
+    pthread_mutex_unlock(&store->lock);
+    return -1;
+  }
+
+  // 現在の版を入れ替える. 古い版を参照しているゲームはそのまま使い続ける
+  set->version = store->stats.version + 1;
+  old = __atomic_exchange_n(&store->current, set, __ATOMIC_SEQ_CST);
+
+  pthread_mutex_lock(&store->lock);
+  old->next = store->retired;
+  store->retired = old;
+  store->stats.version = set->version;
+  store->stats.reloads++;
+  store->stats.retired++;
+  store->stats.lastError[0] = '\0';
+  pthread_mutex_unlock(&store->lock);
+
+  // ストアが持っていた参照を手放す
+  releaseMapSet(store, old);
+
+  return 0;
+}
+
+/*
+ * 参照が無くなった古い版を解放する
+ * 入れ替えの前に current を読んだゲームが参照を増やし終えるまでは
+ * (readers が 0 になるまでは) 参照数が 0 でも解放しない
+ */
+static void reclaimMapSets(MapStore *store)
+{
+  MapSet **p, *set;
+
+  pthread_mutex_lock(&store->lock);
+  if (__atomic_load_n(&store->readers, __ATOMIC_SEQ_CST) == 0) {
+    for (p = &store->retired; *p != NULL; ) {
+      set = *p;
+      if (__atomic_load_n(&set->refCount, __ATOMIC_SEQ_CST) == 0) {
+        *p = set->next;
+        destroyMapSet(set);
+        store->stats.retired--;
+        store->stats.reclaimed++;
+      }
+      else {
+        p = &set->next;
+      }
+    }
+  }
+  pthread_mutex_unlock(&store->lock);
+}
+
+/*
+ * 監視スレッド
+ * マップファイルが書き換えられたら, 変更が止むのを待ってから読み直す
+ */
+static void* watchMapFiles(void *arg)
+{
+  MapStore     *store = (MapStore *)arg;
+  struct pollfd fds[2];
+  int           changed, timeout;
+
+  fds[0].fd     = store->inotifyFd;
+  fds[0].events = POLLIN;
+  fds[1].fd     = store->stopPipe[0];
+  fds[1].events = POLLIN;
+
+  changed = 0;
+  while (1) {
+    // 解放できなかった古い版が残っていれば, ときどき解放し直す
+    pthread_mutex_lock(&store->lock);
+    timeout = store->retired != NULL ? MAP_RECLAIM_RETRY : -1;
+    pthread_mutex_unlock(&store->lock);
+    if (changed)
+      timeout = MAP_RELOAD_DELAY;
+
+    if (poll(fds, 2, timeout) < 0)
+      continue;
+    if (fds[1].revents & POLLIN)
+      break;
+
+    if (fds[0].revents & POLLIN) {
+      // 変更が続いている間は読み直さない
+      changed |= readMapEvents(store);
+      continue;
+    }
+
+    if (changed) {
+      reloadMapStore(store);
+      changed = 0;
+    }
+    reclaimMapSets(store);
+  }
+
+  return NULL;
+}
+
+/*
+ * inotify のイベントをすべて読む
+ * 戻値 :
+ *   マップファイルが変更されていれば 1
+ */
+static int readMapEvents(MapStore *store)
+{
+  char   buf[EVENT_BUF_LEN] __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct inotify_event *event;
+  ssize_t len;
+  char   *p;
+  int     changed = 0;
+
+  while ((len = read(store->inotifyFd, buf, sizeof(buf))) > 0) {
+    for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + event->len) {
+      event = (struct inotify_event *)p;
+      if (event->len > 0 &&
+          (strcmp(event->name, baseName(store->mainName)) == 0 ||
+           strcmp(event->name, baseName(store->subName)) == 0))
+        changed = 1;
+    }
+  }
+
+  return changed;
+}
+
+/*
+ * パス名のファイル名部分を得る
+ */
+static char* baseName(char *path)
+{
+  char *slash = strrchr(path, '/');
+
+  return slash != NULL ? slash + 1 : path;
+}
@@ -0,0 +1,147 @@
+/********************************************************************
+                       マップストア(ホットリロード)モジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef MAP_STORE_H
+#define MAP_STORE_H
+
+#include <pthread.h>
+
+#include "tagMap.h"            // 鬼ごっこマップモジュールヘッダファイル
+#include "mapIndex.h"          // マップ連結性インデックスモジュールヘッダファイル
+#include "mapVision.h"         // マップ視界モジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//   マップストアモジュールにおける定数・型の定義
+//--------------------------------------------------------------------
+#define MAP_RELOAD_DELAY   100   // ファイルの変更が止んでから読み直すまでの時間(ms)
+#define MAP_RECLAIM_RETRY  1000  // 解放できなかった古い版を解放し直す間隔(ms)
+
+/*
+ * マップの版
+ * メインマップ・サブマップとその連結性インデックスをまとめたもの.
+ * 公開した後は書き換えないので, 参照している間はロックなしで読める
+ */
+typedef struct MapSet {
+  Map           *mainMap;        // メインマップ
+  Map           *subMap;         // サブマップ
+  MapIndex      *index;          // 連結性インデックス(作らなかったチャンクマップなら NULL)
+  MapVision     *mainVision;     // メインマップの視界
+  MapVision     *subVision;      // サブマップの視界
+  int            version;        // 版の番号(1 から)
+  int            refCount;       // 参照しているゲームの数(ストアが持つ分を含む)
+  struct MapSet *next;           // 解放待ちの版のリスト
+} MapSet;
+
+/*
+ * マップの版を公開してよいかを調べる関数(遊べないマップなら 0 を返す)
+ */
+typedef int (*MapSetCheck)(MapSet *set, void *arg);
+
+/*
+ * マップストアの統計
+ */
+typedef struct {
+  int     version;               // 現在の版の番号
+  int     reloads;               // 読み直して公開した回数
+  int     rejected;              // 読み直したが公開しなかった回数
+  int     retired;               // 解放待ちの古い版の数
+  int     reclaimed;             // 解放した古い版の数
+  char    lastError[MAP_ERROR_LEN]; // 最後に公開しなかった理由(無ければ空)
+} MapStoreStats;
+
+/*
+ * マップストア構造体の定義
+ * 現在の版へのポインタを原子的に入れ替えて新しい版を公開する(RCU 方式).
+ * 読む側は acquireMapSet() で版を参照し, 終わったら releaseMapSet() で手放す.
+ * 入れ替えられた古い版は, 参照しているゲームが無くなってから解放する
+ */
+typedef struct {
+  char           *mainName;      // メインマップのファイル名
+  char           *subName;       // サブマップのファイル名
+  int             mainArriveX;   // メインマップの既定の到着 X 座標
+  int             mainArriveY;   // メインマップの既定の到着 Y 座標
+  int             subArriveX;    // サブマップの既定の到着 X 座標
+  int             subArriveY;    // サブマップの既定の到着 Y 座標
+  int             indexChunked;  // チャンクマップにも連結性インデックスを作るか
+  MapSet         *current;       // 現在の版(原子的に読み書きする)
+  int             readers;       // current を読んで参照を増やしている途中の数
+  pthread_mutex_t lock;          // retired と統計を守るロック
+  MapSet         *retired;       // 入れ替えられて解放を待っている版
+  MapStoreStats   stats;         // 統計
+  MapSetCheck     check;         // 新しい版を公開してよいかを調べる関数
+  void           *checkArg;      // check に渡す引数
+  int             watching;      // ファイルを監視しているか
+  int             inotifyFd;     // inotify のファイルデスクリプタ
+  int             stopPipe[2];   // 監視スレッドを止めるためのパイプ
+  pthread_t       thread;        // 監視スレッド
+} MapStore;
+
+
+//--------------------------------------------------------------------
+//   マップストアモジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * マップストアを作り, 最初の版を読み込む(読めなければ終了する)
+ * 引数 :
+ *   mainName    - メインマップのファイル名
+ *   mainArriveX - メインマップの既定の到着 X 座標
+ *   mainArriveY - メインマップの既定の到着 Y 座標
+ *   subName     - サブマップのファイル名
+ *   subArriveX  - サブマップの既定の到着 X 座標
+ *   subArriveY  - サブマップの既定の到着 Y 座標
+ *   indexChunked - チャンクマップ(.tmc)にも連結性インデックスを作るか
+ *                  (作ると 1 マス 12 バイトほどの作業領域と, 全チャンクを何度も読む時間がかかる.
+ *                   作らなければ版の index は NULL になり, 出会えるかは調べない)
+ * 戻値 :
+ *   マップストアへのポインタ
+ */
+MapStore* openMapStore(char *mainName, int mainArriveX, int mainArriveY,
+                       char *subName, int subArriveX, int subArriveY, int indexChunked);
+
+/*
+ * マップファイルの監視を始める. 変更されると別スレッドで読み直し,
+ * check が認めた版を公開する
+ * 引数 :
+ *   store - マップストアへのポインタ
+ *   check - 新しい版を公開してよいかを調べる関数(NULL なら調べない)
+ *   arg   - check に渡す引数
+ * 戻値 :
+ *   監視を始められれば 0, できなければ -1
+ */
+int watchMapStore(MapStore *store, MapSetCheck check, void *arg);
+
+/*
+ * 現在の版を参照する(ロックを取らない)
+ * 引数 :
+ *   store - マップストアへのポインタ
+ * 戻値 :
+ *   マップの版へのポインタ. releaseMapSet() で手放すまで解放されない
+ */
+MapSet* acquireMapSet(MapStore *store);
+
+/*
+ * 参照していた版を手放す
+ * 引数 :
+ *   store - マップストアへのポインタ
+ *   set   - acquireMapSet() で得た版
+ */
+void releaseMapSet(MapStore *store, MapSet *set);
+
+/*
+ * マップストアの統計を得る
+ * 引数 :
+ *   store - マップストアへのポインタ
+ *   stats - 統計を格納する構造体(出力)
+ */
+void getMapStoreStats(MapStore *store, MapStoreStats *stats);
+
+/*
+ * マップストアの後始末(監視を止め, すべての版を解放する)
+ * 引数 :
+ *   store - マップストアへのポインタ
+ */
+void closeMapStore(MapStore *store);
+
+#endif
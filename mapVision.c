@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapVision.h"         // マップ視界モジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  マップ視界モジュール内部で使用する型の定義
+//--------------------------------------------------------------------
+
+// シャドウキャスティング 1 回分の作業領域
+typedef struct {
+  int            lines;          // マップの行数
+  int            colums;         // マップの列数
+  unsigned char *opaque;         // マスごとに視線をさえぎるなら 1
+  int            ox, oy;         // opaque の左上のマス(マップ全体なら 0, 0)
+  int            width;          // opaque の幅(マップ全体なら colums)
+  unsigned long long *bits;      // 見えたマスを書き込む視界(中心のマスの分)
+  int            cx, cy;         // 中心のマス
+} Caster;
+
+//--------------------------------------------------------------------
+//  マップ視界モジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static void castLight(Caster *c, int row, double start, double end,
+                      int xx, int xy, int yx, int yy);
+static int  isOpaque(Caster *c, int x, int y);
+static void markVisible(Caster *c, int dx, int dy);
+static void castFrom(Caster *c, int x, int y);
+static unsigned long long *findTile(MapVision *vision, int x, int y);
+static void buildTile(MapVision *vision, int tile, unsigned long long *bits);
+static int  isVisibleFrom(unsigned long long *bits, int fromX, int fromY, int toX, int toY);
+static void symmetrize(MapVision *vision);
+static void *allocOrDie(size_t size);
+
+// 8 つの八分円への座標変換(x = dx * xx + dy * xy, y = dx * yx + dy * yy)
+static const int octant[8][4] = {
+  { 1,  0,  0,  1}, { 0,  1,  1,  0}, { 0, -1,  1,  0}, {-1,  0,  0,  1},
+  {-1,  0,  0, -1}, { 0, -1, -1,  0}, { 0,  1, -1,  0}, { 1,  0,  0, -1},
+};
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * マップ視界の構築
+ * 引数 :
+ *   map - マップの情報(表を作らない大きなマップでは, 視界を捨てるまで参照する)
+ * 戻値 :
+ *   マップ視界へのポインタ
+ */
+MapVision* buildMapVision(Map *map)
+{
+  MapVision *vision = (MapVision *)allocOrDie(sizeof(MapVision));
+  Caster     c;
+  long       cells = (long)map->lines * map->colums;
+  int        x, y;
+
+  bzero(vision, sizeof(MapVision));
+  vision->lines  = map->lines;
+  vision->colums = map->colums;
+  vision->map    = map;
+
+  // 大きなマップは表を作らない(canSee() が聞かれた区画ごとに作って覚えておく)
+  if (cells > VISION_MAX_CELLS) {
+    vision->tileBits = (unsigned long long *)allocOrDie(sizeof(unsigned long long) * VISION_WORDS *
+                                                        VISION_TILE * VISION_TILE * VISION_CACHE_TILES);
+    for (x = 0; x < VISION_CACHE_TILES; x++)
+      vision->tileKey[x] = -1;
+    pthread_mutex_init(&vision->lock, NULL);
+    return vision;
+  }
+
+  vision->bits = (unsigned long long *)allocOrDie(sizeof(unsigned long long) * VISION_WORDS * cells);
+  memset(vision->bits, 0, sizeof(unsigned long long) * VISION_WORDS * cells);
+
+  // 視線をさえぎるマスを先に表にしておく(チャンクファイルでも 1 回だけ読む)
+  c.lines  = map->lines;
+  c.colums = map->colums;
+  c.opaque = (unsigned char *)allocOrDie(cells);
+  c.ox     = 0;
+  c.oy     = 0;
+  c.width  = map->colums;
+  for (y = 0; y < map->lines; y++)
+    for (x = 0; x < map->colums; x++)
+      c.opaque[(long)y * map->colums + x] = getMapCell(map, y, x) == CELL_WALL;
+
+  // 壁の中からは見ないので, 壁以外のマスごとに 8 つの八分円を照らす
+  for (y = 0; y < map->lines; y++) {
+    for (x = 0; x < map->colums; x++) {
+      if (c.opaque[(long)y * map->colums + x])
+        continue;
+      c.bits = vision->bits + ((long)y * map->colums + x) * VISION_WORDS;
+      castFrom(&c, x, y);
+    }
+  }
+
+  free(c.opaque);
+
+  // どちらか一方から見えれば, お互いに見えることにする(鬼と逃げる役で不公平が無いように)
+  symmetrize(vision);
+
+  return vision;
+}
+
+/*
+ * ある位置から別の位置が見えるか(同じマップの中で)
+ * 引数 :
+ *   vision - マップ視界へのポインタ
+ *   fromX  - 見る位置の X 座標
+ *   fromY  - 見る位置の Y 座標
+ *   toX    - 見られる位置の X 座標
+ *   toY    - 見られる位置の Y 座標
+ * 戻値 :
+ *   見えれば 1, 見えなければ 0
+ */
+int canSee(MapVision *vision, int fromX, int fromY, int toX, int toY)
+{
+  int dx = toX - fromX + VISION_RADIUS;
+  int dy = toY - fromY + VISION_RADIUS;
+  int bit, seen;
+
+  if (fromX < 0 || fromX >= vision->colums || fromY < 0 || fromY >= vision->lines)
+    return 0;
+  if (dx < 0 || dx >= VISION_SIDE || dy < 0 || dy >= VISION_SIDE)
+    return 0;
+
+  // 表を作っていない大きなマップでは, 両方の位置の区画の視界からどちらか一方から見えるかを調べる
+  // (2 つ目の区画を探しても, 使ったばかりの 1 つ目の区画は捨てられない)
+  if (vision->bits == NULL) {
+    pthread_mutex_lock(&vision->lock);
+    seen = isVisibleFrom(findTile(vision, fromX, fromY), fromX, fromY, toX, toY);
+    if (!seen && toX >= 0 && toX < vision->colums && toY >= 0 && toY < vision->lines)
+      seen = isVisibleFrom(findTile(vision, toX, toY), toX, toY, fromX, fromY);
+    pthread_mutex_unlock(&vision->lock);
+    return seen;
+  }
+
+  bit = dy * VISION_SIDE + dx;
+  return (vision->bits[((long)fromY * vision->colums + fromX) * VISION_WORDS + bit / 64] >> (bit % 64)) & 1;
+}
+
+/*
+ * マップ視界の後始末
+ * 引数 :
+ *   vision - マップ視界へのポインタ
+ */
+void destroyMapVision(MapVision *vision)
+{
+  if (vision == NULL)
+    return;
+  if (vision->tileBits != NULL)
+    pthread_mutex_destroy(&vision->lock);
+  free(vision->bits);
+  free(vision->tileBits);
+  free(vision);
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * 再帰的シャドウキャスティングで 1 つの八分円を照らす
+ * 中心から row 行目より先を, 傾き start から end の範囲だけ調べ,
+ * 壁で影になった部分を除いて再帰的に先の行へ進む
+ * 引数 :
+ *   c              - 作業領域
+ *   row            - 調べ始める行(中心からの距離)
+ *   start, end     - 照らす範囲の傾き(start > end)
+ *   xx, xy, yx, yy - 八分円への座標変換
+ */
+static void castLight(Caster *c, int row, double start, double end,
+                      int xx, int xy, int yx, int yy)
+{
+  double newStart = 0.0, leftSlope, rightSlope;
+  int    dist, dx, dy, x, y, blocked;
+
+  if (start < end)
+    return;
+
+  for (dist = row; dist <= VISION_RADIUS; dist++) {
+    blocked = 0;
+    dy = -dist;
+    for (dx = -dist; dx <= 0; dx++) {
+      x = c->cx + dx * xx + dy * xy;
+      y = c->cy + dx * yx + dy * yy;
+      leftSlope  = (dx - 0.5) / (dy + 0.5);
+      rightSlope = (dx + 0.5) / (dy - 0.5);
+      if (start < rightSlope)
+        continue;
+      if (end > leftSlope)
+        break;
+
+      // 円の内側だけを見えることにする
+      if (dx * dx + dy * dy <= VISION_RADIUS * VISION_RADIUS)
+        markVisible(c, x - c->cx, y - c->cy);
+
+      if (blocked) {
+        // 壁が続く間は影の始まりをずらすだけ
+        if (isOpaque(c, x, y)) {
+          newStart = rightSlope;
+          continue;
+        }
+        blocked = 0;
+        start = newStart;
+      }
+      else if (isOpaque(c, x, y) && dist < VISION_RADIUS) {
+        // 壁に当たったら, 壁の手前までを先の行で照らす
+        blocked = 1;
+        castLight(c, dist + 1, start, leftSlope, xx, xy, yx, yy);
+        newStart = rightSlope;
+      }
+    }
+    if (blocked)
+      break;
+  }
+}
+
+/*
+ * マスが視線をさえぎるか(マップの外はさえぎる)
+ */
+static int isOpaque(Caster *c, int x, int y)
+{
+  if (x < 0 || x >= c->colums || y < 0 || y >= c->lines)
+    return 1;
+  return c->opaque[(long)(y - c->oy) * c->width + (x - c->ox)];
+}
+
+/*
+ * (x, y) を中心に 8 つの八分円を照らし, 見えるマスを c->bits に書く
+ */
+static void castFrom(Caster *c, int x, int y)
+{
+  int i;
+
+  c->cx = x;
+  c->cy = y;
+  markVisible(c, 0, 0);
+  for (i = 0; i < 8; i++)
+    castLight(c, 1, 1.0, 0.0, octant[i][0], octant[i][1], octant[i][2], octant[i][3]);
+}
+
+/*
+ * (x, y) を含む区画の視界を得る. 覚えていなければ, 一番長く使っていない区画と入れ替えて作る
+ * (vision->lock を持って呼ぶ)
+ */
+static unsigned long long *findTile(MapVision *vision, int x, int y)
+{
+  int tilesX = (vision->colums + VISION_TILE - 1) / VISION_TILE;
+  int tile   = (y / VISION_TILE) * tilesX + x / VISION_TILE;
+  int slot, victim = 0;
+
+  for (slot = 0; slot < VISION_CACHE_TILES; slot++) {
+    if (vision->tileKey[slot] == tile)
+      break;
+    if (vision->tileKey[victim] >= 0 &&
+        (vision->tileKey[slot] < 0 || vision->tileUsed[slot] < vision->tileUsed[victim]))
+      victim = slot;
+  }
+  if (slot == VISION_CACHE_TILES) {
+    slot = victim;
+    vision->tileKey[slot] = tile;
+    buildTile(vision, tile, vision->tileBits + (long)slot * VISION_TILE * VISION_TILE * VISION_WORDS);
+  }
+  vision->tileUsed[slot] = ++vision->useCount;
+
+  return vision->tileBits + (long)slot * VISION_TILE * VISION_TILE * VISION_WORDS;
+}
+
+/*
+ * 区画の中の壁以外のマスごとに 8 つの八分円を照らし, 見えるマスを bits に書く
+ * 視線をさえぎるマスは, 区画の周りの VISION_RADIUS マスまでを先に表にしておく
+ * (チャンクファイルでも 1 マス 1 回だけ読む)
+ */
+static void buildTile(MapVision *vision, int tile, unsigned long long *bits)
+{
+  unsigned char opaque[(VISION_TILE + 2 * VISION_RADIUS) * (VISION_TILE + 2 * VISION_RADIUS)];
+  Caster c;
+  int    tilesX = (vision->colums + VISION_TILE - 1) / VISION_TILE;
+  int    x0 = (tile % tilesX) * VISION_TILE;
+  int    y0 = (tile / tilesX) * VISION_TILE;
+  int    x, y;
+
+  c.lines  = vision->lines;
+  c.colums = vision->colums;
+  c.opaque = opaque;
+  c.ox     = x0 - VISION_RADIUS;
+  c.oy     = y0 - VISION_RADIUS;
+  c.width  = VISION_TILE + 2 * VISION_RADIUS;
+  for (y = c.oy; y < c.oy + c.width; y++)
+    for (x = c.ox; x < c.ox + c.width; x++)
+      opaque[(y - c.oy) * c.width + (x - c.ox)] =
+          x < 0 || x >= vision->colums || y < 0 || y >= vision->lines ||
+          getMapCell(vision->map, y, x) == CELL_WALL;
+
+  // 壁の中からは見ないのは, 表を作るときと同じ
+  memset(bits, 0, sizeof(unsigned long long) * VISION_WORDS * VISION_TILE * VISION_TILE);
+  for (y = y0; y < y0 + VISION_TILE && y < vision->lines; y++) {
+    for (x = x0; x < x0 + VISION_TILE && x < vision->colums; x++) {
+      if (isOpaque(&c, x, y))
+        continue;
+      c.bits = bits + ((y - y0) * VISION_TILE + (x - x0)) * VISION_WORDS;
+      castFrom(&c, x, y);
+    }
+  }
+  vision->tileBuilds++;
+}
+
+/*
+ * 区画の視界で, (fromX, fromY) から (toX, toY) が片方向に見えるか
+ * 引数 :
+ *   bits - (fromX, fromY) を含む区画の視界
+ */
+static int isVisibleFrom(unsigned long long *bits, int fromX, int fromY, int toX, int toY)
+{
+  int bit = (toY - fromY + VISION_RADIUS) * VISION_SIDE + (toX - fromX + VISION_RADIUS);
+
+  bits += ((fromY % VISION_TILE) * VISION_TILE + fromX % VISION_TILE) * VISION_WORDS;
+  return (bits[bit / 64] >> (bit % 64)) & 1;
+}
+
+/*
+ * 中心から (dx, dy) のマスを見えることにする
+ */
+static void markVisible(Caster *c, int dx, int dy)
+{
+  int bit = (dy + VISION_RADIUS) * VISION_SIDE + (dx + VISION_RADIUS);
+
+  c->bits[bit / 64] |= 1ULL << (bit % 64);
+}
+
+/*
+ * 視界を対称にする(A から B が見えれば B から A も見えることにする)
+ */
+static void symmetrize(MapVision *vision)
+{
+  unsigned long long *from, *to;
+  int x, y, dx, dy, bit, back;
+
+  for (y = 0; y < vision->lines; y++) {
+    for (x = 0; x < vision->colums; x++) {
+      from = vision->bits + ((long)y * vision->colums + x) * VISION_WORDS;
+      for (dy = -VISION_RADIUS; dy <= VISION_RADIUS; dy++) {
+        for (dx = -VISION_RADIUS; dx <= VISION_RADIUS; dx++) {
+          if (x + dx < 0 || x + dx >= vision->colums || y + dy < 0 || y + dy >= vision->lines)
+            continue;
+          bit = (dy + VISION_RADIUS) * VISION_SIDE + (dx + VISION_RADIUS);
+          if (!((from[bit / 64] >> (bit % 64)) & 1))
+            continue;
+          to   = vision->bits + ((long)(y + dy) * vision->colums + (x + dx)) * VISION_WORDS;
+          back = (-dy + VISION_RADIUS) * VISION_SIDE + (-dx + VISION_RADIUS);
+          to[back / 64] |= 1ULL << (back % 64);
+        }
+      }
+    }
+  }
+}
+
+/*
+ * メモリを確保する(確保できなければ終了する)
+ */
+static void *allocOrDie(size_t size)
+{
+  void *p = malloc(size);
+
+  if (p == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  return p;
+}
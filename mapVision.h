@@ -0,0 +1,81 @@
+/********************************************************************
+                       マップ視界モジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef MAP_VISION_H
+#define MAP_VISION_H
+
+#include <pthread.h>
+
+#include "tagMap.h"            // 鬼ごっこマップモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//   マップ視界モジュールにおける定数・型の定義
+//--------------------------------------------------------------------
+#define VISION_RADIUS     12     // 見える距離(マス)
+#define VISION_SIDE       (2 * VISION_RADIUS + 1)          // 視界の正方形の 1 辺
+#define VISION_WORDS      ((VISION_SIDE * VISION_SIDE + 63) / 64)  // マス 1 つ分の 64bit 語数
+#define VISION_MAX_CELLS  65536  // 視界の表を作るマップのマス数の上限(これを超えると区画ごとに作る)
+#define VISION_TILE       16     // 大きなマップで視界を作る区画の 1 辺(マス)
+#define VISION_CACHE_TILES 64    // 大きなマップで視界を覚えておく区画の数
+
+/*
+ * マップ視界構造体の定義
+ * マップを読んだときに, すべての床マスからシャドウキャスティングで見えるマスを求め,
+ * マスごとに「そのマスを中心とする VISION_SIDE 四方のうち見えるマス」をビット集合で持つ.
+ * 壁('#')は視線をさえぎり, 飛び越え壁('+')とワープポイントは透けて見える.
+ * シャドウキャスティングは向きによって結果が変わるので, どちらか一方から見えれば
+ * お互いに見えることにする. 「A から B が見えるか」はビットを 1 つ調べるだけで答えられる.
+ * 表は 1 マス 80 バイトほどになるので, VISION_MAX_CELLS を超える大きなマップでは表を作らず,
+ * 聞かれた位置を含む VISION_TILE 四方の区画ごとに, 区画の中のマスから見えるマスを
+ * まとめて照らして VISION_CACHE_TILES 区画まで覚えておく(古いものから捨てる).
+ * 区画の視界は片方向なので, 両方の位置の区画を調べて答える(結果は表と同じ)
+ */
+typedef struct {
+  int      lines;                // マップの行数
+  int      colums;               // マップの列数
+  unsigned long long *bits;      // マスごとの視界(lines * colums * VISION_WORDS 語). NULL なら区画ごとに作る
+  Map     *map;                  // 区画ごとに作るときに読むマップ
+  unsigned long long *tileBits;  // 区画ごとの視界(区画の中のマスごとに VISION_WORDS 語, 対称にしていない)
+  int      tileKey[VISION_CACHE_TILES];       // 覚えている区画の番号(-1 なら空き)
+  unsigned tileUsed[VISION_CACHE_TILES];      // 区画を最後に使った順番
+  unsigned useCount;             // 区画を使った回数(tileUsed に書く)
+  long     tileBuilds;           // 区画の視界を作った回数
+  pthread_mutex_t lock;          // 区画のキャッシュのロック(描画と通信のスレッドから呼ばれる)
+} MapVision;
+
+
+//--------------------------------------------------------------------
+//   マップ視界モジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * マップ視界の構築
+ * 引数 :
+ *   map - マップの情報(表を作らない大きなマップでは, 視界を捨てるまで参照する)
+ * 戻値 :
+ *   マップ視界へのポインタ
+ */
+MapVision* buildMapVision(Map *map);
+
+/*
+ * ある位置から別の位置が見えるか(同じマップの中で)
+ * 引数 :
+ *   vision - マップ視界へのポインタ
+ *   fromX  - 見る位置の X 座標
+ *   fromY  - 見る位置の Y 座標
+ *   toX    - 見られる位置の X 座標
+ *   toY    - 見られる位置の Y 座標
+ * 戻値 :
+ *   見えれば 1, 見えなければ 0
+ */
+int canSee(MapVision *vision, int fromX, int fromY, int toX, int toY);
+
+/*
+ * マップ視界の後始末
+ * 引数 :
+ *   vision - マップ視界へのポインタ
+ */
+void destroyMapVision(MapVision *vision);
+
+#endif
@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "matchStore.h"        // 試合結果ストアモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  試合結果ストアモジュール内部で使用する定数・型の定義
+//--------------------------------------------------------------------
+#define MATCH_TABLE_MIN    64     // ハッシュ表の最初の大きさ
+
+// ログに書く記録 1 つ(チェックサムは record に対して計算する)
+typedef struct {
+  char        magic[4];          // MATCH_LOG_MAGIC
+  uint32_t    crc;               // record の CRC32
+  MatchRecord record;            // 試合の記録
+} MatchLogEntry;
+
+//--------------------------------------------------------------------
+//  試合結果ストアモジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static void*    writerThread(void *arg);
+static void     commitBatch(MatchStore *store, MatchLogEntry *batch, int n);
+static void     replayLog(MatchStore *store);
+static void     applyRecord(MatchStore *store, MatchRecord *record);
+static PlayerStats* findPlayer(MatchStore *store, char *name, int create);
+static void     growTable(MatchStore *store);
+static unsigned hashName(char *name);
+static uint32_t crc32(const void *data, size_t len);
+static int      isHigher(PlayerStats *a, PlayerStats *b);
+static long     nowUsec();
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * 試合結果ストアを開く. ログを読み直して成績を作り, 書き込みスレッドを動かす
+ * ログが開けなければ終了する
+ * 引数 :
+ *   fileName - ログファイル名(無ければ作る)
+ * 戻値 :
+ *   試合結果ストアへのポインタ
+ */
+MatchStore* openMatchStore(char *fileName)
+{
+  MatchStore *store = (MatchStore *)calloc(1, sizeof(MatchStore));
+  int         i;
+
+  if (store == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  // 同じログを複数のサーバープロセスが書くので, 書き込みは常に末尾に足す
+  if ((store->fd = open(fileName, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0) {
+    fprintf(stderr, "Error: cannot open match log %s\n", fileName);
+    exit(1);
+  }
+  pthread_mutex_init(&store->lock, NULL);
+
+  // 名前 → 成績のハッシュ表
+  store->tableSize = MATCH_TABLE_MIN;
+  store->capacity  = MATCH_TABLE_MIN / 2;
+  store->table  = (int *)malloc(sizeof(int) * store->tableSize);
+  store->player = (PlayerStats *)malloc(sizeof(PlayerStats) * store->capacity);
+  if (store->table == NULL || store->player == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  for (i = 0; i < store->tableSize; i++)
+    store->table[i] = -1;
+
+  // ログを先頭から読み直して成績を作る
+  replayLog(store);
+
+  // 書き込みスレッドを動かす
+  store->queue = createSpscQueue(MATCH_QUEUE_LEN, sizeof(MatchRecord), NULL);
+  if (pthread_create(&store->thread, NULL, writerThread, store) != 0) {
+    fprintf(stderr, "Error: cannot create thread\n");
+    exit(1);
+  }
+
+  return store;
+}
+
+/*
+ * 試合の記録を書き込みスレッドへ渡す(待たない. 呼ぶのは 1 つのスレッドだけ)
+ * 引数 :
+ *   store  - 試合結果ストアへのポインタ
+ *   record - 試合の記録
+ * 戻値 :
+ *   渡せれば 1, キューが満杯で捨てたら 0
+ */
+int submitMatch(MatchStore *store, MatchRecord *record)
+{
+  int pushed = pushSpscQueue(store->queue, record);
+
+  __atomic_add_fetch(pushed ? &store->stats.submitted : &store->stats.dropped, 1, __ATOMIC_RELAXED);
+
+  return pushed;
+}
+
+/*
+ * プレイヤーの成績を調べる
+ * 引数 :
+ *   store - 試合結果ストアへのポインタ
+ *   name  - プレイヤー名
+ *   stats - 成績を格納する構造体(出力)
+ * 戻値 :
+ *   成績があれば 1, 無ければ 0
+ */
+int lookupPlayer(MatchStore *store, char *name, PlayerStats *stats)
+{
+  PlayerStats *player;
+
+  pthread_mutex_lock(&store->lock);
+  if ((player = findPlayer(store, name, 0)) != NULL)
+    *stats = *player;
+  pthread_mutex_unlock(&store->lock);
+
+  return player != NULL;
+}
+
+/*
+ * 勝った数の多い順にプレイヤーの成績を得る(同じなら試合数の少ない方が上)
+ * 引数 :
+ *   store - 試合結果ストアへのポインタ
+ *   top   - 成績を格納する配列(出力. k 個以上)
+ *   k     - 得る人数
+ * 戻値 :
+ *   得た人数
+ */
+int topPlayers(MatchStore *store, PlayerStats *top, int k)
+{
+  int n = 0, i, j;
+
+  if (k <= 0)
+    return 0;
+
+  // 上位 k 人だけを並べておく挿入(k は小さいので全体を並べ替えるより速い)
+  pthread_mutex_lock(&store->lock);
+  for (i = 0; i < store->players; i++) {
+    if (n == k && !isHigher(&store->player[i], &top[k - 1]))
+      continue;
+    j = n < k ? n++ : k - 1;
+    for (; j > 0 && isHigher(&store->player[i], &top[j - 1]); j--)
+      top[j] = top[j - 1];
+    top[j] = store->player[i];
+  }
+  pthread_mutex_unlock(&store->lock);
+
+  return n;
+}
+
+/*
+ * 試合結果ストアの統計を得る
+ * 引数 :
+ *   store - 試合結果ストアへのポインタ
+ *   stats - 統計を格納する構造体(出力)
+ */
+void getMatchStoreStats(MatchStore *store, MatchStoreStats *stats)
+{
+  pthread_mutex_lock(&store->lock);
+  *stats = store->stats;
+  pthread_mutex_unlock(&store->lock);
+  stats->submitted = __atomic_load_n(&store->stats.submitted, __ATOMIC_RELAXED);
+  stats->dropped   = __atomic_load_n(&store->stats.dropped, __ATOMIC_RELAXED);
+}
+
+/*
+ * 試合結果ストアを閉じる. キューに残っている記録はすべて書いてから閉じる
+ * 引数 :
+ *   store - 試合結果ストアへのポインタ(NULL なら何もしない)
+ */
+void closeMatchStore(MatchStore *store)
+{
+  if (store == NULL)
+    return;
+
+  __atomic_store_n(&store->stop, 1, __ATOMIC_RELEASE);
+  pthread_join(store->thread, NULL);
+
+  destroySpscQueue(store->queue);
+  close(store->fd);
+  pthread_mutex_destroy(&store->lock);
+  free(store->table);
+  free(store->player);
+  free(store);
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * 書き込みスレッド
+ * キューに溜まった記録を MATCH_BATCH 個までまとめて書き, 1 回だけ fdatasync する.
+ * 止めるよう言われたら, キューを空にしてから終わる
+ * 引数 :
+ *   arg - 試合結果ストアへのポインタ
+ */
+static void* writerThread(void *arg)
+{
+  MatchStore     *store = (MatchStore *)arg;
+  MatchLogEntry   batch[MATCH_BATCH];
+  struct timespec idle = { 0, MATCH_IDLE_MSEC * 1000000L };
+  int             n, stop;
+
+  while (1) {
+    // 止めるかどうかは取り出す前に見る(見た後に入った記録も次の周で書く)
+    stop = __atomic_load_n(&store->stop, __ATOMIC_ACQUIRE);
+
+    for (n = 0; n < MATCH_BATCH && popSpscQueue(store->queue, &batch[n].record); n++) {
+      memcpy(batch[n].magic, MATCH_LOG_MAGIC, 4);
+      batch[n].crc = crc32(&batch[n].record, sizeof(MatchRecord));
+    }
+
+    if (n > 0)
+      commitBatch(store, batch, n);
+    else if (stop)
+      return NULL;
+    else
+      nanosleep(&idle, NULL);
+  }
+}
+
+/*
+ * 記録をまとめてログの末尾に書き, ディスクに届いてから成績に反映する
+ * 書けなかった場合は書きかけの分を切り捨て, 成績にも反映しない.
+ * 同じログを書く他のプロセスと入れ違わないように, ファイルをロックして書く
+ * 引数 :
+ *   store - 試合結果ストアへのポインタ
+ *   batch - 書く記録
+ *   n     - 記録の数
+ */
+static void commitBatch(MatchStore *store, MatchLogEntry *batch, int n)
+{
+  size_t len = sizeof(MatchLogEntry) * n;
+  off_t  end;
+  int    i, failed;
+
+  flock(store->fd, LOCK_EX);
+  end    = lseek(store->fd, 0, SEEK_END);
+  failed = write(store->fd, batch, len) != (ssize_t)len || fdatasync(store->fd) != 0;
+  // 後から書く記録が壊れた記録の後ろにならないようにする
+  // (ロックを持っているので, end より後ろは自分の書きかけだけ)
+  if (failed)
+    ftruncate(store->fd, end);
+  flock(store->fd, LOCK_UN);
+  if (failed)
+    return;
+
+  pthread_mutex_lock(&store->lock);
+  for (i = 0; i < n; i++)
+    applyRecord(store, &batch[i].record);
+  store->stats.committed += n;
+  store->stats.commits++;
+  pthread_mutex_unlock(&store->lock);
+}
+
+/*
+ * ログを先頭から読み直して成績を作る
+ * 途中で壊れた記録(書きかけ・チェックサムの不一致)があれば, そこから後ろを捨てる.
+ * 他のプロセスが書いている途中の記録を壊れた記録と見誤らないように, ファイルをロックして読む
+ * 引数 :
+ *   store - 試合結果ストアへのポインタ
+ */
+static void replayLog(MatchStore *store)
+{
+  MatchLogEntry batch[MATCH_BATCH];
+  long          start = nowUsec();
+  off_t         good = 0, end;
+  ssize_t       len;
+  int           i, n, broken = 0;
+
+  flock(store->fd, LOCK_EX);
+  while (!broken && (len = read(store->fd, batch, sizeof(batch))) > 0) {
+    n = len / sizeof(MatchLogEntry);
+    for (i = 0; i < n; i++) {
+      if (memcmp(batch[i].magic, MATCH_LOG_MAGIC, 4) != 0 ||
+          batch[i].crc != crc32(&batch[i].record, sizeof(MatchRecord))) {
+        broken = 1;
+        break;
+      }
+      applyRecord(store, &batch[i].record);
+      store->stats.replayed++;
+      good += sizeof(MatchLogEntry);
+    }
+    if (len % sizeof(MatchLogEntry) != 0)
+      broken = 1;
+  }
+
+  // 壊れた末尾を捨てる(書き足すときは O_APPEND で末尾に付く)
+  end = lseek(store->fd, 0, SEEK_END);
+  if (end > good && ftruncate(store->fd, good) == 0)
+    store->stats.truncated = end - good;
+  flock(store->fd, LOCK_UN);
+
+  store->stats.replayUsec = nowUsec() - start;
+}
+
+/*
+ * 試合の記録を成績に反映する(ロックを持って呼ぶ)
+ * 引数 :
+ *   store  - 試合結果ストアへのポインタ
+ *   record - 試合の記録
+ */
+static void applyRecord(MatchStore *store, MatchRecord *record)
+{
+  PlayerStats *chaser, *evader;
+
+  // 両方を作ってから指す(後から作る方で成績の配列が広がると, 先に得たポインタは古い配列を指す)
+  findPlayer(store, record->chaser, 1);
+  evader = findPlayer(store, record->evader, 1);
+  chaser = findPlayer(store, record->chaser, 0);
+
+  chaser->games++;
+  evader->games++;
+  switch (record->result) {
+  case MATCH_CHASER_WON:
+    chaser->wins++;
+    evader->losses++;
+    break;
+  case MATCH_EVADER_WON:
+    evader->wins++;
+    chaser->losses++;
+    break;
+  default:
+    chaser->quits++;
+    evader->quits++;
+    break;
+  }
+}
+
+/*
+ * 名前からプレイヤーの成績を探す(ロックを持って呼ぶ)
+ * 引数 :
+ *   store  - 試合結果ストアへのポインタ
+ *   name   - プレイヤー名
+ *   create - 見つからなければ作るなら 1
+ * 戻値 :
+ *   成績へのポインタ. 見つからず作らないなら NULL
+ */
+static PlayerStats* findPlayer(MatchStore *store, char *name, int create)
+{
+  char     key[MATCH_NAME_LEN];
+  unsigned mask = store->tableSize - 1;
+  unsigned slot;
+
+  // ログの名前は '\0' で終わっているとは限らないので切りそろえる
+  strncpy(key, name, MATCH_NAME_LEN - 1);
+  key[MATCH_NAME_LEN - 1] = '\0';
+
+  for (slot = hashName(key) & mask; store->table[slot] >= 0; slot = (slot + 1) & mask)
+    if (strcmp(store->player[store->table[slot]].name, key) == 0)
+      return &store->player[store->table[slot]];
+
+  if (!create)
+    return NULL;
+
+  // 表の半分が埋まったら広げる(開番地法は空きが多いほど速い)
+  if (store->players == store->capacity) {
+    growTable(store);
+    return findPlayer(store, key, create);
+  }
+
+  store->table[slot] = store->players;
+  bzero(&store->player[store->players], sizeof(PlayerStats));
+  strcpy(store->player[store->players].name, key);
+  store->stats.players = ++store->players;
+
+  return &store->player[store->players - 1];
+}
+
+/*
+ * ハッシュ表と成績の配列を 2 倍に広げる
+ * 引数 :
+ *   store - 試合結果ストアへのポインタ
+ */
+static void growTable(MatchStore *store)
+{
+  unsigned mask;
+  unsigned slot;
+  int      i;
+
+  store->tableSize *= 2;
+  store->capacity  *= 2;
+  mask = store->tableSize - 1;
+  store->table  = (int *)realloc(store->table, sizeof(int) * store->tableSize);
+  store->player = (PlayerStats *)realloc(store->player, sizeof(PlayerStats) * store->capacity);
+  if (store->table == NULL || store->player == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+
+  for (i = 0; i < store->tableSize; i++)
+    store->table[i] = -1;
+  for (i = 0; i < store->players; i++) {
+    for (slot = hashName(store->player[i].name) & mask; store->table[slot] >= 0; slot = (slot + 1) & mask)
+      ;
+    store->table[slot] = i;
+  }
+}
+
+/*
+ * プレイヤー名のハッシュ値(FNV-1a)
+ */
+static unsigned hashName(char *name)
+{
+  unsigned hash = 2166136261u;
+
+  while (*name != '\0')
+    hash = (hash ^ (unsigned char)*name++) * 16777619u;
+
+  return hash;
+}
+
+/*
+ * CRC32(IEEE 802.3, zlib と同じ値)
+ */
+static uint32_t crc32(const void *data, size_t len)
+{
+  static uint32_t table[256];
+  static int      ready = 0;
+  const uint8_t  *p = (const uint8_t *)data;
+  uint32_t        crc = 0xffffffffu, c;
+  int             i, j;
+
+  // 表は最初に使うとき作る(ログを読み直すのは書き込みスレッドを動かす前)
+  if (!ready) {
+    for (i = 0; i < 256; i++) {
+      for (c = i, j = 0; j < 8; j++)
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+    ready = 1;
+  }
+
+  while (len-- > 0)
+    crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  return crc ^ 0xffffffffu;
+}
+
+/*
+ * a の方が順位が上か(勝った数が多い. 同じなら試合数が少ない)
+ */
+static int isHigher(PlayerStats *a, PlayerStats *b)
+{
+  if (a->wins != b->wins)
+    return a->wins > b->wins;
+  return a->games < b->games;
+}
+
+/*
+ * 現在時刻(us)
+ */
+static long nowUsec()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,149 @@
+/********************************************************************
+                       試合結果ストアモジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef MATCH_STORE_H
+#define MATCH_STORE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "spscQueue.h"         // SPSC キューモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//   試合結果ストアモジュールにおける定数・型の定義
+//--------------------------------------------------------------------
+#define MATCH_NAME_LEN     16     // プレイヤー名の最大長('\0' を含む)
+#define MATCH_LOG_MAGIC    "TGM1" // ログの各記録の先頭 4 バイト
+#define MATCH_QUEUE_LEN    256    // 書き込みスレッドへ渡すキューの長さ
+#define MATCH_BATCH        64     // 1 回の書き込み(fdatasync)にまとめる最大の記録数
+#define MATCH_IDLE_MSEC    20     // 記録が無いとき書き込みスレッドが休む時間(ms)
+#define MATCH_TOP_K        10     // 順位表に出す既定の人数
+
+// 試合の結果
+#define MATCH_CHASER_WON   0      // 鬼が捕まえた
+#define MATCH_EVADER_WON   1      // 逃げる役が逃げ切った(もう追いつけない)
+#define MATCH_QUIT         2      // どちらかが途中でやめた
+
+/*
+ * 試合 1 つの記録(ログにはこのまま書く)
+ */
+typedef struct {
+  int64_t time;                  // 終わった時刻(UNIX 時間)
+  int32_t ticks;                 // 試合の長さ(ティック)
+  int32_t result;                // 結果(MATCH_*)
+  char    chaser[MATCH_NAME_LEN];  // 鬼のプレイヤー名
+  char    evader[MATCH_NAME_LEN];  // 逃げる役のプレイヤー名
+} MatchRecord;
+
+/*
+ * プレイヤーごとの成績
+ */
+typedef struct {
+  char    name[MATCH_NAME_LEN];  // プレイヤー名
+  int     games;                 // 試合数
+  int     wins;                  // 勝った数
+  int     losses;                // 負けた数
+  int     quits;                 // 途中でやめた試合の数
+} PlayerStats;
+
+/*
+ * 試合結果ストアの統計
+ */
+typedef struct {
+  unsigned long submitted;       // 受け付けた記録の数
+  unsigned long dropped;         // キューが満杯で捨てた記録の数
+  unsigned long committed;       // ログに書いた記録の数
+  unsigned long commits;         // まとめて書いた(fdatasync した)回数
+  unsigned long replayed;        // 開くときにログから読み直した記録の数
+  long          truncated;       // 壊れていたので切り捨てたログの末尾のバイト数
+  long          replayUsec;      // 読み直しにかかった時間(us)
+  int           players;         // 成績のあるプレイヤーの数
+} MatchStoreStats;
+
+/*
+ * 試合結果ストア構造体の定義
+ * ゲームのスレッドは記録を SPSC キューに入れるだけで, ディスクは待たない.
+ * 書き込みスレッドがキューから取り出した記録をまとめてログの末尾に書き,
+ * fdatasync してから成績のインデックスに反映する.
+ * ログの記録にはそれぞれチェックサム(CRC32)を付け, 開くときに先頭から
+ * 読み直してインデックスを作る(途中で壊れていればそこから後ろは捨てる)
+ */
+typedef struct {
+  int             fd;            // ログファイル
+  SpscQueue      *queue;         // ゲーム → 書き込みスレッド: 記録
+  pthread_t       thread;        // 書き込みスレッド
+  int             stop;          // 書き込みスレッドを止めるなら 1
+
+  pthread_mutex_t lock;          // 以下を守るロック
+  PlayerStats    *player;        // プレイヤーごとの成績
+  int             players;       // 成績のあるプレイヤーの数
+  int             capacity;      // player の大きさ
+  int            *table;         // 名前 → player の番号のハッシュ表(-1 なら空き)
+  int             tableSize;     // ハッシュ表の大きさ(2 のべき乗)
+  MatchStoreStats stats;         // 統計
+} MatchStore;
+
+
+//--------------------------------------------------------------------
+//   試合結果ストアモジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * 試合結果ストアを開く. ログを読み直して成績を作り, 書き込みスレッドを動かす
+ * ログが開けなければ終了する
+ * 引数 :
+ *   fileName - ログファイル名(無ければ作る)
+ * 戻値 :
+ *   試合結果ストアへのポインタ
+ */
+MatchStore* openMatchStore(char *fileName);
+
+/*
+ * 試合の記録を書き込みスレッドへ渡す(待たない. 呼ぶのは 1 つのスレッドだけ)
+ * 引数 :
+ *   store  - 試合結果ストアへのポインタ
+ *   record - 試合の記録
+ * 戻値 :
+ *   渡せれば 1, キューが満杯で捨てたら 0
+ */
+int submitMatch(MatchStore *store, MatchRecord *record);
+
+/*
+ * プレイヤーの成績を調べる
+ * 引数 :
+ *   store - 試合結果ストアへのポインタ
+ *   name  - プレイヤー名
+ *   stats - 成績を格納する構造体(出力)
+ * 戻値 :
+ *   成績があれば 1, 無ければ 0
+ */
+int lookupPlayer(MatchStore *store, char *name, PlayerStats *stats);
+
+/*
+ * 勝った数の多い順にプレイヤーの成績を得る(同じなら試合数の少ない方が上)
+ * 引数 :
+ *   store - 試合結果ストアへのポインタ
+ *   top   - 成績を格納する配列(出力. k 個以上)
+ *   k     - 得る人数
+ * 戻値 :
+ *   得た人数
+ */
+int topPlayers(MatchStore *store, PlayerStats *top, int k);
+
+/*
+ * 試合結果ストアの統計を得る
+ * 引数 :
+ *   store - 試合結果ストアへのポインタ
+ *   stats - 統計を格納する構造体(出力)
+ */
+void getMatchStoreStats(MatchStore *store, MatchStoreStats *stats);
+
+/*
+ * 試合結果ストアを閉じる. キューに残っている記録はすべて書いてから閉じる
+ * 引数 :
+ *   store - 試合結果ストアへのポインタ(NULL なら何もしない)
+ */
+void closeMatchStore(MatchStore *store);
+
+#endif
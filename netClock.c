@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "netClock.h"          // 通信遅延・時刻同期モジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  通信遅延・時刻同期モジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static void addSample(NetClock *clock, long rtt, long offset);
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * 単調増加する時計の現在時刻
+ * 戻値 :
+ *   時刻(us)
+ */
+long monotonicUsec()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/*
+ * 通信遅延・時刻同期の状態を初期化する
+ * 引数 :
+ *   clock - 状態へのポインタ
+ */
+void initNetClock(NetClock *clock)
+{
+  int i;
+
+  pthread_mutex_init(&clock->lock, NULL);
+  memset(&clock->stats, 0, sizeof(NetClockStats));
+  clock->stats.minRtt = -1;
+  clock->lastPing     = 0;
+  for (i = 0; i < SYNC_FILTER; i++)
+    clock->filterRtt[i] = -1;
+}
+
+/*
+ * ping を送る時期なら ping のメッセージを作る
+ * 引数 :
+ *   clock - 状態へのポインタ
+ *   msg   - メッセージを格納する領域(SYNC_MSG_LEN バイト以上, 出力)
+ * 戻値 :
+ *   ping を送るなら 1
+ */
+int makePing(NetClock *clock, char *msg)
+{
+  long now = monotonicUsec();
+
+  if (clock->lastPing != 0 && now - clock->lastPing < SYNC_INTERVAL_MSEC * 1000L)
+    return 0;
+
+  clock->lastPing = now;
+  snprintf(msg, SYNC_MSG_LEN, "ping %ld", now);
+
+  return 1;
+}
+
+/*
+ * 届いたメッセージが ping/pong なら処理する
+ * ping には pong の返事を作り, pong からは往復時間・時計のずれ・揺らぎを求める
+ * 引数 :
+ *   clock   - 状態へのポインタ
+ *   msg     - 届いたメッセージ
+ *   arrived - メッセージを読んだ時刻(us)
+ *   reply   - 返事を格納する領域(SYNC_MSG_LEN バイト以上, 出力. 返事が無ければ空文字列)
+ * 戻値 :
+ *   ping/pong なら 1, それ以外のメッセージなら 0
+ */
+int handleSyncMessage(NetClock *clock, char *msg, long arrived, char *reply)
+{
+  long t1, t2, t3;
+
+  reply[0] = '\0';
+
+  // ping: 送った時刻に, 受け取った時刻と送り返す時刻を添えて返す
+  if (strncmp(msg, "ping ", 5) == 0) {
+    if (sscanf(msg + 5, "%ld", &t1) == 1)
+      snprintf(reply, SYNC_MSG_LEN, "pong %ld %ld %ld", t1, arrived, monotonicUsec());
+    return 1;
+  }
+
+  // pong: 自分が送った ping への返事
+  if (strncmp(msg, "pong ", 5) == 0) {
+    if (sscanf(msg + 5, "%ld %ld %ld", &t1, &t2, &t3) == 3 && arrived >= t1)
+      addSample(clock, (arrived - t1) - (t3 - t2), ((t2 - t1) + (t3 - arrived)) / 2);
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * 通信遅延の統計を得る(どのスレッドから呼んでもよい)
+ * 引数 :
+ *   clock - 状態へのポインタ
+ *   stats - 統計を格納する構造体(出力)
+ */
+void getNetClockStats(NetClock *clock, NetClockStats *stats)
+{
+  pthread_mutex_lock(&clock->lock);
+  *stats = clock->stats;
+  pthread_mutex_unlock(&clock->lock);
+}
+
+/*
+ * 通信遅延・時刻同期の状態の後始末
+ * 引数 :
+ *   clock - 状態へのポインタ
+ */
+void destroyNetClock(NetClock *clock)
+{
+  pthread_mutex_destroy(&clock->lock);
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * 1 回分の測定を統計に加える
+ */
+static void addSample(NetClock *clock, long rtt, long offset)
+{
+  NetClockStats *stats = &clock->stats;    // ショートカット
+  long           diff;
+  int            slot, best, i;
+
+  if (rtt < 0)
+    rtt = 0;
+
+  pthread_mutex_lock(&clock->lock);
+
+  // 揺らぎは前回との往復時間の差を 1/SYNC_JITTER_GAIN ずつ平滑化する
+  if (stats->samples > 0) {
+    diff = rtt > stats->rtt ? rtt - stats->rtt : stats->rtt - rtt;
+    stats->jitter += (diff - stats->jitter) / SYNC_JITTER_GAIN;
+  }
+  stats->rtt = rtt;
+  if (stats->minRtt < 0 || rtt < stats->minRtt)
+    stats->minRtt = rtt;
+
+  // 時計のずれは, 往復時間が短い(行きと帰りの差が小さい)測定ほど正確
+  slot = stats->samples % SYNC_FILTER;
+  clock->filterRtt[slot]    = rtt;
+  clock->filterOffset[slot] = offset;
+  best = slot;
+  for (i = 0; i < SYNC_FILTER; i++)
+    if (clock->filterRtt[i] >= 0 && clock->filterRtt[i] < clock->filterRtt[best])
+      best = i;
+  stats->offset = clock->filterOffset[best];
+  stats->samples++;
+
+  pthread_mutex_unlock(&clock->lock);
+}
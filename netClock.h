@@ -0,0 +1,101 @@
+/********************************************************************
+                       通信遅延・時刻同期モジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef NET_CLOCK_H
+#define NET_CLOCK_H
+
+#include <pthread.h>
+
+//--------------------------------------------------------------------
+//   通信遅延・時刻同期モジュールにおける定数・型の定義
+//--------------------------------------------------------------------
+#define SYNC_MSG_LEN        (4 + 3 * 21 + 1)  // "pong" + 時刻 3 つ + '\0'
+#define SYNC_INTERVAL_MSEC  1000   // ping を送る間隔(ms)
+#define SYNC_FILTER         8      // 時計のずれを選ぶときに見る直近の測定の数
+#define SYNC_JITTER_GAIN    16     // 揺らぎを平滑化する重みの逆数(RFC 3550 と同じ)
+
+/*
+ * 通信遅延の統計(時間の単位はすべて us)
+ */
+typedef struct {
+  long    rtt;                   // 最新の往復時間
+  long    minRtt;                // これまでの最小の往復時間
+  long    offset;                // 相手の時計 - 自分の時計
+  double  jitter;                // 往復時間の揺らぎ(平滑化した値)
+  long    samples;               // 測定の回数
+} NetClockStats;
+
+/*
+ * 接続ごとの通信遅延・時刻同期の状態
+ * ping に送った時刻 t1 を入れ, 相手は受け取った時刻 t2 と送り返す時刻 t3 を
+ * 添えて pong で返す. pong を受け取った時刻 t4 から NTP と同じ式で
+ *   往復時間 = (t4 - t1) - (t3 - t2),  時計のずれ = ((t2 - t1) + (t3 - t4)) / 2
+ * を求める. 時計のずれは直近 SYNC_FILTER 回のうち往復時間が最小の測定を使う
+ */
+typedef struct {
+  pthread_mutex_t lock;          // stats を守るロック(表示は別スレッドから読む)
+  NetClockStats   stats;         // 統計
+  long            lastPing;      // 最後に ping を送った時刻
+  long            filterRtt[SYNC_FILTER];     // 直近の往復時間
+  long            filterOffset[SYNC_FILTER];  // 直近の時計のずれ
+} NetClock;
+
+
+//--------------------------------------------------------------------
+//   通信遅延・時刻同期モジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * 単調増加する時計の現在時刻
+ * 戻値 :
+ *   時刻(us)
+ */
+long monotonicUsec();
+
+/*
+ * 通信遅延・時刻同期の状態を初期化する
+ * 引数 :
+ *   clock - 状態へのポインタ
+ */
+void initNetClock(NetClock *clock);
+
+/*
+ * ping を送る時期なら ping のメッセージを作る
+ * 引数 :
+ *   clock - 状態へのポインタ
+ *   msg   - メッセージを格納する領域(SYNC_MSG_LEN バイト以上, 出力)
+ * 戻値 :
+ *   ping を送るなら 1
+ */
+int makePing(NetClock *clock, char *msg);
+
+/*
+ * 届いたメッセージが ping/pong なら処理する
+ * ping には pong の返事を作り, pong からは往復時間・時計のずれ・揺らぎを求める
+ * 引数 :
+ *   clock   - 状態へのポインタ
+ *   msg     - 届いたメッセージ
+ *   arrived - メッセージを読んだ時刻(us)
+ *   reply   - 返事を格納する領域(SYNC_MSG_LEN バイト以上, 出力. 返事が無ければ空文字列)
+ * 戻値 :
+ *   ping/pong なら 1, それ以外のメッセージなら 0
+ */
+int handleSyncMessage(NetClock *clock, char *msg, long arrived, char *reply);
+
+/*
+ * 通信遅延の統計を得る(どのスレッドから呼んでもよい)
+ * 引数 :
+ *   clock - 状態へのポインタ
+ *   stats - 統計を格納する構造体(出力)
+ */
+void getNetClockStats(NetClock *clock, NetClockStats *stats);
+
+/*
+ * 通信遅延・時刻同期の状態の後始末
+ * 引数 :
+ *   clock - 状態へのポインタ
+ */
+void destroyNetClock(NetClock *clock);
+
+#endif
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "roomCheckpoint.h"    // 部屋チェックポイントモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  部屋チェックポイントモジュール内部で使用する定数の定義
+//--------------------------------------------------------------------
+#define CHECKPOINT_STALE_MSEC (10 * 60 * 1000)  // これより古いスナップショットは引き取らない(ms)
+
+//--------------------------------------------------------------------
+//  部屋チェックポイントモジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static int       isValidHeader(CheckpointHeader *header, size_t size);
+static int       isOwnerAlive(Checkpoint *ckpt, int owner);
+static int       newestCopy(CheckpointSlot *slot);
+static int       isStale(RoomSnapshot *snapshot, long long nowMsec);
+static unsigned  snapshotSum(RoomSnapshot *snapshot);
+static long long realtimeMsec();
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * チェックポイントファイルを開く(無いか形式が違えば作り直す)
+ * 引数 :
+ *   fileName - ファイル名
+ *   slots    - 作り直すときのスロット数(すでにあるファイルはその数のまま使う)
+ * 戻値 :
+ *   チェックポイントへのポインタ. 開けなければ NULL
+ */
+Checkpoint* openCheckpoint(char *fileName, int slots)
+{
+  Checkpoint      *ckpt;
+  CheckpointHeader header;
+  struct stat      st;
+  int              fd;
+
+  if ((fd = open(fileName, O_RDWR | O_CREAT, 0644)) < 0)
+    return NULL;
+
+  // 同時に開いた他のプロセスと作り直しが入れ違わないように, ファイルをロックして調べる
+  flock(fd, LOCK_EX);
+  if (fstat(fd, &st) < 0 ||
+      pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      !isValidHeader(&header, st.st_size)) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+    header.slots    = slots;
+    header.slotSize = sizeof(CheckpointSlot);
+    st.st_size = sizeof(CheckpointHeader) + (off_t)slots * sizeof(CheckpointSlot);
+    if (ftruncate(fd, 0) < 0 || ftruncate(fd, st.st_size) < 0 ||
+        pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+      close(fd);
+      return NULL;
+    }
+  }
+  flock(fd, LOCK_UN);
+
+  if ((ckpt = (Checkpoint *)calloc(1, sizeof(Checkpoint))) == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  ckpt->fd     = fd;
+  ckpt->size   = st.st_size;
+  ckpt->header = (CheckpointHeader *)mmap(NULL, ckpt->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ckpt->header == MAP_FAILED) {
+    close(fd);
+    free(ckpt);
+    return NULL;
+  }
+  ckpt->slot  = (CheckpointSlot *)(ckpt->header + 1);
+  ckpt->slots = ckpt->header->slots;
+  ckpt->pid   = getpid();
+
+  return ckpt;
+}
+
+/*
+ * 書き込むスロットを得る. 持ち主のいない, 引き取られるのを待っていないスロットを選ぶ
+ * 引数 :
+ *   ckpt - チェックポイントへのポインタ
+ * 戻値 :
+ *   スロット番号. 空きが無ければ -1
+ */
+int acquireCheckpointSlot(Checkpoint *ckpt)
+{
+  CheckpointSlot *slot;
+  RoomSnapshot    snapshot;
+  long long       now = realtimeMsec();
+  int             n, i, owner;
+
+  for (n = 0; n < ckpt->slots; n++) {
+    i    = (ckpt->next + n) % ckpt->slots;
+    slot = &ckpt->slot[i];
+    owner = __atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE);
+    if (isOwnerAlive(ckpt, owner))
+      continue;
+    // 落ちたプロセスの部屋は, 古くなるまで引き取られるのを待つ
+    if (loadRoomSnapshot(ckpt, i, &snapshot) && !isStale(&snapshot, now))
+      continue;
+    if (!__atomic_compare_exchange_n(&slot->owner, &owner, ckpt->pid, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      continue;
+    memset(slot->copy, 0, sizeof(slot->copy));
+    ckpt->next = (i + 1) % ckpt->slots;
+    return i;
+  }
+
+  return -1;
+}
+
+/*
+ * 落ちたプロセスが残したスナップショットを引き取る(以後は自分がそのスロットに書く)
+ * 引数 :
+ *   ckpt     - チェックポイントへのポインタ
+ *   from     - 探し始めるスロット番号
+ *   snapshot - 引き取ったスナップショットを格納する構造体(出力)
+ * 戻値 :
+ *   スロット番号. 引き取るものが無ければ -1
+ */
+int claimOrphanSnapshot(Checkpoint *ckpt, int from, RoomSnapshot *snapshot)
+{
+  CheckpointSlot *slot;
+  long long       now = realtimeMsec();
+  int             i, owner, newest;
+
+  for (i = from < 0 ? 0 : from; i < ckpt->slots; i++) {
+    slot  = &ckpt->slot[i];
+    owner = __atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE);
+    if (isOwnerAlive(ckpt, owner) || !loadRoomSnapshot(ckpt, i, snapshot) || isStale(snapshot, now))
+      continue;
+    if (!__atomic_compare_exchange_n(&slot->owner, &owner, ckpt->pid, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      continue;
+
+    // 新しい方の版が書きかけで壊れていれば空にしておく(次に書くときに, 読めた版を残す)
+    newest = newestCopy(slot);
+    if (snapshotSum(&slot->copy[newest]) != slot->copy[newest].sum)
+      slot->copy[newest].seq = 0;
+    return i;
+  }
+
+  return -1;
+}
+
+/*
+ * スナップショットを書く(古い方の版に書く. seq, sum, pid, savedMsec はここで埋める)
+ * 引数 :
+ *   ckpt     - チェックポイントへのポインタ
+ *   slot     - スロット番号
+ *   snapshot - 書くスナップショット
+ */
+void saveRoomSnapshot(Checkpoint *ckpt, int slot, RoomSnapshot *snapshot)
+{
+  CheckpointSlot *s = &ckpt->slot[slot];
+  int             newest = newestCopy(s);
+
+  snapshot->seq       = s->copy[newest].seq + 1;
+  snapshot->pid       = ckpt->pid;
+  snapshot->savedMsec = realtimeMsec();
+  snapshot->reserved  = 0;
+  snapshot->sum       = snapshotSum(snapshot);
+
+  // 新しい方は残したまま, 古い方に上書きする(書いている途中で落ちても新しい方が読める)
+  memcpy(&s->copy[1 - newest], snapshot, sizeof(RoomSnapshot));
+}
+
+/*
+ * スナップショットを読む(壊れていない版のうち新しい方)
+ * 引数 :
+ *   ckpt     - チェックポイントへのポインタ
+ *   slot     - スロット番号
+ *   snapshot - スナップショットを格納する構造体(出力)
+ * 戻値 :
+ *   読めれば 1, 空か 2 つとも壊れていれば 0
+ */
+int loadRoomSnapshot(Checkpoint *ckpt, int slot, RoomSnapshot *snapshot)
+{
+  CheckpointSlot *s = &ckpt->slot[slot];
+  int             newest = newestCopy(s);
+  int             i, copy;
+
+  for (i = 0; i < 2; i++) {
+    copy = i == 0 ? newest : 1 - newest;
+    memcpy(snapshot, &s->copy[copy], sizeof(RoomSnapshot));
+    if (snapshot->seq != 0 && snapshotSum(snapshot) == snapshot->sum)
+      return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * スロットを空にして手放す(試合が終わり, もう開き直さない部屋)
+ * 引数 :
+ *   ckpt - チェックポイントへのポインタ
+ *   slot - スロット番号
+ */
+void releaseCheckpointSlot(Checkpoint *ckpt, int slot)
+{
+  CheckpointSlot *s = &ckpt->slot[slot];
+
+  memset(s->copy, 0, sizeof(s->copy));
+  __atomic_store_n(&s->owner, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * チェックポイントファイルを閉じる(スロットは手放さない)
+ * 引数 :
+ *   ckpt - チェックポイントへのポインタ(NULL なら何もしない)
+ */
+void closeCheckpoint(Checkpoint *ckpt)
+{
+  if (ckpt == NULL)
+    return;
+
+  // 書き出しはカーネルに任せる(待たない)
+  msync(ckpt->header, ckpt->size, MS_ASYNC);
+  munmap(ckpt->header, ckpt->size);
+  close(ckpt->fd);
+  free(ckpt);
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * ファイルの先頭が正しく, スロットの形式と数がファイルの大きさと合っているか
+ */
+static int isValidHeader(CheckpointHeader *header, size_t size)
+{
+  return memcmp(header->magic, CHECKPOINT_MAGIC, 8) == 0 &&
+         header->slotSize == sizeof(CheckpointSlot) && header->slots > 0 &&
+         size == sizeof(CheckpointHeader) + (size_t)header->slots * sizeof(CheckpointSlot);
+}
+
+/*
+ * スロットの持ち主のプロセスが生きているか(自分なら調べない)
+ */
+static int isOwnerAlive(Checkpoint *ckpt, int owner)
+{
+  if (owner == 0)
+    return 0;
+  if (owner == ckpt->pid)
+    return 1;
+  return kill(owner, 0) == 0 || errno != ESRCH;
+}
+
+/*
+ * 2 つの版のうち seq が大きい方(壊れているかは調べない)
+ */
+static int newestCopy(CheckpointSlot *slot)
+{
+  return slot->copy[1].seq > slot->copy[0].seq;
+}
+
+/*
+ * 引き取っても仕方がないほど古いスナップショットか
+ */
+static int isStale(RoomSnapshot *snapshot, long long nowMsec)
+{
+  return nowMsec - snapshot->savedMsec > CHECKPOINT_STALE_MSEC;
+}
+
+/*
+ * スナップショットのチェックサム(FNV-1a. sum 自身は含めない)
+ */
+static unsigned snapshotSum(RoomSnapshot *snapshot)
+{
+  unsigned char *p   = (unsigned char *)snapshot;
+  unsigned char *end = p + sizeof(RoomSnapshot);
+  unsigned       hash = 2166136261u;
+
+  for (; p < end; p++) {
+    if (p == (unsigned char *)&snapshot->sum) {
+      p += sizeof(snapshot->sum) - 1;
+      continue;
+    }
+    hash = (hash ^ *p) * 16777619u;
+  }
+
+  return hash;
+}
+
+/*
+ * 現在時刻(UNIX 時間 ms. 立ち上げ直した後のプロセスとも比べられるように)
+ */
+static long long realtimeMsec()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,163 @@
+/********************************************************************
+                       部屋チェックポイントモジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef ROOM_CHECKPOINT_H
+#define ROOM_CHECKPOINT_H
+
+#include <stddef.h>
+
+#include "roomDirectory.h"     // 部屋ディレクトリモジュールヘッダファイル
+#include "matchStore.h"        // 試合結果ストアモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//   部屋チェックポイントモジュールにおける定数・型の定義
+//--------------------------------------------------------------------
+#define CHECKPOINT_MAGIC   "TAGCKPT1"         // ファイルの先頭の印
+#define CHECKPOINT_FILE    "tagRooms.%d.ckpt" // 既定のファイル名(%d はポート番号)
+#define CHECKPOINT_SLOTS   ROOM_DIR_SLOTS     // 既定のスロット数(同じポートのサーバーの数だけ)
+
+/*
+ * スナップショットに書くプレイヤー
+ */
+typedef struct {
+  int     chara;                 // プレイヤーを表すキャラクタ
+  int     x;                     // X 座標
+  int     y;                     // Y 座標
+  int     inMainMap;             // メインマップにいるか
+} SnapshotPlayer;
+
+/*
+ * 部屋 1 つのスナップショット(固定長. ポインタは持たず, 詰め物も無い)
+ */
+typedef struct {
+  unsigned  seq;                 // 書いた順番(大きい方が新しい. 0 なら空)
+  unsigned  sum;                 // seq を含む, この後ろすべてのチェックサム
+  unsigned long long token;      // 入り直すクライアントが示す合言葉
+  long long savedMsec;           // 書いた時刻(UNIX 時間 ms)
+  int       pid;                 // 書いたプロセス
+  char      name[ROOM_NAME_LEN]; // 入り直すクライアントが名指しする部屋名
+  int       roundState;          // ラウンドの状態(ROUND_*)
+  int       round;               // 何ラウンド目か
+  int       result;              // 最後のラウンドの結果
+  int       tick;                // ラウンド中のティック
+  int       fogOfWar;            // 霧を有効にしているか
+  int       maxRewind;           // 捕獲判定で巻き戻す最大ティック数
+  int       mapVersion;          // マップの版の番号(書いたプロセスの中での番号)
+  unsigned  mapHash;             // マップの中身のハッシュ(読み直したマップが同じかを確かめる)
+  SnapshotPlayer my;             // サーバー側のプレイヤー
+  SnapshotPlayer it;             // クライアント側のプレイヤー
+  char      myName[MATCH_NAME_LEN];  // サーバー側のプレイヤー名
+  char      itName[MATCH_NAME_LEN];  // クライアント側のプレイヤー名
+  int       reserved;            // 8 バイト境界までの詰め物(チェックサムに含めるので 0 にする)
+} RoomSnapshot;
+
+/*
+ * スロット(部屋 1 つ分). スナップショットを 2 つ持ち, 古い方に交互に書く
+ * 書いている途中で落ちても, もう 1 つは前に書いたまま残る
+ */
+typedef struct {
+  int          owner;            // 書いているプロセス(0 なら持ち主なし)
+  int          reserved;
+  RoomSnapshot copy[2];          // 交互に書くスナップショット
+} CheckpointSlot;
+
+/*
+ * ファイルの先頭
+ */
+typedef struct {
+  char    magic[8];              // CHECKPOINT_MAGIC
+  int     slots;                 // スロットの数
+  int     slotSize;              // スロット 1 つのバイト数(形式が変わっていないかを確かめる)
+  char    reserved[48];
+} CheckpointHeader;
+
+/*
+ * チェックポイント構造体の定義
+ * 部屋の状態(プレイヤー, ティック, ラウンドの状態, マップの版)を mmap した
+ * ファイルのスロットに書く. 書くのはメモリへのコピーだけで, ファイルへは
+ * カーネルが後で書き出すので, ティックのループは止まらない
+ * (プロセスが落ちても書いた内容は残る). 落ちたプロセスのスロットは,
+ * 立ち上げ直したサーバーが引き取って部屋を開き直す
+ */
+typedef struct {
+  int               fd;          // ファイルデスクリプタ
+  size_t            size;        // ファイルの大きさ
+  CheckpointHeader *header;      // ファイルの先頭(mmap した領域)
+  CheckpointSlot   *slot;        // スロットの配列
+  int               slots;       // スロットの数
+  int               next;        // 空きスロットを探し始める位置
+  int               pid;         // 自分のプロセス番号
+} Checkpoint;
+
+
+//--------------------------------------------------------------------
+//   部屋チェックポイントモジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * チェックポイントファイルを開く(無いか形式が違えば作り直す)
+ * 引数 :
+ *   fileName - ファイル名
+ *   slots    - 作り直すときのスロット数(すでにあるファイルはその数のまま使う)
+ * 戻値 :
+ *   チェックポイントへのポインタ. 開けなければ NULL
+ */
+Checkpoint* openCheckpoint(char *fileName, int slots);
+
+/*
+ * 書き込むスロットを得る. 持ち主のいない, 引き取られるのを待っていないスロットを選ぶ
+ * 引数 :
+ *   ckpt - チェックポイントへのポインタ
+ * 戻値 :
+ *   スロット番号. 空きが無ければ -1
+ */
+int acquireCheckpointSlot(Checkpoint *ckpt);
+
+/*
+ * 落ちたプロセスが残したスナップショットを引き取る(以後は自分がそのスロットに書く)
+ * 引数 :
+ *   ckpt     - チェックポイントへのポインタ
+ *   from     - 探し始めるスロット番号
+ *   snapshot - 引き取ったスナップショットを格納する構造体(出力)
+ * 戻値 :
+ *   スロット番号. 引き取るものが無ければ -1
+ */
+int claimOrphanSnapshot(Checkpoint *ckpt, int from, RoomSnapshot *snapshot);
+
+/*
+ * スナップショットを書く(古い方の版に書く. seq, sum, pid, savedMsec はここで埋める)
+ * 引数 :
+ *   ckpt     - チェックポイントへのポインタ
+ *   slot     - スロット番号
+ *   snapshot - 書くスナップショット
+ */
+void saveRoomSnapshot(Checkpoint *ckpt, int slot, RoomSnapshot *snapshot);
+
+/*
+ * スナップショットを読む(壊れていない版のうち新しい方)
+ * 引数 :
+ *   ckpt     - チェックポイントへのポインタ
+ *   slot     - スロット番号
+ *   snapshot - スナップショットを格納する構造体(出力)
+ * 戻値 :
+ *   読めれば 1, 空か 2 つとも壊れていれば 0
+ */
+int loadRoomSnapshot(Checkpoint *ckpt, int slot, RoomSnapshot *snapshot);
+
+/*
+ * スロットを空にして手放す(試合が終わり, もう開き直さない部屋)
+ * 引数 :
+ *   ckpt - チェックポイントへのポインタ
+ *   slot - スロット番号
+ */
+void releaseCheckpointSlot(Checkpoint *ckpt, int slot);
+
+/*
+ * チェックポイントファイルを閉じる(スロットは手放さない)
+ * 引数 :
+ *   ckpt - チェックポイントへのポインタ(NULL なら何もしない)
+ */
+void closeCheckpoint(Checkpoint *ckpt);
+
+#endif
@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "roomDirectory.h"     // 部屋ディレクトリモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  部屋ディレクトリモジュール内部で使用する定数の定義
+//--------------------------------------------------------------------
+#define ROOM_DIR_WAIT_MSEC 1000   // 他のプロセスが表を初期化し終えるのを待つ時間(ms)
+
+//--------------------------------------------------------------------
+//  部屋ディレクトリモジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static RoomDirectory* mapDirectory(int port, int create);
+static void initTable(RoomTable *table, int port);
+static void lockTable(RoomTable *table);
+static int  isAlive(RoomEntry *entry);
+static int  sameName(RoomEntry *entry, char *name);
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * 部屋ディレクトリを開く(共有メモリが無ければ作る). 開けなければ終了する
+ * 引数 :
+ *   port - ポート番号
+ * 戻値 :
+ *   部屋ディレクトリへのポインタ
+ */
+RoomDirectory* openRoomDirectory(int port)
+{
+  return mapDirectory(port, 1);
+}
+
+/*
+ * すでにある部屋ディレクトリを開く(作らない. 同じホストでサーバーが動いたことが無ければ NULL)
+ * 引数 :
+ *   port - ポート番号
+ * 戻値 :
+ *   部屋ディレクトリへのポインタ. 無ければ NULL
+ */
+RoomDirectory* attachRoomDirectory(int port)
+{
+  return mapDirectory(port, 0);
+}
+
+/*
+ * 自分のプロセスを, 相手を待っている部屋として登録する
+ * 引数 :
+ *   dir  - 部屋ディレクトリへのポインタ
+ *   name - 部屋名(NULL か空なら名前の無い部屋)
+ * 戻値 :
+ *   登録できれば 0, 同じ名前の部屋があるか表が満杯なら -1
+ */
+int registerRoom(RoomDirectory *dir, char *name)
+{
+  RoomTable *table = dir->table;
+  RoomEntry *entry;
+  int        i, slot = -1;
+
+  lockTable(table);
+  for (i = 0; i < ROOM_DIR_SLOTS; i++) {
+    entry = &table->entry[i];
+    if (entry->pid != 0 && !isAlive(entry))
+      entry->pid = 0;                 // 落ちたプロセスの登録を消す
+    if (entry->pid == 0) {
+      if (slot < 0)
+        slot = i;
+    }
+    else if (name != NULL && name[0] != '\0' && sameName(entry, name)) {
+      pthread_mutex_unlock(&table->lock);
+      return -1;
+    }
+  }
+  if (slot >= 0) {
+    entry = &table->entry[slot];
+    entry->pid   = getpid();
+    entry->state = ROOM_WAITING;
+    entry->since = time(NULL);
+    memset(entry->name, 0, ROOM_NAME_LEN);
+    if (name != NULL)
+      strncpy(entry->name, name, ROOM_NAME_LEN - 1);
+    dir->slot = slot;
+  }
+  pthread_mutex_unlock(&table->lock);
+
+  return slot >= 0 ? 0 : -1;
+}
+
+/*
+ * 自分の部屋の状態を変える(ロックを取るので, deliverToRoom() とは入れ違わない)
+ * 引数 :
+ *   dir   - 部屋ディレクトリへのポインタ
+ *   state - 新しい状態(ROOM_*)
+ */
+void setRoomState(RoomDirectory *dir, int state)
+{
+  RoomEntry *entry;
+
+  if (dir->slot < 0)
+    return;
+
+  lockTable(dir->table);
+  entry = &dir->table->entry[dir->slot];
+  entry->state = state;
+  entry->since = time(NULL);
+  pthread_mutex_unlock(&dir->table->lock);
+}
+
+/*
+ * 部屋を持つプロセスへ接続を渡す. 名前が無ければ, 相手を待っている
+ * 自分以外のプロセスへ順番に振り分ける. 渡す間はロックを持っているので,
+ * 渡した先のプロセスは必ずまだ相手を待っている
+ * 引数 :
+ *   dir     - 部屋ディレクトリへのポインタ
+ *   name    - 部屋名(NULL か空なら名前の無い部屋)
+ *   deliver - 接続を渡す関数
+ *   arg     - deliver に渡す引数
+ * 戻値 :
+ *   ROOM_DELIVERED, ROOM_BUSY, ROOM_UNKNOWN のいずれか
+ */
+int deliverToRoom(RoomDirectory *dir, char *name, RoomDeliver deliver, void *arg)
+{
+  RoomTable *table = dir->table;
+  RoomEntry *entry;
+  int        anyRoom = name == NULL || name[0] == '\0';
+  int        result = ROOM_UNKNOWN;
+  int        i, slot;
+
+  lockTable(table);
+  for (i = 0; i < ROOM_DIR_SLOTS; i++) {
+    // 名前の無い部屋は, 前回渡したスロットの次から探す
+    slot  = anyRoom ? (table->next + i) % ROOM_DIR_SLOTS : i;
+    entry = &table->entry[slot];
+    if (entry->pid == 0 || slot == dir->slot)
+      continue;
+    if (!anyRoom && !sameName(entry, name))
+      continue;
+    if (!isAlive(entry)) {
+      entry->pid = 0;
+      continue;
+    }
+    if (entry->state != ROOM_WAITING) {
+      result = ROOM_BUSY;
+      if (anyRoom)
+        continue;
+      break;
+    }
+    if (deliver(entry, arg) == 0) {
+      result = ROOM_DELIVERED;
+      table->next = (slot + 1) % ROOM_DIR_SLOTS;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&table->lock);
+
+  // 名前の無い部屋は, どこも空いていなければ「部屋が無い」ではなく「混んでいる」
+  if (anyRoom && result != ROOM_DELIVERED)
+    result = ROOM_BUSY;
+  return result;
+}
+
+/*
+ * 相手を待っている部屋を探す. 名前が無ければ, 待っている部屋を順番に選ぶ
+ * 引数 :
+ *   dir   - 部屋ディレクトリへのポインタ
+ *   name  - 部屋名(NULL か空なら名前の無い部屋)
+ *   entry - 見つけた部屋の登録を格納する構造体(出力)
+ * 戻値 :
+ *   見つかれば 1, 無ければ 0
+ */
+int findRoom(RoomDirectory *dir, char *name, RoomEntry *entry)
+{
+  RoomTable *table = dir->table;
+  int        anyRoom = name == NULL || name[0] == '\0';
+  int        i, slot, found = 0;
+
+  lockTable(table);
+  for (i = 0; i < ROOM_DIR_SLOTS && !found; i++) {
+    slot = anyRoom ? (table->next + i) % ROOM_DIR_SLOTS : i;
+    if (table->entry[slot].pid == 0 || table->entry[slot].state != ROOM_WAITING)
+      continue;
+    if (!anyRoom && !sameName(&table->entry[slot], name))
+      continue;
+    if (!isAlive(&table->entry[slot])) {
+      table->entry[slot].pid = 0;
+      continue;
+    }
+    *entry = table->entry[slot];
+    found  = 1;
+    if (anyRoom)
+      table->next = (slot + 1) % ROOM_DIR_SLOTS;
+  }
+  pthread_mutex_unlock(&table->lock);
+
+  return found;
+}
+
+/*
+ * 登録されている部屋の一覧を得る
+ * 引数 :
+ *   dir   - 部屋ディレクトリへのポインタ
+ *   list  - 部屋の登録を格納する配列(出力. max 個以上)
+ *   max   - 得る最大の数
+ * 戻値 :
+ *   得た数
+ */
+int listRooms(RoomDirectory *dir, RoomEntry *list, int max)
+{
+  RoomTable *table = dir->table;
+  int        i, n = 0;
+
+  lockTable(table);
+  for (i = 0; i < ROOM_DIR_SLOTS && n < max; i++) {
+    if (table->entry[i].pid == 0)
+      continue;
+    if (!isAlive(&table->entry[i])) {
+      table->entry[i].pid = 0;
+      continue;
+    }
+    list[n++] = table->entry[i];
+  }
+  pthread_mutex_unlock(&table->lock);
+
+  return n;
+}
+
+/*
+ * 部屋ディレクトリを閉じる(自分の登録は消す. 共有メモリは残す)
+ * 引数 :
+ *   dir - 部屋ディレクトリへのポインタ(NULL なら何もしない)
+ */
+void closeRoomDirectory(RoomDirectory *dir)
+{
+  if (dir == NULL)
+    return;
+
+  if (dir->slot >= 0) {
+    lockTable(dir->table);
+    dir->table->entry[dir->slot].pid = 0;
+    pthread_mutex_unlock(&dir->table->lock);
+  }
+  munmap(dir->table, sizeof(RoomTable));
+  free(dir);
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * 部屋ディレクトリの共有メモリを開く(create が 1 なら, 無ければ作る)
+ * 作るときは最初のプロセスだけが初期化し, 他のプロセスは初期化が済むのを待つ
+ */
+static RoomDirectory* mapDirectory(int port, int create)
+{
+  RoomDirectory *dir;
+  char           shmName[64];
+  struct stat    st;
+  int            fd = -1, created = 0, waited;
+
+  sprintf(shmName, ROOM_DIR_SHM, port);
+  if (create && (fd = shm_open(shmName, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0)
+    created = 1;
+  else if (!create || errno == EEXIST)
+    fd = shm_open(shmName, O_RDWR, 0600);
+  if (fd < 0) {
+    if (!create)
+      return NULL;
+    fprintf(stderr, "Error: cannot open room directory %s\n", shmName);
+    exit(1);
+  }
+
+  if ((dir = (RoomDirectory *)calloc(1, sizeof(RoomDirectory))) == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  dir->port = port;
+  dir->slot = -1;
+
+  if (created && ftruncate(fd, sizeof(RoomTable)) < 0) {
+    fprintf(stderr, "Error: cannot size room directory %s\n", shmName);
+    exit(1);
+  }
+
+  // 作ったプロセスが大きさを決めるまで待つ
+  for (waited = 0; fstat(fd, &st) == 0 && st.st_size < (off_t)sizeof(RoomTable); waited++) {
+    if (waited >= ROOM_DIR_WAIT_MSEC && !create) {
+      close(fd);
+      free(dir);
+      return NULL;
+    }
+    if (waited >= ROOM_DIR_WAIT_MSEC) {
+      fprintf(stderr, "Error: room directory %s is broken (remove it from /dev/shm)\n", shmName);
+      exit(1);
+    }
+    usleep(1000);
+  }
+
+  dir->table = (RoomTable *)mmap(NULL, sizeof(RoomTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (dir->table == MAP_FAILED) {
+    fprintf(stderr, "Error: cannot map room directory %s\n", shmName);
+    exit(1);
+  }
+
+  if (created) {
+    initTable(dir->table, port);
+    return dir;
+  }
+
+  // 作ったプロセスが初期化し終えるまで待つ
+  for (waited = 0; __atomic_load_n(&dir->table->magic, __ATOMIC_ACQUIRE) != ROOM_DIR_MAGIC; waited++) {
+    if (waited >= ROOM_DIR_WAIT_MSEC && !create) {
+      munmap(dir->table, sizeof(RoomTable));
+      free(dir);
+      return NULL;
+    }
+    if (waited >= ROOM_DIR_WAIT_MSEC) {
+      fprintf(stderr, "Error: room directory %s is broken (remove it from /dev/shm)\n", shmName);
+      exit(1);
+    }
+    usleep(1000);
+  }
+  return dir;
+}
+
+
+/*
+ * 共有メモリの表を初期化する(ロックはプロセス間で共有し, 持ち主が落ちても取り戻せるようにする)
+ */
+static void initTable(RoomTable *table, int port)
+{
+  pthread_mutexattr_t attr;
+
+  memset(table, 0, sizeof(RoomTable));
+  table->port = port;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&table->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  // 初期化が済んだことを他のプロセスに知らせる
+  __atomic_store_n(&table->magic, ROOM_DIR_MAGIC, __ATOMIC_RELEASE);
+}
+
+/*
+ * 表のロックを取る(前の持ち主が落ちていたら, 表はそのまま使い続ける)
+ */
+static void lockTable(RoomTable *table)
+{
+  if (pthread_mutex_lock(&table->lock) == EOWNERDEAD)
+    pthread_mutex_consistent(&table->lock);
+}
+
+/*
+ * 登録したプロセスがまだ居るか
+ */
+static int isAlive(RoomEntry *entry)
+{
+  return kill(entry->pid, 0) == 0 || errno != ESRCH;
+}
+
+/*
+ * 部屋名が同じか
+ */
+static int sameName(RoomEntry *entry, char *name)
+{
+  return strncmp(entry->name, name, ROOM_NAME_LEN - 1) == 0;
+}
@@ -0,0 +1,152 @@
+/********************************************************************
+                       部屋ディレクトリモジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef ROOM_DIRECTORY_H
+#define ROOM_DIRECTORY_H
+
+#include <pthread.h>
+#include <sys/types.h>
+
+//--------------------------------------------------------------------
+//   部屋ディレクトリモジュールにおける定数・型の定義
+//--------------------------------------------------------------------
+#define ROOM_DIR_SLOTS     64          // 登録できるサーバープロセスの数
+#define ROOM_NAME_LEN      16          // 部屋名の最大長('\0' を含む)
+#define ROOM_DIR_MAGIC     0x31524454  // 共有メモリの先頭の印("TDR1")
+#define ROOM_DIR_SHM       "/tagRooms.%d"   // 共有メモリの名前(%d はポート番号)
+
+// 部屋の状態
+#define ROOM_FREE          0           // 空きスロット
+#define ROOM_WAITING       1           // 相手を待っている
+#define ROOM_PLAYING       2           // 試合中
+#define ROOM_DRAINING      3           // 新しい相手は受け付けず, 終わるのを待っている
+
+// deliverToRoom() の結果
+#define ROOM_DELIVERED     0           // 部屋を持つプロセスへ渡した
+#define ROOM_BUSY          1           // 部屋はあるが相手を待っていない
+#define ROOM_UNKNOWN       2           // そういう部屋は無い(名前が無ければ, 待っているプロセスが無い)
+
+/*
+ * 部屋 1 つ(サーバープロセス 1 つ)の登録
+ */
+typedef struct {
+  pid_t   pid;                   // 部屋を持つプロセス(0 なら空き)
+  int     state;                 // 状態(ROOM_*)
+  char    name[ROOM_NAME_LEN];   // 部屋名(空なら名前の無い部屋)
+  long    since;                 // 今の状態になった時刻(UNIX 時間)
+} RoomEntry;
+
+/*
+ * 共有メモリに置く表(同じポートのすべてのサーバープロセスが同じものを見る)
+ */
+typedef struct {
+  unsigned        magic;         // ROOM_DIR_MAGIC(初期化が済むまで 0)
+  int             port;          // ポート番号
+  pthread_mutex_t lock;          // 以下を守るロック(プロセス間で共有. 持ったまま落ちても取り戻せる)
+  int             next;          // 名前の無い部屋を探し始めるスロット(順番に振り分ける)
+  RoomEntry       entry[ROOM_DIR_SLOTS];   // 部屋の登録
+} RoomTable;
+
+/*
+ * 部屋ディレクトリ構造体の定義
+ * SO_REUSEPORT で同じポートを共有するサーバープロセスが, どのプロセスが
+ * どの部屋を持っていて相手を待っているかを共有メモリの表で教え合う.
+ * 落ちたプロセスの登録は, 表を調べるときにプロセスが居ないことを確かめて消す
+ */
+typedef struct {
+  int        port;               // ポート番号
+  RoomTable *table;              // 共有メモリの表
+  int        slot;               // 自分の登録のスロット(-1 なら登録していない)
+} RoomDirectory;
+
+/*
+ * 部屋を持つプロセスへ接続を渡す関数(渡せたら 0, 渡せなければ -1 を返す)
+ */
+typedef int (*RoomDeliver)(RoomEntry *entry, void *arg);
+
+
+//--------------------------------------------------------------------
+//   部屋ディレクトリモジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * 部屋ディレクトリを開く(共有メモリが無ければ作る). 開けなければ終了する
+ * 引数 :
+ *   port - ポート番号
+ * 戻値 :
+ *   部屋ディレクトリへのポインタ
+ */
+RoomDirectory* openRoomDirectory(int port);
+
+/*
+ * すでにある部屋ディレクトリを開く(作らない. 同じホストでサーバーが動いたことが無ければ NULL)
+ * 引数 :
+ *   port - ポート番号
+ * 戻値 :
+ *   部屋ディレクトリへのポインタ. 無ければ NULL
+ */
+RoomDirectory* attachRoomDirectory(int port);
+
+/*
+ * 自分のプロセスを, 相手を待っている部屋として登録する
+ * 引数 :
+ *   dir  - 部屋ディレクトリへのポインタ
+ *   name - 部屋名(NULL か空なら名前の無い部屋)
+ * 戻値 :
+ *   登録できれば 0, 同じ名前の部屋があるか表が満杯なら -1
+ */
+int registerRoom(RoomDirectory *dir, char *name);
+
+/*
+ * 自分の部屋の状態を変える(ロックを取るので, deliverToRoom() とは入れ違わない)
+ * 引数 :
+ *   dir   - 部屋ディレクトリへのポインタ
+ *   state - 新しい状態(ROOM_*)
+ */
+void setRoomState(RoomDirectory *dir, int state);
+
+/*
+ * 部屋を持つプロセスへ接続を渡す. 名前が無ければ, 相手を待っている
+ * 自分以外のプロセスへ順番に振り分ける. 渡す間はロックを持っているので,
+ * 渡した先のプロセスは必ずまだ相手を待っている
+ * 引数 :
+ *   dir     - 部屋ディレクトリへのポインタ
+ *   name    - 部屋名(NULL か空なら名前の無い部屋)
+ *   deliver - 接続を渡す関数
+ *   arg     - deliver に渡す引数
+ * 戻値 :
+ *   ROOM_DELIVERED, ROOM_BUSY, ROOM_UNKNOWN のいずれか
+ */
+int deliverToRoom(RoomDirectory *dir, char *name, RoomDeliver deliver, void *arg);
+
+/*
+ * 相手を待っている部屋を探す. 名前が無ければ, 待っている部屋を順番に選ぶ
+ * 引数 :
+ *   dir   - 部屋ディレクトリへのポインタ
+ *   name  - 部屋名(NULL か空なら名前の無い部屋)
+ *   entry - 見つけた部屋の登録を格納する構造体(出力)
+ * 戻値 :
+ *   見つかれば 1, 無ければ 0
+ */
+int findRoom(RoomDirectory *dir, char *name, RoomEntry *entry);
+
+/*
+ * 登録されている部屋の一覧を得る
+ * 引数 :
+ *   dir   - 部屋ディレクトリへのポインタ
+ *   list  - 部屋の登録を格納する配列(出力. max 個以上)
+ *   max   - 得る最大の数
+ * 戻値 :
+ *   得た数
+ */
+int listRooms(RoomDirectory *dir, RoomEntry *list, int max);
+
+/*
+ * 部屋ディレクトリを閉じる(自分の登録は消す. 共有メモリは残す)
+ * 引数 :
+ *   dir - 部屋ディレクトリへのポインタ(NULL なら何もしない)
+ */
+void closeRoomDirectory(RoomDirectory *dir);
+
+#endif
@@ -0,0 +1,654 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <ifaddrs.h>
+
+#include "roomListener.h"      // 部屋リスナーモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  部屋リスナーモジュール内部で使用する定数・型の定義
+//--------------------------------------------------------------------
+#define ROOM_HANDOFF_NAME  "tagServer.%d.%d"   // 接続を受け取るソケットの名前(ポート番号, プロセス番号)
+#define ROOM_LOCAL_NAME    "tagServer.%d.%d.local"   // 同じホストのクライアントが接続するソケットの名前
+
+// 別のプロセスへ渡す接続
+typedef struct {
+  int    port;                   // ポート番号
+  int    s;                      // 渡す接続
+  char  *hello;                  // 接続から読んだ部屋名のメッセージ(一緒に渡す)
+} Handoff;
+
+//--------------------------------------------------------------------
+//  部屋リスナーモジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static void onDrain(int sig);
+static int  openListenSocket(int port);
+static int  openHandoffSocket(int port);
+static int  openLocalSocket(int port);
+static void unixAddress(struct sockaddr_un *addr, socklen_t *len, char *format, int port, pid_t pid);
+static int  isLocalHost(char *hostName);
+static int  connectServer(char *serverName, int port);
+static int  deliverHandoff(RoomEntry *entry, void *arg);
+static int  receiveHandoff(RoomListener *listener, char *hello);
+static void routeAway(RoomListener *listener, int s, char *hello);
+static void stopListening(RoomListener *listener);
+static void drainBacklog(RoomListener *listener, int *fd);
+static int  isMyRoom(RoomListener *listener, char *hello);
+static int  readRoomName(int s, char *hello);
+static int  readHello(int s, char *hello, int msec);
+static void sendHello(int s, char *text);
+
+static volatile sig_atomic_t draining = 0;   // SIGUSR1 を受けたら 1
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * 部屋リスナーを開く. ポートで待ち受け, 部屋ディレクトリに登録する
+ * 待ち受けられないか, 同じ名前の部屋があれば終了する
+ * 引数 :
+ *   port - ポート番号
+ *   name - 部屋名(NULL なら名前の無い部屋)
+ * 戻値 :
+ *   部屋リスナーへのポインタ
+ */
+RoomListener* openRoomListener(int port, char *name)
+{
+  RoomListener    *listener = (RoomListener *)calloc(1, sizeof(RoomListener));
+  struct sigaction sa;
+
+  if (listener == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  listener->port = port;
+  if (name != NULL)
+    strncpy(listener->name, name, ROOM_NAME_LEN - 1);
+
+  // 渡された接続を受け取れるようにしてから部屋を登録する
+  listener->handoffFd = openHandoffSocket(port);
+  listener->dir       = openRoomDirectory(port);
+  if (registerRoom(listener->dir, listener->name) < 0) {
+    fprintf(stderr, "Error: room '%s' is already open (or too many servers on port %d)\n",
+            listener->name, port);
+    exit(1);
+  }
+  listener->listenFd = openListenSocket(port);
+  listener->localFd  = openLocalSocket(port);
+
+  // SIGUSR1 で新しい相手の受け付けをやめる(試合中の read などは中断しない)
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onDrain;
+  sa.sa_flags   = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, NULL);
+
+  return listener;
+}
+
+/*
+ * この部屋に入る相手が来るまで待つ. 相手が来たら試合中として登録し, 待ち受けをやめる
+ * 引数 :
+ *   listener - 部屋リスナーへのポインタ
+ * 戻値 :
+ *   相手との会話用ファイルデスクリプタ. 相手が来る前に SIGUSR1 を受けるか, waitSec が過ぎたら -1
+ */
+int acceptRoomPlayer(RoomListener *listener)
+{
+  char           hello[ROOM_HELLO_LEN];
+  fd_set         arrived;
+  struct timeval watchTime;
+  time_t         deadline = listener->waitSec > 0 ? time(NULL) + listener->waitSec : 0;
+  int            s = -1, fd, width;
+
+  while (s < 0) {
+    // やめる合図を受けたら, 受け付け待ちの接続を他のプロセスへ渡して終わる
+    if (isRoomDraining(listener)) {
+      stopListening(listener);
+      return -1;
+    }
+    // 待つ時間が過ぎたら, 受け付け待ちの接続を他のプロセスへ渡して終わる
+    if (deadline != 0 && time(NULL) >= deadline) {
+      stopListening(listener);
+      return -1;
+    }
+
+    FD_ZERO(&arrived);
+    FD_SET(listener->listenFd, &arrived);
+    FD_SET(listener->localFd, &arrived);
+    FD_SET(listener->handoffFd, &arrived);
+    width = listener->listenFd > listener->handoffFd ? listener->listenFd : listener->handoffFd;
+    width = width > listener->localFd ? width : listener->localFd;
+    watchTime.tv_sec  = 0;
+    watchTime.tv_usec = ROOM_POLL_MSEC * 1000;
+    if (select(width + 1, &arrived, NULL, NULL, &watchTime) <= 0)
+      continue;
+
+    // 他のプロセスから渡された接続は, この部屋に入る相手
+    if (FD_ISSET(listener->handoffFd, &arrived)) {
+      if ((s = receiveHandoff(listener, hello)) >= 0)
+        listener->received++;
+      continue;
+    }
+
+    // 自分で受け付けた接続(TCP か, 同じホストからの UNIX ドメイン)は, 部屋名を読んで行き先を決める
+    fd = FD_ISSET(listener->localFd, &arrived) ? listener->localFd : listener->listenFd;
+    if ((s = accept(fd, NULL, NULL)) < 0)
+      continue;
+    if (readRoomName(s, hello) < 0) {
+      close(s);
+      s = -1;
+    }
+    else if (!isMyRoom(listener, hello)) {
+      routeAway(listener, s, hello);
+      s = -1;
+    }
+    else {
+      listener->accepted++;
+      if (fd == listener->localFd)
+        listener->local++;
+    }
+  }
+
+  // 試合中にしてから待ち受けをやめる(これより後は, この部屋へ接続が渡されない)
+  setRoomState(listener->dir, ROOM_PLAYING);
+  stopListening(listener);
+  sendHello(s, "ok");
+
+  return s;
+}
+
+/*
+ * やめる合図(SIGUSR1)を受けたか. 受けていれば部屋ディレクトリにも終わるのを待っていると書く
+ * 試合中のサーバーはラウンドの合間にこれを見て, 今のラウンドで終わる
+ * 引数 :
+ *   listener - 部屋リスナーへのポインタ(NULL なら受けていないとみなす)
+ * 戻値 :
+ *   受けていれば 1, いなければ 0
+ */
+int isRoomDraining(RoomListener *listener)
+{
+  if (listener == NULL || !draining)
+    return 0;
+
+  // シグナルハンドラの中ではロックを取れないので, 気付いたところで書く
+  if (!listener->drained) {
+    setRoomState(listener->dir, ROOM_DRAINING);
+    listener->drained = 1;
+  }
+  return 1;
+}
+
+/*
+ * 部屋リスナーを閉じる(部屋ディレクトリの登録も消す)
+ * 引数 :
+ *   listener - 部屋リスナーへのポインタ(NULL なら何もしない)
+ */
+void closeRoomListener(RoomListener *listener)
+{
+  if (listener == NULL)
+    return;
+  stopListening(listener);
+  closeRoomDirectory(listener->dir);
+  free(listener);
+}
+
+/*
+ * (クライアント側) サーバーが同じホストで動いていれば, UNIX ドメインソケットで接続する
+ * 部屋ディレクトリから相手を待っているサーバーを選んで直接つなぐ
+ * 引数 :
+ *   serverName - サーバーのホスト名
+ *   port       - ポート番号
+ *   name       - 部屋名(NULL か空なら, 空いているどの部屋でもよい)
+ * 戻値 :
+ *   サーバーとの会話用ファイルデスクリプタ. 同じホストに待っているサーバーが無ければ -1
+ *   (そのときは TCP で接続する)
+ */
+int setupLocalClient(char *serverName, int port, char *name)
+{
+  RoomDirectory     *dir;
+  RoomEntry          entry;
+  struct sockaddr_un addr;
+  socklen_t          len;
+  int                s, found;
+
+  if (!isLocalHost(serverName) || (dir = attachRoomDirectory(port)) == NULL)
+    return -1;
+  found = findRoom(dir, name, &entry);
+  closeRoomDirectory(dir);
+  if (!found)
+    return -1;
+
+  // 選んだサーバーがちょうど試合を始めていたら, TCP で接続し直す
+  unixAddress(&addr, &len, ROOM_LOCAL_NAME, port, entry.pid);
+  if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return -1;
+  if (connect(s, (struct sockaddr *)&addr, len) < 0) {
+    close(s);
+    return -1;
+  }
+  return s;
+}
+
+/*
+ * (クライアント側) 接続したサーバーで部屋に入る
+ * 引数 :
+ *   s    - サーバーとの会話用ファイルデスクリプタ
+ *   name - 部屋名(NULL か空なら, 空いているどの部屋でもよい)
+ * 戻値 :
+ *   ROOM_JOINED, ROOM_BUSY, ROOM_UNKNOWN のいずれか. 切断されたら -1
+ */
+int joinRoom(int s, char *name)
+{
+  char hello[ROOM_HELLO_LEN];
+
+  snprintf(hello, ROOM_HELLO_LEN, "room %.*s", ROOM_NAME_LEN - 1, name != NULL ? name : "");
+  sendHello(s, hello);
+
+  // サーバーは部屋が決まってから返事をする(別のプロセスへ渡されることもある)
+  if (readHello(s, hello, -1) < 0)
+    return -1;
+  if (strcmp(hello, "ok") == 0)
+    return ROOM_JOINED;
+  if (strcmp(hello, "busy") == 0)
+    return ROOM_BUSY;
+  if (strcmp(hello, "noroom") == 0)
+    return ROOM_UNKNOWN;
+  return -1;
+}
+
+/*
+ * (クライアント側) サーバーに接続し直して部屋に入る(接続できなくても終了しない)
+ * 落ちたサーバーの部屋を, 立ち上げ直したサーバーが開くのを待つあいだ繰り返し呼ぶ
+ * 引数 :
+ *   serverName - サーバーのホスト名
+ *   port       - ポート番号
+ *   name       - 部屋名
+ * 戻値 :
+ *   部屋に入れたらサーバーとの会話用ファイルデスクリプタ. 入れなければ -1
+ */
+int rejoinRoom(char *serverName, int port, char *name)
+{
+  int s;
+
+  if ((s = setupLocalClient(serverName, port, name)) < 0 &&
+      (s = connectServer(serverName, port)) < 0)
+    return -1;
+  if (joinRoom(s, name) != ROOM_JOINED) {
+    close(s);
+    return -1;
+  }
+  return s;
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * SIGUSR1 を受けたら, 新しい相手の受け付けをやめる
+ */
+static void onDrain(int sig)
+{
+  draining = 1;
+}
+
+/*
+ * ポートで待ち受けるソケットを作る(同じポートの他のプロセスと一緒に待ち受ける)
+ */
+static int openListenSocket(int port)
+{
+  struct sockaddr_in addr;
+  int                s, on = 1;
+
+  if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    fprintf(stderr, "Error: socket allocation failed\n");
+    exit(1);
+  }
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+    fprintf(stderr, "Error: SO_REUSEPORT is not supported\n");
+    exit(1);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port        = htons(port);
+  if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(s, ROOM_BACKLOG) < 0) {
+    fprintf(stderr, "Error: cannot bind port %d\n", port);
+    exit(1);
+  }
+  return s;
+}
+
+/*
+ * 他のプロセスから接続を受け取るソケットを作る(名前はポート番号と自分のプロセス番号)
+ */
+static int openHandoffSocket(int port)
+{
+  struct sockaddr_un addr;
+  socklen_t          len;
+  int                s;
+
+  unixAddress(&addr, &len, ROOM_HANDOFF_NAME, port, getpid());
+  if ((s = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0 || bind(s, (struct sockaddr *)&addr, len) < 0) {
+    fprintf(stderr, "Error: cannot open handoff socket\n");
+    exit(1);
+  }
+  return s;
+}
+
+/*
+ * 同じホストのクライアントが接続する UNIX ドメインの待ち受けソケットを作る
+ * (TCP のループバックと同じメッセージを運ぶが, TCP/IP の処理を通らない)
+ */
+static int openLocalSocket(int port)
+{
+  struct sockaddr_un addr;
+  socklen_t          len;
+  int                s;
+
+  unixAddress(&addr, &len, ROOM_LOCAL_NAME, port, getpid());
+  if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(s, (struct sockaddr *)&addr, len) < 0 ||
+      listen(s, ROOM_BACKLOG) < 0) {
+    fprintf(stderr, "Error: cannot open local socket\n");
+    exit(1);
+  }
+  return s;
+}
+
+/*
+ * UNIX ドメインソケットのアドレス(ファイルを作らない抽象名前空間を使う)
+ * 名前はポート番号とプロセス番号から作る
+ */
+static void unixAddress(struct sockaddr_un *addr, socklen_t *len, char *format, int port, pid_t pid)
+{
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, format, port, (int)pid);
+  *len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(addr->sun_path + 1);
+}
+
+/*
+ * ホストが自分自身か(ループバックか, 自分のネットワークインタフェースのアドレスか)
+ */
+static int isLocalHost(char *hostName)
+{
+  struct addrinfo  hints, *list, *ai;
+  struct ifaddrs  *ifList, *ifa;
+  struct in_addr   addr;
+  int              local = 0;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  if (getaddrinfo(hostName, NULL, &hints, &list) != 0)
+    return 0;
+  if (getifaddrs(&ifList) != 0)
+    ifList = NULL;
+
+  for (ai = list; ai != NULL && !local; ai = ai->ai_next) {
+    addr = ((struct sockaddr_in *)ai->ai_addr)->sin_addr;
+    if ((ntohl(addr.s_addr) >> 24) == 127)
+      local = 1;
+    for (ifa = ifList; ifa != NULL && !local; ifa = ifa->ifa_next)
+      if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET &&
+          ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr == addr.s_addr)
+        local = 1;
+  }
+
+  if (ifList != NULL)
+    freeifaddrs(ifList);
+  freeaddrinfo(list);
+  return local;
+}
+
+/*
+ * TCP でサーバーに接続する(setupClient() と違い, 接続できなくても終了しない)
+ */
+static int connectServer(char *serverName, int port)
+{
+  struct addrinfo hints, *list, *ai;
+  char            service[16];
+  int             s = -1;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(service, sizeof(service), "%d", port);
+  if (getaddrinfo(serverName, service, &hints, &list) != 0)
+    return -1;
+
+  for (ai = list; ai != NULL && s < 0; ai = ai->ai_next) {
+    if ((s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+      continue;
+    if (connect(s, ai->ai_addr, ai->ai_addrlen) < 0) {
+      close(s);
+      s = -1;
+    }
+  }
+
+  freeaddrinfo(list);
+  return s;
+}
+
+/*
+ * 部屋を持つプロセスへ接続を渡す(deliverToRoom() から呼ばれる)
+ * 接続のファイルデスクリプタは SCM_RIGHTS で, 部屋名のメッセージは本文で送る
+ */
+static int deliverHandoff(RoomEntry *entry, void *arg)
+{
+  Handoff           *handoff = (Handoff *)arg;
+  struct sockaddr_un addr;
+  socklen_t          len;
+  struct msghdr      msg;
+  struct iovec       iov;
+  struct cmsghdr    *cmsg;
+  char               control[CMSG_SPACE(sizeof(int))];
+  int                s, result;
+
+  if ((s = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
+    return -1;
+  unixAddress(&addr, &len, ROOM_HANDOFF_NAME, handoff->port, entry->pid);
+
+  iov.iov_base = handoff->hello;
+  iov.iov_len  = ROOM_HELLO_LEN;
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_name       = &addr;
+  msg.msg_namelen    = len;
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control;
+  msg.msg_controllen = sizeof(control);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &handoff->s, sizeof(int));
+
+  // 相手の受信キューが満杯なら待たずに次の部屋を探す
+  result = sendmsg(s, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) == ROOM_HELLO_LEN ? 0 : -1;
+  close(s);
+
+  return result;
+}
+
+/*
+ * 他のプロセスから渡された接続を 1 つ受け取る(待たない)
+ * 戻値 :
+ *   接続のファイルデスクリプタ. 受け取れなければ -1
+ */
+static int receiveHandoff(RoomListener *listener, char *hello)
+{
+  struct msghdr   msg;
+  struct iovec    iov;
+  struct cmsghdr *cmsg;
+  char            control[CMSG_SPACE(sizeof(int))];
+  int             s = -1;
+
+  iov.iov_base = hello;
+  iov.iov_len  = ROOM_HELLO_LEN;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control;
+  msg.msg_controllen = sizeof(control);
+
+  if (recvmsg(listener->handoffFd, &msg, MSG_DONTWAIT) != ROOM_HELLO_LEN)
+    return -1;
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    return -1;
+  memcpy(&s, CMSG_DATA(cmsg), sizeof(int));
+  hello[ROOM_HELLO_LEN - 1] = '\0';
+
+  return s;
+}
+
+/*
+ * この部屋に入らない接続を, 部屋を持つプロセスへ渡すか断る(接続はこのプロセスでは閉じる)
+ */
+static void routeAway(RoomListener *listener, int s, char *hello)
+{
+  Handoff handoff;
+  int     result;
+
+  handoff.port  = listener->port;
+  handoff.s     = s;
+  handoff.hello = hello;
+
+  // 自分の部屋を名指しされても, もう相手を待っていなければ混んでいる
+  if (hello[5] != '\0' && strcmp(hello + 5, listener->name) == 0)
+    result = ROOM_BUSY;
+  else
+    result = deliverToRoom(listener->dir, hello + 5, deliverHandoff, &handoff);
+
+  if (result == ROOM_DELIVERED) {
+    listener->routed++;
+  }
+  else {
+    sendHello(s, result == ROOM_BUSY ? "busy" : "noroom");
+    listener->refused++;
+  }
+  close(s);
+}
+
+/*
+ * 待ち受けをやめる. 受け付け待ちの接続と, 渡されたが受け取っていない接続は
+ * 別のプロセスへ渡すか断る(黙って切らない)
+ */
+static void stopListening(RoomListener *listener)
+{
+  char hello[ROOM_HELLO_LEN];
+  int  s;
+
+  drainBacklog(listener, &listener->listenFd);
+  drainBacklog(listener, &listener->localFd);
+
+  if (listener->handoffFd >= 0) {
+    while ((s = receiveHandoff(listener, hello)) >= 0)
+      routeAway(listener, s, hello);
+    close(listener->handoffFd);
+    listener->handoffFd = -1;
+  }
+}
+
+/*
+ * 待ち受けソケットの受け付け待ちの接続を別のプロセスへ渡すか断り, ソケットを閉じる
+ */
+static void drainBacklog(RoomListener *listener, int *fd)
+{
+  char hello[ROOM_HELLO_LEN];
+  int  s;
+
+  if (*fd < 0)
+    return;
+
+  fcntl(*fd, F_SETFL, O_NONBLOCK);
+  while ((s = accept(*fd, NULL, NULL)) >= 0) {
+    if (readRoomName(s, hello) < 0)
+      close(s);
+    else
+      routeAway(listener, s, hello);
+  }
+  close(*fd);
+  *fd = -1;
+}
+
+/*
+ * 接続してきた相手がこの部屋に入るか(名前が無ければどの部屋でもよい)
+ */
+static int isMyRoom(RoomListener *listener, char *hello)
+{
+  return hello[5] == '\0' || strcmp(hello + 5, listener->name) == 0;
+}
+
+/*
+ * 接続してきた相手から部屋名のメッセージ("room 部屋名")を読む(少しだけ待つ)
+ */
+static int readRoomName(int s, char *hello)
+{
+  if (readHello(s, hello, ROOM_HELLO_MSEC) < 0 || strncmp(hello, "room ", 5) != 0)
+    return -1;
+  return 0;
+}
+
+/*
+ * ROOM_HELLO_LEN バイトのメッセージを読む
+ * 引数 :
+ *   s     - 相手との会話用ファイルデスクリプタ
+ *   hello - メッセージを格納する領域(ROOM_HELLO_LEN バイト)
+ *   msec  - 待つ時間(ms). 負なら届くまで待つ
+ * 戻値 :
+ *   読めれば 0, 時間切れか切断されたら -1
+ */
+static int readHello(int s, char *hello, int msec)
+{
+  fd_set         arrived;
+  struct timeval watchTime;
+  int            got = 0, n;
+
+  memset(hello, 0, ROOM_HELLO_LEN);
+  while (got < ROOM_HELLO_LEN) {
+    if (msec >= 0) {
+      FD_ZERO(&arrived);
+      FD_SET(s, &arrived);
+      watchTime.tv_sec  = msec / 1000;
+      watchTime.tv_usec = (msec % 1000) * 1000;
+      if (select(s + 1, &arrived, NULL, NULL, &watchTime) <= 0)
+        return -1;
+    }
+    if ((n = read(s, hello + got, ROOM_HELLO_LEN - got)) <= 0)
+      return -1;
+    got += n;
+  }
+  hello[ROOM_HELLO_LEN - 1] = '\0';
+
+  return 0;
+}
+
+/*
+ * ROOM_HELLO_LEN バイトのメッセージを送る(残りは 0 で埋める. 相手が切っていても落ちない)
+ */
+static void sendHello(int s, char *text)
+{
+  char hello[ROOM_HELLO_LEN];
+
+  memset(hello, 0, ROOM_HELLO_LEN);
+  strncpy(hello, text, ROOM_HELLO_LEN - 1);
+  send(s, hello, ROOM_HELLO_LEN, MSG_NOSIGNAL);
+}
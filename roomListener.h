@@ -0,0 +1,126 @@
+/********************************************************************
+                       部屋リスナーモジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef ROOM_LISTENER_H
+#define ROOM_LISTENER_H
+
+#include "roomDirectory.h"     // 部屋ディレクトリモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//   部屋リスナーモジュールにおける定数・型の定義
+//--------------------------------------------------------------------
+#define ROOM_HELLO_LEN     32     // 接続してすぐに交わすメッセージの長さ
+#define ROOM_HELLO_MSEC    1000   // 接続してきた相手が部屋名を送るのを待つ時間(ms)
+#define ROOM_POLL_MSEC     200    // 相手を待つ間に, やめる合図を確かめる間隔(ms)
+#define ROOM_BACKLOG       16     // 受け付け待ちの接続の数
+
+// joinRoom() の結果(ROOM_BUSY, ROOM_UNKNOWN は部屋ディレクトリと同じ)
+#define ROOM_JOINED        0      // 部屋に入れた
+
+/*
+ * 部屋リスナー構造体の定義
+ * 同じポートに SO_REUSEPORT で複数のサーバープロセスが待ち受け, カーネルが
+ * 接続を振り分ける. 接続してきた相手は最初に部屋名を送り, その部屋を持つのが
+ * 別のプロセスなら, 接続(ファイルデスクリプタ)を UNIX ドメインソケットで
+ * そのプロセスへ渡す. 試合が始まったら待ち受けをやめて, 受け付け待ちの
+ * 接続は相手を待っている別のプロセスへ渡す.
+ * SIGUSR1 を受けたら新しい相手は受け付けず, 試合中なら試合を終えてから終わる
+ * (入れ替えるときは, 新しいプロセスを同じポートで動かしてから古いプロセスに送る).
+ * 同じホストのクライアントは TCP のループバックを通らず, プロセスごとの
+ * UNIX ドメインソケットに直接つなぐ(運ぶメッセージは TCP と同じ)
+ */
+typedef struct {
+  int            port;           // ポート番号
+  char           name[ROOM_NAME_LEN];  // 自分の部屋名(空なら名前の無い部屋)
+  int            listenFd;       // 待ち受けソケット(-1 なら待ち受けていない)
+  int            localFd;        // 同じホストのクライアントを待ち受ける UNIX ドメインソケット(-1 なら待ち受けていない)
+  int            handoffFd;      // 他のプロセスから接続を受け取るソケット(-1 なら閉じた)
+  RoomDirectory *dir;            // 部屋ディレクトリ
+  long           accepted;       // 自分で受け付けた接続の数
+  long           local;          // そのうち UNIX ドメインソケットで受け付けた数
+  long           received;       // 他のプロセスから受け取った接続の数
+  long           routed;         // 他のプロセスへ渡した接続の数
+  long           refused;        // 部屋が無いか混んでいて断った接続の数
+  int            waitSec;        // 相手を待つ最長の時間(秒. 0 なら限りなく待つ)
+  int            drained;        // やめる合図を部屋ディレクトリに書いたら 1
+} RoomListener;
+
+
+//--------------------------------------------------------------------
+//   部屋リスナーモジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * 部屋リスナーを開く. ポートで待ち受け, 部屋ディレクトリに登録する
+ * 待ち受けられないか, 同じ名前の部屋があれば終了する
+ * 引数 :
+ *   port - ポート番号
+ *   name - 部屋名(NULL なら名前の無い部屋)
+ * 戻値 :
+ *   部屋リスナーへのポインタ
+ */
+RoomListener* openRoomListener(int port, char *name);
+
+/*
+ * この部屋に入る相手が来るまで待つ. 相手が来たら試合中として登録し, 待ち受けをやめる
+ * 引数 :
+ *   listener - 部屋リスナーへのポインタ
+ * 戻値 :
+ *   相手との会話用ファイルデスクリプタ. 相手が来る前に SIGUSR1 を受けるか, waitSec が過ぎたら -1
+ */
+int acceptRoomPlayer(RoomListener *listener);
+
+/*
+ * やめる合図(SIGUSR1)を受けたか. 受けていれば部屋ディレクトリにも終わるのを待っていると書く
+ * 試合中のサーバーはラウンドの合間にこれを見て, 今のラウンドで終わる
+ * 引数 :
+ *   listener - 部屋リスナーへのポインタ(NULL なら受けていないとみなす)
+ * 戻値 :
+ *   受けていれば 1, いなければ 0
+ */
+int isRoomDraining(RoomListener *listener);
+
+/*
+ * 部屋リスナーを閉じる(部屋ディレクトリの登録も消す)
+ * 引数 :
+ *   listener - 部屋リスナーへのポインタ(NULL なら何もしない)
+ */
+void closeRoomListener(RoomListener *listener);
+
+/*
+ * (クライアント側) サーバーが同じホストで動いていれば, UNIX ドメインソケットで接続する
+ * 部屋ディレクトリから相手を待っているサーバーを選んで直接つなぐ
+ * 引数 :
+ *   serverName - サーバーのホスト名
+ *   port       - ポート番号
+ *   name       - 部屋名(NULL か空なら, 空いているどの部屋でもよい)
+ * 戻値 :
+ *   サーバーとの会話用ファイルデスクリプタ. 同じホストに待っているサーバーが無ければ -1
+ *   (そのときは TCP で接続する)
+ */
+int setupLocalClient(char *serverName, int port, char *name);
+
+/*
+ * (クライアント側) 接続したサーバーで部屋に入る
+ * 引数 :
+ *   s    - サーバーとの会話用ファイルデスクリプタ
+ *   name - 部屋名(NULL か空なら, 空いているどの部屋でもよい)
+ * 戻値 :
+ *   ROOM_JOINED, ROOM_BUSY, ROOM_UNKNOWN のいずれか. 切断されたら -1
+ */
+int joinRoom(int s, char *name);
+
+/*
+ * (クライアント側) サーバーに接続し直して部屋に入る(接続できなくても終了しない)
+ * 落ちたサーバーの部屋を, 立ち上げ直したサーバーが開くのを待つあいだ繰り返し呼ぶ
+ * 引数 :
+ *   serverName - サーバーのホスト名
+ *   port       - ポート番号
+ *   name       - 部屋名
+ * 戻値 :
+ *   部屋に入れたらサーバーとの会話用ファイルデスクリプタ. 入れなければ -1
+ */
+int rejoinRoom(char *serverName, int port, char *name);
+
+#endif
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "roomPool.h"          // 部屋プールモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * 部屋プールの作成
+ * 引数 :
+ *   slots     - 部屋の数
+ *   arenaSize - 部屋 1 つのアリーナの大きさ(バイト)
+ * 戻値 :
+ *   部屋プールへのポインタ
+ */
+RoomPool* createRoomPool(int slots, size_t arenaSize)
+{
+  RoomPool *pool = (RoomPool *)malloc(sizeof(RoomPool));
+  int       i;
+
+  // アリーナの大きさはキャッシュラインの倍数にそろえる
+  arenaSize = (arenaSize + 63) & ~(size_t)63;
+
+  if (pool == NULL ||
+      (pool->room = (Room *)malloc(sizeof(Room) * slots)) == NULL ||
+      posix_memalign((void **)&pool->memory, 64, arenaSize * slots) != 0) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  pool->slots = slots;
+  pool->inUse = 0;
+
+  // 空きスロットのリストは 0 番から順に使う
+  for (i = 0; i < slots; i++) {
+    pool->room[i].id          = i;
+    pool->room[i].inUse       = 0;
+    pool->room[i].nextFree    = i + 1 < slots ? i + 1 : -1;
+    pool->room[i].arena.base  = pool->memory + arenaSize * i;
+    pool->room[i].arena.size  = arenaSize;
+    pool->room[i].arena.used  = 0;
+    pool->room[i].arena.peak  = 0;
+  }
+  pool->freeHead = slots > 0 ? 0 : -1;
+
+  return pool;
+}
+
+/*
+ * 空いている部屋を得る
+ * 引数 :
+ *   pool - 部屋プールへのポインタ
+ * 戻値 :
+ *   部屋へのポインタ. 空きが無ければ NULL
+ */
+Room* acquireRoom(RoomPool *pool)
+{
+  Room *room;
+
+  if (pool->freeHead < 0)
+    return NULL;
+
+  room = &pool->room[pool->freeHead];
+  pool->freeHead = room->nextFree;
+  room->inUse    = 1;
+  room->nextFree = -1;
+  pool->inUse++;
+
+  return room;
+}
+
+/*
+ * 部屋を返す. 部屋のアリーナから切り出した領域はすべて無効になる
+ * 引数 :
+ *   pool - 部屋プールへのポインタ
+ *   room - acquireRoom() で得た部屋
+ */
+void releaseRoom(RoomPool *pool, Room *room)
+{
+  if (room == NULL || !room->inUse)
+    return;
+
+  // アリーナを空に戻すだけ(中身は次に使う部屋が上書きする)
+  room->arena.used = 0;
+  room->inUse      = 0;
+  room->nextFree   = pool->freeHead;
+  pool->freeHead   = room->id;
+  pool->inUse--;
+}
+
+/*
+ * 部屋プールの後始末
+ * 引数 :
+ *   pool - 部屋プールへのポインタ
+ */
+void destroyRoomPool(RoomPool *pool)
+{
+  if (pool == NULL)
+    return;
+  free(pool->memory);
+  free(pool->room);
+  free(pool);
+}
+
+/*
+ * アリーナから領域を切り出す. arena が NULL ならヒープから確保する
+ * どちらも足りなければ終了する
+ * 引数 :
+ *   arena - アリーナへのポインタ(NULL ならヒープ)
+ *   size  - バイト数
+ *   align - 境界(2 のべき乗)
+ * 戻値 :
+ *   切り出した領域へのポインタ(0 で埋めていない)
+ */
+void* arenaAlloc(Arena *arena, size_t size, size_t align)
+{
+  void     *p;
+  uintptr_t start;
+
+  if (arena == NULL) {
+    if (align < sizeof(void *))
+      align = sizeof(void *);
+    if (posix_memalign(&p, align, size > 0 ? size : 1) != 0) {
+      fprintf(stderr, "Error: out of memory\n");
+      exit(1);
+    }
+    return p;
+  }
+
+  start = ((uintptr_t)arena->base + arena->used + align - 1) & ~(uintptr_t)(align - 1);
+  if (start + size > (uintptr_t)arena->base + arena->size) {
+    fprintf(stderr, "Error: room arena is full (%lu bytes)\n", (unsigned long)arena->size);
+    exit(1);
+  }
+  arena->used = start + size - (uintptr_t)arena->base;
+  if (arena->used > arena->peak)
+    arena->peak = arena->used;
+
+  return (void *)start;
+}
+
+/*
+ * arenaAlloc() で得た領域を解放する. アリーナから切り出した領域なら何もしない
+ * 引数 :
+ *   arena - arenaAlloc() に渡したアリーナ(NULL ならヒープ)
+ *   p     - 解放する領域
+ */
+void arenaFree(Arena *arena, void *p)
+{
+  if (arena == NULL)
+    free(p);
+}
+
+/*
+ * アリーナを以前の位置まで巻き戻す. mark より後に切り出した領域はすべて無効になる
+ * (ラウンドごとに作り直すデータを, 部屋を返さずに捨てるときに使う)
+ * 引数 :
+ *   arena - アリーナへのポインタ
+ *   mark  - 巻き戻す位置(以前の arena->used)
+ */
+void arenaRewind(Arena *arena, size_t mark)
+{
+  if (mark < arena->used)
+    arena->used = mark;
+}
@@ -0,0 +1,119 @@
+/********************************************************************
+                       部屋プール(アリーナ)モジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef ROOM_POOL_H
+#define ROOM_POOL_H
+
+#include <stddef.h>
+
+//--------------------------------------------------------------------
+//   部屋プールモジュールにおける定数・型の定義
+//--------------------------------------------------------------------
+#define ROOM_POOL_SLOTS   16            // 部屋プールの既定の部屋数
+#define ROOM_ARENA_SIZE   (64 * 1024)   // 部屋 1 つのアリーナの既定の大きさ(バイト)
+#define ROOM_ALIGN        16            // アリーナから割り当てる領域の既定の境界
+
+/*
+ * アリーナ(バンプアロケータ)
+ * 先頭から順に切り出すだけで, 個別には解放しない. まとめて used を 0 に戻す
+ */
+typedef struct {
+  char   *base;                  // 領域の先頭
+  size_t  size;                  // 領域の大きさ
+  size_t  used;                  // 切り出したバイト数
+  size_t  peak;                  // これまでで最も多く切り出したバイト数
+} Arena;
+
+/*
+ * 部屋(プールのスロット 1 つ)
+ */
+typedef struct {
+  int     id;                    // スロット番号
+  int     inUse;                 // 使用中なら 1
+  int     nextFree;              // 空きスロットのリストの次(-1 なら末尾)
+  Arena   arena;                 // 部屋ごとのデータを切り出すアリーナ
+} Room;
+
+/*
+ * 部屋プール構造体の定義
+ * 決まった数の部屋と, 部屋ごとのアリーナの領域を最初にまとめて確保しておく.
+ * 部屋を返すとアリーナを空に戻すだけなので O(1) で, ヒープは断片化しない
+ */
+typedef struct {
+  int     slots;                 // 部屋の数
+  int     inUse;                 // 使用中の部屋の数
+  int     freeHead;              // 空きスロットのリストの先頭(-1 なら空きなし)
+  Room   *room;                  // 部屋の配列
+  char   *memory;                // すべてのアリーナの領域
+} RoomPool;
+
+
+//--------------------------------------------------------------------
+//   部屋プールモジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * 部屋プールの作成
+ * 引数 :
+ *   slots     - 部屋の数
+ *   arenaSize - 部屋 1 つのアリーナの大きさ(バイト)
+ * 戻値 :
+ *   部屋プールへのポインタ
+ */
+RoomPool* createRoomPool(int slots, size_t arenaSize);
+
+/*
+ * 空いている部屋を得る
+ * 引数 :
+ *   pool - 部屋プールへのポインタ
+ * 戻値 :
+ *   部屋へのポインタ. 空きが無ければ NULL
+ */
+Room* acquireRoom(RoomPool *pool);
+
+/*
+ * 部屋を返す. 部屋のアリーナから切り出した領域はすべて無効になる
+ * 引数 :
+ *   pool - 部屋プールへのポインタ
+ *   room - acquireRoom() で得た部屋
+ */
+void releaseRoom(RoomPool *pool, Room *room);
+
+/*
+ * 部屋プールの後始末
+ * 引数 :
+ *   pool - 部屋プールへのポインタ
+ */
+void destroyRoomPool(RoomPool *pool);
+
+/*
+ * アリーナから領域を切り出す. arena が NULL ならヒープから確保する
+ * どちらも足りなければ終了する
+ * 引数 :
+ *   arena - アリーナへのポインタ(NULL ならヒープ)
+ *   size  - バイト数
+ *   align - 境界(2 のべき乗)
+ * 戻値 :
+ *   切り出した領域へのポインタ(0 で埋めていない)
+ */
+void* arenaAlloc(Arena *arena, size_t size, size_t align);
+
+/*
+ * arenaAlloc() で得た領域を解放する. アリーナから切り出した領域なら何もしない
+ * 引数 :
+ *   arena - arenaAlloc() に渡したアリーナ(NULL ならヒープ)
+ *   p     - 解放する領域
+ */
+void arenaFree(Arena *arena, void *p);
+
+/*
+ * アリーナを以前の位置まで巻き戻す. mark より後に切り出した領域はすべて無効になる
+ * (ラウンドごとに作り直すデータを, 部屋を返さずに捨てるときに使う)
+ * 引数 :
+ *   arena - アリーナへのポインタ
+ *   mark  - 巻き戻す位置(以前の arena->used)
+ */
+void arenaRewind(Arena *arena, size_t mark);
+
+#endif
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "spatialHash.h"       // 空間ハッシュモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  空間ハッシュモジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static long cellKey(int inMainMap, int x, int y);
+static int  hashKey(SpatialHash *hash, long key);
+static void linkEntity(SpatialHash *hash, int id);
+static void unlinkEntity(SpatialHash *hash, int id);
+static int  addCapture(SpatialHash *hash, CaptureEvent *events, int n, int max,
+                       int chaser, int evader, int passThrough);
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * 空間ハッシュの作成
+ * 引数 :
+ *   maxEntities - 登録できるエンティティの数
+ *   arena       - 確保に使うアリーナ(NULL ならヒープ)
+ * 戻値 :
+ *   空間ハッシュへのポインタ
+ */
+SpatialHash* createSpatialHash(int maxEntities, Arena *arena)
+{
+  SpatialHash *hash = (SpatialHash *)arenaAlloc(arena, sizeof(SpatialHash), ROOM_ALIGN);
+  int buckets = 16, i;
+
+  // バケツの数はエンティティ数の 2 倍以上の 2 のべき乗にする
+  while (buckets < maxEntities * 2)
+    buckets *= 2;
+
+  hash->entity  = (SpatialEntity *)arenaAlloc(arena, sizeof(SpatialEntity) * maxEntities, ROOM_ALIGN);
+  hash->chasers = (int *)arenaAlloc(arena, sizeof(int) * maxEntities, ROOM_ALIGN);
+  hash->bucket  = (int *)arenaAlloc(arena, sizeof(int) * buckets, ROOM_ALIGN);
+  hash->arena   = arena;
+  hash->maxEntities  = maxEntities;
+  hash->entities     = 0;
+  hash->chaserCount  = 0;
+  hash->mask         = buckets - 1;
+  hash->tick         = 0;
+  hash->captureStamp = 0;
+  for (i = 0; i < buckets; i++)
+    hash->bucket[i] = -1;
+
+  return hash;
+}
+
+/*
+ * エンティティを登録する
+ * 引数 :
+ *   hash      - 空間ハッシュへのポインタ
+ *   inMainMap - メインマップにいるか
+ *   x, y      - 座標
+ *   chaser    - 鬼なら 1
+ * 戻値 :
+ *   エンティティ番号
+ */
+int addSpatialEntity(SpatialHash *hash, int inMainMap, int x, int y, int chaser)
+{
+  int id = hash->entities;
+  SpatialEntity *e;
+
+  if (id >= hash->maxEntities) {
+    fprintf(stderr, "Error: too many entities\n");
+    exit(1);
+  }
+  hash->entities++;
+
+  e = &hash->entity[id];
+  e->key           = cellKey(inMainMap, x, y);
+  e->preKey        = e->key;
+  e->movedTick     = -1;
+  e->capturedStamp = -1;
+  e->chaser        = chaser;
+  linkEntity(hash, id);
+
+  if (chaser)
+    hash->chasers[hash->chaserCount++] = id;
+
+  return id;
+}
+
+/*
+ * 新しいティックを始める(これ以降の移動がこのティックの移動になる)
+ * 引数 :
+ *   hash - 空間ハッシュへのポインタ
+ */
+void startSpatialTick(SpatialHash *hash)
+{
+  hash->tick++;
+}
+
+/*
+ * エンティティの移動を反映する(動いていなければ何もしない)
+ * 引数 :
+ *   hash      - 空間ハッシュへのポインタ
+ *   id        - エンティティ番号
+ *   inMainMap - メインマップにいるか
+ *   x, y      - 移動後の座標
+ */
+void moveSpatialEntity(SpatialHash *hash, int id, int inMainMap, int x, int y)
+{
+  SpatialEntity *e = &hash->entity[id];
+  long key = cellKey(inMainMap, x, y);
+
+  if (key == e->key)
+    return;
+
+  // 同じティックに 2 回動いた場合も, ティックの最初にいたマスを覚えておく
+  if (e->movedTick != hash->tick) {
+    e->preKey    = e->key;
+    e->movedTick = hash->tick;
+  }
+
+  // バケツを付け替える
+  unlinkEntity(hash, id);
+  e->key = key;
+  linkEntity(hash, id);
+}
+
+/*
+ * このティックの捕獲イベントをすべて求める
+ * 同じマスに鬼と逃げる役がいる場合と, このティックに鬼と逃げる役がマスを
+ * 入れ替えた(すれ違った)場合を捕獲とする. 1 回の呼び出しで逃げる役 1 人につき 1 件だけ報告する
+ * 引数 :
+ *   hash   - 空間ハッシュへのポインタ
+ *   events - 捕獲イベントを格納する配列(出力)
+ *   max    - events に格納できる数
+ * 戻値 :
+ *   捕獲イベントの数
+ */
+int findCaptures(SpatialHash *hash, CaptureEvent *events, int max)
+{
+  SpatialEntity *entity = hash->entity;    // ショートカット
+  int n = 0, c, i;
+
+  hash->captureStamp++;
+
+  for (c = 0; c < hash->chaserCount && n < max; c++) {
+    int id = hash->chasers[c];
+    SpatialEntity *chaser = &entity[id];
+
+    // 鬼と同じマスにいる逃げる役
+    for (i = hash->bucket[hashKey(hash, chaser->key)]; i >= 0; i = entity[i].next)
+      if (entity[i].key == chaser->key && !entity[i].chaser)
+        n = addCapture(hash, events, n, max, id, i, 0);
+
+    // 鬼とマスを入れ替えた逃げる役(鬼の元のマスに今いて, 鬼の今のマスから来た)
+    if (chaser->movedTick != hash->tick)
+      continue;
+    for (i = hash->bucket[hashKey(hash, chaser->preKey)]; i >= 0; i = entity[i].next)
+      if (entity[i].key == chaser->preKey && !entity[i].chaser &&
+          entity[i].movedTick == hash->tick && entity[i].preKey == chaser->key)
+        n = addCapture(hash, events, n, max, id, i, 1);
+  }
+
+  return n;
+}
+
+/*
+ * 空間ハッシュの後始末
+ * 引数 :
+ *   hash - 空間ハッシュへのポインタ
+ */
+void destroySpatialHash(SpatialHash *hash)
+{
+  if (hash == NULL)
+    return;
+  arenaFree(hash->arena, hash->entity);
+  arenaFree(hash->arena, hash->chasers);
+  arenaFree(hash->arena, hash->bucket);
+  arenaFree(hash->arena, hash);
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * マップ・座標をまとめて 1 つのキーにする
+ */
+static long cellKey(int inMainMap, int x, int y)
+{
+  return ((long)(inMainMap ? 1 : 0) << 42) | ((long)y << 21) | (long)x;
+}
+
+/*
+ * キーからバケツ番号を求める
+ */
+static int hashKey(SpatialHash *hash, long key)
+{
+  return (int)(((unsigned long)key * 0x9E3779B97F4A7C15UL) >> 40) & hash->mask;
+}
+
+/*
+ * エンティティを今いるマスのバケツの先頭につなぐ
+ */
+static void linkEntity(SpatialHash *hash, int id)
+{
+  SpatialEntity *e = &hash->entity[id];
+  int h = hashKey(hash, e->key);
+
+  e->prev = -1;
+  e->next = hash->bucket[h];
+  if (e->next >= 0)
+    hash->entity[e->next].prev = id;
+  hash->bucket[h] = id;
+}
+
+/*
+ * エンティティを今いるマスのバケツから外す
+ */
+static void unlinkEntity(SpatialHash *hash, int id)
+{
+  SpatialEntity *e = &hash->entity[id];
+
+  if (e->prev >= 0)
+    hash->entity[e->prev].next = e->next;
+  else
+    hash->bucket[hashKey(hash, e->key)] = e->next;
+  if (e->next >= 0)
+    hash->entity[e->next].prev = e->prev;
+}
+
+/*
+ * 捕獲イベントを追加する(この呼び出しですでに捕まっていれば追加しない)
+ * 戻値 :
+ *   追加後のイベント数
+ */
+static int addCapture(SpatialHash *hash, CaptureEvent *events, int n, int max,
+                      int chaser, int evader, int passThrough)
+{
+  if (n >= max || hash->entity[evader].capturedStamp == hash->captureStamp)
+    return n;
+
+  hash->entity[evader].capturedStamp = hash->captureStamp;
+  events[n].chaser      = chaser;
+  events[n].evader      = evader;
+  events[n].passThrough = passThrough;
+
+  return n + 1;
+}
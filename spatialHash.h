@@ -0,0 +1,119 @@
+/********************************************************************
+                       空間ハッシュ(捕獲判定)モジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef SPATIAL_HASH_H
+#define SPATIAL_HASH_H
+
+#include "roomPool.h"          // 部屋プールモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//   空間ハッシュモジュールにおける型の定義
+//--------------------------------------------------------------------
+
+/*
+ * 空間ハッシュに登録するエンティティ(プレイヤー)
+ */
+typedef struct {
+  long    key;                   // 今いるマス(マップ, Y, X をまとめた値)
+  long    preKey;                // このティックで動く前にいたマス
+  int     movedTick;             // 最後に動いたティック
+  int     capturedStamp;         // 最後に捕まったときの findCaptures() の呼び出し番号
+  int     chaser;                // 鬼なら 1
+  int     prev;                  // 同じバケツの前のエンティティ(-1 なら先頭)
+  int     next;                  // 同じバケツの次のエンティティ(-1 なら末尾)
+} SpatialEntity;
+
+/*
+ * 空間ハッシュ構造体の定義
+ * マスごとにそこにいるエンティティをバケツでつなぎ, 移動のたびに差分で更新する.
+ * 捕獲判定は鬼ごとに自分のマス(とすれ違い用に元のマス)のバケツを見るだけなので,
+ * 1 ティックあたり O(N) で済む
+ */
+typedef struct {
+  int            maxEntities;    // 登録できるエンティティの数
+  int            entities;       // 登録したエンティティの数
+  SpatialEntity *entity;         // エンティティの配列
+  int           *chasers;        // 鬼のエンティティ番号の配列
+  int            chaserCount;    // 鬼の数
+  int           *bucket;         // バケツの先頭のエンティティ番号(-1 なら空)
+  int            mask;           // バケツの数 - 1
+  int            tick;           // 現在のティック
+  int            captureStamp;   // findCaptures() の呼び出し番号
+  Arena         *arena;          // 確保に使ったアリーナ(NULL ならヒープ)
+} SpatialHash;
+
+/*
+ * 捕獲イベント
+ */
+typedef struct {
+  int     chaser;                // 捕まえた鬼のエンティティ番号
+  int     evader;                // 捕まった逃げる役のエンティティ番号
+  int     passThrough;           // すれ違い(マスを入れ替えた)による捕獲なら 1
+} CaptureEvent;
+
+
+//--------------------------------------------------------------------
+//   空間ハッシュモジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * 空間ハッシュの作成
+ * 引数 :
+ *   maxEntities - 登録できるエンティティの数
+ *   arena       - 確保に使うアリーナ(NULL ならヒープ)
+ * 戻値 :
+ *   空間ハッシュへのポインタ
+ */
+SpatialHash* createSpatialHash(int maxEntities, Arena *arena);
+
+/*
+ * エンティティを登録する
+ * 引数 :
+ *   hash      - 空間ハッシュへのポインタ
+ *   inMainMap - メインマップにいるか
+ *   x, y      - 座標
+ *   chaser    - 鬼なら 1
+ * 戻値 :
+ *   エンティティ番号
+ */
+int addSpatialEntity(SpatialHash *hash, int inMainMap, int x, int y, int chaser);
+
+/*
+ * 新しいティックを始める(これ以降の移動がこのティックの移動になる)
+ * 引数 :
+ *   hash - 空間ハッシュへのポインタ
+ */
+void startSpatialTick(SpatialHash *hash);
+
+/*
+ * エンティティの移動を反映する(動いていなければ何もしない)
+ * 引数 :
+ *   hash      - 空間ハッシュへのポインタ
+ *   id        - エンティティ番号
+ *   inMainMap - メインマップにいるか
+ *   x, y      - 移動後の座標
+ */
+void moveSpatialEntity(SpatialHash *hash, int id, int inMainMap, int x, int y);
+
+/*
+ * このティックの捕獲イベントをすべて求める
+ * 同じマスに鬼と逃げる役がいる場合と, このティックに鬼と逃げる役がマスを
+ * 入れ替えた(すれ違った)場合を捕獲とする. 1 回の呼び出しで逃げる役 1 人につき 1 件だけ報告する
+ * 引数 :
+ *   hash   - 空間ハッシュへのポインタ
+ *   events - 捕獲イベントを格納する配列(出力)
+ *   max    - events に格納できる数
+ * 戻値 :
+ *   捕獲イベントの数
+ */
+int findCaptures(SpatialHash *hash, CaptureEvent *events, int max);
+
+/*
+ * 空間ハッシュの後始末
+ * 引数 :
+ *   hash - 空間ハッシュへのポインタ
+ */
+void destroySpatialHash(SpatialHash *hash);
+
+#endif
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spscQueue.h"         // SPSC キューモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * SPSC キューの作成
+ * 引数 :
+ *   capacity - 入れられる要素の数(2 のべき乗に切り上げる)
+ *   elemSize - 要素 1 つのバイト数
+ *   arena    - 確保に使うアリーナ(NULL ならヒープ)
+ * 戻値 :
+ *   SPSC キューへのポインタ
+ */
+SpscQueue* createSpscQueue(int capacity, int elemSize, Arena *arena)
+{
+  SpscQueue *queue;
+  int        size = 1;
+
+  while (size < capacity)
+    size *= 2;
+
+  // head と tail を別のキャッシュラインに置くため, キュー自体も境界に揃える
+  queue = (SpscQueue *)arenaAlloc(arena, sizeof(SpscQueue), SPSC_CACHE_LINE);
+  queue->buf        = (char *)arenaAlloc(arena, (size_t)size * elemSize, SPSC_CACHE_LINE);
+  queue->arena      = arena;
+  queue->head       = 0;
+  queue->cachedTail = 0;
+  queue->tail       = 0;
+  queue->cachedHead = 0;
+  queue->pushes     = 0;
+  queue->fulls      = 0;
+  queue->maxDepth   = 0;
+  queue->capacity   = size;
+  queue->elemSize   = elemSize;
+
+  return queue;
+}
+
+/*
+ * 要素を入れる(生産者のスレッドだけが呼ぶ)
+ * 引数 :
+ *   queue - SPSC キューへのポインタ
+ *   elem  - 入れる要素
+ * 戻値 :
+ *   入れられれば 1, 満杯なら 0
+ */
+int pushSpscQueue(SpscQueue *queue, const void *elem)
+{
+  unsigned long tail = queue->tail;
+  int           depth;
+
+  // 満杯に見えるときだけ, 消費者が進めた head を読み直す
+  if (tail - queue->cachedHead >= (unsigned long)queue->capacity) {
+    queue->cachedHead = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    if (tail - queue->cachedHead >= (unsigned long)queue->capacity) {
+      __atomic_store_n(&queue->fulls, queue->fulls + 1, __ATOMIC_RELAXED);
+      return 0;
+    }
+  }
+
+  memcpy(queue->buf + (tail & (queue->capacity - 1)) * queue->elemSize, elem, queue->elemSize);
+  __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+  // 溜まっている数は統計のためなので, 順序を保証しない読み出しで十分
+  depth = (int)(tail + 1 - __atomic_load_n(&queue->head, __ATOMIC_RELAXED));
+  if (depth > queue->maxDepth)
+    __atomic_store_n(&queue->maxDepth, depth, __ATOMIC_RELAXED);
+  __atomic_store_n(&queue->pushes, queue->pushes + 1, __ATOMIC_RELAXED);
+
+  return 1;
+}
+
+/*
+ * 要素を取り出す(消費者のスレッドだけが呼ぶ)
+ * 引数 :
+ *   queue - SPSC キューへのポインタ
+ *   elem  - 取り出した要素を格納する領域(出力)
+ * 戻値 :
+ *   取り出せれば 1, 空なら 0
+ */
+int popSpscQueue(SpscQueue *queue, void *elem)
+{
+  unsigned long head = queue->head;
+
+  // 空に見えるときだけ, 生産者が進めた tail を読み直す
+  if (head == queue->cachedTail) {
+    queue->cachedTail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (head == queue->cachedTail)
+      return 0;
+  }
+
+  memcpy(elem, queue->buf + (head & (queue->capacity - 1)) * queue->elemSize, queue->elemSize);
+  __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+/*
+ * SPSC キューの統計を得る(どのスレッドから呼んでもよい)
+ * 引数 :
+ *   queue - SPSC キューへのポインタ
+ *   stats - 統計を格納する構造体(出力)
+ */
+void getSpscQueueStats(SpscQueue *queue, SpscQueueStats *stats)
+{
+  unsigned long head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+  unsigned long tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+  stats->capacity = queue->capacity;
+  stats->depth    = tail >= head ? (int)(tail - head) : 0;
+  stats->maxDepth = __atomic_load_n(&queue->maxDepth, __ATOMIC_RELAXED);
+  stats->pushes   = __atomic_load_n(&queue->pushes, __ATOMIC_RELAXED);
+  stats->fulls    = __atomic_load_n(&queue->fulls, __ATOMIC_RELAXED);
+}
+
+/*
+ * SPSC キューの後始末
+ * 引数 :
+ *   queue - SPSC キューへのポインタ
+ */
+void destroySpscQueue(SpscQueue *queue)
+{
+  if (queue == NULL)
+    return;
+  arenaFree(queue->arena, queue->buf);
+  arenaFree(queue->arena, queue);
+}
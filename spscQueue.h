@@ -0,0 +1,103 @@
+/********************************************************************
+                       SPSC キューモジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include "roomPool.h"          // 部屋プールモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//   SPSC キューモジュールにおける型の定義
+//--------------------------------------------------------------------
+#define SPSC_CACHE_LINE   64     // 生産者と消費者が書く変数を離す距離(バイト)
+
+/*
+ * 単一生産者・単一消費者の有限長キュー
+ * 生産者だけが tail を, 消費者だけが head を書くのでロックは要らない.
+ * 相手の位置は読むたびに共有変数を見ず, 足りなくなったときだけ読み直す
+ */
+typedef struct {
+  // 消費者が書く変数
+  unsigned long head;            // 次に取り出す位置
+  unsigned long cachedTail;      // 最後に読んだ tail
+  char          pad1[SPSC_CACHE_LINE - 2 * sizeof(unsigned long)];
+
+  // 生産者が書く変数
+  unsigned long tail;            // 次に入れる位置
+  unsigned long cachedHead;      // 最後に読んだ head
+  unsigned long pushes;          // 入れた要素の数
+  unsigned long fulls;           // 満杯で入れられなかった回数
+  int           maxDepth;        // これまでで最も多く溜まった要素の数
+  char          pad2[SPSC_CACHE_LINE - 4 * sizeof(unsigned long) - sizeof(int)];
+
+  // 作成後は変わらない変数
+  int           capacity;        // 入れられる要素の数(2 のべき乗)
+  int           elemSize;        // 要素 1 つのバイト数
+  char         *buf;             // 要素を入れる領域
+  Arena        *arena;           // 確保に使ったアリーナ(NULL ならヒープ)
+} SpscQueue;
+
+/*
+ * SPSC キューの統計
+ */
+typedef struct {
+  int           capacity;        // 入れられる要素の数
+  int           depth;           // 今溜まっている要素の数
+  int           maxDepth;        // これまでで最も多く溜まった要素の数
+  unsigned long pushes;          // 入れた要素の数
+  unsigned long fulls;           // 満杯で入れられなかった回数
+} SpscQueueStats;
+
+
+//--------------------------------------------------------------------
+//   SPSC キューモジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * SPSC キューの作成
+ * 引数 :
+ *   capacity - 入れられる要素の数(2 のべき乗に切り上げる)
+ *   elemSize - 要素 1 つのバイト数
+ *   arena    - 確保に使うアリーナ(NULL ならヒープ)
+ * 戻値 :
+ *   SPSC キューへのポインタ
+ */
+SpscQueue* createSpscQueue(int capacity, int elemSize, Arena *arena);
+
+/*
+ * 要素を入れる(生産者のスレッドだけが呼ぶ)
+ * 引数 :
+ *   queue - SPSC キューへのポインタ
+ *   elem  - 入れる要素
+ * 戻値 :
+ *   入れられれば 1, 満杯なら 0
+ */
+int pushSpscQueue(SpscQueue *queue, const void *elem);
+
+/*
+ * 要素を取り出す(消費者のスレッドだけが呼ぶ)
+ * 引数 :
+ *   queue - SPSC キューへのポインタ
+ *   elem  - 取り出した要素を格納する領域(出力)
+ * 戻値 :
+ *   取り出せれば 1, 空なら 0
+ */
+int popSpscQueue(SpscQueue *queue, void *elem);
+
+/*
+ * SPSC キューの統計を得る(どのスレッドから呼んでもよい)
+ * 引数 :
+ *   queue - SPSC キューへのポインタ
+ *   stats - 統計を格納する構造体(出力)
+ */
+void getSpscQueueStats(SpscQueue *queue, SpscQueueStats *stats);
+
+/*
+ * SPSC キューの後始末
+ * 引数 :
+ *   queue - SPSC キューへのポインタ
+ */
+void destroySpscQueue(SpscQueue *queue);
+
+#endif
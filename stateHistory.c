@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stateHistory.h"      // 状態履歴モジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * 状態履歴の作成
+ * 引数 :
+ *   entities - エンティティの数
+ *   ticks    - 保持するティック数
+ *   arena    - 確保に使うアリーナ(NULL ならヒープ)
+ * 戻値 :
+ *   状態履歴へのポインタ
+ */
+StateHistory* createStateHistory(int entities, int ticks, Arena *arena)
+{
+  StateHistory *history = (StateHistory *)arenaAlloc(arena, sizeof(StateHistory), ROOM_ALIGN);
+  int i;
+
+  history->tickOf   = (int *)arenaAlloc(arena, sizeof(int) * ticks, ROOM_ALIGN);
+  history->state    = (EntityState *)arenaAlloc(arena, sizeof(EntityState) * ticks * entities, ROOM_ALIGN);
+  history->arena    = arena;
+  history->entities = entities;
+  history->ticks    = ticks;
+  for (i = 0; i < ticks; i++)
+    history->tickOf[i] = -1;
+
+  return history;
+}
+
+/*
+ * あるティックのエンティティの状態を記録する
+ * 引数 :
+ *   history   - 状態履歴へのポインタ
+ *   tick      - ティック
+ *   entity    - エンティティ番号
+ *   inMainMap - メインマップにいるか
+ *   x, y      - 座標
+ */
+void recordState(StateHistory *history, int tick, int entity, int inMainMap, int x, int y)
+{
+  int slot = tick % history->ticks;
+  EntityState *state = &history->state[slot * history->entities + entity];
+
+  history->tickOf[slot] = tick;
+  state->x         = x;
+  state->y         = y;
+  state->inMainMap = inMainMap;
+}
+
+/*
+ * あるティックのエンティティの状態を得る
+ * 引数 :
+ *   history - 状態履歴へのポインタ
+ *   tick    - ティック
+ *   entity  - エンティティ番号
+ * 戻値 :
+ *   状態へのポインタ. そのティックがもう残っていなければ NULL
+ */
+EntityState* rewindState(StateHistory *history, int tick, int entity)
+{
+  int slot;
+
+  if (tick < 0)
+    return NULL;
+  slot = tick % history->ticks;
+  if (history->tickOf[slot] != tick)
+    return NULL;
+
+  return &history->state[slot * history->entities + entity];
+}
+
+/*
+ * 状態履歴の後始末
+ * 引数 :
+ *   history - 状態履歴へのポインタ
+ */
+void destroyStateHistory(StateHistory *history)
+{
+  if (history == NULL)
+    return;
+  arenaFree(history->arena, history->tickOf);
+  arenaFree(history->arena, history->state);
+  arenaFree(history->arena, history);
+}
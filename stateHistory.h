@@ -0,0 +1,81 @@
+/********************************************************************
+                       状態履歴(巻き戻し)モジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef STATE_HISTORY_H
+#define STATE_HISTORY_H
+
+#include "roomPool.h"          // 部屋プールモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//   状態履歴モジュールにおける型の定義
+//--------------------------------------------------------------------
+
+/*
+ * 1 ティック・1 エンティティ分の状態
+ */
+typedef struct {
+  int     x;                     // X 座標
+  int     y;                     // Y 座標
+  int     inMainMap;             // メインマップにいるか
+} EntityState;
+
+/*
+ * 状態履歴構造体の定義
+ * 直近 ticks ティック分の状態をリングバッファに持つ.
+ * ティック t の状態は t % ticks 番目に入っているので, 巻き戻しは添字計算だけで済む
+ */
+typedef struct {
+  int          entities;         // エンティティの数
+  int          ticks;            // 保持するティック数
+  int         *tickOf;           // リングの各位置に入っているティック(-1 なら空)
+  EntityState *state;            // 状態 (ticks * entities 個)
+  Arena       *arena;            // 確保に使ったアリーナ(NULL ならヒープ)
+} StateHistory;
+
+
+//--------------------------------------------------------------------
+//   状態履歴モジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * 状態履歴の作成
+ * 引数 :
+ *   entities - エンティティの数
+ *   ticks    - 保持するティック数
+ *   arena    - 確保に使うアリーナ(NULL ならヒープ)
+ * 戻値 :
+ *   状態履歴へのポインタ
+ */
+StateHistory* createStateHistory(int entities, int ticks, Arena *arena);
+
+/*
+ * あるティックのエンティティの状態を記録する
+ * 引数 :
+ *   history   - 状態履歴へのポインタ
+ *   tick      - ティック
+ *   entity    - エンティティ番号
+ *   inMainMap - メインマップにいるか
+ *   x, y      - 座標
+ */
+void recordState(StateHistory *history, int tick, int entity, int inMainMap, int x, int y);
+
+/*
+ * あるティックのエンティティの状態を得る
+ * 引数 :
+ *   history - 状態履歴へのポインタ
+ *   tick    - ティック
+ *   entity  - エンティティ番号
+ * 戻値 :
+ *   状態へのポインタ. そのティックがもう残っていなければ NULL
+ */
+EntityState* rewindState(StateHistory *history, int tick, int entity);
+
+/*
+ * 状態履歴の後始末
+ * 引数 :
+ *   history - 状態履歴へのポインタ
+ */
+void destroyStateHistory(StateHistory *history);
+
+#endif
@@ -0,0 +1,805 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "spatialHash.h"     // 空間ハッシュモジュール
+#include "stateHistory.h"    // 状態履歴モジュール
+#include "spscQueue.h"       // SPSC キューモジュール
+#include "roomPool.h"        // 部屋プールモジュール
+#include "matchStore.h"      // 試合結果ストアモジュール
+#include "roomCheckpoint.h"  // 部屋チェックポイントモジュール
+
+#define ARENA_SIZE     64    // spatial: エンティティが歩き回る正方形の 1 辺
+#define SPATIAL_TICKS  20000 // spatial: 1 回の計測のティック数
+#define CHASER_RATIO   10    // spatial: 何人に 1 人を鬼にするか
+#define ROOM_CYCLES    2000000 // rooms: 既定の部屋の作成・破棄の回数
+#define ROOM_LIVE      8     // rooms: 同時に使っている部屋の数
+#define ROOM_GAME_SIZE 2048  // rooms: ゲーム本体(TagGame 相当)のバイト数
+#define ROOM_PLAYERS   2     // rooms: 部屋のプレイヤー数
+#define ROOM_HISTORY   32    // rooms: 部屋の状態履歴のティック数
+#define ROOM_QUEUE_LEN 64    // rooms: 部屋のステージ間キューの長さ
+#define ROOM_QUEUE_ELEM 48   // rooms: キューの要素のバイト数
+#define ROOM_REPORTS   4     // rooms: 途中で RSS を報告する回数
+#define RESULT_MATCHES 100000  // results: 既定の試合数
+#define RESULT_PLAYERS 1000  // results: プレイヤーの人数
+#define RESULT_LOG     "tagBench-results.log"  // results: 一時的なログファイル
+#define RESULT_GROW    100   // results: 1 人の鬼と対戦させる新しい逃げる役の人数(成績の表が何度か広がる)
+#define LINK_TRIPS     20000 // transport: 既定の往復の回数
+#define LINK_STREAM    10    // transport: 往復の何倍のメッセージを一方向に流すか
+#define LINK_MSG_LEN   68    // transport: メッセージの長さ(ゲームのメッセージと同じ)
+#define LINK_UNIX_NAME "tagBench.%d"   // transport: UNIX ドメインソケットの名前(抽象名前空間)
+#define CKPT_ROOMS     10000 // checkpoint: 既定の部屋の数
+#define CKPT_TICKS     100   // checkpoint: 部屋ごとに書くスナップショットの数
+#define CKPT_FILE      "tagBench-rooms.ckpt"  // checkpoint: 一時的なチェックポイントファイル
+
+// ベンチマーク用のプレイヤー
+typedef struct {
+  int     x, y;              // 今の座標
+  int     preX, preY;        // このティックで動く前の座標
+  int     chaser;            // 鬼なら 1
+} BenchPlayer;
+
+static void   usage();
+static int    benchSpatial(int argc, char *argv[]);
+static void   runSpatial(int entities, int ticks);
+static int    naiveCaptures(BenchPlayer *player, int n);
+static int    benchRooms(int argc, char *argv[]);
+static void   runRooms(RoomPool *pool, long cycles);
+static void  *createBenchRoom(Arena *arena);
+static void   destroyBenchRoom(Arena *arena, void *game);
+static int    benchResults(int argc, char *argv[]);
+static int    checkGrowth();
+static int    benchTransport(int argc, char *argv[]);
+static void   runTransport(int domain, long trips);
+static int    openLinkPair(int domain, int *peer);
+static void   echoPeer(int s);
+static int    readFrame(int s, char *frame);
+static int    benchCheckpoint(int argc, char *argv[]);
+static void   writeCheckpoints(int rooms);
+static void   restoreCheckpoints(char *label, int rooms);
+static int    compareDouble(const void *a, const void *b);
+static long   rssKB();
+static double now();
+
+int main(int argc, char *argv[])
+{
+  if (argc >= 2 && strcmp(argv[1], "spatial") == 0)
+    return benchSpatial(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "rooms") == 0)
+    return benchRooms(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "results") == 0)
+    return benchResults(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "transport") == 0)
+    return benchTransport(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "checkpoint") == 0)
+    return benchCheckpoint(argc, argv);
+
+  usage();
+  return 1;
+}
+
+/*
+ * 使い方を表示する
+ */
+static void usage()
+{
+  fprintf(stderr,
+          "usage: tagBench spatial [entities...]\n"
+          "       tagBench rooms [cycles]\n"
+          "       tagBench results [matches]\n"
+          "       tagBench transport [roundTrips]\n"
+          "       tagBench checkpoint [rooms]\n");
+}
+
+/*
+ * 空間ハッシュによる捕獲判定と, 総当たりの捕獲判定を比べる
+ * 引数でエンティティ数を指定しなければ 10, 100, 1000 人で計測する
+ */
+static int benchSpatial(int argc, char *argv[])
+{
+  int i;
+
+  printf("%8s %12s %12s %10s\n", "entities", "hash ns/tick", "naive ns/tick", "captures");
+  if (argc <= 2) {
+    runSpatial(10, SPATIAL_TICKS);
+    runSpatial(100, SPATIAL_TICKS);
+    runSpatial(1000, SPATIAL_TICKS);
+  }
+  for (i = 2; i < argc; i++)
+    runSpatial(atoi(argv[i]), SPATIAL_TICKS);
+
+  return 0;
+}
+
+/*
+ * 指定した人数のプレイヤーをランダムに歩かせ, 毎ティック捕獲を調べる
+ * 捕まった後も全員が歩き続ける(捕獲判定の負荷を一定に保つため)
+ */
+static void runSpatial(int entities, int ticks)
+{
+  static const int dx[5] = { 0, 1, -1, 0, 0 };
+  static const int dy[5] = { 0, 0, 0, 1, -1 };
+  BenchPlayer  *player = (BenchPlayer *)malloc(sizeof(BenchPlayer) * entities);
+  CaptureEvent *events = (CaptureEvent *)malloc(sizeof(CaptureEvent) * entities);
+  SpatialHash  *hash = createSpatialHash(entities, NULL);
+  long   hashCaptures = 0, naiveTotal = 0;
+  double hashTime = 0, naiveTime = 0, start;
+  int    t, i;
+
+  srand(entities);
+  for (i = 0; i < entities; i++) {
+    player[i].x = player[i].preX = rand() % ARENA_SIZE;
+    player[i].y = player[i].preY = rand() % ARENA_SIZE;
+    player[i].chaser = (i % CHASER_RATIO == 0);
+    addSpatialEntity(hash, 1, player[i].x, player[i].y, player[i].chaser);
+  }
+
+  for (t = 0; t < ticks; t++) {
+    // 全員を 1 マス動かす(計測には含めない)
+    for (i = 0; i < entities; i++) {
+      int d = rand() % 5;
+      player[i].preX = player[i].x;
+      player[i].preY = player[i].y;
+      player[i].x = (player[i].x + dx[d] + ARENA_SIZE) % ARENA_SIZE;
+      player[i].y = (player[i].y + dy[d] + ARENA_SIZE) % ARENA_SIZE;
+    }
+
+    // 空間ハッシュ: 差分更新と捕獲判定
+    start = now();
+    startSpatialTick(hash);
+    for (i = 0; i < entities; i++)
+      moveSpatialEntity(hash, i, 1, player[i].x, player[i].y);
+    hashCaptures += findCaptures(hash, events, entities);
+    hashTime += now() - start;
+
+    // 総当たり
+    start = now();
+    naiveTotal += naiveCaptures(player, entities);
+    naiveTime += now() - start;
+  }
+
+  printf("%8d %12.0f %12.0f %10ld%s\n", entities, hashTime * 1e9 / ticks,
+         naiveTime * 1e9 / ticks, hashCaptures,
+         hashCaptures == naiveTotal ? "" : "  (MISMATCH with naive)");
+
+  destroySpatialHash(hash);
+  free(player);
+  free(events);
+}
+
+/*
+ * 総当たりで捕獲された逃げる役の数を数える(同じマスかすれ違い)
+ */
+static int naiveCaptures(BenchPlayer *player, int n)
+{
+  int captures = 0, i, j;
+
+  for (j = 0; j < n; j++) {
+    if (player[j].chaser)
+      continue;
+    for (i = 0; i < n; i++) {
+      BenchPlayer *c = &player[i], *e = &player[j];
+      if (!c->chaser)
+        continue;
+      if ((c->x == e->x && c->y == e->y) ||
+          (c->x == e->preX && c->y == e->preY && e->x == c->preX && e->y == c->preY &&
+           (c->x != c->preX || c->y != c->preY))) {
+        captures++;
+        break;
+      }
+    }
+  }
+
+  return captures;
+}
+
+/*
+ * 部屋の作成・破棄を繰り返し, 1 秒あたりの部屋数と RSS の変化を
+ * 部屋プール(アリーナ)とヒープ(malloc/free)で比べる
+ */
+static int benchRooms(int argc, char *argv[])
+{
+  RoomPool *pool;
+  long      cycles = ROOM_CYCLES;
+
+  if (argc >= 3)
+    cycles = atol(argv[2]);
+  if (cycles <= 0) {
+    fprintf(stderr, "Error: bad cycle count\n");
+    return 1;
+  }
+
+  printf("%-6s %10s %12s %10s %10s\n", "alloc", "cycles", "rooms/s", "RSS start", "RSS end");
+
+  pool = createRoomPool(ROOM_LIVE, ROOM_ARENA_SIZE);
+  runRooms(pool, cycles);
+  printf("       arena peak %lu bytes of %lu per room\n",
+         (unsigned long)pool->room[0].arena.peak, (unsigned long)pool->room[0].arena.size);
+  destroyRoomPool(pool);
+
+  runRooms(NULL, cycles);
+
+  return 0;
+}
+
+/*
+ * ROOM_LIVE 個の部屋を使い回しながら cycles 回部屋を作り直す
+ * 引数 :
+ *   pool   - 部屋プール(NULL ならヒープから確保する)
+ *   cycles - 作成・破棄の回数
+ */
+static void runRooms(RoomPool *pool, long cycles)
+{
+  Room  *room[ROOM_LIVE];
+  void  *game[ROOM_LIVE];
+  long   startRss, i;
+  double start, elapsed;
+  int    slot;
+
+  // 先に全部の部屋を作っておき, 古い部屋から順に作り直す
+  for (slot = 0; slot < ROOM_LIVE; slot++) {
+    room[slot] = pool != NULL ? acquireRoom(pool) : NULL;
+    game[slot] = createBenchRoom(room[slot] != NULL ? &room[slot]->arena : NULL);
+  }
+
+  startRss = rssKB();
+  start = now();
+  for (i = 0; i < cycles; i++) {
+    slot = i % ROOM_LIVE;
+    if (pool != NULL) {
+      releaseRoom(pool, room[slot]);
+      room[slot] = acquireRoom(pool);
+      game[slot] = createBenchRoom(&room[slot]->arena);
+    }
+    else {
+      destroyBenchRoom(NULL, game[slot]);
+      game[slot] = createBenchRoom(NULL);
+    }
+
+    if ((i + 1) % (cycles / ROOM_REPORTS > 0 ? cycles / ROOM_REPORTS : 1) == 0 && i + 1 < cycles)
+      printf("%-6s %10ld %12s %10s %8ldKB\n", pool != NULL ? "arena" : "heap", i + 1, "", "", rssKB());
+  }
+  elapsed = now() - start;
+
+  printf("%-6s %10ld %12.0f %8ldKB %8ldKB\n", pool != NULL ? "arena" : "heap", cycles,
+         cycles / elapsed, startRss, rssKB());
+
+  for (slot = 0; slot < ROOM_LIVE; slot++) {
+    if (pool != NULL)
+      releaseRoom(pool, room[slot]);
+    else
+      destroyBenchRoom(NULL, game[slot]);
+  }
+}
+
+/*
+ * 部屋 1 つ分のデータを作る(ゲーム本体, 空間ハッシュ, 状態履歴, ステージ間キュー 4 本)
+ * 戻値 :
+ *   ゲーム本体へのポインタ(先頭に部屋のデータへのポインタを置く)
+ */
+static void *createBenchRoom(Arena *arena)
+{
+  void **game = (void **)arenaAlloc(arena, ROOM_GAME_SIZE, ROOM_ALIGN);
+  int    i;
+
+  memset(game, 0, ROOM_GAME_SIZE);
+  game[0] = createSpatialHash(ROOM_PLAYERS, arena);
+  game[1] = createStateHistory(ROOM_PLAYERS, ROOM_HISTORY, arena);
+  for (i = 0; i < 4; i++)
+    game[2 + i] = createSpscQueue(ROOM_QUEUE_LEN, ROOM_QUEUE_ELEM, arena);
+
+  return game;
+}
+
+/*
+ * 部屋 1 つ分のデータを個別に解放する(ヒープの場合)
+ */
+static void destroyBenchRoom(Arena *arena, void *game)
+{
+  void **data = (void **)game;
+  int    i;
+
+  destroySpatialHash((SpatialHash *)data[0]);
+  destroyStateHistory((StateHistory *)data[1]);
+  for (i = 0; i < 4; i++)
+    destroySpscQueue((SpscQueue *)data[2 + i]);
+  arenaFree(arena, game);
+}
+
+/*
+ * 試合結果ストアに試合を記録し続け, 記録する側が待たされた時間と
+ * まとめ書きの回数, ログを読み直して成績を作り直す時間を計る
+ */
+static int benchResults(int argc, char *argv[])
+{
+  MatchStore     *store;
+  MatchStoreStats stats;
+  MatchRecord     record;
+  PlayerStats     top[MATCH_TOP_K];
+  long            matches = RESULT_MATCHES, i, retries = 0;
+  double          start, t, elapsed, worst = 0;
+
+  if (argc >= 3)
+    matches = atol(argv[2]);
+  if (matches <= 0) {
+    fprintf(stderr, "Error: bad match count\n");
+    return 1;
+  }
+
+  // 計る前に, 成績の表が広がっても正しく数えるかを確かめる
+  if (!checkGrowth())
+    return 1;
+  unlink(RESULT_LOG);
+
+  //
+  // 記録する(満杯なら書き込みスレッドが追いつくまで譲る. ゲームでは捨てる)
+  //
+  store = openMatchStore(RESULT_LOG);
+  start = now();
+  for (i = 0; i < matches; i++) {
+    bzero(&record, sizeof(MatchRecord));
+    record.time   = i;
+    record.ticks  = i % 600;
+    record.result = i % 3;
+    sprintf(record.chaser, "player%ld", i % RESULT_PLAYERS);
+    sprintf(record.evader, "player%ld", (i * 7 + 1) % RESULT_PLAYERS);
+
+    t = now();
+    while (!submitMatch(store, &record)) {
+      retries++;
+      sched_yield();
+      t = now();
+    }
+    if (now() - t > worst)
+      worst = now() - t;
+  }
+
+  // すべてディスクに届くまで待つ
+  do {
+    sched_yield();
+    getMatchStoreStats(store, &stats);
+  } while (stats.committed < (unsigned long)matches);
+  elapsed = now() - start;
+  closeMatchStore(store);
+
+  printf("write : %ld matches in %.3f s (%.0f matches/s), %lu fdatasync (%.1f matches each)\n",
+         matches, elapsed, matches / elapsed, stats.commits, (double)stats.committed / stats.commits);
+  printf("        worst submit %.1f us, %ld retries on full queue\n", worst * 1e6, retries);
+
+  // ログを読み直して成績を作り直す
+  store = openMatchStore(RESULT_LOG);
+  getMatchStoreStats(store, &stats);
+  printf("replay: %lu matches, %d players in %.3f ms (%.0f matches/s)\n",
+         stats.replayed, stats.players, stats.replayUsec / 1000.0,
+         stats.replayUsec > 0 ? stats.replayed / (stats.replayUsec / 1e6) : 0.0);
+
+  start = now();
+  for (i = 0; i < 1000; i++)
+    topPlayers(store, top, MATCH_TOP_K);
+  printf("top-%d: %.1f us per query (leader %s, %d wins)\n",
+         MATCH_TOP_K, (now() - start) * 1e6 / 1000, top[0].name, top[0].wins);
+
+  closeMatchStore(store);
+  unlink(RESULT_LOG);
+
+  return 0;
+}
+
+/*
+ * 1 人の鬼が初めて現れる逃げる役と次々に対戦したとき, 成績の表が広がっても
+ * 正しく数えられるかを確かめる(書いたときと, ログを読み直したときの両方)
+ * 戻値 :
+ *   正しければ 1
+ */
+static int checkGrowth()
+{
+  MatchStore     *store;
+  MatchStoreStats stats;
+  MatchRecord     record;
+  PlayerStats     player;
+  char            name[MATCH_NAME_LEN];
+  int             pass, i, ok = 1;
+
+  unlink(RESULT_LOG);
+  for (pass = 0; pass < 2; pass++) {
+    store = openMatchStore(RESULT_LOG);
+
+    // 1 回目は記録して書き終わるのを待ち, 2 回目はログを読み直しただけで調べる
+    if (pass == 0) {
+      for (i = 0; i < RESULT_GROW; i++) {
+        bzero(&record, sizeof(MatchRecord));
+        record.time   = i;
+        record.result = MATCH_CHASER_WON;
+        strcpy(record.chaser, "chaser");
+        sprintf(record.evader, "evader%d", i);
+        while (!submitMatch(store, &record))
+          sched_yield();
+      }
+      do {
+        sched_yield();
+        getMatchStoreStats(store, &stats);
+      } while (stats.committed < RESULT_GROW);
+    }
+
+    if (!lookupPlayer(store, "chaser", &player) || player.games != RESULT_GROW || player.wins != RESULT_GROW)
+      ok = 0;
+    for (i = 0; i < RESULT_GROW; i++) {
+      sprintf(name, "evader%d", i);
+      if (!lookupPlayer(store, name, &player) || player.games != 1 || player.losses != 1)
+        ok = 0;
+    }
+    closeMatchStore(store);
+  }
+  unlink(RESULT_LOG);
+
+  printf("grow  : 1 chaser against %d new evaders %s\n", RESULT_GROW, ok ? "ok" : "MISCOUNTED");
+
+  return ok;
+}
+
+/*
+ * 同じホストのサーバーとクライアントの間の通信を, TCP のループバックと
+ * UNIX ドメインソケットで比べる(ゲームと同じ長さのメッセージの往復時間と,
+ * 一方向に流したときのメッセージ数)
+ */
+static int benchTransport(int argc, char *argv[])
+{
+  long trips = LINK_TRIPS;
+
+  if (argc >= 3)
+    trips = atol(argv[2]);
+  if (trips <= 0) {
+    fprintf(stderr, "Error: bad round trip count\n");
+    return 1;
+  }
+
+  printf("%-6s %8s %8s %8s %8s %12s %8s\n",
+         "link", "trips", "mean us", "p50 us", "p99 us", "stream msg/s", "MB/s");
+  runTransport(AF_INET, trips);
+  runTransport(AF_UNIX, trips);
+
+  return 0;
+}
+
+/*
+ * 1 種類の通信路で往復時間と流量を計る(相手は子プロセスで動かす)
+ * 引数 :
+ *   domain - AF_INET なら TCP のループバック, AF_UNIX なら UNIX ドメインソケット
+ *   trips  - 往復の回数
+ */
+static void runTransport(int domain, long trips)
+{
+  char    frame[LINK_MSG_LEN];
+  double *rtt = (double *)malloc(sizeof(double) * trips);
+  double  start, t, sum = 0, elapsed;
+  long    i, stream = trips * LINK_STREAM;
+  int     s, peer;
+  pid_t   pid;
+
+  if (rtt == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+
+  // 子プロセスが接続してきて, 届いたメッセージを送り返す
+  s = openLinkPair(domain, &peer);
+  fflush(stdout);                     // 子プロセスが同じ出力をもう一度書かないように
+  if ((pid = fork()) == 0) {
+    close(s);
+    echoPeer(peer);
+    exit(0);
+  }
+  close(peer);
+  if ((peer = accept(s, NULL, NULL)) < 0) {
+    fprintf(stderr, "Error: cannot accept\n");
+    exit(1);
+  }
+  close(s);
+  s = peer;
+
+  // 往復時間(ゲームの ping/pong と同じく, 1 つ送って返事を待つ)
+  memset(frame, 0, LINK_MSG_LEN);
+  for (i = 0; i < trips; i++) {
+    frame[0] = 'P';
+    t = now();
+    if (write(s, frame, LINK_MSG_LEN) != LINK_MSG_LEN || readFrame(s, frame) < 0) {
+      fprintf(stderr, "Error: peer closed the connection\n");
+      exit(1);
+    }
+    rtt[i] = now() - t;
+    sum   += rtt[i];
+  }
+  qsort(rtt, trips, sizeof(double), compareDouble);
+
+  // 一方向に流す(最後のメッセージにだけ返事をもらう)
+  start = now();
+  frame[0] = 'S';
+  for (i = 0; i < stream - 1; i++)
+    if (write(s, frame, LINK_MSG_LEN) != LINK_MSG_LEN)
+      break;
+  frame[0] = 'E';
+  if (write(s, frame, LINK_MSG_LEN) != LINK_MSG_LEN || readFrame(s, frame) < 0) {
+    fprintf(stderr, "Error: peer closed the connection\n");
+    exit(1);
+  }
+  elapsed = now() - start;
+
+  printf("%-6s %8ld %8.1f %8.1f %8.1f %12.0f %8.1f\n",
+         domain == AF_INET ? "tcp" : "unix", trips, sum / trips * 1e6,
+         rtt[trips / 2] * 1e6, rtt[trips * 99 / 100] * 1e6,
+         stream / elapsed, stream * LINK_MSG_LEN / elapsed / 1e6);
+
+  close(s);
+  waitpid(pid, NULL, 0);
+  free(rtt);
+}
+
+/*
+ * 待ち受けソケットと, そこへ接続したソケットを作る
+ * 引数 :
+ *   domain - AF_INET なら 127.0.0.1 の空いているポート, AF_UNIX なら抽象名前空間の名前
+ *   peer   - 接続したソケット(出力)
+ * 戻値 :
+ *   待ち受けソケット
+ */
+static int openLinkPair(int domain, int *peer)
+{
+  struct sockaddr_in in;
+  struct sockaddr_un un;
+  struct sockaddr   *addr;
+  socklen_t          len;
+  int                s;
+
+  if (domain == AF_INET) {
+    memset(&in, 0, sizeof(in));
+    in.sin_family      = AF_INET;
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr = (struct sockaddr *)&in;
+    len  = sizeof(in);
+  }
+  else {
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    snprintf(un.sun_path + 1, sizeof(un.sun_path) - 1, LINK_UNIX_NAME, (int)getpid());
+    addr = (struct sockaddr *)&un;
+    len  = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(un.sun_path + 1);
+  }
+
+  if ((s = socket(domain, SOCK_STREAM, 0)) < 0 || bind(s, addr, len) < 0 || listen(s, 1) < 0 ||
+      getsockname(s, addr, &len) < 0) {
+    fprintf(stderr, "Error: cannot listen\n");
+    exit(1);
+  }
+  if ((*peer = socket(domain, SOCK_STREAM, 0)) < 0 || connect(*peer, addr, len) < 0) {
+    fprintf(stderr, "Error: cannot connect\n");
+    exit(1);
+  }
+  return s;
+}
+
+/*
+ * 届いたメッセージを送り返す('S' は送り返さず, 'E' にだけ返事をする)
+ */
+static void echoPeer(int s)
+{
+  char frame[LINK_MSG_LEN];
+
+  while (readFrame(s, frame) == 0) {
+    if (frame[0] == 'S')
+      continue;
+    if (write(s, frame, LINK_MSG_LEN) != LINK_MSG_LEN)
+      break;
+  }
+  close(s);
+}
+
+/*
+ * LINK_MSG_LEN バイトのメッセージを読む(読めれば 0, 切断されたら -1)
+ */
+static int readFrame(int s, char *frame)
+{
+  int got = 0, n;
+
+  while (got < LINK_MSG_LEN) {
+    if ((n = read(s, frame + got, LINK_MSG_LEN - got)) <= 0)
+      return -1;
+    got += n;
+  }
+  return 0;
+}
+
+/*
+ * 部屋のチェックポイントを書く時間と, 落ちたサーバーの部屋をすべて引き取る時間を計る
+ * 書くのも引き取るのも子プロセスで動かす(書いた側はスロットを手放さずに終わるので,
+ * 落ちたサーバーと同じに見える). 引き取りはページキャッシュに載ったまま(warm)と,
+ * キャッシュから追い出してディスクから読む(cold)の 2 通りで計る
+ */
+static int benchCheckpoint(int argc, char *argv[])
+{
+  pid_t pid;
+  int   rooms = CKPT_ROOMS, fd;
+
+  if (argc >= 3)
+    rooms = atoi(argv[2]);
+  if (rooms <= 0) {
+    fprintf(stderr, "Error: bad room count\n");
+    return 1;
+  }
+  unlink(CKPT_FILE);
+
+  // 書く(子プロセスはスロットを手放さずに終わる)
+  fflush(stdout);
+  if ((pid = fork()) == 0) {
+    writeCheckpoints(rooms);
+    fflush(stdout);
+    _exit(0);
+  }
+  waitpid(pid, NULL, 0);
+
+  // ページキャッシュに載ったまま引き取る(引き取った子プロセスも手放さずに終わる)
+  if ((pid = fork()) == 0) {
+    restoreCheckpoints("warm", rooms);
+    fflush(stdout);
+    _exit(0);
+  }
+  waitpid(pid, NULL, 0);
+
+  // ディスクに書いてからキャッシュから追い出し, 読み直して引き取る
+  if ((fd = open(CKPT_FILE, O_RDONLY)) >= 0) {
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+  if ((pid = fork()) == 0) {
+    restoreCheckpoints("cold", rooms);
+    fflush(stdout);
+    _exit(0);
+  }
+  waitpid(pid, NULL, 0);
+
+  unlink(CKPT_FILE);
+
+  return 0;
+}
+
+/*
+ * rooms 個の部屋のスロットを得て, CKPT_TICKS 回ずつスナップショットを書く
+ * (ゲームの 1 ティックで全部屋が 1 回ずつ書いたときの時間も表示する)
+ */
+static void writeCheckpoints(int rooms)
+{
+  Checkpoint  *ckpt = openCheckpoint(CKPT_FILE, rooms);
+  RoomSnapshot snapshot;
+  double       start, elapsed;
+  int         *slot = (int *)malloc(sizeof(int) * rooms);
+  int          i, tick;
+
+  if (ckpt == NULL || slot == NULL) {
+    fprintf(stderr, "Error: cannot open %s\n", CKPT_FILE);
+    exit(1);
+  }
+
+  start = now();
+  for (i = 0; i < rooms; i++)
+    if ((slot[i] = acquireCheckpointSlot(ckpt)) < 0) {
+      fprintf(stderr, "Error: no free checkpoint slot\n");
+      exit(1);
+    }
+  elapsed = now() - start;
+  printf("acquire: %d slots in %.3f ms, file %lu KB (%lu bytes per room)\n",
+         rooms, elapsed * 1e3, (unsigned long)ckpt->size / 1024, (unsigned long)sizeof(CheckpointSlot));
+
+  bzero(&snapshot, sizeof(RoomSnapshot));
+  snapshot.roundState = 2;
+  snapshot.round      = 1;
+  snapshot.maxRewind  = 5;
+  snapshot.my.chara   = 'o';
+  snapshot.it.chara   = 'x';
+  start = now();
+  for (tick = 0; tick < CKPT_TICKS; tick++)
+    for (i = 0; i < rooms; i++) {
+      snapshot.token = i + 1;
+      snprintf(snapshot.name, ROOM_NAME_LEN, "room%d", i);
+      snapshot.tick = tick;
+      snapshot.my.x = 1 + (tick + i) % 30;
+      snapshot.my.y = 1 + tick % 15;
+      snapshot.it.x = 1 + (tick * 3 + i) % 30;
+      snapshot.it.y = 1 + (tick + 7) % 15;
+      saveRoomSnapshot(ckpt, slot[i], &snapshot);
+    }
+  elapsed = now() - start;
+  printf("save   : %ld snapshots in %.3f ms (%.0f ns each, %.3f ms per tick of all rooms)\n",
+         (long)rooms * CKPT_TICKS, elapsed * 1e3, elapsed * 1e9 / ((double)rooms * CKPT_TICKS),
+         elapsed * 1e3 / CKPT_TICKS);
+
+  // 落ちたサーバーと同じく, スロットを手放さずに終わる
+  free(slot);
+  closeCheckpoint(ckpt);
+}
+
+/*
+ * 落ちたサーバーの部屋をすべて引き取り, 部屋の状態を戻すまでの時間を計る
+ * 引数 :
+ *   label - 表示する名前
+ *   rooms - 書いた部屋の数(引き取れた数と比べる)
+ */
+static void restoreCheckpoints(char *label, int rooms)
+{
+  Checkpoint   *ckpt;
+  RoomSnapshot *restored = (RoomSnapshot *)malloc(sizeof(RoomSnapshot) * rooms);
+  double        start, elapsed;
+  int           n = 0, old = 0, i;
+
+  if (restored == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+
+  start = now();
+  if ((ckpt = openCheckpoint(CKPT_FILE, rooms)) == NULL) {
+    fprintf(stderr, "Error: cannot open %s\n", CKPT_FILE);
+    exit(1);
+  }
+  for (i = claimOrphanSnapshot(ckpt, 0, &restored[0]); i >= 0;
+       i = n < rooms ? claimOrphanSnapshot(ckpt, i + 1, &restored[n]) : -1) {
+    // 最後に書いたティックまで戻っているか
+    if (restored[n].tick != CKPT_TICKS - 1)
+      old++;
+    n++;
+  }
+  elapsed = now() - start;
+
+  printf("restore: %d of %d rooms (%s) in %.3f ms (%.2f us per room), %d not at the last tick\n",
+         n, rooms, label, elapsed * 1e3, elapsed * 1e6 / (n > 0 ? n : 1), old);
+
+  free(restored);
+  closeCheckpoint(ckpt);
+}
+
+/*
+ * qsort 用に double を比べる
+ */
+static int compareDouble(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * 今の RSS (KB)
+ */
+static long rssKB()
+{
+  FILE *fp = fopen("/proc/self/statm", "r");
+  long  size, resident = 0;
+
+  if (fp == NULL)
+    return -1;
+  if (fscanf(fp, "%ld %ld", &size, &resident) != 2)
+    resident = 0;
+  fclose(fp);
+
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/*
+ * 現在時刻(秒)
+ */
+static double now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
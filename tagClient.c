@@ -1,45 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#include "snet.h"           // а̿饤֥
-#include "tagGame.h"        // ä⥸塼
+#include "snet.h"           // 一対一通信ライブラリ
+#include "tagGame.h"        // 鬼ごっこモジュール
+#include "roomListener.h"   // 部屋リスナーモジュール
 
-#define PORT       10000    // ǥեȤΥС¦ݡֹ
-#define HOST_LEN   64       // ۥ̾κĹ
-#define MY_CHARA   'o'      // ʬɽ饯
-#define MY_SX      10       // ʬγ X ɸ
-#define MY_SY      10       // ʬγ Y ɸ
-#define IT_CHARA   'x'      // ɽ饯
-#define IT_SX      1       // γ X ɸ
-#define IT_SY      1       // γ Y ɸ
+#define PORT       10000    // デフォルトのサーバー側ポート番号
+#define HOST_LEN   64       // ホスト名の最大長
+#define MY_CHARA   'o'      // 自分を表すキャラクタ
+#define MY_SX      10       // 自分の開始 X 座標
+#define MY_SY      10       // 自分の開始 Y 座標
+#define IT_CHARA   'x'      // 相手を表すキャラクタ
+#define IT_SX      1       // 相手の開始 X 座標
+#define IT_SY      1       // 相手の開始 Y 座標
 
 int main(int argc, char *argv[]) 
 { 
-  char     serverName[HOST_LEN];    // СΥۥ̾
-  int      s;                       // 饤ȤȤβѥǥץ
-  TagGame *game;                    // ä
+  char     serverName[HOST_LEN];    // サーバーのホスト名
+  int      s;                       // クライアントとの会話用デスクリプタ
+  TagGame *game;                    // 鬼ごっこゲーム
+  int      opt;
+  char    *roomName = NULL;                 // -N の値
+  int      tcpOnly = FALSE;                 // -T が指定されたか
+  int      showNetClock = FALSE;            // -n が指定されたか
+  char    *name = NULL;                     // -u の値
+  int      indexChunked = FALSE;            // -I が指定されたか
 
-  // äν
+  // -n      : サーバーとの往復時間・揺らぎ・時計のずれを表示する
+  // -u 名前 : 自分のプレイヤー名(既定はログイン名)
+  // -N 部屋名 : 名前を付けた部屋に入る(既定は空いているどの部屋でもよい)
+  // -T      : サーバーが同じホストでも TCP で接続する
+  // -I      : チャンクマップ(.tmc)にも連結性インデックスを作る
+  // (使い方の表示が端末の設定に埋もれないよう, 鬼ごっこゲームの初期化より前に読む)
+  while ((opt = getopt(argc, argv, "nu:N:TI")) != -1) {
+    if (opt == 'n') {
+      showNetClock = TRUE;
+    } else if (opt == 'u') {
+      name = optarg;
+    } else if (opt == 'N') {
+      roomName = optarg;
+    } else if (opt == 'T') {
+      tcpOnly = TRUE;
+    } else if (opt == 'I') {
+      indexChunked = TRUE;
+    } else {
+      fprintf(stderr, "usage: %s [-n] [-u name] [-N room] [-T] [-I] [serverName]\n", argv[0]);
+      exit(1);
+    }
+  }
+
+  // 鬼ごっこゲームの初期化
   game = initTagGame(MY_CHARA, MY_SX, MY_SY, IT_CHARA, IT_SX, IT_SY);
+  game->showNetClock = showNetClock;
+  game->indexChunked = indexChunked;
+  if (name != NULL)
+    strncpy(game->myName, name, MATCH_NAME_LEN - 1);
 
-  // ǻꤵ줿ۥ̾򥵡ФȤ
-  // ⤷ʤмʬȤ򥵡СȤƲꤷߤ
-  if (argc == 2) 
-    strcpy(serverName, argv[1]);
+  // 引数で指定されたホスト名をサーバとする
+  // もし引数がなければ自分自身をサーバーとして仮定し，アクセスを試みる
+  if (optind < argc) 
+    strcpy(serverName, argv[optind]);
   else
     gethostname(serverName, HOST_LEN);
 
-  // С롣ΥСλΥݡȤ³,С
-  // Ȳä뤿Υǥץ֤
-  s = setupClient(serverName, PORT);
+  // サーバーを準備する。指定のサーバーの指定のポートに接続すると,サーバー
+  // と会話するためのデスクリプタを返す
+  // サーバーが同じホストで動いていれば, TCP のループバックではなく UNIX ドメインソケットでつなぐ
+  if (tcpOnly || (s = setupLocalClient(serverName, PORT, roomName)) < 0)
+    s = setupClient(serverName, PORT);
+
+  // 部屋に入る(サーバーが複数あれば, 部屋を持つサーバーへ接続が渡される)
+  switch (joinRoom(s, roomName)) {
+  case ROOM_JOINED:
+    break;
+  case ROOM_BUSY:
+    endwin();
+    fprintf(stderr, "Error: room is busy\n");
+    exit(1);
+  case ROOM_UNKNOWN:
+    // 部屋を名指ししなかったなら, 相手を待っているサーバーが 1 つも無い
+    endwin();
+    if (roomName == NULL)
+      fprintf(stderr, "Error: no server is waiting for a player\n");
+    else
+      fprintf(stderr, "Error: no such room '%s'\n", roomName);
+    exit(1);
+  default:
+    endwin();
+    fprintf(stderr, "Error: server closed the connection\n");
+    exit(1);
+  }
+
+  // サーバーと同じく, マップファイルが書き換えられたら新しいラウンドから新しいマップを使う
+  game->watchMaps = TRUE;
+
+  // サーバーが落ちたときに, 立ち上げ直したサーバーへ入り直せるように覚えておく
+  game->serverName = serverName;
+  game->port       = PORT;
 
-  // äν
+  // 鬼ごっこゲームの準備
   setupTagGame(game, s);
 
-  // äγ
+  // 鬼ごっこゲームの開始(再戦するあいだは同じサーバーと続ける)
   playClientTagGame(game);
 
-  // äθ
+  // 鬼ごっこゲームの後始末
   destroyTagGame(game);
 
   return 0;
@@ -2,103 +2,273 @@
 #include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
 
-#include "tagGame.h"           // ä⥸塼إåե
+#include "tagGame.h"           // 鬼ごっこモジュールヘッダファイル
+#include "mapChunk.h"          // マップチャンクキャッシュモジュールヘッダファイル
+#include "spscQueue.h"         // SPSC キューモジュールヘッダファイル
+#include "netClock.h"          // 通信遅延・時刻同期モジュールヘッダファイル
+#include "roomListener.h"      // 部屋リスナーモジュールヘッダファイル
 
-#define MAINWIN_LINES   20     // ᥤ󥦥ɥι⤵(Կ)
-#define MAINWIN_COLUMS  40     // ᥤ󥦥ɥβ()
-#define MAINWIN_SX      2      // ᥤ󥦥ɥκɸ
-#define MAINWIN_SY      1      // ᥤ󥦥ɥκɸ
+#define MAINWIN_LINES   20     // メインウィンドウの高さ(行数)
+#define MAINWIN_COLUMS  40     // メインウィンドウの横幅(桁数)
+#define MAINWIN_SX      2      // メインウィンドウの左上座標
+#define MAINWIN_SY      1      // メインウィンドウの左上座標
 
 
 
-#define SUBWIN_LINES   10     // ᥤ󥦥ɥι⤵(Կ)
-#define SUBWIN_COLUMS  40     // ᥤ󥦥ɥβ()
-#define SUBWIN_SX      44      // ᥤ󥦥ɥκɸ
-#define SUBWIN_SY      1      // ᥤ󥦥ɥκɸ
+#define SUBWIN_LINES   10     // メインウィンドウの高さ(行数)
+#define SUBWIN_COLUMS  40     // メインウィンドウの横幅(桁数)
+#define SUBWIN_SX      44      // メインウィンドウの左上座標
+#define SUBWIN_SY      1      // メインウィンドウの左上座標
 
 
 
-#define MOVE_UP         'i'    // ˰ư륭
-#define MOVE_LEFT       'j'    // ˰ư륭
-#define MOVE_DOWN       'k'    // ˰ư륭
-#define MOVE_RIGHT      'l'    // ˰ư륭
+#define WARP_MAIN_SX    37     // メインマップへワープしたときの到着 X 座標
+#define WARP_MAIN_SY    17     // メインマップへワープしたときの到着 Y 座標
+#define WARP_SUB_SX     2      // サブマップへワープしたときの到着 X 座標
+#define WARP_SUB_SY     2      // サブマップへワープしたときの到着 Y 座標
 
-// СåκĹ
-// ʬκɸ(8byte) + κɸ(8byte) + ʬΤޥå(8byte) + Τޥå(8byte) +'\0'
-#define SERVER_MSG_LEN   (8 + 8 + 8 + 8 + 1)
+#define CAMERA_MARGIN   4      // カメラが動き始めるウィンドウ端からの距離
 
-// 饤ȤåκĹ
-// Ƥ륭 + '\0'
-#define CLIENT_MSG_LEN   (4 + 1)
+#define HISTORY_TICKS    32    // サーバーが状態を覚えておくティック数
+#define MAX_REWIND_TICKS 5     // 捕獲判定で巻き戻す最大ティック数(既定値)
 
-//Mapط
-int** MAP;//2 (->ޥå)
-int** SUBMAP;
+#define TICK_MSEC        100   // サーバーの 1 ティックの長さ(ms)
+#define STAGE_QUEUE_LEN  64    // ステージ間のキューの長さ
+#define IO_POLL_MSEC     5     // 通信ステージが送るゲームの状態を見に行く間隔(ms)
+#define RENDER_POLL_MSEC 10    // 描画ステージがキー入力を待つ時間(ms)
+#define STALL_USEC       200   // キューが満杯のときに待つ時間(us)
+
+#define RESULT_PLAYING   0     // ゲーム中
+#define RESULT_WIN       1     // 鬼が逃げる役に追いついた
+#define RESULT_NO_CATCH  2     // もう鬼が逃げる役に追いつけない
+#define RESULT_QUIT      3     // どちらかが終了した
+#define RESULT_DESYNC    4     // ロックステップの同期が外れた
+#define RESULT_MAP_MISMATCH 5  // ラウンドを始めるときにマップの版が相手と食い違った
+
+#define TIMER_SLOT_MSEC  10    // ラウンドの合間のタイマーの精度(ms)
+#define LOBBY_POLL_MSEC  500   // ラウンドの合間にキー入力とメッセージを待つ最長の時間(ms)
+#define NAME_WAIT_MSEC   1000  // クライアントのプレイヤー名を待つ時間(ms. 届かなければ名無しで始める)
+#define COUNTDOWN_SECS   3     // ラウンドを始める前のカウントダウン(秒)
+#define RESULT_MSEC      3000  // 結果を表示しておく時間(ms)
+#define REMATCH_MSEC     20000 // 再戦するかの返事を待つ時間(ms)
+#define STALL_WAIT_MSEC  5000  // ロックステップで相手の入力を待つ最長の時間(ms. 過ぎたら相手が終了したとみなす)
+#define END_WAIT_MSEC    2000  // ロックステップの終わりのフレームを待つ最長の時間(ms. 過ぎたら切断されたとみなす)
+#define BYE_MSEC         2000  // 終わりのあいさつを表示しておく時間(ms)
+
+#define CHECKPOINT_TICKS 5     // ラウンド中に部屋の状態をチェックポイントに書く間隔(ティック)
+#define TOKEN_WAIT_MSEC  3000  // 入り直したクライアントが合言葉を送るのを待つ時間(ms)
+#define RESUME_WAIT_MSEC 30000 // クライアントがサーバーの立ち上げ直しを待つ時間(ms)
+#define REJOIN_MSEC      500   // クライアントが入り直しを試す間隔(ms)
+
+#define MOVE_UP         'i'    // 上に移動するキー
+#define MOVE_LEFT       'j'    // 左に移動するキー
+#define MOVE_DOWN       'k'    // 下に移動するキー
+#define MOVE_RIGHT      'l'    // 右に移動するキー
+
+// 2 つの長さの長い方
+#define LONGER(a, b)     ((a) > (b) ? (a) : (b))
+
+// サーバーが送信するメッセージの長さ(どのメッセージもこの長さで送る)
+// 自分の座標情報(12byte) + 相手の座標情報(12byte) + 自分のいるマップ(6byte) + 相手のいるマップ(6byte) + ティック(11byte) +'\0'
+// と, 時刻同期のメッセージ(ping/pong)の長い方
+#define SERVER_MSG_LEN   LONGER(12 + 12 + 6 + 6 + 11 + 1, SYNC_MSG_LEN)
+
+// クライアントが送信するメッセージの長さ(どのメッセージもこの長さで送る)
+// 押しているキー情報 + 最後に見た状態のティック + '\0' と, 時刻同期のメッセージの長い方
+#define CLIENT_MSG_LEN   LONGER(4 + 11 + 1, SYNC_MSG_LEN)
 
 //--------------------------------------------------------------------
-//  ä⥸塼ǻѤ빽¤Τ
+//  鬼ごっこゲームモジュール内部で使用する構造体の定義
 //--------------------------------------------------------------------
 
-// СϤϥǡ
+// サーバーに届く入力データ
 typedef struct {
-  int myKey;                   // 桼Ƥ륭
-  int itKey;                   // βƤ륭(饤ȤϤ)
-  int quit;                    // λåϤ TRUE
+  int myKey;                   // ユーザが押しているキー
+  int itKey;                   // 相手の押しているキー(クライアントから届く)
+  int itSeenTick;              // 相手がキーを押したときに見ていた状態のティック(クライアントから届く)
+  int quit;                    // ゲームを終了させるメッセージが届いた場合に TRUE
 } ServerInputData;
 
-// 饤ȤϤϥǡ
+// クライアントに届く入力データ
 typedef struct {
-  int myKey;                   // 桼Ƥ륭
-  int myX;                     // ʬ X ɸ(СϤ)
-  int myY;                     // ʬ Y ɸ(СϤ)
-  int itX;                     //  X ɸ(СϤ)
-  int itY;                     //  Y ɸ(СϤ)
-  int quit;                    // λåϤ TRUE
-  int myInMainMap;       // ʬᥤޥåפˤ뤫
-  int itInMainMap;       // ꤬ᥤޥåפˤ뤫
+  int myKey;                   // ユーザが押しているキー
+  int myX;                     // 自分の X 座標(サーバーから届く)
+  int myY;                     // 自分の Y 座標(サーバーから届く)
+  int itX;                     // 相手の X 座標(サーバーから届く)
+  int itY;                     // 相手の Y 座標(サーバーから届く)
+  int quit;                    // ユーザが終了のキーを押した場合に TRUE
+  int result;                  // ラウンドの結果(サーバーから届く. 届いていなければ RESULT_PLAYING)
+  int myInMainMap;       // 自分がメインマップにいるか
+  int itInMainMap;       // 相手がメインマップにいるか
+  int tick;              // 届いた状態のティック(サーバーから届く)
 } ClientInputData;
 
+// ステージ間で受け渡す入力イベント
+typedef struct {
+  int key;                     // 押されたキー
+  int seenTick;                // 相手がキーを押したときに見ていた状態のティック
+} InputEvent;
+
+// ステージ間で受け渡すゲームの状態
+typedef struct {
+  Player my;                   // 自分のデータ
+  Player it;                   // 相手のデータ
+  int    tick;                 // ティック
+  int    result;               // ゲームの結果(RESULT_*)
+} GameSnapshot;
+
+// ステージごとの統計(書くのはそのステージのスレッドだけ)
+typedef struct {
+  long   busyNs;               // 仕事をしていた時間
+  long   stallNs;              // 満杯のキューや送信で待たされた時間
+} StageStats;
+
+// サーバーのパイプライン
+// 通信・シミュレーション・描画の 3 つのステージを別スレッドで動かし,
+// 有限長の SPSC キューでつなぐ. 入力イベントは満杯なら捨て,
+// ゲームの状態は満杯なら空くまで待つ(待った時間をストールとして数える)
+// 終了・切断は捨てられないので, キューとは別にフラグで知らせる
+typedef struct {
+  TagGame    *game;
+  SpscQueue  *keyQueue;        // 描画 → シミュレーション: キー入力
+  SpscQueue  *netInQueue;      // 通信 → シミュレーション: 相手のキー入力
+  SpscQueue  *netOutQueue;     // シミュレーション → 通信: 相手に送るゲームの状態
+  SpscQueue  *renderQueue;     // シミュレーション → 描画: 描くゲームの状態
+  StageStats  io;              // 通信ステージの統計
+  StageStats  sim;             // シミュレーションステージの統計
+  StageStats  render;          // 描画ステージの統計
+  long        sentFrames;      // 相手に送ったゲームの状態の数
+  long        culledFrames;    // 相手から見て変わらないので送らなかったゲームの状態の数
+  int         quit;            // 自分か相手が終了した, または相手が切断したら TRUE
+} ServerPipeline;
+
+//--------------------------------------------------------------------
+//  鬼ごっこゲームモジュール内部で使用する変数
+//--------------------------------------------------------------------
+static RoomPool *roomPool = NULL;      // ゲーム(部屋)を置く部屋プール
+
 //--------------------------------------------------------------------
-//  ä⥸塼ǻѤؿΥץȥ
+//  鬼ごっこゲームモジュール内部で使用する関数のプロトタイプ宣言
 //--------------------------------------------------------------------
-static void getServerInputData(TagGame *game, ServerInputData *serverData);
+static void* networkStage(void *arg);
+static void* simulationStage(void *arg);
+static int  renderStage(ServerPipeline *pipeline);
+static int  judgeGame(TagGame *game, ServerInputData *serverData);
+static void pushState(SpscQueue *queue, GameSnapshot *snapshot, StageStats *stage);
+static void addStageTime(long *counter, long ns);
+static long nowNs();
+static void printPipelineStats(ServerPipeline *pipeline);
 static void getClientInputData(TagGame *game, ClientInputData *clientData);
 static void updatePlayerStatus(TagGame *game, ServerInputData *serverData);
 static void copyGameState(TagGame *game, ClientInputData *clientData);
-static void printGame(TagGame *game);
-static void sendGameInfo(TagGame *game);
+static void printGame(TagGame *game, Player *my, Player *preMy, Player *it, Player *preIt);
+static void sendGameInfo(TagGame *game, GameSnapshot *snapshot);
 static void sendMyPressedKey(TagGame *game, ClientInputData *clietData);
+static void sendMessage(int s, char *text, int len);
+static int  readMessage(int s, char *msg, int len);
+static void printNetClock(TagGame *game, WINDOW *win, int y, int x);
+static void recordMatch(TagGame *game, GameSnapshot *snapshot);
+static void printMatchStats(TagGame *game);
 static void die();
-
+static void checkTagMaps(TagGame *game);
+static int  isPlayableMapSet(MapSet *set, void *arg);
+static void printMapNotice(TagGame *game);
+static void catchPlayer(TagGame *game, ServerInputData *serverData);
+static void recordGameState(TagGame *game);
+static int  startLockstep(TagGame *game);
+static int  playLockstepTagGame(TagGame *game);
+static int  pollLockstep(TagGame *game, long deadline, int *key);
+static unsigned hashGameState(TagGame *game);
+static void showResult(TagGame *game, int result);
+static void printLockstepStats(TagGame *game);
+static int  canSeePlayer(TagGame *game, Player *from, Player *to);
+static void hideUnseen(TagGame *game, Player *viewer, Player *target);
+static void beginRounds(TagGame *game);
+static int  playServerRound(TagGame *game);
+static int  runServerPipeline(TagGame *game);
+static int  playClientRound(TagGame *game);
+static void startRound(TagGame *game);
+static int  switchMapSet(TagGame *game, unsigned hash);
+static void pollLobby(TagGame *game);
+static void handleLobbyKey(TagGame *game, int key);
+static void handleLobbyMessage(TagGame *game, char *msg);
+static void sendRoundMessage(TagGame *game, char *text);
+static void enterCountdown(TagGame *game);
+static void showCountdown(TagGame *game);
+static void enterResult(TagGame *game, int result);
+static void enterRematch(TagGame *game);
+static void answerRematch(TagGame *game, int answer);
+static void checkRematch(TagGame *game);
+static void enterTeardown(TagGame *game);
+static void showLobbyText(TagGame *game, char *text, int penID);
+static int  resultPen(TagGame *game);
+static void onNameTimeout(void *arg);
+static void onCountdown(void *arg);
+static void onResultShown(void *arg);
+static void onRematchTimeout(void *arg);
+static void onClosed(void *arg);
+static void runServerRounds(TagGame *game);
+static void redrawMaps(TagGame *game);
+static void saveCheckpoint(TagGame *game);
+static void storePlayer(SnapshotPlayer *to, Player *from);
+static void loadPlayer(Player *to, SnapshotPlayer *from);
+static unsigned long long makeResumeToken();
+static unsigned hashMapSet(MapSet *set);
+static int  rejoinServer(TagGame *game);
+
+void showText(TagGame *game,char *text,int WinX,int WinY,int penID);
+void createMap(TagGame *game,WINDOW *Win,Map *map,Camera *cam);
+int followCamera(TagGame *game,Player *character);
+void drawCharacter(TagGame *game,Player *character,int chara);
+void warp(TagGame *game,Player *character);
+void prefetchAhead(TagGame *game,Player *pre,Player *character);
+void printChunkStats();
 WINDOW* chooseWin(TagGame *game,Player *character);
-int** chooseMap(TagGame *game,Player *character);
+Map* chooseMap(TagGame *game,Player *character);
+Camera* chooseCam(TagGame *game,Player *character);
+int chooseMap_Lines(TagGame *game,Player *character);
+int chooseMap_Colums(TagGame *game,Player *character);
 //--------------------------------------------------------------------
-//  ˸ؿ
+//  外部に公開する関数の定義
 //--------------------------------------------------------------------
 
 /*
- * äν
- *  :
- *   myChara - ʬɽ饯
- *   mySX    - ʬγ X ɸ
- *   mySY    - ʬγ Y ɸ
- *   itChara - ɽ饯
- *   itSX    - γ X ɸ
- *   itSY    - γ Y ɸ
- *  :
- *   ä४֥ȤؤΥݥ
+ * 鬼ごっこゲームの初期化
+ * 引数 :
+ *   myChara - 自分を表すキャラクタ
+ *   mySX    - 自分の開始 X 座標
+ *   mySY    - 自分の開始 Y 座標
+ *   itChara - 相手を表すキャラクタ
+ *   itSX    - 相手の開始 X 座標
+ *   itSY    - 相手の開始 Y 座標
+ * 戻値 :
+ *   鬼ごっこゲームオブジェクトへのポインタ
  */
 TagGame* initTagGame(char myChara, int mySX, int mySY,
                      char itChara, int itSX, int itSY)
 {
-  TagGame* game = (TagGame *)malloc(sizeof(TagGame));
+  TagGame* game;
+  Room*    room;
+
+  // ゲームは部屋プールの部屋のアリーナに置く(後始末は部屋を返すだけで済む)
+  if (roomPool == NULL)
+    roomPool = createRoomPool(ROOM_POOL_SLOTS, ROOM_ARENA_SIZE);
+  if ((room = acquireRoom(roomPool)) == NULL) {
+    fprintf(stderr, "Error: no free room\n");
+    exit(1);
+  }
+  game = (TagGame *)arenaAlloc(&room->arena, sizeof(TagGame), ROOM_ALIGN);
 
-  // ٤ƤΥФ 0 ǽ
+  // すべてのメンバを 0 で初期化
   bzero(game, sizeof(TagGame));
+  game->room = room;
 
   //
-  // Ūǡν
+  // ゲームの論理的データの初期化
   //
   game->my.chara = myChara;
   game->my.x     = mySX;
@@ -108,318 +278,831 @@ TagGame* initTagGame(char myChara, int mySX, int mySY,
   game->it.y     = itSY;
   game->my.inMainMap = true;
   game->it.inMainMap = true;
+  game->maxRewind = MAX_REWIND_TICKS;
 
-  // Υץ쥤䡼(ߤΥץ쥤䡼Ʊˤ)
+  // 前回のプレイヤー情報を初期化(現在のプレイヤー情報と同じにする)
   memcpy(&game->preMy, &game->my, sizeof(Player));
   memcpy(&game->preIt, &game->it, sizeof(Player));
 
+  // 開始位置を覚えておく(読み直したマップが遊べるかを調べるときに使う)
+  memcpy(&game->startMy, &game->my, sizeof(Player));
+  memcpy(&game->startIt, &game->it, sizeof(Player));
+
   //
-  // ̤ν
+  // 画面の初期化
   //
-  initscr();               // curses 饤֥ν
-  signal(SIGINT, die);     // Ctrl-C ü줹ؿ die Ͽ
-  signal(SIGTERM, die);    // kill ü줹ؿ die Ͽ
-  noecho();                // Хå
-  cbreak();                // ܡɥХåե󥰤
-
-  // ̤κ
+  initscr();               // curses ライブラリの初期化
+  signal(SIGINT, die);     // Ctrl-C 時に端末を復旧する関数 die を登録
+  signal(SIGTERM, die);    // kill 時に端末を復旧する関数 die を登録
+  signal(SIGPIPE, SIG_IGN);  // 相手が先に切断しても終了しない(書き込みの失敗は読むときに気づく)
+  noecho();                // エコーバックの中止
+  cbreak();                // キーボードバッファリングの中止
+
+  // ゲーム画面の作成
   game->mainWin = newwin(MAINWIN_LINES, MAINWIN_COLUMS, MAINWIN_SY, MAINWIN_SX);
   game->subWin = newwin(SUBWIN_LINES, SUBWIN_COLUMS, SUBWIN_SY, SUBWIN_SX);
 
-  // ̤
+  // 画面が小さい場合
   if (game->mainWin == NULL || game->subWin == NULL) {
     endwin();
     fprintf(stderr, "Error: terminal size is too small\n");
     exit(1);
   }
 
-  // 業ϥץ󥹤ɽƤ
-  // ɤѴ
+  // 各制御キーはエスケープシーケンスで表現されている
+  // それを論理キーコードに変換する
   keypad(game->mainWin, TRUE);
 
   return game;
 }
 
 /*
- * äν
- *  :
- *   game - ä४֥ȤؤΥݥ
- *   s    - Ȥβѥեǥץ
+ * 鬼ごっこゲームの準備
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ *   s    - 相手との会話用ファイルデスクリプタ
  */
 void setupTagGame(TagGame *game, int s)
 {
   //
-  // ǡϤΤν
+  // データ入力のための準備
   //
-  game->s = s;                    // ȤβѥեǥץϿ
-  FD_ZERO(&(game->fdset));        // Ϥƻ뤹եǥץޥ
-  FD_SET(0, &(game->fdset));      // ɸ(ܡ)ƻ뤹
-  FD_SET(s, &(game->fdset));      // Ȥβѥǥץƻ뤹
-  game->fdsetWidth = s + 1;       // fdset Υӥå(=ǥץֹܣ)
-  game->watchTime.tv_sec  = 0;    // ƻ֤ 100 msec ˥å
+  game->s = s;                    // 相手との会話用ファイルデスクリプタを登録
+  FD_ZERO(&(game->fdset));        // 入力を監視するファイルデスクリプタマスクを初期化
+  FD_SET(0, &(game->fdset));      // 標準入力(キーボード)を監視する
+  FD_SET(s, &(game->fdset));      // 相手との会話用デスクリプタを監視する
+  game->fdsetWidth = s + 1;       // fdset のビット幅(=最大デスクリプタ番号＋１)
+  game->watchTime.tv_sec  = 0;    // 監視時間を 100 msec にセット
   game->watchTime.tv_usec = 100 * 1000;
 
+  // 通信遅延の測定を始める
+  initNetClock(&game->netClock);
+
+  // プレイヤー名が指定されていなければログイン名を使う
+  if (game->myName[0] == '\0') {
+    strncpy(game->myName, getenv("USER") != NULL ? getenv("USER") : "player", MATCH_NAME_LEN - 1);
+    game->myName[MATCH_NAME_LEN - 1] = '\0';
+  }
+
   //
-  // ̤ν
+  // 画面の準備
   //
 
-  // ̤ŪǤ
+  // 標準画面を先に描画しておく(後から警告などを書いてもウィンドウを消さないように)
+  refresh();
+
+  // 画面の静的要素の描画
   box(game->mainWin, ACS_VLINE, ACS_HLINE);
   box(game->subWin, ACS_VLINE, ACS_HLINE);
 
-  //ޥå
-  createMap(game,game->mainWin,"O-map.txt");
-  createMap(game,game->subWin,"T-map.txt");
+  //マップ読み込み(マップはマップストアの版をゲームが参照し, ウィンドウにはカメラの範囲だけ描く)
+  game->mapStore = openMapStore("O-map.txt", WARP_MAIN_SX, WARP_MAIN_SY,
+                                "T-map.txt", WARP_SUB_SX, WARP_SUB_SY, game->indexChunked);
+  game->mapSet   = acquireMapSet(game->mapStore);
+  game->mainMap  = game->mapSet->mainMap;
+  game->subMap   = game->mapSet->subMap;
+  game->mapIndex = game->mapSet->index;
+  game->mapHash  = hashMapSet(game->mapSet);
+
+  //カメラを自分の位置に合わせてマップを描画
+  game->mainCam.x = game->mainCam.y = 1;
+  game->subCam.x = game->subCam.y = 1;
+  followCamera(game,&game->my);
+  createMap(game,game->mainWin,game->mainMap,&game->mainCam);
+  createMap(game,game->subWin,game->subMap,&game->subCam);
+
+  //マップが遊べるかを調べる
+  checkTagMaps(game);
+
+  //マップファイルが書き換えられたら読み直す(このゲームは今の版を使い続ける)
+  if (game->watchMaps && watchMapStore(game->mapStore, isPlayableMapSet, game) < 0) {
+    mvprintw(0, MAINWIN_SX, "Warning: cannot watch map files");
+    refresh();
+  }
 
-  // ʪ̤
+  // 物理画面に描画
   wrefresh(game->mainWin);
   wrefresh(game->subWin);
 }
 
 /*
- * С¦äγ
- *  :
- *   game - ä४֥ȤؤΥݥ
+ * サーバー側鬼ごっこゲームの開始
+ * ラウンドの合間(カウントダウン・結果の表示・再戦の返事)はタイマーで進め,
+ * 両方が再戦を選べば同じ接続で次のラウンドを始める. 終わったら戻る.
+ * ラウンド中の通信・シミュレーションは別スレッドで動かし, このスレッドは描画とキー入力を受け持つ
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
  */
 void playServerTagGame(TagGame *game)
 {
-  ServerInputData serverData;
+  char msg[SERVER_MSG_LEN];
 
-  while (1) {
-    
-    // 桼ΥϤ꤫Ϥϥǡɤ
-    getServerInputData(game, &serverData);
+  // サーバー(自分)が鬼
+  game->chaserIsMe = TRUE;
 
-    if(game->my.x == game->it.x && game->my.y == game->it.y && game->my.inMainMap == game->it.inMainMap){//ƨɤĤȤ
+  // クライアントのプレイヤー名が届いたらカウントダウンを始める
+  beginRounds(game);
+  addTimer(&game->timers, &game->roundTimer, NAME_WAIT_MSEC, onNameTimeout, game);
+
+  // チェックポイントを書くなら, 立ち上げ直したサーバーに入り直すための部屋名と合言葉を知らせる
+  if (game->checkpoint != NULL) {
+    sprintf(msg, "resume %s %llx", game->resumeName, game->resumeToken);
+    sendRoundMessage(game, msg);
+  }
 
-      showText(game,"You Win",5,15,2);
-      showText(game,"Thank you for playing!!",5,8,2);
+  runServerRounds(game);
+}
 
-      serverData.quit = 1;
+/*
+ * サーバー側 部屋の状態をチェックポイントに書くようにする(setupTagGame() の前に呼ぶ)
+ * 書いた状態は, このプロセスが落ちたときに立ち上げ直したサーバーが引き取る.
+ * クライアントには入り直すための部屋名と合言葉を知らせる
+ * 引数 :
+ *   game       - 鬼ごっこゲームオブジェクトへのポインタ
+ *   checkpoint - チェックポイントへのポインタ
+ *   slot       - 書くスロット
+ *   roomName   - 部屋名(NULL か空なら, 入り直すための名前を作る)
+ */
+void enableCheckpoint(TagGame *game, Checkpoint *checkpoint, int slot, char *roomName)
+{
+  game->checkpoint     = checkpoint;
+  game->checkpointSlot = slot;
+  game->resumeToken    = makeResumeToken();
+  if (roomName != NULL && roomName[0] != '\0')
+    strncpy(game->resumeName, roomName, ROOM_NAME_LEN - 1);
+  else
+    sprintf(game->resumeName, "~%08x", (unsigned)game->resumeToken);
+}
 
-      break;
-    }
+/*
+ * サーバー側 落ちたサーバーの部屋を, 引き取ったスナップショットから再開する
+ * (setupTagGame() の後に, playServerTagGame() の代わりに呼ぶ)
+ * クライアントが合言葉を示したら, ラウンドの途中ならその位置から続け,
+ * 合間なら次のカウントダウンか再戦の返事からやり直す. 終わったら戻る
+ * 引数 :
+ *   game     - 鬼ごっこゲームオブジェクトへのポインタ
+ *   snapshot - 引き取ったスナップショット
+ */
+void resumeServerTagGame(TagGame *game, RoomSnapshot *snapshot)
+{
+  struct pollfd      watch;
+  char               msg[LONGER(SERVER_MSG_LEN, CLIENT_MSG_LEN)];
+  unsigned long long token = 0;
+  int                state;
+
+  // サーバー(自分)が鬼
+  game->chaserIsMe = TRUE;
+  beginRounds(game);
+
+  // 書いておいた部屋の状態を戻す
+  game->resumeToken = snapshot->token;
+  strncpy(game->resumeName, snapshot->name, ROOM_NAME_LEN - 1);
+  game->round     = snapshot->round;
+  game->result    = snapshot->result;
+  game->tick      = snapshot->tick;
+  game->fogOfWar  = snapshot->fogOfWar;
+  game->maxRewind = snapshot->maxRewind;
+  loadPlayer(&game->my, &snapshot->my);
+  loadPlayer(&game->it, &snapshot->it);
+  strncpy(game->myName, snapshot->myName, MATCH_NAME_LEN - 1);
+  strncpy(game->itName, snapshot->itName, MATCH_NAME_LEN - 1);
+
+  // 入ってきたクライアントが合言葉を示すのを待つ
+  // (違えば部屋はそのままにして終わる. 本当のクライアントは別のサーバーが引き取る)
+  watch.fd     = game->s;
+  watch.events = POLLIN;
+  if (poll(&watch, 1, TOKEN_WAIT_MSEC) <= 0 || readMessage(game->s, msg, CLIENT_MSG_LEN) <= 0 ||
+      sscanf(msg, "resume %llx", &token) != 1 || token != snapshot->token) {
+    game->checkpoint = NULL;
+    return;
+  }
 
-    // 桼⤷꤫齪λΥåϤ,λ
-    if (serverData.quit){
+  // ラウンドの途中なら続ける. ただしマップが書いたときと違えば, そのラウンドをやり直す.
+  // 結果の表示中なら再戦の返事から, それ以外はカウントダウンからやり直す
+  state = snapshot->roundState;
+  if (state == ROUND_PLAYING && snapshot->mapHash != game->mapHash) {
+    state = ROUND_COUNTDOWN;
+    game->round--;
+  }
+  else if (state == ROUND_RESULT)
+    state = game->result == RESULT_QUIT || game->result == RESULT_DESYNC ||
+            game->result == RESULT_MAP_MISMATCH ? ROUND_TEARDOWN : ROUND_REMATCH;
+  else if (state != ROUND_PLAYING && state != ROUND_REMATCH && state != ROUND_TEARDOWN)
+    state = ROUND_COUNTDOWN;
+
+  // クライアントにどこから再開するかを知らせる
+  sprintf(msg, "resumed %d %d", state, game->result);
+  sendRoundMessage(game, msg);
+
+  if (state == ROUND_PLAYING) {
+    game->resumed    = TRUE;
+    game->roundState = ROUND_PLAYING;
+  }
+  else if (state == ROUND_REMATCH)
+    enterRematch(game);
+  else if (state == ROUND_TEARDOWN)
+    enterTeardown(game);
+  else
+    enterCountdown(game);
+
+  runServerRounds(game);
+}
 
-      showText(game,"QUIT",5,18,1);
 
-      break;
+/*
+ * クライアント側鬼ごっこゲームの開始(サーバーが終わりを知らせるか, 切断されたら戻る)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+void playClientTagGame(TagGame *game)
+{
+  char msg[CLIENT_MSG_LEN];
+
+  // サーバーに自分のプレイヤー名を知らせる(試合結果の記録に使う. カウントダウンの合図にもなる)
+  sprintf(msg, "name %s", game->myName);
+  sendMessage(game->s, msg, CLIENT_MSG_LEN);
+
+  // サーバーが "start" か "lockstep" を送ってきたらラウンドを始める
+  beginRounds(game);
+
+  while (game->roundState != ROUND_CLOSED) {
+    if (game->roundState == ROUND_PLAYING) {
+      game->result = playClientRound(game);
+      advanceTimerWheel(&game->timers, monotonicUsec() / 1000);
+      // 入り直したサーバーがラウンドの合間から再開したなら, 結果は表示しない
+      if (game->roundState == ROUND_PLAYING)
+        enterResult(game, game->result);
     }
+    else
+      pollLobby(game);
+  }
+}
 
-    // ץ쥤䡼ξ֤򹹿
-    updatePlayerStatus(game, &serverData);
+/*
+ * 鬼ごっこゲームの後始末(試合結果ストアは記録を書き終えてから閉じる. 端末も元に戻す)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+void destroyTagGame(TagGame *game)
+{
+  // ウィンドウを廃棄
+  delwin(game->mainWin);
+  delwin(game->subWin);
+  // マップの版を手放す(監視スレッドもここで止まる)
+  releaseMapSet(game->mapStore, game->mapSet);
+  closeMapStore(game->mapStore);
+  destroySpatialHash(game->occupancy);
+  destroyStateHistory(game->history);
+  // ファイルデスクリプタを閉じる
+  close(game->s);
+  destroyNetClock(&game->netClock);
+  // 試合結果をすべて書いてから閉じる
+  closeMatchStore(game->results);
+  // 部屋を返す(アリーナに置いたゲームのデータはまとめて解放される)
+  releaseRoom(roomPool, game->room);
+  // 端末を元に戻す(終了するかどうかは呼んだ側が決める)
+  endwin();
+}
 
-    // ɽ
-    printGame(game);
 
-    // ξ֤Τ餻
-    sendGameInfo(game);
-  }
 
-  // ⽪λ褦å
-  write(game->s, "quit", 5);  
-}
 
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
 
 /*
- * 饤¦äγ
- *  :
- *   game - ä४֥ȤؤΥݥ
+ * サーバー側 通信ステージ
+ * 相手から届いたキー入力をシミュレーションへ渡し, シミュレーションから届いた
+ * ゲームの状態を相手に送る. 終わりの状態が届いたら試合結果を記録して終わる
+ * 引数 :
+ *   arg - パイプラインへのポインタ
  */
-void playClientTagGame(TagGame *game)
+static void* networkStage(void *arg)
 {
-  ClientInputData clientData;
+  ServerPipeline *pipeline = (ServerPipeline *)arg;
+  TagGame        *game = pipeline->game;          // ショートカット
+  struct pollfd   watch;
+  InputEvent      event;
+  GameSnapshot    snapshot, view;
+  GameSnapshot    sent;                           // 最後に相手に送ったゲームの状態
+  char            msg[CLIENT_MSG_LEN];            // 相手から届いたメッセージ
+  char            reply[SYNC_MSG_LEN];            // ping への返事
+  long            start, arrived;
+  int             len;
+
+  watch.fd     = game->s;
+  watch.events = POLLIN;
+  bzero(&sent, sizeof(GameSnapshot));
 
   while (1) {
-    
-    // 桼ΥϤ, ꤫Ϥξ֤ɤ
-    getClientInputData(game, &clientData);
+    //
+    // 相手との会話用ファイルデスクリプタにデータが届いている場合
+    //
+    if (poll(&watch, 1, IO_POLL_MSEC) > 0 && watch.revents != 0) {
+      start = nowNs();
+      bzero(&event, sizeof(InputEvent));
+      len = readMessage(game->s, msg, CLIENT_MSG_LEN);   // メッセージを読み取る
+      arrived = monotonicUsec();
+
+      // ping にはすぐに返事をし, pong からは通信遅延を求める(ゲームには渡さない)
+      if (len > 0 && handleSyncMessage(&game->netClock, msg, arrived, reply)) {
+        if (reply[0] != '\0')
+          sendMessage(game->s, reply, SERVER_MSG_LEN);
+        addStageTime(&pipeline->io.busyNs, nowNs() - start);
+        continue;
+      }
 
-    if(game->my.x == game->it.x && game->my.y == game->it.y && game->my.inMainMap == game->it.inMainMap){//ƨɤĤȤ
+      // 相手のプレイヤー名(ゲームには渡さない)
+      if (len > 0 && strncmp(msg, "name ", 5) == 0) {
+        strncpy(game->itName, msg + 5, MATCH_NAME_LEN - 1);
+        addStageTime(&pipeline->io.busyNs, nowNs() - start);
+        continue;
+      }
 
-      showText(game,"You Lose",5,15,3);
-      showText(game,"Thank you for playing!!",5,8,3);
+      // 切断された場合や終了のメッセージの場合は終了する(もう読まない)
+      // (キューが満杯でも落とさないよう, フラグで知らせる)
+      if (len <= 0 || strcmp(msg, "quit") == 0) {
+        watch.fd = -1;
+        if (len <= 0)
+          __atomic_store_n(&game->peerGone, TRUE, __ATOMIC_RELAXED);
+        __atomic_store_n(&pipeline->quit, TRUE, __ATOMIC_RELEASE);
+        addStageTime(&pipeline->io.busyNs, nowNs() - start);
+        continue;
+      }
 
-      clientData.quit = 1;
+      // 届いたメッセージから押下情報を抽出
+      // 満杯なら捨てる(1 ティックに使うキーは 1 つだけなので困らない)
+      sscanf(msg, "%d %d", &event.key, &event.seenTick);
+      pushSpscQueue(pipeline->netInQueue, &event);
+      addStageTime(&pipeline->io.busyNs, nowNs() - start);
+    }
 
-      break;
+    //
+    // 通信遅延を測るため, ときどき ping を送る
+    //
+    if (makePing(&game->netClock, msg))
+      sendMessage(game->s, msg, SERVER_MSG_LEN);
+
+    //
+    // シミュレーションから届いたゲームの状態を送る
+    //
+    while (popSpscQueue(pipeline->netOutQueue, &snapshot)) {
+      start = nowNs();
+      if (snapshot.result != RESULT_PLAYING) {
+        // 結果は描画のスレッドが相手に知らせる(スレッドを止めてから, 同じ接続で次のラウンドを話す)
+        // 試合結果を記録する(書き込みは別スレッドなので待たない)
+        recordMatch(game, &snapshot);
+        return NULL;
+      }
+      // 相手から見えない自分(鬼)の位置は送らない. 相手から見て変わらなければ送らない
+      view = snapshot;
+      hideUnseen(game, &view.it, &view.my);
+      if (memcmp(&view.my, &sent.my, sizeof(Player)) == 0 && memcmp(&view.it, &sent.it, sizeof(Player)) == 0) {
+        __atomic_store_n(&pipeline->culledFrames, pipeline->culledFrames + 1, __ATOMIC_RELAXED);
+        continue;
+      }
+      // 送信が詰まっている時間は待ち時間として数える
+      sendGameInfo(game, &view);
+      sent = view;
+      __atomic_store_n(&pipeline->sentFrames, pipeline->sentFrames + 1, __ATOMIC_RELAXED);
+      addStageTime(&pipeline->io.stallNs, nowNs() - start);
     }
+  }
+}
 
-    // 桼⤷꤫齪λΥåϤ,λ
-    if (clientData.quit){
+/*
+ * サーバー側 シミュレーションステージ
+ * TICK_MSEC ごとに, そのティックまでに届いた入力でゲームを進め,
+ * 結果を描画と通信のステージへ渡す. 勝敗が決まったら終わる
+ * 引数 :
+ *   arg - パイプラインへのポインタ
+ */
+static void* simulationStage(void *arg)
+{
+  ServerPipeline *pipeline = (ServerPipeline *)arg;
+  TagGame        *game = pipeline->game;          // ショートカット
+  ServerInputData serverData;
+  InputEvent      event;
+  GameSnapshot    snapshot;
+  struct timespec next;
+  long            start, stalled;
+  int             first = TRUE;                   // 最初のティックか
 
-      showText(game,"QUIT",5,18,1);
+  clock_gettime(CLOCK_MONOTONIC, &next);
 
-      break;
+  while (1) {
+    // 次のティックの時刻まで休む
+    next.tv_nsec += TICK_MSEC * 1000000L;
+    if (next.tv_nsec >= 1000000000L) {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000L;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    start = nowNs();
+
+    // このティックまでに届いた入力をまとめる(キーはそれぞれ最初の 1 つだけを使う)
+    bzero(&serverData, sizeof(ServerInputData));
+    while (popSpscQueue(pipeline->keyQueue, &event))
+      if (serverData.myKey == 0)
+        serverData.myKey = event.key;
+    while (popSpscQueue(pipeline->netInQueue, &event)) {
+      if (serverData.itKey == 0) {
+        serverData.itKey      = event.key;
+        serverData.itSeenTick = event.seenTick;
+      }
     }
+    if (__atomic_load_n(&pipeline->quit, __ATOMIC_ACQUIRE))
+      serverData.quit = TRUE;
 
-    // ξ֤򹹿
-    copyGameState(game, &clientData);
+    // 勝敗が決まっていなければゲームを進める
+    snapshot.result = judgeGame(game, &serverData);
+    if (snapshot.result == RESULT_PLAYING) {
+      // プレイヤーの状態を更新する
+      updatePlayerStatus(game, &serverData);
 
-    // ɽ
-    printGame(game);
+      // すれ違った場合や, 相手の画面では追いついていた場合は捕まえたことにする
+      catchPlayer(game, &serverData);
 
-    // ʬβƤ륭
-    sendMyPressedKey(game, &clientData);
+      // このティックの状態を覚えておく
+      recordGameState(game);
+
+      // ときどき部屋の状態をチェックポイントに書く(mmap した領域へのコピーなので待たない)
+      if (game->tick % CHECKPOINT_TICKS == 0)
+        saveCheckpoint(game);
+    }
+    snapshot.my   = game->my;
+    snapshot.it   = game->it;
+    snapshot.tick = game->tick;
+
+    // 描画と通信のステージへ渡す(相手には最初と, 変化したときと終わったときだけ送る.
+    // 途中から再開したラウンドでは, 最初に送る状態で入り直したクライアントが位置を知る)
+    stalled = pipeline->sim.stallNs;
+    pushState(pipeline->renderQueue, &snapshot, &pipeline->sim);
+    if (first || snapshot.result != RESULT_PLAYING ||
+        memcmp(&game->my, &game->preMy, sizeof(Player)) != 0 ||
+        memcmp(&game->it, &game->preIt, sizeof(Player)) != 0)
+      pushState(pipeline->netOutQueue, &snapshot, &pipeline->sim);
+    first = FALSE;
+    addStageTime(&pipeline->sim.busyNs, nowNs() - start - (pipeline->sim.stallNs - stalled));
+
+    if (snapshot.result != RESULT_PLAYING)
+      return NULL;
   }
+}
+
+/*
+ * サーバー側 描画ステージ(curses を使うのはこのスレッドだけ)
+ * キー入力をシミュレーションへ渡し, 届いたゲームの状態のうち最新のものを描く
+ * 終わりの状態が届いたら戻る
+ * 引数 :
+ *   pipeline - パイプラインへのポインタ
+ * 戻値 :
+ *   ゲームの結果(RESULT_*)
+ */
+static int renderStage(ServerPipeline *pipeline)
+{
+  TagGame      *game = pipeline->game;            // ショートカット
+  InputEvent    event;
+  GameSnapshot  snapshot, latest;
+  Player        drawnMy = game->my;               // 最後に描いた自分
+  Player        drawnIt = game->it;               // 最後に描いた相手
+  Player        shownIt;                          // 描く相手(見えなければ隠す)
+  fd_set        arrived;
+  TimeVal       watchTime;
+  long          start;
+  int           arrivedState;
 
-  // ⽪λ褦å
-  write(game->s, "quit", 5);  
+  while (1) {
+    //
+    // 標準入力 (キーボード, ０番) にデータが届いている場合
+    //
+    FD_ZERO(&arrived);
+    FD_SET(0, &arrived);
+    watchTime.tv_sec  = 0;
+    watchTime.tv_usec = RENDER_POLL_MSEC * 1000;
+    if (select(1, &arrived, NULL, NULL, &watchTime) > 0) {
+      bzero(&event, sizeof(InputEvent));
+      event.key = wgetch(game->mainWin);          // 押されているキーを読み取る
+      // 終了するかどうかチェック(キューが満杯でも落とさないよう, フラグで知らせる)
+      if (event.key == 'q')
+        __atomic_store_n(&pipeline->quit, TRUE, __ATOMIC_RELEASE);
+      // 満杯なら捨てる(1 ティックに使うキーは 1 つだけなので困らない)
+      else
+        pushSpscQueue(pipeline->keyQueue, &event);
+    }
+
+    //
+    // 届いたゲームの状態のうち最新のものを描く(描画が遅れても途中の状態は飛ばす)
+    //
+    arrivedState = FALSE;
+    while (popSpscQueue(pipeline->renderQueue, &snapshot)) {
+      latest = snapshot;
+      arrivedState = TRUE;
+      if (snapshot.result != RESULT_PLAYING)
+        break;
+    }
+    if (!arrivedState)
+      continue;
+
+    // 勝敗が決まったら終わる
+    if (latest.result != RESULT_PLAYING)
+      return latest.result;
+
+    // 表示する
+    start = nowNs();
+    shownIt = latest.it;
+    hideUnseen(game, &latest.my, &shownIt);
+    printGame(game, &latest.my, &drawnMy, &shownIt, &drawnIt);
+    drawnMy = latest.my;
+    drawnIt = shownIt;
+    printPipelineStats(pipeline);
+    addStageTime(&pipeline->render.busyNs, nowNs() - start);
+  }
 }
 
 /*
- * äθ
- *  :
- *   game - ä४֥ȤؤΥݥ
+ * 勝敗が決まったかを調べる
+ * 引数 :
+ *   game       - 鬼ごっこゲームオブジェクトへのポインタ
+ *   serverData - このティックの入力データ
+ * 戻値 :
+ *   ゲームの結果(RESULT_*)
  */
-void destroyTagGame(TagGame *game)
+static int judgeGame(TagGame *game, ServerInputData *serverData)
 {
-  // ɥѴ
-  delwin(game->mainWin);
-  // եǥץĤ
-  close(game->s);
-  // ֥Ȥ
-  free(game);
-  // ü򸵤ᤷƽλ
-  die();
+  CaptureEvent capture;
+
+  //鬼が逃げる役に追いついたとき
+  if (findCaptures(game->occupancy, &capture, 1) > 0)
+    return RESULT_WIN;
+
+  // もう鬼が逃げる役に追いつけないとき(マップで分断されている)
+  if (!canMeet(game->mapIndex, game->my.inMainMap, game->my.x, game->my.y,
+               game->it.inMainMap, game->it.x, game->it.y))
+    return RESULT_NO_CATCH;
+
+  // ユーザもしくは相手から終了のメッセージが届いた場合
+  if (serverData->quit)
+    return RESULT_QUIT;
+
+  return RESULT_PLAYING;
 }
 
+/*
+ * ゲームの状態を次のステージへ渡す. 満杯なら空くまで待ち, 待った時間を数える
+ * 引数 :
+ *   queue    - 渡すキュー
+ *   snapshot - ゲームの状態
+ *   stage    - 渡す側のステージの統計
+ */
+static void pushState(SpscQueue *queue, GameSnapshot *snapshot, StageStats *stage)
+{
+  long start;
 
+  if (pushSpscQueue(queue, snapshot))
+    return;
 
+  start = nowNs();
+  while (!pushSpscQueue(queue, snapshot))
+    usleep(STALL_USEC);
+  addStageTime(&stage->stallNs, nowNs() - start);
+}
 
-//--------------------------------------------------------------------
-//  ˸ʤؿ
-//--------------------------------------------------------------------
+/*
+ * ステージの統計に時間を足す(描画ステージが別スレッドから読む)
+ */
+static void addStageTime(long *counter, long ns)
+{
+  __atomic_store_n(counter, *counter + ns, __ATOMIC_RELAXED);
+}
 
 /*
- * С¦: ǡϤƤեǥץǡɤ
- *  :
- *   game       - ä४֥ȤؤΥݥ
- *   serverData - ϤǡǼ ServerInputData ¤ΤؤΥݥ()
+ * 現在時刻(ns)
  */
-static void getServerInputData(TagGame *game, ServerInputData *serverData)
+static long nowNs()
 {
-  fd_set  arrived   = game->fdset;        // ǡϤեǥץν
-  TimeVal watchTime = game->watchTime;    // եǥץδƻ
-  char    msg[CLIENT_MSG_LEN];            // ꤫Ϥå
+  struct timespec ts;
 
-  // ٤ƤΥФ򣰤ǽ
-  // ǡϤƤʤ, Фͤϣ
-  bzero(serverData, sizeof(ServerInputData));
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
 
-  //
-  // ǡϤƤեǥץĴ٤
-  //
-  select(game->fdsetWidth, &arrived, NULL, NULL, &watchTime);
-  
-  //
-  // ɸ (ܡ, ) ˥ǡϤƤ
-  //
-  if (FD_ISSET(0, &arrived)) {
-    serverData->myKey = wgetch(game->mainWin);    // Ƥ륭ɤ߼
-    // λ뤫ɤå
-    if (serverData->myKey == 'q')
-      serverData->quit = TRUE;
+/*
+ * パイプラインのステージごとの仕事・ストール時間と, キューの深さを画面の下に表示する
+ * 引数 :
+ *   pipeline - パイプラインへのポインタ
+ */
+static void printPipelineStats(ServerPipeline *pipeline)
+{
+  SpscQueueStats netIn, netOut, render;
+
+  getSpscQueueStats(pipeline->netInQueue, &netIn);
+  getSpscQueueStats(pipeline->netOutQueue, &netOut);
+  getSpscQueueStats(pipeline->renderQueue, &render);
+
+  mvprintw(MAINWIN_SY + MAINWIN_LINES + 1, MAINWIN_SX,
+           "busy/stall ms io %ld/%ld sim %ld/%ld draw %ld | queue in %d(%d) out %d(%d) draw %d(%d)",
+           __atomic_load_n(&pipeline->io.busyNs, __ATOMIC_RELAXED) / 1000000,
+           __atomic_load_n(&pipeline->io.stallNs, __ATOMIC_RELAXED) / 1000000,
+           __atomic_load_n(&pipeline->sim.busyNs, __ATOMIC_RELAXED) / 1000000,
+           __atomic_load_n(&pipeline->sim.stallNs, __ATOMIC_RELAXED) / 1000000,
+           pipeline->render.busyNs / 1000000,
+           netIn.depth, netIn.maxDepth, netOut.depth, netOut.maxDepth, render.depth, render.maxDepth);
+  clrtoeol();
+
+  // クライアントとの通信遅延
+  printNetClock(pipeline->game, stdscr, MAINWIN_SY + MAINWIN_LINES + 2, MAINWIN_SX);
+  clrtoeol();
+
+  // 自分の成績
+  if (pipeline->game->results != NULL) {
+    printMatchStats(pipeline->game);
+    clrtoeol();
   }
 
-  //
-  // Ȥβѥեǥץ˥ǡϤƤ
-  //
-  if (FD_ISSET(game->s, &arrived)) {
-    read(game->s, msg, CLIENT_MSG_LEN);   // åɤ߼
-    
-    // λ뤫ɤå
-    if (strcmp(msg, "quit") == 0)
-      serverData->quit = TRUE;
-    // Ϥå鲡
-    else 
-      sscanf(msg, "%3d ", &serverData->itKey);
+  // 霧で送らずに済んだゲームの状態
+  if (pipeline->game->fogOfWar) {
+    mvprintw(MAINWIN_SY + MAINWIN_LINES + 4, MAINWIN_SX, " fog: sent %ld states, culled %ld (%ld bytes saved) ",
+             __atomic_load_n(&pipeline->sentFrames, __ATOMIC_RELAXED),
+             __atomic_load_n(&pipeline->culledFrames, __ATOMIC_RELAXED),
+             __atomic_load_n(&pipeline->culledFrames, __ATOMIC_RELAXED) * SERVER_MSG_LEN);
+    clrtoeol();
   }
+  wnoutrefresh(stdscr);
+}
 
-  // Ǥ˥ǡϤƤ, select() ľ˽λ
-  // ;äƻ֤ٻߤ(Linux ǤΤͭ)
-  usleep(watchTime.tv_usec); 
-  // ٻˤޤäϤ򥯥ꥢ
-  if (serverData->myKey != 0)  
-    flushinp(); 
+/*
+ * 相手との往復時間・揺らぎ・時計のずれを表示する
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ *   win  - 表示するウィンドウ
+ *   y, x - 表示する位置
+ */
+static void printNetClock(TagGame *game, WINDOW *win, int y, int x)
+{
+  NetClockStats stats;
+
+  getNetClockStats(&game->netClock, &stats);
+  if (stats.samples == 0) {
+    mvwprintw(win, y, x, " rtt -- ");
+    return;
+  }
+  mvwprintw(win, y, x, " rtt %.1fms (min %.1f) jitter %.1fms offset %+.1fms ",
+            stats.rtt / 1000.0, stats.minRtt / 1000.0, stats.jitter / 1000.0, stats.offset / 1000.0);
 }
 
 /*
- * 饤¦: ǡϤƤեǥץǡɤ
- *  :
- *   game       - ä४֥ȤؤΥݥ
- *   clientData - ϤǡǼ ClientInputData ¤ΤؤΥݥ()
+ * 試合結果を試合結果ストアへ渡す
+ * 引数 :
+ *   game     - 鬼ごっこゲームオブジェクトへのポインタ
+ *   snapshot - 終わりのゲームの状態
  */
-static void getClientInputData(TagGame *game, ClientInputData *clientData)
+static void recordMatch(TagGame *game, GameSnapshot *snapshot)
 {
-  fd_set  arrived   = game->fdset;        // ǡϤեǥץν
-  TimeVal watchTime = game->watchTime;    // եǥץδƻ
-  char    msg[SERVER_MSG_LEN];            // ꤫Ϥå
+  MatchRecord record;
 
-  // ٤ƤΥФ򣰤ǽ
-  // ǡϤƤʤ, Фͤϣ
-  bzero(clientData, sizeof(ClientInputData));
+  if (game->results == NULL)
+    return;
 
-  //
-  // ǡϤƤեǥץĴ٤
-  //
-  select(game->fdsetWidth, &arrived, NULL, NULL, &watchTime);
-  
-  //
-  // ɸ (ܡ, ) ˥ǡϤƤ
-  //
-  if (FD_ISSET(0, &arrived)) {
-    clientData->myKey = wgetch(game->mainWin);    // Ƥ륭ɤ߼
-    // λ뤫ɤå
-    if (clientData->myKey == 'q')
-      clientData->quit = TRUE;
+  // サーバー(自分)が鬼, クライアント(相手)が逃げる役
+  bzero(&record, sizeof(MatchRecord));
+  record.time  = time(NULL);
+  record.ticks = snapshot->tick;
+  strncpy(record.chaser, game->myName, MATCH_NAME_LEN - 1);
+  strncpy(record.evader, game->itName[0] != '\0' ? game->itName : "unknown", MATCH_NAME_LEN - 1);
+  switch (snapshot->result) {
+  case RESULT_WIN:      record.result = MATCH_CHASER_WON; break;
+  case RESULT_NO_CATCH: record.result = MATCH_EVADER_WON; break;
+  default:              record.result = MATCH_QUIT;       break;
   }
 
+  submitMatch(game->results, &record);
+}
+
+/*
+ * 自分の成績と試合結果ストアの状態を表示する
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void printMatchStats(TagGame *game)
+{
+  PlayerStats     player;
+  MatchStoreStats stats;
+
+  getMatchStoreStats(game->results, &stats);
+  if (!lookupPlayer(game->results, game->myName, &player))
+    bzero(&player, sizeof(PlayerStats));
+
+  mvprintw(MAINWIN_SY + MAINWIN_LINES + 3, MAINWIN_SX,
+           " %s: %dW %dL %dQ | log %lu matches (%lu commits, replay %ld us) ",
+           game->myName, player.wins, player.losses, player.quits,
+           stats.replayed + stats.committed, stats.commits, stats.replayUsec);
+}
+
+/*
+ * クライアント側: データが届いているファイルデスクリプタからデータを読む
+ * 引数 :
+ *   game       - 鬼ごっこゲームオブジェクトへのポインタ
+ *   clientData - 届いたデータを格納する ClientInputData 構造体へのポインタ(出力)
+ */
+static void getClientInputData(TagGame *game, ClientInputData *clientData)
+{
+  fd_set  watch     = game->fdset;        // 監視するファイルデスクリプタの集合
+  fd_set  arrived;                        // データが届いたファイルデスクリプタの集合
+  TimeVal watchTime;                      // ファイルデスクリプタの監視時間
+  char    msg[SERVER_MSG_LEN];            // 相手から届いたメッセージ
+  char    reply[SYNC_MSG_LEN];            // ping への返事
+  long    deadline, remain, arrivedTime;
+
+  // すべてのメンバを０で初期化
+  // データが届いていない場合, メンバの値は０
+  bzero(clientData, sizeof(ClientInputData));
+
+  // 通信遅延を測るため, ときどき ping を送る
+  if (makePing(&game->netClock, msg))
+    sendMessage(game->s, msg, CLIENT_MSG_LEN);
+
   //
-  // Ȥβѥեǥץ˥ǡϤƤ
+  // 監視時間が終わるまで, 届いたデータを読み続ける
+  // (ping にすぐ返事をするため, 届いたゲームの状態は最新のものだけを使う)
   //
-  if (FD_ISSET(game->s, &arrived)) {
-    read(game->s, msg, SERVER_MSG_LEN);          // åɤ߼
-    lseek(game->s, 0, SEEK_END);
+  deadline = monotonicUsec() + game->watchTime.tv_sec * 1000000L + game->watchTime.tv_usec;
+  while (!clientData->quit && (remain = deadline - monotonicUsec()) > 0) {
+    arrived = watch;
+    watchTime.tv_sec  = remain / 1000000L;
+    watchTime.tv_usec = remain % 1000000L;
+    if (select(game->fdsetWidth, &arrived, NULL, NULL, &watchTime) <= 0)
+      break;
 
-    // λ뤫ɤå
-    if (strcmp(msg, "quit") == 0)
-      clientData->quit = TRUE;
-    // Ϥåɸ
-    else {
-      // ʬκɸ
-      sscanf(msg, "%3d %3d %3d %3d %3d %3d", &clientData->itX, &clientData->itY, 
-                                      &clientData->myX, &clientData->myY, &clientData->itInMainMap, &clientData->myInMainMap);
+    //
+    // 標準入力 (キーボード, ０番) にデータが届いている場合
+    //
+    if (FD_ISSET(0, &arrived)) {
+      clientData->myKey = wgetch(game->mainWin);    // 押されているキーを読み取る
+      // 終了するかどうかチェック
+      if (clientData->myKey == 'q')
+        clientData->quit = TRUE;
+      // このティックに使うキーは 1 つだけ(残りは後でクリアする)
+      FD_CLR(0, &watch);
+    }
+
+    //
+    // 相手との会話用ファイルデスクリプタにデータが届いている場合
+    //
+    if (FD_ISSET(game->s, &arrived)) {
+      // メッセージを読み取る
+      if (readMessage(game->s, msg, SERVER_MSG_LEN) <= 0) {
+        game->peerGone = TRUE;
+        clientData->result = RESULT_QUIT;
+        break;
+      }
+      arrivedTime = monotonicUsec();
+
+      // ping にはすぐに返事をし, pong からは通信遅延を求める
+      if (handleSyncMessage(&game->netClock, msg, arrivedTime, reply)) {
+        if (reply[0] != '\0')
+          sendMessage(game->s, reply, CLIENT_MSG_LEN);
+      }
+      // ラウンドが終わった(この後はラウンドの合間のメッセージなので, もう読まない)
+      else if (sscanf(msg, "result %d", &clientData->result) == 1)
+        break;
+      // 届いたメッセージから座標を抽出
+      else {
+        // 自分と相手の座標情報を抽出
+        sscanf(msg, "%d %d %d %d %d %d %d", &clientData->itX, &clientData->itY, 
+                                        &clientData->myX, &clientData->myY, &clientData->itInMainMap, &clientData->myInMainMap,
+                                        &clientData->tick);
+      }
     }
   }
 
-  // Ǥ˥ǡϤƤ, select() ľ˽λ
-  // ;äƻ֤ٻߤ(Linux ǤΤͭ)
-  usleep(watchTime.tv_usec); 
-  // ٻˤޤäϤ򥯥ꥢ
+  // 待っている間にたまったキー入力をクリア
   if (clientData->myKey != 0)  
     flushinp(); 
 }
 
 /*
- * ץ쥤䡼ξ֤򹹿
- *  :
- *   game       - ä४֥ȤؤΥݥ
- *   serverData - äФϥǡ
+ * プレイヤーの状態を更新する
+ * 引数 :
+ *   game       - 鬼ごっこゲームオブジェクトへのポインタ
+ *   serverData - 鬼ごっこゲームに対する入力データ
  */
 static void updatePlayerStatus(TagGame *game, ServerInputData *serverData)
 {
-  Player *my = &game->my;    // 硼ȥå
-  Player *it = &game->it;    // 硼ȥå
+  Player *my = &game->my;    // ショートカット
+  Player *it = &game->it;    // ショートカット
 
-  // Υץ쥤䡼¸
+  // 前回のプレイヤー情報を保存
   memcpy(&game->preMy, &game->my, sizeof(Player));
   memcpy(&game->preIt, &game->it, sizeof(Player));
+
+  // ここからの移動を新しいティックとする
+  game->tick++;
+  startSpatialTick(game->occupancy);
   
-  int **myMap = chooseMap(game,my);
-  int **itMap = chooseMap(game,it);
+  Map *myMap = chooseMap(game,my);
+  Map *itMap = chooseMap(game,it);
 
   int myLines = chooseMap_Lines(game,my);
   int myColums = chooseMap_Colums(game,my);
@@ -427,15 +1110,15 @@ static void updatePlayerStatus(TagGame *game, ServerInputData *serverData)
   int itColums = chooseMap_Colums(game,it);
 
 
-// ˱ƽ
+// キーに応じて処理
   switch (serverData->myKey) {
   case KEY_UP:
-    if(my->y > 2 && myMap[my->y - 1][my->x] == 3 && myMap[my->y - 2][my->x] == 0) my->y -= 2;//ӱۤɤ,ľ­줬
+    if(my->y > 2 && getMapCell(myMap, my->y - 1, my->x) == 3 && getMapCell(myMap, my->y - 2, my->x) == 0) my->y -= 2;//上方向に飛び越え壁があり,２つ上方向に足場がある場合
     break;
   case MOVE_UP: 
-    if(myMap[my->y - 1][my->x] == 1 || myMap[my->y - 1][my->x] == 3)//ɤä
+    if(getMapCell(myMap, my->y - 1, my->x) == 1 || getMapCell(myMap, my->y - 1, my->x) == 3)//上方向に壁があった場合
     break;
-    if(myMap[my->y - 1][my->x] == 2){ //˥ץݥȤä
+    if(getMapCell(myMap, my->y - 1, my->x) == 2){ //上方向にワープポイントがあった場合
       warp(game,my);
       break;
     }
@@ -443,12 +1126,12 @@ static void updatePlayerStatus(TagGame *game, ServerInputData *serverData)
     break;
 
   case KEY_DOWN: 
-    if(my->y < myLines - 2 - 1 && myMap[my->y + 1][my->x] == 3 && myMap[my->y + 2][my->x] == 0) my->y += 2;//ӱۤɤ,2Ĳ­줬
+    if(my->y < myLines - 2 - 1 && getMapCell(myMap, my->y + 1, my->x) == 3 && getMapCell(myMap, my->y + 2, my->x) == 0) my->y += 2;//下方向に飛び越え壁があり,2つ下方向に足場がある場合
     break;
   case MOVE_DOWN:
-    if(myMap[my->y + 1][my->x] == 1 || myMap[my->y + 1][my->x] == 3)//ɤä
+    if(getMapCell(myMap, my->y + 1, my->x) == 1 || getMapCell(myMap, my->y + 1, my->x) == 3)//下方向に壁があった場合
     break;
-    if(myMap[my->y + 1][my->x] == 2){//˥ץݥȤä
+    if(getMapCell(myMap, my->y + 1, my->x) == 2){//舌方向にワープポイントがあった場合
       warp(game,my);
       break;
     }
@@ -456,12 +1139,12 @@ static void updatePlayerStatus(TagGame *game, ServerInputData *serverData)
     break;
 
   case KEY_LEFT: 
-    if(my->x > 2 && myMap[my->y][my->x - 1] == 3 && myMap[my->y][my->x - 2] == 0) my->x -= 2; //ӱۤɤ,2­줬
+    if(my->x > 2 && getMapCell(myMap, my->y, my->x - 1) == 3 && getMapCell(myMap, my->y, my->x - 2) == 0) my->x -= 2; //左方向に飛び越え壁があり,2左方向に足場がある場合
     break;
   case MOVE_LEFT:
-    if(myMap[my->y][my->x - 1] == 1 || myMap[my->y][my->x - 1] == 3)//ɤä
+    if(getMapCell(myMap, my->y, my->x - 1) == 1 || getMapCell(myMap, my->y, my->x - 1) == 3)//左方向に壁があった場合
     break;
-    if(myMap[my->y][my->x - 1] == 2){//˥ץݥȤä
+    if(getMapCell(myMap, my->y, my->x - 1) == 2){//左方向にワープポイントがあった場合
       warp(game,my);
       break;
     }
@@ -469,12 +1152,12 @@ static void updatePlayerStatus(TagGame *game, ServerInputData *serverData)
     break;
 
   case KEY_RIGHT: 
-    if(my->x < myColums - 2 - 1 && myMap[my->y][my->x + 1] == 3 && myMap[my->y][my->x + 2] == 0) my->x += 2; //ӱۤɤ,2ı­줬
+    if(my->x < myColums - 2 - 1 && getMapCell(myMap, my->y, my->x + 1) == 3 && getMapCell(myMap, my->y, my->x + 2) == 0) my->x += 2; //右方向に飛び越え壁があり,2つ右方向に足場がある場合
     break;
   case MOVE_RIGHT:
-    if(myMap[my->y][my->x + 1] == 1 || myMap[my->y][my->x + 1] == 3)//ɤä
+    if(getMapCell(myMap, my->y, my->x + 1) == 1 || getMapCell(myMap, my->y, my->x + 1) == 3)//右方向に壁があった場合
     break;
-    if(myMap[my->y][my->x + 1] == 2){//˥ץݥȤä
+    if(getMapCell(myMap, my->y, my->x + 1) == 2){//右方向にワープポイントがあった場合
       warp(game,my);
       break;
     }
@@ -483,15 +1166,15 @@ static void updatePlayerStatus(TagGame *game, ServerInputData *serverData)
 
   }
 
-  // ˱ƽ
+  // キーに応じて処理
   switch (serverData->itKey) {
   case KEY_UP:
-    if(it->y > 2 && itMap[it->y - 1][it->x] == 3 && itMap[it->y - 2][it->x] == 0) it->y -= 2;//ӱۤɤ,2ľ­줬
+    if(it->y > 2 && getMapCell(itMap, it->y - 1, it->x) == 3 && getMapCell(itMap, it->y - 2, it->x) == 0) it->y -= 2;//上方向に飛び越え壁があり,2つ上方向に足場ががある場合
     break;
   case MOVE_UP: 
-    if(itMap[it->y - 1][it->x] == 1 || itMap[it->y - 1][it->x] == 3)//ɤä
+    if(getMapCell(itMap, it->y - 1, it->x) == 1 || getMapCell(itMap, it->y - 1, it->x) == 3)//上方向に壁があった場合
     break;
-    if(itMap[it->y - 1][it->x] == 2){ //˥ץݥȤä
+    if(getMapCell(itMap, it->y - 1, it->x) == 2){ //上方向にワープポイントがあった場合
       warp(game,it);
       break;
     }
@@ -499,12 +1182,12 @@ static void updatePlayerStatus(TagGame *game, ServerInputData *serverData)
     break;
 
   case KEY_DOWN: 
-    if(it->y < itLines - 2 - 1 && itMap[it->y + 1][it->x] == 3 && itMap[it->y + 2][it->x] == 0) it->y += 2;//ɤ,2Ĳ­줬
+    if(it->y < itLines - 2 - 1 && getMapCell(itMap, it->y + 1, it->x) == 3 && getMapCell(itMap, it->y + 2, it->x) == 0) it->y += 2;//下方向に壁があり,2つ下方向に足場がある場合
     break;
   case MOVE_DOWN:
-    if(itMap[it->y + 1][it->x] == 1 || itMap[it->y + 1][it->x] == 3)//ɤä
+    if(getMapCell(itMap, it->y + 1, it->x) == 1 || getMapCell(itMap, it->y + 1, it->x) == 3)//下方向に壁があった場合
     break;
-    if(itMap[it->y + 1][it->x] == 2){//˥ץݥȤä
+    if(getMapCell(itMap, it->y + 1, it->x) == 2){//舌方向にワープポイントがあった場合
       warp(game,it);
       break;
     }
@@ -512,12 +1195,12 @@ static void updatePlayerStatus(TagGame *game, ServerInputData *serverData)
     break;
 
   case KEY_LEFT: 
-    if(it->x > 2 && itMap[it->y][it->x - 1] == 3 && itMap[it->y][it->x - 2] == 0) it->x -= 2;
+    if(it->x > 2 && getMapCell(itMap, it->y, it->x - 1) == 3 && getMapCell(itMap, it->y, it->x - 2) == 0) it->x -= 2;
     break;
   case MOVE_LEFT:
-    if(itMap[it->y][it->x - 1] == 1 || itMap[it->y][it->x - 1] == 3)//ɤä
+    if(getMapCell(itMap, it->y, it->x - 1) == 1 || getMapCell(itMap, it->y, it->x - 1) == 3)//左方向に壁があった場合
     break;
-    if(itMap[it->y][it->x - 1] == 2){//˥ץݥȤä
+    if(getMapCell(itMap, it->y, it->x - 1) == 2){//左方向にワープポイントがあった場合
       warp(game,it);
       break;
     }
@@ -525,320 +1208,1654 @@ static void updatePlayerStatus(TagGame *game, ServerInputData *serverData)
     break;
 
   case KEY_RIGHT: 
-    if(it->x < itColums - 2 - 1 && itMap[it->y][it->x + 1] == 3 && itMap[it->y][it->x + 2] == 0) it->x += 2;
+    if(it->x < itColums - 2 - 1 && getMapCell(itMap, it->y, it->x + 1) == 3 && getMapCell(itMap, it->y, it->x + 2) == 0) it->x += 2;
     break;
   case MOVE_RIGHT:
-    if(itMap[it->y][it->x + 1] == 1 || itMap[it->y][it->x + 1] == 3)//ɤä
+    if(getMapCell(itMap, it->y, it->x + 1) == 1 || getMapCell(itMap, it->y, it->x + 1) == 3)//右方向に壁があった場合
     break;
-    if(itMap[it->y][it->x + 1] == 2){//˥ץݥȤä
+    if(getMapCell(itMap, it->y, it->x + 1) == 2){//右方向にワープポイントがあった場合
       warp(game,it);
       break;
     }
     if (it->x < itColums - 2) it->x++;
     break;
   }
+
+  // 空間ハッシュに移動を反映する
+  moveSpatialEntity(game->occupancy, game->myEntity, my->inMainMap, my->x, my->y);
+  moveSpatialEntity(game->occupancy, game->itEntity, it->inMainMap, it->x, it->y);
+
+  // 移動方向の先のマップを先読みする
+  prefetchAhead(game,&game->preMy,my);
+  prefetchAhead(game,&game->preIt,it);
 }
 
 /*
- * ξ֤򹹿
- *  :
- *   game       - ä४֥ȤؤΥݥ
- *   clientData - äФϥǡ
+ * 捕まえたかどうかを, その場で同じマスにいる場合以外についても調べる
+ *   - 鬼と逃げる役が 1 ティックでマスを入れ替えた(すれ違った)場合
+ *   - 相手がキーを押したときに見ていた状態(通信の遅れの分だけ古い)では,
+ *     相手が鬼のいるマスに入っていた場合(ラグ補償. 最大 maxRewind ティック巻き戻す)
+ *     霧があるときは, そのティックに相手から鬼が見えていた場合だけ巻き戻して比べる
+ *     (霧で状態を送らないあいだ相手の見ていたティックは進まないので, 巻き戻し先が
+ *      相手の見ていない鬼の位置になることがある)
+ * 捕まえた場合は逃げる役を鬼のマスに置く
+ * (次のループで自分も相手も同じマスにいることを確認してゲームが終わる)
+ * 引数 :
+ *   game       - 鬼ごっこゲームオブジェクトへのポインタ
+ *   serverData - このティックの入力データ
  */
-static void copyGameState(TagGame *game, ClientInputData *clientData)
+static void catchPlayer(TagGame *game, ServerInputData *serverData)
 {
-  Player *my = &game->my;    // 硼ȥå
-  Player *it = &game->it;    // 硼ȥå
-
-  // ǡϤƤʤ, ⤹ɬפϤʤ
-  if (clientData->myX == 0) 
-    return; 
+  CaptureEvent capture;
+  EntityState *seen;             // 相手が見ていた鬼の状態
+  EntityState *viewer;           // そのときの逃げる役の状態
+  Player *chaser = game->chaserIsMe ? &game->my : &game->it;    // 鬼
+  Player *it     = game->chaserIsMe ? &game->it : &game->my;    // 逃げる役
+  Player *preIt  = game->chaserIsMe ? &game->preIt : &game->preMy;
+  int     caught = FALSE;
+  int     seenTick;
+
+  // すれ違った場合
+  if (findCaptures(game->occupancy, &capture, 1) > 0 && capture.passThrough)
+    caught = TRUE;
+
+  // 相手が動いた場合は, 相手が見ていたティックまで鬼の位置を巻き戻して比べる
+  if (!caught && game->maxRewind > 0 && serverData->itKey != 0 && memcmp(it, preIt, sizeof(Player)) != 0) {
+    seenTick = serverData->itSeenTick;
+    if (seenTick < game->tick - game->maxRewind) seenTick = game->tick - game->maxRewind;
+    if (seenTick > game->tick - 1) seenTick = game->tick - 1;
+
+    seen = rewindState(game->history, seenTick, game->chaserIsMe ? game->myEntity : game->itEntity);
+    if (seen != NULL && game->fogOfWar) {
+      viewer = rewindState(game->history, seenTick, game->chaserIsMe ? game->itEntity : game->myEntity);
+      if (viewer == NULL || viewer->inMainMap != seen->inMainMap ||
+          !canSee(viewer->inMainMap ? game->mapSet->mainVision : game->mapSet->subVision,
+                  viewer->x, viewer->y, seen->x, seen->y))
+        seen = NULL;
+    }
+    if (seen != NULL && seen->x == it->x && seen->y == it->y && seen->inMainMap == it->inMainMap)
+      caught = TRUE;
+  }
 
-  // Υץ쥤䡼¸
-  memcpy(&game->preMy, &game->my, sizeof(Player));
-  memcpy(&game->preIt, &game->it, sizeof(Player));
-  
-  // ֤򹹿
-  my->x = clientData->myX;
-  my->y = clientData->myY;
-  it->x = clientData->itX;
-  it->y = clientData->itY;
-  my->inMainMap = clientData->myInMainMap;
-  it->inMainMap = clientData->itInMainMap;
+  if (!caught)
+    return;
 
+  it->inMainMap = chaser->inMainMap;
+  it->x = chaser->x;
+  it->y = chaser->y;
+  moveSpatialEntity(game->occupancy, game->chaserIsMe ? game->itEntity : game->myEntity,
+                    it->inMainMap, it->x, it->y);
 }
 
 /*
- * ̤ɽ
- *  :
- *   game - ä४֥ȤؤΥݥ
+ * 現在のティックの自分と相手の状態を履歴に記録する
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
  */
-static void printGame(TagGame *game)
+static void recordGameState(TagGame *game)
 {
-  WINDOW *mw    = game->mainWin;    // 硼ȥå
-  Player *my    = &game->my;        // 硼ȥå
-  Player *preMy = &game->preMy;     // 硼ȥå
-  Player *it    = &game->it;        // 硼ȥå
-  Player *preIt = &game->preIt;     // 硼ȥå
-  bool IinMainMap = game->my.inMainMap;
-  bool ItinMainMap = game->it.inMainMap;
+  recordState(game->history, game->tick, game->myEntity, game->my.inMainMap, game->my.x, game->my.y);
+  recordState(game->history, game->tick, game->itEntity, game->it.inMainMap, game->it.x, game->it.y);
+}
 
-  WINDOW *myWin = chooseWin(game,my);//ʬ륦ɥ
-  WINDOW *itWin = chooseWin(game,it);//꤬륦ɥ
-  WINDOW *preMyWin = chooseWin(game,preMy);//ʬɥ
-  WINDOW *preItWin = chooseWin(game,preIt);//꤬ɥ
+/*
+ * サーバー側 ロックステップの開始
+ * クライアントに入力遅延とこのラウンドのマップの版(ハッシュ)を知らせ, クライアントが
+ * 切り替えたと返事をするまでに届いたメッセージ(切り替える前のキー入力や ping)は読み捨てる.
+ * 同じマップでなければ同じシミュレーションにならないので, 版が食い違えばクライアントが断る
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ * 戻値 :
+ *   切り替えられたら RESULT_PLAYING, マップの版が食い違ったら RESULT_MAP_MISMATCH,
+ *   その前に相手が終了・切断したら RESULT_QUIT
+ */
+static int startLockstep(TagGame *game)
+{
+  char msg[LONGER(SERVER_MSG_LEN, CLIENT_MSG_LEN)];
 
-  //  (⤷ʬȽŤʤä, ʬ褷Τ꤬)
-  mvwaddch(preItWin, preIt->y, preIt->x, ' ');    // õ
-  mvwaddch(itWin, it->y, it->x, it->chara);    // ɽ
+  sprintf(msg, "lockstep %d %d %x", game->inputDelay, game->fogOfWar, game->mapHash);
+  sendMessage(game->s, msg, SERVER_MSG_LEN);
 
-  // ʬ
-  mvwaddch(preMyWin, preMy->y, preMy->x, ' ');    // õ
-  mvwaddch(myWin, my->y, my->x, my->chara);    // ɽ
+  while (readMessage(game->s, msg, CLIENT_MSG_LEN) > 0) {
+    if (strcmp(msg, "lockstep") == 0)
+      return RESULT_PLAYING;
+    if (strcmp(msg, "lockstep mismatch") == 0)
+      return RESULT_MAP_MISMATCH;
+    if (strcmp(msg, "quit") == 0)
+      return RESULT_QUIT;
+    if (strncmp(msg, "name ", 5) == 0)
+      strncpy(game->itName, msg + 5, MATCH_NAME_LEN - 1);
+  }
 
-  // ʪ̤
-  wrefresh(game->mainWin);
-  wrefresh(game->subWin);
+  game->peerGone = TRUE;
+  return RESULT_QUIT;
 }
 
-
-
 /*
- * ξ֤Τ餻
- *  :
- *   game - ä४֥ȤؤΥݥ
+ * ロックステップの鬼ごっこゲーム(サーバー側・クライアント側で共通)
+ * 両方の端末が同じ入力で同じシミュレーションを動かし, 1 ティックごとに
+ * 入力(3 バイト)だけを交換する. ティック t に押したキーは t + inputDelay に使うので,
+ * 相手の入力は inputDelay ティック分の通信の遅れまでは待たずに届く.
+ * LOCKSTEP_HASH_TICKS ごとに状態のハッシュを交換し, 食い違ったら終わる.
+ * 終わったら終わりのフレームを交換する(この後は同じ接続でラウンドの合間のメッセージを話す)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ * 戻値 :
+ *   ゲームの結果(RESULT_*)
  */
-static void sendGameInfo(TagGame *game)
+static int playLockstepTagGame(TagGame *game)
 {
-  Player *my = &game->my;        // 硼ȥå
-  Player *it = &game->it;        // 硼ȥå
-  char    msg[SERVER_MSG_LEN];   // å
+  Lockstep       *ls;
+  ServerInputData input;
+  GameSnapshot    snapshot;
+  Player          shownIt, drawnIt = game->it;   // 描く相手と最後に描いた相手
+  long            next, deadline;
+  int             key, tick, result = RESULT_PLAYING;
+
+  ls = (Lockstep *)arenaAlloc(&game->room->arena, sizeof(Lockstep), ROOM_ALIGN);
+  initLockstep(ls, game->inputDelay);
+  game->lockstep = ls;
+
+  // 両方の端末で同じ判定をするため, ラグ補償はしない(通信の遅れは入力遅延で隠す)
+  game->maxRewind = 0;
+  game->occupancy = createSpatialHash(2, &game->room->arena);
+  game->myEntity = addSpatialEntity(game->occupancy, game->my.inMainMap, game->my.x, game->my.y, game->chaserIsMe);
+  game->itEntity = addSpatialEntity(game->occupancy, game->it.inMainMap, game->it.x, game->it.y, !game->chaserIsMe);
+
+  next = monotonicUsec();
+  while (result == RESULT_PLAYING) {
+    tick = game->tick + 1;
+
+    // このティックの間に押されたキーを, inputDelay ティック後の入力として送る
+    key = 0;
+    next += TICK_MSEC * 1000L;
+    while (result == RESULT_PLAYING && monotonicUsec() < next)
+      if (pollLockstep(game, next, &key) < 0)
+        result = RESULT_QUIT;
+    if (result != RESULT_PLAYING)
+      break;
+    sendLockstepInput(ls, game->s, key);
+
+    // 相手の入力が間に合わなければ届くまで待つ(待った分は取り戻さない)
+    // 相手が先に同期が外れたことに気づいて終えた場合は, もう入力は届かない
+    // 切断されないまま STALL_WAIT_MSEC 届かなければ, 相手が終了したとみなす
+    if (!hasLockstepInputs(ls, tick)) {
+      deadline = monotonicUsec() + STALL_WAIT_MSEC * 1000L;
+      ls->stalls++;
+      while (result == RESULT_PLAYING && !hasLockstepInputs(ls, tick)) {
+        if (pollLockstep(game, monotonicUsec() + TICK_MSEC * 1000L, NULL) < 0)
+          result = RESULT_QUIT;
+        else if (ls->desyncTick != 0)
+          result = RESULT_DESYNC;
+        else if (ls->remoteEnded)
+          result = RESULT_QUIT;
+        else if (monotonicUsec() >= deadline)
+          result = RESULT_QUIT;
+      }
+      if (result != RESULT_PLAYING)
+        break;
+      next = monotonicUsec();
+    }
 
-  // ʬξѲƤʤɬפϤʤ
-  if (memcmp(&game->my, &game->preMy, sizeof(Player)) == 0 &&
-      memcmp(&game->it, &game->preIt, sizeof(Player)) == 0)
-    return;
+    // 両方の入力でゲームを進める('q' も入力として同じティックで両方に効く)
+    bzero(&input, sizeof(ServerInputData));
+    getLockstepInputs(ls, tick, &input.myKey, &input.itKey);
+    input.quit = input.myKey == 'q' || input.itKey == 'q';
+    result = judgeGame(game, &input);
+    if (result == RESULT_PLAYING) {
+      updatePlayerStatus(game, &input);
+      catchPlayer(game, &input);
+
+      // 状態のハッシュを交換する(相手の分が先に届いていればここで比べる)
+      sendLockstepHash(ls, game->s, game->tick, hashGameState(game));
+      if (ls->desyncTick != 0)
+        result = RESULT_DESYNC;
+
+      // 表示する
+      // (両方の端末が全部の状態を持っているので, 霧は表示だけに効く)
+      printLockstepStats(game);
+      shownIt = game->it;
+      hideUnseen(game, &game->my, &shownIt);
+      printGame(game, &game->my, &game->preMy, &shownIt, &drawnIt);
+      drawnIt = shownIt;
+    }
+  }
 
-  //
-  // ֺɸåѴ
-  //
+  // 終わりのフレームを交換する(相手の終わりのフレームより後は読まない)
+  // END_WAIT_MSEC 届かなければ, この後に届くのがフレームかメッセージか分からないので切断されたとみなす
+  if (!game->peerGone)
+    sendLockstepEnd(ls, game->s);
+  deadline = monotonicUsec() + END_WAIT_MSEC * 1000L;
+  while (!game->peerGone && !ls->remoteEnded) {
+    if (monotonicUsec() >= deadline) {
+      game->peerGone = TRUE;
+      break;
+    }
+    pollLockstep(game, monotonicUsec() + TICK_MSEC * 1000L, NULL);
+  }
 
-  // ץ쥤䡼κɸ
-  sprintf(msg, "%3d %3d %3d %3d %3d %3d", my->x, my->y, it->x, it->y, my->inMainMap, it->inMainMap);
+  // サーバー側は試合結果を記録する
+  if (game->chaserIsMe) {
+    snapshot.tick   = game->tick;
+    snapshot.result = result;
+    recordMatch(game, &snapshot);
+  }
 
-  // 
-  write(game->s, msg, SERVER_MSG_LEN);    
+  return result;
 }
 
 /*
- * ʬβƤ륭
- *  :
- *   game      - ä४֥ȤؤΥݥ
- *   clietData - 饤ȤФϥǡ
+ * ロックステップの通信とキー入力を 1 回だけ待つ
+ * 引数 :
+ *   game     - 鬼ごっこゲームオブジェクトへのポインタ
+ *   deadline - 待つ期限(us, monotonicUsec() の時刻)
+ *   key      - 押されたキー(入出力. 最初のキーを残し, 'q' は必ず残す. NULL ならキーは読まない)
+ * 戻値 :
+ *   相手が切断したら -1(peerGone も立てる), そうでなければ 0
  */
-static void sendMyPressedKey(TagGame *game, ClientInputData *clietData)
+static int pollLockstep(TagGame *game, long deadline, int *key)
 {
-  char    msg[CLIENT_MSG_LEN];   // å
-
-  // ⲡƤʤɬפϤʤ
-  if (clietData->myKey == 0)
-    return;
-
-  //
-  // ֺɸåѴ
-  //
+  fd_set  arrived;
+  TimeVal watchTime;
+  long    remain = deadline - monotonicUsec();
+  int     c;
+
+  FD_ZERO(&arrived);
+  if (key != NULL)
+    FD_SET(0, &arrived);
+  if (!game->lockstep->remoteEnded)     // 終わりのフレームより後はラウンドの合間のメッセージ
+    FD_SET(game->s, &arrived);
+  watchTime.tv_sec  = remain > 0 ? remain / 1000000L : 0;
+  watchTime.tv_usec = remain > 0 ? remain % 1000000L : 0;
+  if (select(game->fdsetWidth, &arrived, NULL, NULL, &watchTime) <= 0)
+    return 0;
+
+  if (key != NULL && FD_ISSET(0, &arrived)) {
+    c = wgetch(game->mainWin);
+    if (*key == 0 || c == 'q')
+      *key = c;
+  }
 
-  // ץ쥤䡼κɸ
-  sprintf(msg, "%d", clietData->myKey);
+  if (FD_ISSET(game->s, &arrived) && receiveLockstepFrames(game->lockstep, game->s) < 0) {
+    game->peerGone = TRUE;
+    return -1;
+  }
 
-  // 
-  write(game->s, msg, CLIENT_MSG_LEN);    
+  return 0;
 }
 
 /*
- * üλ
+ * ゲームの状態のハッシュ(FNV-1a). どちらの端末でも鬼, 逃げる役の順に計算する
+ * (使っているマップの版も混ぜるので, 違うマップで動いていれば食い違う)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ * 戻値 :
+ *   ハッシュ値
  */
-static void die()
+static unsigned hashGameState(TagGame *game)
 {
-  endwin();
-  exit(1);
+  Player  *chaser = game->chaserIsMe ? &game->my : &game->it;
+  Player  *evader = game->chaserIsMe ? &game->it : &game->my;
+  int      value[8];
+  unsigned hash = 2166136261u;
+  int      i;
+
+  value[0] = game->tick;
+  value[1] = chaser->x;
+  value[2] = chaser->y;
+  value[3] = chaser->inMainMap;
+  value[4] = evader->x;
+  value[5] = evader->y;
+  value[6] = evader->inMainMap;
+  value[7] = (int)game->mapHash;
+  for (i = 0; i < 8; i++)
+    hash = (hash ^ (unsigned)value[i]) * 16777619u;
+
+  return hash;
 }
 
+/*
+ * ゲームの結果を表示する
+ * 引数 :
+ *   game   - 鬼ごっこゲームオブジェクトへのポインタ
+ *   result - ゲームの結果(RESULT_*)
+ */
+static void showResult(TagGame *game, int result)
+{
+  char text[MAINWIN_COLUMS];
+
+  switch (result) {
+  case RESULT_WIN:                      //鬼が逃げる役に追いついたとき
+    if (game->chaserIsMe)
+      showText(game,"You Win",5,15,resultPen(game));
+    else
+      showText(game,"You Lose",5,15,resultPen(game));
+    break;
+  case RESULT_NO_CATCH:                 // もう鬼が逃げる役に追いつけないとき(マップで分断されている)
+    showText(game,"No Catch",5,16,1);
+    break;
+  case RESULT_DESYNC:                   // ロックステップの同期が外れたとき
+    sprintf(text, "Desync at tick %d", game->lockstep->desyncTick);
+    showText(game,text,5,11,1);
+    break;
+  case RESULT_MAP_MISMATCH:             // マップの版が相手と食い違ったとき
+    showText(game,"Map mismatch",5,14,1);
+    break;
+  default:                              // ユーザもしくは相手から終了のメッセージが届いた場合
+    showText(game,"QUIT",5,18,1);
+    break;
+  }
+}
 
+/*
+ * ロックステップの通信量・待ち・同期の状態を表示する
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void printLockstepStats(TagGame *game)
+{
+  Lockstep *ls = game->lockstep;    // ショートカット
+  int       ticks = game->tick > 0 ? game->tick : 1;
+
+  mvprintw(MAINWIN_SY + MAINWIN_LINES + 2, MAINWIN_SX,
+           " lockstep delay %d: sent %.1f B/tick, recv %.1f B/tick, stalls %d, hash ok @%d ",
+           ls->delay, (double)ls->bytesSent / ticks, (double)ls->bytesReceived / ticks,
+           ls->stalls, ls->checkedTick);
+  clrtoeol();
+  wnoutrefresh(stdscr);
+}
 
-//--------------------------------------------------------------------
-//  ؿ
-//--------------------------------------------------------------------
+/*
+ * プレイヤーからもう一人のプレイヤーが見えるか(霧が無ければ常に見える)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ *   from - 見るプレイヤー
+ *   to   - 見られるプレイヤー
+ * 戻値 :
+ *   見えれば TRUE
+ */
+static int canSeePlayer(TagGame *game, Player *from, Player *to)
+{
+  if (!game->fogOfWar)
+    return TRUE;
 
-void showText(TagGame *game,char *text,int WinX,int WinY,int penID){
+  // 別のマップにいる相手は見えない
+  if (from->inMainMap != to->inMainMap)
+    return FALSE;
 
-  start_color();//顼롼
-  init_pair(1,COLOR_WHITE,COLOR_BLACK);//ڥο
-  init_pair(2,COLOR_RED,COLOR_WHITE);
-  init_pair(3,COLOR_BLUE,COLOR_WHITE);
+  return canSee(from->inMainMap ? game->mapSet->mainVision : game->mapSet->subVision,
+                from->x, from->y, to->x, to->y);
+}
 
-  wattron(game->mainWin,COLOR_PAIR(penID));//Ȥڥ
-  wbkgd(game->mainWin,COLOR_PAIR(penID));//طʿɤ
+/*
+ * viewer から見えなければ target の位置を隠す(座標を -1 にする)
+ * 引数 :
+ *   game   - 鬼ごっこゲームオブジェクトへのポインタ
+ *   viewer - 見るプレイヤー
+ *   target - 見られるプレイヤー(入出力)
+ */
+static void hideUnseen(TagGame *game, Player *viewer, Player *target)
+{
+  if (canSeePlayer(game, viewer, target))
+    return;
+  target->x = -1;
+  target->y = -1;
+}
 
-  wclear(game->mainWin);//ᥤ󥦥ɥΥޥåפõ
-  werase(game->subWin);//֥ɥõ
+/*
+ * ラウンドの合間の状態を初期化する(最初のラウンドの前に 1 度だけ呼ぶ)
+ * ここより後にアリーナから切り出すデータは, ラウンドごとに作り直す
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void beginRounds(TagGame *game)
+{
+  game->roundMark  = game->room->arena.used;
+  game->roundState = ROUND_WAITING;
+  game->result     = RESULT_PLAYING;
+  initTimerWheel(&game->timers, TIMER_SLOT_MSEC, monotonicUsec() / 1000);
+}
 
-  box(game->mainWin, ACS_VLINE, ACS_HLINE); // ̤ŪǤ
-  wmove(game->mainWin,WinX,WinY); //ΰ֤
-  wprintw(game->mainWin,text);  //ΰ֤ʸ
+/*
+ * サーバー側 ラウンドとラウンドの合間を, 部屋が閉じるまで繰り返す
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void runServerRounds(TagGame *game)
+{
+  while (game->roundState != ROUND_CLOSED) {
+    if (game->roundState == ROUND_PLAYING) {
+      game->result = playServerRound(game);
+      advanceTimerWheel(&game->timers, monotonicUsec() / 1000);
+      enterResult(game, game->result);
+    }
+    else
+      pollLobby(game);
+  }
+}
 
-  wrefresh(game->mainWin);  //ʪ̤
-  wrefresh(game->subWin);
+/*
+ * サーバー側 ラウンドを 1 つ遊ぶ
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ * 戻値 :
+ *   ゲームの結果(RESULT_*)
+ */
+static int playServerRound(TagGame *game)
+{
+  char msg[SERVER_MSG_LEN];
+  int  result;
 
-  sleep(3);
+  startRound(game);
 
+  // ロックステップにする場合は, クライアントと入力だけを交換する
+  if (game->inputDelay > 0) {
+    if ((result = startLockstep(game)) != RESULT_PLAYING)
+      return result;
+    return playLockstepTagGame(game);
+  }
+
+  // クライアントにラウンドの始まりとこのラウンドのマップの版を知らせてから, パイプラインを動かす
+  sprintf(msg, "start %x", game->mapHash);
+  sendRoundMessage(game, msg);
+  return runServerPipeline(game);
 }
 
-//ƥȥեǤMAPɤ߹ǣȤ
-int** readLine(char *mapName){
-  /* macros */
-  int N = 256;
+/*
+ * サーバー側 通信・シミュレーション・描画のパイプラインでラウンドを 1 つ遊ぶ
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ * 戻値 :
+ *   ゲームの結果(RESULT_*)
+ */
+static int runServerPipeline(TagGame *game)
+{
+  ServerPipeline pipeline;
+  pthread_t      ioThread, simThread;
+  int            result;
+
+  // 鬼(自分)と逃げる役(相手)を空間ハッシュに登録する
+  game->occupancy = createSpatialHash(2, &game->room->arena);
+  game->myEntity = addSpatialEntity(game->occupancy, game->my.inMainMap, game->my.x, game->my.y, TRUE);
+  game->itEntity = addSpatialEntity(game->occupancy, game->it.inMainMap, game->it.x, game->it.y, FALSE);
+
+  // 捕獲判定の巻き戻しのために, 直近の状態を覚えておく
+  game->history = createStateHistory(2, HISTORY_TICKS, &game->room->arena);
+  recordGameState(game);
+
+  // ステージをつなぐキューを作る
+  bzero(&pipeline, sizeof(ServerPipeline));
+  pipeline.game        = game;
+  pipeline.keyQueue    = createSpscQueue(STAGE_QUEUE_LEN, sizeof(InputEvent), &game->room->arena);
+  pipeline.netInQueue  = createSpscQueue(STAGE_QUEUE_LEN, sizeof(InputEvent), &game->room->arena);
+  pipeline.netOutQueue = createSpscQueue(STAGE_QUEUE_LEN, sizeof(GameSnapshot), &game->room->arena);
+  pipeline.renderQueue = createSpscQueue(STAGE_QUEUE_LEN, sizeof(GameSnapshot), &game->room->arena);
+
+  // 通信とシミュレーションのステージを動かす
+  if (pthread_create(&ioThread, NULL, networkStage, &pipeline) != 0 ||
+      pthread_create(&simThread, NULL, simulationStage, &pipeline) != 0) {
+    endwin();
+    fprintf(stderr, "Error: cannot create thread\n");
+    exit(1);
+  }
 
-  FILE *fp;
-  char *filename = mapName;
-  char readline[N];
-  int** map;//2Υޥå
-	int i, j = 0;
-	int lines, columes;
+  // 描画のステージ(ラウンドが終わるまで戻らない)
+  result = renderStage(&pipeline);
 
-	// ޥåѤΥΰγ
-	map = (int**)malloc(sizeof(int*) * N);
-	for(i = 0; i < N; i++){
-		map[i] = malloc(sizeof(int) * N);
-	}
-	
-    /* եΥץ */
-  if ((fp = fopen(filename, "r")) == NULL) {
-    fprintf(stderr, "cannot open %s.\n", filename);
-    exit(1);
+  // 終わりの状態を受け取った時点で, 他のステージも終わっている
+  pthread_join(simThread, NULL);
+  pthread_join(ioThread, NULL);
+
+  destroySpscQueue(pipeline.keyQueue);
+  destroySpscQueue(pipeline.netInQueue);
+  destroySpscQueue(pipeline.netOutQueue);
+  destroySpscQueue(pipeline.renderQueue);
+
+  return result;
+}
+
+/*
+ * クライアント側 ラウンドを 1 つ遊ぶ
+ * 'q' を押したらサーバーに知らせ, サーバーが決めた結果が届くか切断されたら戻る
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ * 戻値 :
+ *   ゲームの結果(RESULT_*)
+ */
+static int playClientRound(TagGame *game)
+{
+  ClientInputData clientData;
+
+  startRound(game);
+
+  // サーバーがロックステップにした場合は, 入力だけを交換する
+  if (game->inputDelay > 0)
+    return playLockstepTagGame(game);
+
+  while (1) {
+    
+    // ユーザのキー入力と, 相手から届いたゲームの状態を読む
+    getClientInputData(game, &clientData);
+
+    // サーバーから結果が届いたか, 切断された場合は終わる
+    // (サーバーが落ちたのなら立ち上げ直したサーバーに入り直し, ラウンドの途中から再開すれば続ける)
+    if (clientData.result != RESULT_PLAYING) {
+      if (!game->peerGone || !rejoinServer(game))
+        return clientData.result;
+      if (game->roundState != ROUND_PLAYING)
+        return game->result;
+      continue;
+    }
+
+    // ユーザが終了のキーを押した場合はサーバーに知らせる(結果はサーバーから届く)
+    if (clientData.quit) {
+      sendRoundMessage(game, "quit");
+      continue;
+    }
+
+    // ゲームの状態を更新する
+    copyGameState(game, &clientData);
+
+    // 表示する
+    printGame(game, &game->my, &game->preMy, &game->it, &game->preIt);
+
+    // 自分の押しているキーを相手に送る
+    sendMyPressedKey(game, &clientData);
   }
-	
-	// 1ܤɤ߹
-	if(fscanf(fp, "%d, %d", &lines, &columes) != EOF){
-		//printf("line: %d, columns: %d\n", lines, columes);
-	}
-	else {
-		fprintf(stderr, "format error: %s.\n", filename);
-		exit(1);
-	}
-	
-	i = 0;
-  /* եνüޤʸɤ߼ɽ */
-  while ( fgets(readline, N, fp) != NULL ) {
-	// 1ܤϥå
-	if(i > 0){
-
-		// 2ܰʹߤޥåפɤ߹
-    for(j = 0; j < columes; j++){
-
-      if(readline[j] == ' '){
-        map[i-1][j] = 0;
-      }
-      else if(readline[j] == 'W'){
-        map[i-1][j] = 2;
-      }
-      else if(readline[j] == '+'){
-        map [i-1][j] = 3;
-      }
-      else{
-        map[i-1][j] = 1;
+}
+
+/*
+ * ラウンドを始める(サーバー側・クライアント側で共通)
+ * プレイヤーを開始位置に戻し, 前のラウンドで作ったデータをアリーナごと捨てて画面を描き直す
+ * (チェックポイントから途中で再開したラウンドなら, 書いておいた位置とティックから続ける)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void startRound(TagGame *game)
+{
+  cancelTimer(&game->timers, &game->roundTimer);
+  game->roundState = ROUND_PLAYING;
+
+  // 前のラウンドの空間ハッシュ・履歴・キューなどはまとめて捨てる(再戦してもアリーナは伸びない)
+  arenaRewind(&game->room->arena, game->roundMark);
+  game->occupancy = NULL;
+  game->history   = NULL;
+  game->lockstep  = NULL;
+
+  // プレイヤーを開始位置に戻す
+  if (game->resumed)
+    game->resumed = FALSE;
+  else {
+    game->round++;
+    memcpy(&game->my, &game->startMy, sizeof(Player));
+    memcpy(&game->it, &game->startIt, sizeof(Player));
+    game->tick = 0;
+  }
+  memcpy(&game->preMy, &game->my, sizeof(Player));
+  memcpy(&game->preIt, &game->it, sizeof(Player));
+  game->seenTick = 0;
+
+  // マップファイルが読み直されていれば, このラウンドから新しい版を使う
+  // (クライアントはサーバーが知らせてきた版に, ラウンドの合間で切り替えてある)
+  if (game->chaserIsMe)
+    switchMapSet(game, 0);
+  saveCheckpoint(game);
+
+  // カメラを自分の位置に合わせてマップを描き直す
+  game->mainCam.x = game->mainCam.y = 1;
+  game->subCam.x = game->subCam.y = 1;
+  followCamera(game,&game->my);
+  redrawMaps(game);
+}
+
+/*
+ * 結果の表示で変えた色を戻し, 今のカメラの位置でマップを描き直す
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void redrawMaps(TagGame *game)
+{
+  wattrset(game->mainWin, A_NORMAL);
+  wbkgd(game->mainWin, ' ');
+  werase(game->mainWin);
+  werase(game->subWin);
+  box(game->mainWin, ACS_VLINE, ACS_HLINE);
+  box(game->subWin, ACS_VLINE, ACS_HLINE);
+  createMap(game,game->mainWin,game->mainMap,&game->mainCam);
+  createMap(game,game->subWin,game->subMap,&game->subCam);
+}
+
+/*
+ * マップストアに新しい版があれば切り替える(ラウンドの始めにだけ呼ぶ)
+ * クライアント側はサーバーが知らせてきた版にだけ切り替え, それより新しい版や
+ * 古い版には切り替えない
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ *   hash - 切り替えてよい版のハッシュ(0 なら最新の版に切り替える)
+ * 戻値 :
+ *   使っているマップの版が hash と同じ(hash が 0 なら常に)なら TRUE
+ */
+static int switchMapSet(TagGame *game, unsigned hash)
+{
+  MapSet *set = acquireMapSet(game->mapStore);
+
+  if (set == game->mapSet || (hash != 0 && hashMapSet(set) != hash)) {
+    releaseMapSet(game->mapStore, set);
+    return hash == 0 || game->mapHash == hash;
+  }
+
+  // 古い版は, 参照しているゲームが無くなればストアが解放する
+  releaseMapSet(game->mapStore, game->mapSet);
+  game->mapSet   = set;
+  game->mainMap  = set->mainMap;
+  game->subMap   = set->subMap;
+  game->mapIndex = set->index;
+  game->mapHash  = hashMapSet(set);
+  return TRUE;
+}
+
+/*
+ * ラウンドの合間のイベントループを 1 回まわす(サーバー側・クライアント側で共通)
+ * 次のタイマーの期限までキー入力と相手からのメッセージを待ち, 期限が来たタイマーを呼んでから
+ * 届いたものを処理する. 眠って待つことはないので, 結果の表示中も ping に答える
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void pollLobby(TagGame *game)
+{
+  fd_set  arrived;
+  TimeVal watchTime;
+  char    msg[LONGER(SERVER_MSG_LEN, CLIENT_MSG_LEN)];
+  char    reply[SYNC_MSG_LEN];
+  int     msgLen = game->chaserIsMe ? CLIENT_MSG_LEN : SERVER_MSG_LEN;   // 相手から届くメッセージの長さ
+  long    wait;
+
+  // 通信遅延を測るため, ときどき ping を送る
+  if (!game->peerGone && makePing(&game->netClock, msg))
+    sendRoundMessage(game, msg);
+
+  // 次のタイマーの期限まで待つ(ping を送るため, 長くても LOBBY_POLL_MSEC)
+  wait = nextTimerMsec(&game->timers, monotonicUsec() / 1000);
+  if (wait < 0 || wait > LOBBY_POLL_MSEC)
+    wait = LOBBY_POLL_MSEC;
+  FD_ZERO(&arrived);
+  FD_SET(0, &arrived);
+  if (!game->peerGone)
+    FD_SET(game->s, &arrived);
+  watchTime.tv_sec  = wait / 1000;
+  watchTime.tv_usec = (wait % 1000) * 1000;
+  if (select(game->fdsetWidth, &arrived, NULL, NULL, &watchTime) <= 0)
+    FD_ZERO(&arrived);
+
+  // 期限が来たタイマーを呼ぶ(この後に登録するタイマーは今の時刻から数える)
+  advanceTimerWheel(&game->timers, monotonicUsec() / 1000);
+
+  // 再戦の返事を待つ間にやめる合図を受けたら, 再戦しないと答える
+  if (game->chaserIsMe && game->roundState == ROUND_REMATCH && isRoomDraining(game->listener))
+    answerRematch(game, FALSE);
+
+  //
+  // 標準入力 (キーボード, ０番) にデータが届いている場合
+  //
+  if (FD_ISSET(0, &arrived))
+    handleLobbyKey(game, wgetch(game->mainWin));
+
+  //
+  // 相手との会話用ファイルデスクリプタにデータが届いている場合
+  //
+  if (!game->peerGone && FD_ISSET(game->s, &arrived)) {
+    if (readMessage(game->s, msg, msgLen) <= 0) {
+      // サーバーが落ちたのなら, 立ち上げ直したサーバーに入り直す
+      // 入り直せなければ, 結果の表示中なら表示し終えてから終わる
+      game->peerGone = TRUE;
+      if (rejoinServer(game))
+        return;
+      if (game->roundState != ROUND_RESULT)
+        enterTeardown(game);
+    }
+    // ping にはすぐに返事をし, pong からは通信遅延を求める
+    else if (handleSyncMessage(&game->netClock, msg, monotonicUsec(), reply)) {
+      if (reply[0] != '\0')
+        sendRoundMessage(game, reply);
+    }
+    else
+      handleLobbyMessage(game, msg);
+  }
+}
+
+/*
+ * ラウンドの合間に押されたキーを処理する
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ *   key  - 押されたキー
+ */
+static void handleLobbyKey(TagGame *game, int key)
+{
+  switch (key) {
+  case 'y':                             // 再戦する
+    if (game->roundState == ROUND_REMATCH && game->myRematch < 0)
+      answerRematch(game, TRUE);
+    break;
+  case 'n':                             // 再戦しない
+    if (game->roundState == ROUND_REMATCH && game->myRematch < 0)
+      answerRematch(game, FALSE);
+    break;
+  case 'q':                             // やめる(あいさつの表示中ならすぐに終わる)
+    if (game->roundState == ROUND_TEARDOWN) {
+      game->roundState = ROUND_CLOSED;
+      break;
+    }
+    if (!game->chaserIsMe)
+      sendRoundMessage(game, "quit");
+    enterTeardown(game);
+    break;
+  }
+}
+
+/*
+ * ラウンドの合間に相手から届いたメッセージを処理する
+ * 行き違ったラウンド中のメッセージ(キー入力など)は読み捨てる
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ *   msg  - 届いたメッセージ
+ */
+static void handleLobbyMessage(TagGame *game, char *msg)
+{
+  char               name[ROOM_NAME_LEN];
+  unsigned long long token;
+  unsigned           hash;
+  int                value;
+
+  if (game->roundState == ROUND_TEARDOWN)
+    return;
+
+  //
+  // サーバー側: クライアントからのメッセージ
+  //
+  if (game->chaserIsMe) {
+    if (strncmp(msg, "name ", 5) == 0) {
+      strncpy(game->itName, msg + 5, MATCH_NAME_LEN - 1);
+      if (game->roundState == ROUND_WAITING)
+        enterCountdown(game);
+    }
+    else if (sscanf(msg, "rematch %d", &value) == 1) {
+      if (game->roundState == ROUND_REMATCH) {
+        game->itRematch = value != 0;
+        checkRematch(game);
       }
+    }
+    else if (strcmp(msg, "quit") == 0)
+      enterTeardown(game);
+    return;
+  }
+
+  //
+  // クライアント側: サーバーからのメッセージ
+  //
+  if (sscanf(msg, "countdown %d", &value) == 1) {
+    cancelTimer(&game->timers, &game->roundTimer);
+    game->roundState = ROUND_COUNTDOWN;
+    game->countdown  = value;
+    showCountdown(game);
+  }
+  // ラウンドを始める(サーバーと同じ版のマップが無ければ, 遊ばずに食い違いを知らせる)
+  else if (sscanf(msg, "start %x", &hash) == 1) {
+    if (switchMapSet(game, hash))
+      game->roundState = ROUND_PLAYING;
+    else {
+      sendRoundMessage(game, "quit");
+      cancelTimer(&game->timers, &game->roundTimer);
+      enterResult(game, RESULT_MAP_MISMATCH);
+    }
+  }
+  // ロックステップにする(受けたことを知らせてから, 入力だけを交換する)
+  // 同じマップでなければ同じシミュレーションにならないので, サーバーの版が無ければ断る
+  else if (sscanf(msg, "lockstep %d %d %x", &game->inputDelay, &game->fogOfWar, &hash) == 3) {
+    if (!switchMapSet(game, hash)) {
+      sendRoundMessage(game, "lockstep mismatch");
+      cancelTimer(&game->timers, &game->roundTimer);
+      enterResult(game, RESULT_MAP_MISMATCH);
+    }
+    else {
+      sendRoundMessage(game, "lockstep");
+      game->roundState = ROUND_PLAYING;
+    }
+  }
+  else if (strcmp(msg, "rematch?") == 0)
+    enterRematch(game);
+  else if (strcmp(msg, "bye") == 0)
+    enterTeardown(game);
+  // サーバーが落ちたときに入り直すための部屋名と合言葉
+  else if (sscanf(msg, "resume %15s %llx", name, &token) == 2) {
+    strcpy(game->resumeName, name);
+    game->resumeToken = token;
+  }
+}
+
+/*
+ * ラウンドの合間のメッセージを相手に送る(切断されていれば送らない)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ *   text - 送る文字列
+ */
+static void sendRoundMessage(TagGame *game, char *text)
+{
+  if (!game->peerGone)
+    sendMessage(game->s, text, game->chaserIsMe ? SERVER_MSG_LEN : CLIENT_MSG_LEN);
+}
+
+/*
+ * サーバー側 カウントダウンを始める(1 秒ごとにクライアントにも知らせる)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void enterCountdown(TagGame *game)
+{
+  cancelTimer(&game->timers, &game->roundTimer);
+  game->roundState = ROUND_COUNTDOWN;
+  game->countdown  = COUNTDOWN_SECS;
+  saveCheckpoint(game);
+  showCountdown(game);
+  addTimer(&game->timers, &game->roundTimer, 1000, onCountdown, game);
+}
+
+/*
+ * カウントダウンの残りを表示する(サーバー側はクライアントにも知らせる)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void showCountdown(TagGame *game)
+{
+  char text[MAINWIN_COLUMS];
+
+  if (game->chaserIsMe) {
+    sprintf(text, "countdown %d", game->countdown);
+    sendRoundMessage(game, text);
+  }
+  sprintf(text, "Round %d starts in %d", game->round + 1, game->countdown);
+  showLobbyText(game, text, 1);
+}
+
+/*
+ * ラウンドの結果を表示する. 表示し終えたら再戦するかを聞くか, 終わる
+ * 引数 :
+ *   game   - 鬼ごっこゲームオブジェクトへのポインタ
+ *   result - ゲームの結果(RESULT_*)
+ */
+static void enterResult(TagGame *game, int result)
+{
+  char msg[SERVER_MSG_LEN];
+
+  game->roundState = ROUND_RESULT;
+  game->result     = result;
+  saveCheckpoint(game);
+
+  // パイプラインのときは結果をサーバーだけが知っているので, クライアントに知らせる
+  // (ロックステップでは両方の端末が同じ結果を出している)
+  if (game->chaserIsMe && game->inputDelay == 0) {
+    sprintf(msg, "result %d", result);
+    sendRoundMessage(game, msg);
+  }
+
+  showResult(game, result);
+  addTimer(&game->timers, &game->roundTimer, RESULT_MSEC, onResultShown, game);
+}
+
+/*
+ * 再戦するかを聞く(サーバー側はクライアントにも聞き, 返事を REMATCH_MSEC だけ待つ)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void enterRematch(TagGame *game)
+{
+  // やめる合図を受けていたら, 再戦を聞かずに終わる
+  if (game->chaserIsMe && isRoomDraining(game->listener)) {
+    enterTeardown(game);
+    return;
+  }
+
+  cancelTimer(&game->timers, &game->roundTimer);
+  game->roundState = ROUND_REMATCH;
+  game->myRematch  = -1;
+  game->itRematch  = -1;
+  saveCheckpoint(game);
+  if (game->chaserIsMe) {
+    sendRoundMessage(game, "rematch?");
+    addTimer(&game->timers, &game->roundTimer, REMATCH_MSEC, onRematchTimeout, game);
+  }
+  showLobbyText(game, "Rematch? (y/n)", 1);
+}
+
+/*
+ * 自分の再戦の返事を決める
+ * クライアント側はサーバーに知らせ, 再戦するならサーバーが始めるのを待つ
+ * 引数 :
+ *   game   - 鬼ごっこゲームオブジェクトへのポインタ
+ *   answer - 再戦するなら TRUE
+ */
+static void answerRematch(TagGame *game, int answer)
+{
+  char msg[CLIENT_MSG_LEN];
+
+  game->myRematch = answer;
+  if (game->chaserIsMe) {
+    checkRematch(game);
+    return;
+  }
+
+  sprintf(msg, "rematch %d", answer);
+  sendRoundMessage(game, msg);
+  if (answer)
+    showLobbyText(game, "Waiting for the other player", 1);
+  else
+    enterTeardown(game);
+}
+
+/*
+ * サーバー側 両方の返事がそろったら, 次のラウンドのカウントダウンを始めるか終わる
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void checkRematch(TagGame *game)
+{
+  if (game->myRematch == FALSE || game->itRematch == FALSE)
+    enterTeardown(game);
+  else if (game->myRematch == TRUE && game->itRematch == TRUE)
+    enterCountdown(game);
+  else if (game->myRematch == TRUE)
+    showLobbyText(game, "Waiting for the other player", 1);
+}
+
+/*
+ * 終わりのあいさつを表示し, BYE_MSEC 後に終わる(サーバー側はクライアントにも知らせる)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void enterTeardown(TagGame *game)
+{
+  if (game->roundState == ROUND_TEARDOWN || game->roundState == ROUND_CLOSED)
+    return;
+
+  cancelTimer(&game->timers, &game->roundTimer);
+  game->roundState = ROUND_TEARDOWN;
+
+  // 終わる部屋は, 立ち上げ直しても開き直さない
+  if (game->checkpoint != NULL) {
+    releaseCheckpointSlot(game->checkpoint, game->checkpointSlot);
+    game->checkpoint = NULL;
+  }
+
+  if (game->chaserIsMe)
+    sendRoundMessage(game, "bye");
+  showLobbyText(game, "Thank you for playing!!", resultPen(game));
+  addTimer(&game->timers, &game->roundTimer, BYE_MSEC, onClosed, game);
+}
+
+/*
+ * ラウンドの合間の文字列をメインウィンドウの中央に表示する
+ * 引数 :
+ *   game  - 鬼ごっこゲームオブジェクトへのポインタ
+ *   text  - 表示する文字列
+ *   penID - 使うペン
+ */
+static void showLobbyText(TagGame *game, char *text, int penID)
+{
+  showText(game, text, 5, (MAINWIN_COLUMS - (int)strlen(text)) / 2, penID);
+}
+
+/*
+ * 最後のラウンドの結果を表示するペン(勝ち負けが決まったときだけ色を付ける)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ * 戻値 :
+ *   ペンの番号
+ */
+static int resultPen(TagGame *game)
+{
+  if (game->result != RESULT_WIN)
+    return 1;
+  return game->chaserIsMe ? 2 : 3;
+}
+
+/*
+ * タイマー: クライアントのプレイヤー名が届かないまま待ち時間が過ぎた
+ */
+static void onNameTimeout(void *arg)
+{
+  TagGame *game = (TagGame *)arg;
+
+  if (game->roundState == ROUND_WAITING)
+    enterCountdown(game);
+}
+
+/*
+ * タイマー: カウントダウンの 1 秒が過ぎた(0 になったらラウンドを始める)
+ */
+static void onCountdown(void *arg)
+{
+  TagGame *game = (TagGame *)arg;
+
+  if (--game->countdown > 0) {
+    showCountdown(game);
+    addTimer(&game->timers, &game->roundTimer, 1000, onCountdown, game);
+  }
+  else
+    game->roundState = ROUND_PLAYING;
+}
+
+/*
+ * タイマー: 結果を表示し終えた
+ * 終了・切断・同期外れで終わったラウンドなら終わる. そうでなければサーバー側が再戦するかを聞く
+ * (クライアント側はサーバーが聞いてくるのを待つ)
+ */
+static void onResultShown(void *arg)
+{
+  TagGame *game = (TagGame *)arg;
+
+  if (game->peerGone || game->result == RESULT_QUIT || game->result == RESULT_DESYNC ||
+      game->result == RESULT_MAP_MISMATCH)
+    enterTeardown(game);
+  else if (game->chaserIsMe)
+    enterRematch(game);
+}
 
-    } 
+/*
+ * タイマー: 再戦の返事を待つ時間が過ぎた
+ */
+static void onRematchTimeout(void *arg)
+{
+  enterTeardown((TagGame *)arg);
+}
 
-	}
-	i++;
+/*
+ * タイマー: 終わりのあいさつを表示し終えた
+ */
+static void onClosed(void *arg)
+{
+  ((TagGame *)arg)->roundState = ROUND_CLOSED;
 }
-	
-  /*եɽ
-	for(i = 0; i < lines; i++){
-		for(j = 0; j < columes; j++){
-			printf("%d", map[i][j]);
-		}
-		printf("\n");
-	}
-	*/
 
-    /* եΥ */
+/*
+ * サーバー側 部屋の状態をチェックポイントに書く(チェックポイントが無ければ何もしない)
+ * ラウンド中はシミュレーションのスレッドから, 合間は状態が変わるたびに呼ぶ
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void saveCheckpoint(TagGame *game)
+{
+  RoomSnapshot snapshot;
+
+  if (game->checkpoint == NULL)
+    return;
+
+  bzero(&snapshot, sizeof(RoomSnapshot));
+  snapshot.token      = game->resumeToken;
+  strncpy(snapshot.name, game->resumeName, ROOM_NAME_LEN - 1);
+  snapshot.roundState = game->roundState;
+  snapshot.round      = game->round;
+  snapshot.result     = game->result;
+  snapshot.tick       = game->tick;
+  snapshot.fogOfWar   = game->fogOfWar;
+  snapshot.maxRewind  = game->maxRewind;
+  snapshot.mapVersion = game->mapSet->version;
+  snapshot.mapHash    = game->mapHash;
+  storePlayer(&snapshot.my, &game->my);
+  storePlayer(&snapshot.it, &game->it);
+  strncpy(snapshot.myName, game->myName, MATCH_NAME_LEN - 1);
+  strncpy(snapshot.itName, game->itName, MATCH_NAME_LEN - 1);
+
+  saveRoomSnapshot(game->checkpoint, game->checkpointSlot, &snapshot);
+}
+
+/*
+ * プレイヤーをスナップショットの形にする
+ * 引数 :
+ *   to   - スナップショットのプレイヤー(出力)
+ *   from - プレイヤー
+ */
+static void storePlayer(SnapshotPlayer *to, Player *from)
+{
+  to->chara     = from->chara;
+  to->x         = from->x;
+  to->y         = from->y;
+  to->inMainMap = from->inMainMap;
+}
+
+/*
+ * スナップショットのプレイヤーを戻す
+ * 引数 :
+ *   to   - プレイヤー(出力)
+ *   from - スナップショットのプレイヤー
+ */
+static void loadPlayer(Player *to, SnapshotPlayer *from)
+{
+  to->chara     = from->chara;
+  to->x         = from->x;
+  to->y         = from->y;
+  to->inMainMap = from->inMainMap;
+}
+
+/*
+ * 入り直すときの合言葉を作る(他の部屋のクライアントが入ってこないように)
+ * 戻値 :
+ *   合言葉(0 にはならない)
+ */
+static unsigned long long makeResumeToken()
+{
+  unsigned long long token = 0;
+  FILE              *fp;
+
+  if ((fp = fopen("/dev/urandom", "r")) != NULL) {
+    if (fread(&token, sizeof(token), 1, fp) != 1)
+      token = 0;
     fclose(fp);
+  }
+  if (token == 0)
+    token = ((unsigned long long)time(NULL) << 20) ^ getpid() ^ monotonicUsec();
 
-    return map;
+  return token != 0 ? token : 1;
 }
 
+/*
+ * マップの版の中身のハッシュ(立ち上げ直したサーバーが同じマップを読んだかを確かめる)
+ * 引数 :
+ *   set - マップの版
+ * 戻値 :
+ *   ハッシュ
+ */
+static unsigned hashMapSet(MapSet *set)
+{
+  return hashMap(set->mainMap) * 31 + hashMap(set->subMap);
+}
+
+/*
+ * クライアント側 サーバーが落ちたとき, 立ち上げ直したサーバーに入り直す
+ * 部屋名を名指しして接続し, 合言葉を示す. サーバーが部屋を開き直すまで
+ * REJOIN_MSEC ごとに RESUME_WAIT_MSEC まで試す('q' を押したらあきらめる).
+ * 入り直せたら, サーバーが知らせてきた状態に合わせる
+ * (ラウンドの途中なら続け, そうでなければサーバーのメッセージを待つ)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ * 戻値 :
+ *   入り直せたら TRUE
+ */
+static int rejoinServer(TagGame *game)
+{
+  struct pollfd watch;
+  char          msg[SERVER_MSG_LEN];
+  long          deadline;
+  int           s = -1, state, result;
+
+  // 入り直す先を知らないか, もう終わるところなら入り直さない
+  if (game->chaserIsMe || game->resumeToken == 0 || game->serverName == NULL ||
+      game->roundState == ROUND_TEARDOWN || game->roundState == ROUND_CLOSED)
+    return FALSE;
+
+  showLobbyText(game, "Reconnecting...", 1);
+  deadline = monotonicUsec() / 1000 + RESUME_WAIT_MSEC;
+  while (s < 0 && monotonicUsec() / 1000 < deadline) {
+    // 'q' を押したらあきらめる(押されなければ次に試すまで待つ)
+    watch.fd     = 0;
+    watch.events = POLLIN;
+    if (poll(&watch, 1, REJOIN_MSEC) > 0 && wgetch(game->mainWin) == 'q')
+      return FALSE;
+
+    if ((s = rejoinRoom(game->serverName, game->port, game->resumeName)) < 0)
+      continue;
+    sprintf(msg, "resume %llx", game->resumeToken);
+    sendMessage(s, msg, CLIENT_MSG_LEN);
+
+    // 合言葉が通れば, どこから再開するかが届く
+    watch.fd = s;
+    if (poll(&watch, 1, TOKEN_WAIT_MSEC) <= 0 || readMessage(s, msg, SERVER_MSG_LEN) <= 0 ||
+        sscanf(msg, "resumed %d %d", &state, &result) != 2) {
+      close(s);
+      s = -1;
+    }
+  }
+  if (s < 0)
+    return FALSE;
+
+  // 新しい接続に切り替える
+  close(game->s);
+  game->s = s;
+  FD_ZERO(&game->fdset);
+  FD_SET(0, &game->fdset);
+  FD_SET(s, &game->fdset);
+  game->fdsetWidth = s + 1;
+  game->peerGone   = FALSE;
+  game->seenTick   = 0;
+
+  // ラウンドの途中から続けるなら描き直す. そうでなければサーバーのメッセージを待つ
+  // (カウントダウンか "start" か再戦の問いか, 終わりのあいさつが届く)
+  if (state == ROUND_PLAYING && game->roundState == ROUND_PLAYING) {
+    redrawMaps(game);
+    return TRUE;
+  }
+  cancelTimer(&game->timers, &game->roundTimer);
+  game->roundState = state == ROUND_REMATCH ? ROUND_RESULT : ROUND_COUNTDOWN;
+  game->result     = result;
+  showLobbyText(game, "Reconnected", 1);
 
-void createMap(TagGame *game,WINDOW *Win,char *mapName) {
-  int WinLinesIndex = 0;//Ĥ롼ײѿ
-  int WinColumsIndex = 0;//ΤӤ礬롼פβѿ
+  return TRUE;
+}
 
-  int** map;//ΤΥޥå
+/*
+ * ゲームの状態を更新する
+ * 引数 :
+ *   game       - 鬼ごっこゲームオブジェクトへのポインタ
+ *   clientData - 鬼ごっこゲームに対する入力データ
+ */
+static void copyGameState(TagGame *game, ClientInputData *clientData)
+{
+  Player *my = &game->my;    // ショートカット
+  Player *it = &game->it;    // ショートカット
 
-  if(Win == game->mainWin){//ᥤ󥦥ɥ褹Ȥ
-    WinLinesIndex = MAINWIN_LINES;
-    WinColumsIndex = MAINWIN_COLUMS;
-    MAP = readLine(mapName);
-    map = MAP;
+  // データが届いていなければ, 何もする必要はない
+  if (clientData->myX == 0) 
+    return; 
+
+  // 前回のプレイヤー情報を保存
+  memcpy(&game->preMy, &game->my, sizeof(Player));
+  memcpy(&game->preIt, &game->it, sizeof(Player));
+  
+  // 位置を更新
+  my->x = clientData->myX;
+  my->y = clientData->myY;
+  it->x = clientData->itX;
+  it->y = clientData->itY;
+  my->inMainMap = clientData->myInMainMap;
+  it->inMainMap = clientData->itInMainMap;
+
+  // 自分がどの時点の状態を見ているかを覚えておく(キーと一緒にサーバーへ送る)
+  game->seenTick = clientData->tick;
+
+  // 移動方向の先のマップを先読みする
+  prefetchAhead(game,&game->preMy,my);
+  prefetchAhead(game,&game->preIt,it);
+
+}
+
+/*
+ * ゲーム画面を表示する
+ * 引数 :
+ *   game  - 鬼ごっこゲームオブジェクトへのポインタ
+ *   my    - 描く自分のデータ
+ *   preMy - 前回描いた自分のデータ(消去する)
+ *   it    - 描く相手のデータ
+ *   preIt - 前回描いた相手のデータ(消去する)
+ */
+static void printGame(TagGame *game, Player *my, Player *preMy, Player *it, Player *preIt)
+{
+  // カメラを自分に追従させ, 動いた場合は見えている範囲だけ描き直す
+  if (followCamera(game,my))
+    createMap(game,chooseWin(game,my),chooseMap(game,my),chooseCam(game,my));
+
+  // 前回の位置を消去(消した場所にはマップのマスを描く)
+  drawCharacter(game,preIt,-1);
+  drawCharacter(game,preMy,-1);
+
+  // 相手の描画 (もし自分と重なった場合, 自分を上に描画したいので相手が先)
+  drawCharacter(game,it,it->chara);
+
+  // 自分の描画
+  drawCharacter(game,my,my->chara);
+
+  // チャンクファイルのマップを使っているときはキャッシュの状態を表示
+  if (game->mainMap->chunks != NULL || game->subMap->chunks != NULL)
+    printChunkStats();
+
+  // マップファイルが読み直された場合はそのことを表示
+  if (game->watchMaps)
+    printMapNotice(game);
+
+  // 通信遅延を表示(クライアント側で指定された場合)
+  if (game->showNetClock) {
+    printNetClock(game, stdscr, MAINWIN_SY + MAINWIN_LINES + 2, MAINWIN_SX);
+    clrtoeol();
+    wnoutrefresh(stdscr);
   }
-  else if(Win == game->subWin){//֥ɥ褹Ȥ
-    WinLinesIndex = SUBWIN_LINES;
-    WinColumsIndex = SUBWIN_COLUMS;
-    SUBMAP = readLine(mapName);
-    map = SUBMAP;
+
+  // 物理画面へ描画
+  wrefresh(game->mainWin);
+  wrefresh(game->subWin);
+}
+
+
+
+/*
+ * ゲームの状態を相手に知らせる
+ * 引数 :
+ *   game     - 鬼ごっこゲームオブジェクトへのポインタ
+ *   snapshot - 知らせるゲームの状態
+ */
+static void sendGameInfo(TagGame *game, GameSnapshot *snapshot)
+{
+  Player *my = &snapshot->my;    // ショートカット
+  Player *it = &snapshot->it;    // ショートカット
+  char    msg[SERVER_MSG_LEN];   // 相手に送るメッセージ
+
+  //
+  // 位置座標をメッセージに変換
+  //
+  bzero(msg, SERVER_MSG_LEN);
+
+  // プレイヤーの座標情報
+  sprintf(msg, "%5d %5d %5d %5d %5d %5d %10d", my->x, my->y, it->x, it->y, my->inMainMap, it->inMainMap,
+          snapshot->tick);
+
+  // 送る
+  write(game->s, msg, SERVER_MSG_LEN);    
+}
+
+/*
+ * 自分の押しているキーを相手に送る
+ * 引数 :
+ *   game      - 鬼ごっこゲームオブジェクトへのポインタ
+ *   clietData - クライアントに対する入力データ
+ */
+static void sendMyPressedKey(TagGame *game, ClientInputData *clietData)
+{
+  char    msg[CLIENT_MSG_LEN];   // 相手に送るメッセージ
+
+  // 何も押されていなければ送る必要はない
+  if (clietData->myKey == 0)
+    return;
+
+  //
+  // 位置座標をメッセージに変換
+  //
+  bzero(msg, CLIENT_MSG_LEN);
+
+  // プレイヤーの座標情報
+  sprintf(msg, "%d %d", clietData->myKey, game->seenTick);
+
+  // 送る
+  write(game->s, msg, CLIENT_MSG_LEN);    
+}
+
+/*
+ * 文字列を決まった長さのメッセージとして送る(余りは 0 で埋める)
+ * 引数 :
+ *   s    - 相手との会話用ファイルデスクリプタ
+ *   text - 送る文字列
+ *   len  - メッセージの長さ
+ */
+static void sendMessage(int s, char *text, int len)
+{
+  char msg[LONGER(SERVER_MSG_LEN, CLIENT_MSG_LEN)];
+
+  bzero(msg, len);
+  strncpy(msg, text, len - 1);
+  write(s, msg, len);
+}
+
+/*
+ * 決まった長さのメッセージを 1 つ読む(途中までしか届いていなければ残りを待つ)
+ * 引数 :
+ *   s   - 相手との会話用ファイルデスクリプタ
+ *   msg - メッセージを格納する領域(出力. 必ず '\0' で終わる)
+ *   len - メッセージの長さ
+ * 戻値 :
+ *   読んだバイト数. 切断されていれば 0 以下
+ */
+static int readMessage(int s, char *msg, int len)
+{
+  int got = 0, n;
+
+  bzero(msg, len);
+  while (got < len && (n = read(s, msg + got, len - got)) > 0)
+    got += n;
+  msg[len - 1] = '\0';
+
+  return got;
+}
+
+/*
+ * マップが遊べるかを調べる
+ * 開始位置から互いに出会えないマップは読み込み時に拒否する
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void checkTagMaps(TagGame *game)
+{
+  Player  *my = &game->my;    // ショートカット
+  Player  *it = &game->it;    // ショートカット
+  int      unreachable;
+
+  // 開始位置から鬼が逃げる役に追いつけない場合
+  if (!isPlayableMapSet(game->mapSet, game)) {
+    endwin();
+    fprintf(stderr, "Error: map is unsound (players can never meet)\n");
+    exit(1);
+  }
+
+  // チャンクマップで連結性インデックスを作らなかった場合は調べていないことを知らせる
+  if (game->mapIndex == NULL) {
+    mvprintw(0, MAINWIN_SX, "Notice: chunked maps are not checked for reachability (-I to index)");
+    refresh();
+    return;
   }
 
-  // ޥåפγϰ֤
-  wmove(Win, 1, 1);//ޥåפγɽʤ(1,1)
+  // どちらのプレイヤーも入れない場所がある場合は画面の上に警告を出す
+  unreachable = countUnreachableCells(game->mapIndex, my->inMainMap, my->x, my->y,
+                                      it->inMainMap, it->x, it->y);
+  if (unreachable > 0) {
+    mvprintw(0, MAINWIN_SX, "Warning: %d unreachable cells in map", unreachable);
+    refresh();
+  }
+}
 
-  // ޥåפ
-  for (int i = 1; i < WinLinesIndex - 1; i++) {//Ĥ롼
-    for (int j = 1; j < WinColumsIndex - 1; j++) {//롼
-      if (map[i][j] == 0){//ʤˤʤ
-        wprintw(Win, " ");
-      }
-      else if(map[i][j] == 2){//ץݥȤ
-        wprintw(Win,"W");
-      }
-      else if(map[i][j] == 3){
-        wprintw(Win,"+");
-      }
-      else {//ɤ
-        wprintw(Win, "#");
-      }
+/*
+ * マップの版が遊べるか(開始位置から鬼が逃げる役に追いつけるか)を調べる
+ * 監視スレッドからも呼ばれるので, 開始位置以外のゲームの状態は見ない
+ * 引数 :
+ *   set - マップの版
+ *   arg - 鬼ごっこゲームオブジェクトへのポインタ
+ * 戻値 :
+ *   遊べれば 1
+ */
+static int isPlayableMapSet(MapSet *set, void *arg)
+{
+  TagGame *game = (TagGame *)arg;
+  Player  *my = &game->startMy;    // ショートカット
+  Player  *it = &game->startIt;    // ショートカット
+
+  return canMeet(set->index, my->inMainMap, my->x, my->y, it->inMainMap, it->x, it->y);
+}
+
+/*
+ * マップファイルが読み直されたら画面の上に知らせる
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ */
+static void printMapNotice(TagGame *game)
+{
+  MapStoreStats stats;
+
+  getMapStoreStats(game->mapStore, &stats);
+  if (stats.reloads + stats.rejected == game->mapNotice)
+    return;
+  game->mapNotice = stats.reloads + stats.rejected;
+
+  if (stats.lastError[0] != '\0')
+    mvprintw(0, MAINWIN_SX, "Map reload rejected: %s", stats.lastError);
+  else
+    mvprintw(0, MAINWIN_SX, "Maps reloaded (v%d): used from the next round", stats.version);
+  clrtoeol();
+  wnoutrefresh(stdscr);
+}
+
+/*
+ * 端末を復元し終了する
+ */
+static void die()
+{
+  endwin();
+  exit(1);
+}
+
+
+
+//--------------------------------------------------------------------
+//  自作関数
+//--------------------------------------------------------------------
+
+void showText(TagGame *game,char *text,int WinX,int WinY,int penID){
+
+  start_color();//カラールーチンを初期化
+  init_pair(1,COLOR_WHITE,COLOR_BLACK);//ペンの色を設定
+  init_pair(2,COLOR_RED,COLOR_WHITE);
+  init_pair(3,COLOR_BLUE,COLOR_WHITE);
+
+  wattron(game->mainWin,COLOR_PAIR(penID));//使うペンを設定
+  wbkgd(game->mainWin,COLOR_PAIR(penID));//背景色を塗る
+
+  wclear(game->mainWin);//メインウィンドウのマップを消去
+  werase(game->subWin);//サブウィンドウ消去
+
+  box(game->mainWin, ACS_VLINE, ACS_HLINE); // 画面の静的要素の描画
+  wmove(game->mainWin,WinX,WinY); //カーソルの位置を指定
+  wprintw(game->mainWin,text);  //カーソルの位置に文字出力
+
+  wrefresh(game->mainWin);  //物理画面へ描写
+  wrefresh(game->subWin);
+
+}
+
+//カメラの範囲にあるマップをウィンドウに描画する
+//描画にかかる時間はマップの大きさではなくウィンドウの大きさに比例する
+void createMap(TagGame *game,WINDOW *Win,Map *map,Camera *cam) {
+  int WinLinesIndex;//縦の描画ループ回数の変数
+  int WinColumsIndex;//横の描画ループの回数の変数
+
+  getmaxyx(Win, WinLinesIndex, WinColumsIndex);
+
+  // マップを描画(ウィンドウの外周は枠なので(1,1)スタート)
+  for (int i = 1; i < WinLinesIndex - 1; i++) {//縦の描画ループ
+    wmove(Win, i, 1);
+    for (int j = 1; j < WinColumsIndex - 1; j++) {//横の描画ループ
+      waddch(Win, mapCellChar(getMapCell(map, cam->y + i - 1, cam->x + j - 1)));
     }
-    // ιԤإư
-    wmove(Win, i + 1, 1);
   }
 
-  // ɥι
+  // ウィンドウの更新
   wrefresh(Win);
 
 }
 
+//キャラクターがウィンドウの端に近づいたらカメラを動かす
+//カメラが動いたら TRUE を返す
+int followCamera(TagGame *game,Player *character){
+
+  WINDOW *win = chooseWin(game,character);
+  Map *map = chooseMap(game,character);
+  Camera *cam = chooseCam(game,character);
+  int viewLines, viewColums;//マップを表示できる範囲の大きさ
+  int marginY, marginX;
+  int y = cam->y;
+  int x = cam->x;
+
+  getmaxyx(win, viewLines, viewColums);
+  viewLines -= 2;
+  viewColums -= 2;
+  marginY = (viewLines - 1) / 2 < CAMERA_MARGIN ? (viewLines - 1) / 2 : CAMERA_MARGIN;
+  marginX = (viewColums - 1) / 2 < CAMERA_MARGIN ? (viewColums - 1) / 2 : CAMERA_MARGIN;
+
+  // キャラクターが端から CAMERA_MARGIN 以内に入らないようにする
+  if (character->y < y + marginY) y = character->y - marginY;
+  if (character->y > y + viewLines - 1 - marginY) y = character->y - (viewLines - 1 - marginY);
+  if (character->x < x + marginX) x = character->x - marginX;
+  if (character->x > x + viewColums - 1 - marginX) x = character->x - (viewColums - 1 - marginX);
+
+  // マップの外周(壁)より外は映さない
+  if (y > map->lines - 1 - viewLines) y = map->lines - 1 - viewLines;
+  if (x > map->colums - 1 - viewColums) x = map->colums - 1 - viewColums;
+  if (y < 1) y = 1;
+  if (x < 1) x = 1;
+
+  if (y == cam->y && x == cam->x)
+    return FALSE;
+
+  cam->y = y;
+  cam->x = x;
+  return TRUE;
+
+}
+
+//キャラクターをカメラの位置に合わせて描画する
+//chara が負のときはキャラクターを消し, その位置のマスを描く
+void drawCharacter(TagGame *game,Player *character,int chara){
+
+  WINDOW *win = chooseWin(game,character);
+  Camera *cam = chooseCam(game,character);
+  int winLines, winColums;
+  int y = character->y - cam->y + 1;//ウィンドウ上の座標
+  int x = character->x - cam->x + 1;
+
+  getmaxyx(win, winLines, winColums);
+  if (y < 1 || y >= winLines - 1 || x < 1 || x >= winColums - 1)//カメラの外
+    return;
+
+  if (chara < 0)
+    chara = mapCellChar(getMapCell(chooseMap(game,character), character->y, character->x));
+  mvwaddch(win, y, x, chara);
+
+}
+
+
+
+//キャラクターが動いた方向の先にあるマップを先読みする
+void prefetchAhead(TagGame *game,Player *pre,Player *character){
+
+  if(pre->inMainMap != character->inMainMap)//ワープした場合は方向が無い
+    return;
+
+  if(pre->x < 0 || character->x < 0)//霧で見えていない場合は位置が分からない
+    return;
+
+  prefetchMap(chooseMap(game,character), character->y, character->x,
+              character->y - pre->y, character->x - pre->x);
+
+}
+
+//チャンクキャッシュのヒット率と使用メモリをウィンドウの下に表示する
+void printChunkStats(){
+
+  MapChunkStats stats;
+  unsigned long total;
+
+  getMapChunkStats(&stats);
+  total = stats.hits + stats.misses;
 
+  mvprintw(MAINWIN_SY + MAINWIN_LINES, MAINWIN_SX,
+           "chunk cache: hit %5.1f%%  resident %ldKB (%d chunks)  prefetch %lu",
+           total ? 100.0 * stats.hits / total : 100.0,
+           stats.residentBytes / 1024, stats.residentChunks, stats.prefetches);
+  clrtoeol();
+  wnoutrefresh(stdscr);
+
+}
 
 void warp(TagGame *game,Player *character){
 
- if(character->inMainMap){//ᥤ󥦥ɥˤȤ
+ if(character->inMainMap){//メインウィンドウにいるとき
     character->inMainMap = false;
-    character->x = 2;
-    character->y = 2;
+    character->x = game->subMap->arriveX;
+    character->y = game->subMap->arriveY;
   }
-  else{//֥ɥˤȤ
+  else{//サブウィンドウにいるとき
     character->inMainMap = true;
-    character->x = 37;
-    character->y = 17;
+    character->x = game->mainMap->arriveX;
+    character->y = game->mainMap->arriveY;
   }
 
 }
 
-//饯륦ɥ
+//キャラクターがいるウィンドウを取得する
 WINDOW* chooseWin(TagGame *game,Player *character){
 
-  if(character->inMainMap == true){//饯ᥤޥåפˤʤ
+  if(character->inMainMap == true){//キャラクターがメインマップにいるなら
     return game->mainWin;
   }
   else{
@@ -847,39 +2864,51 @@ WINDOW* chooseWin(TagGame *game,Player *character){
 
 }
 
-//饯ޥåפ
-int** chooseMap(TagGame *game,Player *character){
+//キャラクターがいるマップを取得する
+Map* chooseMap(TagGame *game,Player *character){
+
+  if(character->inMainMap == true){//キャラクターがメインマップにいるなら
+    return game->mainMap;
+  }
+  else{
+    return game->subMap;
+  }
+
+}
+
+//キャラクターがいるウィンドウのカメラを取得する
+Camera* chooseCam(TagGame *game,Player *character){
 
-  if(character->inMainMap == true){//饯ᥤޥåפˤʤ
-    return MAP;
+  if(character->inMainMap == true){//キャラクターがメインマップにいるなら
+    return &game->mainCam;
   }
   else{
-    return SUBMAP;
+    return &game->subCam;
   }
 
 }
 
-//饯ޥåפιԿ
+//キャラクターがいるマップの行数を取得する
 int chooseMap_Lines(TagGame *game,Player *character){
 
-  if(character->inMainMap == true){//饯ᥤޥåפˤʤ
-    return MAINWIN_LINES;
+  if(character->inMainMap == true){//キャラクターがメインマップにいるなら
+    return game->mainMap->lines;
   }
   else{
-    return SUBWIN_LINES;
+    return game->subMap->lines;
   }
 
 }
 
 
-//饯ޥåפ
+//キャラクターがいるマップの列数を取得する
 int chooseMap_Colums(TagGame *game,Player *character){
 
-  if(character->inMainMap == true){//饯ᥤޥåפˤʤ
-    return MAINWIN_COLUMS;
+  if(character->inMainMap == true){//キャラクターがメインマップにいるなら
+    return game->mainMap->colums;
   }
   else{
-    return SUBWIN_COLUMS;
+    return game->subMap->colums;
   }
 
 }
\ No newline at end of file
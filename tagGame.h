@@ -1,94 +1,205 @@
 /********************************************************************
-                       ä⥸塼
-                            إåե
+                       鬼ごっこゲームモジュール
+                            ヘッダファイル
  ********************************************************************/ 
 #include <curses.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "tagMap.h"            // 鬼ごっこマップモジュールヘッダファイル
+#include "mapIndex.h"          // マップ連結性インデックスモジュールヘッダファイル
+#include "mapStore.h"          // マップストアモジュールヘッダファイル
+#include "roomPool.h"          // 部屋プールモジュールヘッダファイル
+#include "spatialHash.h"       // 空間ハッシュモジュールヘッダファイル
+#include "stateHistory.h"      // 状態履歴モジュールヘッダファイル
+#include "netClock.h"          // 通信遅延・時刻同期モジュールヘッダファイル
+#include "matchStore.h"        // 試合結果ストアモジュールヘッダファイル
+#include "lockstep.h"          // ロックステップモジュールヘッダファイル
+#include "timerWheel.h"        // タイマーホイールモジュールヘッダファイル
+#include "roomCheckpoint.h"    // 部屋チェックポイントモジュールヘッダファイル
+#include "roomListener.h"      // 部屋リスナーモジュールヘッダファイル
+
 //--------------------------------------------------------------------
-//   ä⥸塼ˤ뷿
+//   鬼ごっこゲームモジュールにおける型の定義
 //--------------------------------------------------------------------
-typedef struct timeval TimeVal;  // ؤΤ˹¤Τ̾
+typedef struct timeval TimeVal;  // 簡便のために構造体に別名を定義
+
+// ラウンドの状態
+#define ROUND_WAITING    0     // 相手のプレイヤー名を待っている
+#define ROUND_COUNTDOWN  1     // 始まる前のカウントダウン
+#define ROUND_PLAYING    2     // ゲーム中
+#define ROUND_RESULT     3     // 結果を表示している
+#define ROUND_REMATCH    4     // 再戦するかの返事を待っている
+#define ROUND_TEARDOWN   5     // 終わりのあいさつを表示している
+#define ROUND_CLOSED     6     // 終わった
 
 /*
- * ץ졼䡼ǡ¤Τ
+ * プレーヤーデータ構造体の定義
  */
 typedef struct {
-  char    chara;                 // ʬɽ饯
-  int     x;                     // ʬ X ɸ
-  int     y;                     // ʬ Y ɸ
+  char    chara;                 // 自分を表すキャラクタ
+  int     x;                     // 自分の X 座標
+  int     y;                     // 自分の Y 座標
   int    inMainMap;
 } Player;
 
 /*
- * ä๽¤Τ
+ * カメラ(ウィンドウに表示するマップの範囲)の定義
  */
 typedef struct {
-  // Ūǡ
-  Player  my;                    // ʬΥǡ
-  Player  preMy;                 // μʬΥǡ
-  Player  it;                    // Υǡ
-  Player  preIt;                 // Υǡ
-
-  // ̴ϢΥǡ
-  WINDOW *mainWin;               // ᥤ󥦥ɥ
+  int     x;                     // ウィンドウの左上に表示するマップの X 座標
+  int     y;                     // ウィンドウの左上に表示するマップの Y 座標
+} Camera;
+
+/*
+ * 鬼ごっこゲーム構造体の定義
+ */
+typedef struct {
+  Room   *room;                  // このゲームを置いている部屋
+
+  // ゲームの論理的データ
+  Player  my;                    // 自分のデータ
+  Player  preMy;                 // 前回の自分のデータ
+  Player  it;                    // 相手のデータ
+  Player  preIt;                 // 前回の相手のデータ
+  Player  startMy;               // 自分の開始位置
+  Player  startIt;               // 相手の開始位置
+  SpatialHash *occupancy;        // プレイヤーがいるマスの空間ハッシュ(サーバー側のみ)
+  int     myEntity;              // 空間ハッシュでの自分の番号
+  int     itEntity;              // 空間ハッシュでの相手の番号
+  int     tick;                  // 現在のティック(サーバー側で数える)
+  StateHistory *history;         // 直近のティックの状態(サーバー側のみ)
+  int     maxRewind;             // 捕獲判定で巻き戻す最大ティック数
+  int     seenTick;              // 最後に受け取ったゲームの状態のティック(クライアント側)
+  int     chaserIsMe;            // 自分が鬼なら TRUE(サーバー側が鬼)
+  int     inputDelay;            // ロックステップの入力遅延(ティック. 0 ならロックステップにしない)
+  Lockstep *lockstep;            // ロックステップの状態(ロックステップのときだけ)
+  int     fogOfWar;              // 見えない相手を隠すか(サーバー側で決める)
+  char    myName[MATCH_NAME_LEN];  // 自分のプレイヤー名
+  char    itName[MATCH_NAME_LEN];  // 相手のプレイヤー名(サーバー側. クライアントから届く)
+  MatchStore *results;           // 試合結果ストア(サーバー側. NULL なら記録しない)
+
+  // ラウンド関連のデータ
+  int     roundState;            // ラウンドの状態(ROUND_*)
+  int     round;                 // 何ラウンド目か(始めたラウンドの数)
+  int     result;                // 最後のラウンドの結果
+  int     countdown;             // カウントダウンの残り(秒)
+  int     myRematch;             // 自分の再戦の返事(-1 ならまだ, 0 ならしない, 1 ならする)
+  int     itRematch;             // 相手の再戦の返事(サーバー側)
+  int     peerGone;              // 相手との接続が切れたら TRUE
+  TimerWheel timers;             // ラウンドの合間の表示や待ち時間を数えるタイマー
+  Timer   roundTimer;            // 今の状態の期限
+  size_t  roundMark;             // ラウンドごとに作り直すデータを切り出し始めるアリーナの位置
+  RoomListener *listener;        // 部屋リスナー(サーバー側. やめる合図を受けたら再戦しない. NULL なら見ない)
+
+  // 立ち上げ直しに備えるデータ
+  Checkpoint *checkpoint;        // 部屋の状態を書くチェックポイント(サーバー側. NULL なら書かない)
+  int     checkpointSlot;        // チェックポイントの自分のスロット
+  int     resumed;               // 途中から再開したラウンドなら TRUE(開始位置に戻さない)
+  char    resumeName[ROOM_NAME_LEN];  // 立ち上げ直したサーバーで名指しする部屋名
+  unsigned long long resumeToken;     // 入り直すときに示す合言葉(0 なら入り直さない)
+  char   *serverName;            // サーバーのホスト名(クライアント側. 入り直すときに使う)
+  int     port;                  // サーバーのポート番号(クライアント側)
+
+  // マップ関連のデータ
+  MapStore *mapStore;            // マップストア(マップファイルの版を管理する)
+  MapSet   *mapSet;              // このゲームが使っているマップの版
+  int       watchMaps;           // マップファイルの変更を監視するか(サーバー側)
+  int       indexChunked;        // チャンクマップにも連結性インデックスを作るか(-I)
+  int       mapNotice;           // 最後に表示したマップの読み直し回数
+  Map      *mainMap;             // メインマップ(mapSet の中を指す)
+  Map      *subMap;              // サブマップ(mapSet の中を指す)
+  MapIndex *mapIndex;            // マップの連結性インデックス(mapSet の中を指す)
+  unsigned  mapHash;             // マップの中身のハッシュ(チェックポイントに書く)
+
+  // 画面関連のデータ
+  WINDOW *mainWin;               // メインウィンドウ
   WINDOW *subWin;
+  Camera  mainCam;               // メインウィンドウのカメラ
+  Camera  subCam;                // サブウィンドウのカメラ
 
 
-  // ϴϢΥǡ
-  int     s;                     // Ȥβѥեǥץ
-  fd_set  fdset;                 // Ϥƻ뤹եǥץν
-  int     fdsetWidth;            // fdset Υӥå(=ǥץֹܣ)
-  TimeVal watchTime;             // ƻ
+  // 入力関連のデータ
+  int     s;                     // 相手との会話用ファイルデスクリプタ
+  fd_set  fdset;                 // 入力を監視するファイルデスクリプタの集合
+  int     fdsetWidth;            // fdset のビット幅(=最大デスクリプタ番号＋１)
+  TimeVal watchTime;             // 監視時間
+  NetClock netClock;             // 相手との通信遅延と時計のずれ
+  int     showNetClock;          // 通信遅延を表示するか(クライアント側)
 } TagGame;
 
 
 //--------------------------------------------------------------------
-//   ä⥸塼뤬˸ؿΥץȥ
+//   鬼ごっこゲームモジュールが外部に公開する関数のプロトタイプ宣言
 //--------------------------------------------------------------------
 
 /*
- * äν
- *  :
- *   myChara - ʬɽ饯
- *   mySX    - ʬγ X ɸ
- *   mySY    - ʬγ Y ɸ
- *   itChara - ɽ饯
- *   itSX    - γ X ɸ
- *   itSY    - γ Y ɸ
- *  :
- *   ä४֥ȤؤΥݥ
+ * 鬼ごっこゲームの初期化
+ * 引数 :
+ *   myChara - 自分を表すキャラクタ
+ *   mySX    - 自分の開始 X 座標
+ *   mySY    - 自分の開始 Y 座標
+ *   itChara - 相手を表すキャラクタ
+ *   itSX    - 相手の開始 X 座標
+ *   itSY    - 相手の開始 Y 座標
+ * 戻値 :
+ *   鬼ごっこゲームオブジェクトへのポインタ
  */
 TagGame* initTagGame(char myChara, int mySX, int mySY,
                      char itChara, int itSX, int itSY);
 
 /*
- * äν
- *  :
- *   game - ä४֥ȤؤΥݥ
- *   s    - Ȥβѥեǥץ
+ * 鬼ごっこゲームの準備
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
+ *   s    - 相手との会話用ファイルデスクリプタ
  */
 void setupTagGame(TagGame *game, int s);
 
 /*
- * С¦äγ
- *  :
- *   game - ä४֥ȤؤΥݥ
+ * サーバー側鬼ごっこゲームの開始
+ * ラウンドの合間(カウントダウン・結果の表示・再戦の返事)はタイマーで進め,
+ * 両方が再戦を選べば同じ接続で次のラウンドを始める. 終わったら戻る.
+ * ラウンド中の通信・シミュレーションは別スレッドで動かし, このスレッドは描画とキー入力を受け持つ
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
  */
 void playServerTagGame(TagGame *game);
 
 /*
- * 饤¦äγ
- *  :
- *   game - ä४֥ȤؤΥݥ
+ * サーバー側 部屋の状態をチェックポイントに書くようにする(setupTagGame() の前に呼ぶ)
+ * 書いた状態は, このプロセスが落ちたときに立ち上げ直したサーバーが引き取る.
+ * クライアントには入り直すための部屋名と合言葉を知らせる
+ * 引数 :
+ *   game       - 鬼ごっこゲームオブジェクトへのポインタ
+ *   checkpoint - チェックポイントへのポインタ
+ *   slot       - 書くスロット
+ *   roomName   - 部屋名(NULL か空なら, 入り直すための名前を作る)
+ */
+void enableCheckpoint(TagGame *game, Checkpoint *checkpoint, int slot, char *roomName);
+
+/*
+ * サーバー側 落ちたサーバーの部屋を, 引き取ったスナップショットから再開する
+ * (setupTagGame() の後に, playServerTagGame() の代わりに呼ぶ)
+ * クライアントが合言葉を示したら, ラウンドの途中ならその位置から続け,
+ * 合間なら次のカウントダウンか再戦の返事からやり直す. 終わったら戻る
+ * 引数 :
+ *   game     - 鬼ごっこゲームオブジェクトへのポインタ
+ *   snapshot - 引き取ったスナップショット
+ */
+void resumeServerTagGame(TagGame *game, RoomSnapshot *snapshot);
+
+/*
+ * クライアント側鬼ごっこゲームの開始(サーバーが終わりを知らせるか, 切断されたら戻る)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
  */
 void playClientTagGame(TagGame *game);
 
 /*
- * äθ
- *  :
- *   game - ä४֥ȤؤΥݥ
+ * 鬼ごっこゲームの後始末(試合結果ストアは記録を書き終えてから閉じる. 端末も元に戻す)
+ * 引数 :
+ *   game - 鬼ごっこゲームオブジェクトへのポインタ
  */
 void destroyTagGame(TagGame *game);
\ No newline at end of file
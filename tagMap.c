@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tagMap.h"            // 鬼ごっこマップモジュールヘッダファイル
+#include "mapChunk.h"          // マップチャンクキャッシュモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  鬼ごっこマップモジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static Map* checkArrival(Map *map, char *mapName, char *error);
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * マップを読み込む
+ * テキストファイルの 1 行目は "行数,列数" で, 続けて ",到着Y座標,到着X座標" を書くこともできる
+ * チャンクファイルならマス全体は読み込まず, 必要になったチャンクだけを読む
+ * 引数 :
+ *   mapName - マップファイル名
+ *   arriveX - 1 行目に到着座標が無い場合の到着 X 座標
+ *   arriveY - 1 行目に到着座標が無い場合の到着 Y 座標
+ * 戻値 :
+ *   マップへのポインタ
+ */
+Map* loadMap(char *mapName, int arriveX, int arriveY)
+{
+  char error[MAP_ERROR_LEN];
+  Map *map;
+
+  if ((map = tryLoadMap(mapName, arriveX, arriveY, error)) == NULL) {
+    fprintf(stderr, "%s\n", error);
+    exit(1);
+  }
+
+  return map;
+}
+
+/*
+ * マップを読み込む(読めなくても終了しない)
+ * 大きすぎるマップ, 到着座標が床でないマップ, メモリが足りない場合も読めなかったことにする
+ * 引数 :
+ *   mapName - マップファイル名
+ *   arriveX - 1 行目に到着座標が無い場合の到着 X 座標
+ *   arriveY - 1 行目に到着座標が無い場合の到着 Y 座標
+ *   error   - 読めなかった理由を格納する領域(MAP_ERROR_LEN バイト)
+ * 戻値 :
+ *   マップへのポインタ. 読めなければ NULL
+ */
+Map* tryLoadMap(char *mapName, int arriveX, int arriveY, char *error)
+{
+  FILE   *fp;
+  Map    *map;
+  char   *readline = NULL;      // 読み込んだ 1 行(長さに制限はない)
+  size_t  readlineSize = 0;
+  ssize_t len;
+  int     i, j;
+
+  map = (Map *)malloc(sizeof(Map));
+  if (map == NULL) {
+    snprintf(error, MAP_ERROR_LEN, "out of memory: %s.", mapName);
+    return NULL;
+  }
+  map->arriveX = arriveX;
+  map->arriveY = arriveY;
+  map->cells   = NULL;
+
+  // チャンクファイルならヘッダだけを読む
+  if ((map->chunks = openMapChunkFile(mapName)) != NULL) {
+    MapChunkHeader *header = &map->chunks->header;
+    map->lines  = header->lines;
+    map->colums = header->colums;
+    if (header->arriveX >= 0 && header->arriveY >= 0) {
+      map->arriveX = header->arriveX;
+      map->arriveY = header->arriveY;
+    }
+    if ((long long)map->lines * map->colums > MAP_MAX_CELLS) {
+      snprintf(error, MAP_ERROR_LEN, "map too large: %s.", mapName);
+      destroyMap(map);
+      return NULL;
+    }
+    return checkArrival(map, mapName, error);
+  }
+
+  /* ファイルのオープン */
+  if ((fp = fopen(mapName, "r")) == NULL) {
+    snprintf(error, MAP_ERROR_LEN, "cannot open %s.", mapName);
+    free(map);
+    return NULL;
+  }
+
+  // 1行目の読み込み
+  if ((len = getline(&readline, &readlineSize, fp)) == -1 ||
+      sscanf(readline, "%d, %d, %d, %d", &map->lines, &map->colums,
+             &map->arriveY, &map->arriveX) < 2 ||
+      map->lines <= 0 || map->colums <= 0) {
+    snprintf(error, MAP_ERROR_LEN, "format error: %s.", mapName);
+    free(readline);
+    fclose(fp);
+    free(map);
+    return NULL;
+  }
+  if ((long long)map->lines * map->colums > MAP_MAX_CELLS) {
+    snprintf(error, MAP_ERROR_LEN, "map too large: %s.", mapName);
+    free(readline);
+    fclose(fp);
+    free(map);
+    return NULL;
+  }
+
+  // マップ用のメモリ領域の確保(足りない行・列は壁にしておく)
+  map->cells = (unsigned char *)malloc((size_t)map->lines * map->colums);
+  if (map->cells == NULL) {
+    snprintf(error, MAP_ERROR_LEN, "out of memory: %s.", mapName);
+    free(readline);
+    fclose(fp);
+    free(map);
+    return NULL;
+  }
+  memset(map->cells, CELL_WALL, (size_t)map->lines * map->colums);
+
+  // 2行目以降をマップに読み込む
+  for (i = 0; i < map->lines && (len = getline(&readline, &readlineSize, fp)) != -1; i++) {
+    unsigned char *row = &map->cells[(long)i * map->colums];
+
+    for (j = 0; j < map->colums && j < len; j++) {
+      if (readline[j] == ' ') {
+        row[j] = CELL_FLOOR;
+      }
+      else if (readline[j] == 'W') {
+        row[j] = CELL_WARP;
+      }
+      else if (readline[j] == '+') {
+        row[j] = CELL_JUMP;
+      }
+    }
+  }
+
+  /* ファイルのクローズ */
+  free(readline);
+  fclose(fp);
+
+  return checkArrival(map, mapName, error);
+}
+
+/*
+ * マップの後始末
+ * 引数 :
+ *   map - マップへのポインタ
+ */
+void destroyMap(Map *map)
+{
+  if (map == NULL)
+    return;
+  closeMapChunkFile(map->chunks);
+  free(map->cells);
+  free(map);
+}
+
+/*
+ * マップをチャンクファイルに書き出す
+ * 一時ファイルに書いてから名前を付け替えるので, 読み込み中のマップが途中で変わることはない
+ * 引数 :
+ *   map       - マップへのポインタ
+ *   fileName  - 書き出すファイル名
+ *   chunkSize - チャンク 1 辺のマス数
+ * 戻値 :
+ *   成功すれば 0, 失敗すれば -1
+ */
+int saveMapChunks(Map *map, char *fileName, int chunkSize)
+{
+  MapChunkHeader header;
+  unsigned char *chunk;
+  FILE          *fp;
+  char          *tmpName;
+  unsigned       checksum = 2166136261u;    // FNV-1a
+  int            cy, cx, y, x, error;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAP_CHUNK_MAGIC, 8);
+  header.lines     = map->lines;
+  header.colums    = map->colums;
+  header.arriveX   = map->arriveX;
+  header.arriveY   = map->arriveY;
+  header.chunkSize = chunkSize;
+  header.chunksY   = (map->lines + chunkSize - 1) / chunkSize;
+  header.chunksX   = (map->colums + chunkSize - 1) / chunkSize;
+
+  if ((tmpName = (char *)malloc(strlen(fileName) + 5)) == NULL)
+    return -1;
+  sprintf(tmpName, "%s.tmp", fileName);
+  if ((fp = fopen(tmpName, "w")) == NULL) {
+    free(tmpName);
+    return -1;
+  }
+  if ((chunk = (unsigned char *)malloc((size_t)chunkSize * chunkSize)) == NULL) {
+    fclose(fp);
+    unlink(tmpName);
+    free(tmpName);
+    return -1;
+  }
+  fwrite(&header, sizeof(header), 1, fp);
+
+  // チャンクを行優先で書き出す(マップの外は壁)
+  // 読む側がマス全体を読まずに版を区別できるように, 書いた中身のハッシュを後でヘッダに入れる
+  for (cy = 0; cy < header.chunksY; cy++) {
+    for (cx = 0; cx < header.chunksX; cx++) {
+      for (y = 0; y < chunkSize; y++)
+        for (x = 0; x < chunkSize; x++) {
+          chunk[y * chunkSize + x] = getMapCell(map, cy * chunkSize + y, cx * chunkSize + x);
+          checksum = (checksum ^ chunk[y * chunkSize + x]) * 16777619u;
+        }
+      fwrite(chunk, chunkSize, chunkSize, fp);
+    }
+  }
+  header.checksum = checksum;
+  if (fseek(fp, 0, SEEK_SET) == 0)
+    fwrite(&header, sizeof(header), 1, fp);
+
+  free(chunk);
+  error = ferror(fp);
+  if (fclose(fp) != 0 || error || rename(tmpName, fileName) != 0) {
+    unlink(tmpName);
+    free(tmpName);
+    return -1;
+  }
+  free(tmpName);
+  return 0;
+}
+
+/*
+ * マップをテキストファイルに書き出す(1 行目には到着座標も書く)
+ * 一時ファイルに書いてから名前を付け替える
+ * 引数 :
+ *   map      - マップへのポインタ
+ *   fileName - 書き出すファイル名
+ * 戻値 :
+ *   成功すれば 0, 失敗すれば -1
+ */
+int saveMapText(Map *map, char *fileName)
+{
+  FILE *fp;
+  char *tmpName;
+  char *row;
+  int   y, x, error;
+
+  if ((tmpName = (char *)malloc(strlen(fileName) + 5)) == NULL)
+    return -1;
+  sprintf(tmpName, "%s.tmp", fileName);
+  if ((fp = fopen(tmpName, "w")) == NULL) {
+    free(tmpName);
+    return -1;
+  }
+  if ((row = (char *)malloc(map->colums + 1)) == NULL) {
+    fclose(fp);
+    unlink(tmpName);
+    free(tmpName);
+    return -1;
+  }
+  fprintf(fp, "%d,%d,%d,%d\n", map->lines, map->colums, map->arriveY, map->arriveX);
+
+  // 1 行ずつ文字に直して書き出す
+  for (y = 0; y < map->lines; y++) {
+    for (x = 0; x < map->colums; x++)
+      row[x] = mapCellChar(getMapCell(map, y, x));
+    row[map->colums] = '\n';
+    fwrite(row, 1, map->colums + 1, fp);
+  }
+
+  free(row);
+  error = ferror(fp);
+  if (fclose(fp) != 0 || error || rename(tmpName, fileName) != 0) {
+    unlink(tmpName);
+    free(tmpName);
+    return -1;
+  }
+  free(tmpName);
+  return 0;
+}
+
+/*
+ * 移動方向の先にあるマップを先読みする(チャンクファイルのときのみ)
+ * 引数 :
+ *   map - マップへのポインタ
+ *   y   - 現在の Y 座標
+ *   x   - 現在の X 座標
+ *   dy  - Y 方向の移動量
+ *   dx  - X 方向の移動量
+ */
+void prefetchMap(Map *map, int y, int x, int dy, int dx)
+{
+  if (map->chunks != NULL)
+    prefetchMapChunks(map->chunks, y, x, dy, dx);
+}
+
+/*
+ * チャンクファイルのマップのマスの値を得る(getMapCell() から呼ばれる)
+ */
+int getStreamedMapCell(Map *map, int y, int x)
+{
+  return getMapChunkCell(map->chunks, y, x);
+}
+
+/*
+ * マップの中身のハッシュ(同じマップを読み直したかを確かめるのに使う)
+ * チャンクファイルのマップは, マス全体を読まないように大きさと到着座標と,
+ * 書き出したときにヘッダに入れたチャンク全体のハッシュから求める
+ * 引数 :
+ *   map - マップへのポインタ
+ * 戻値 :
+ *   ハッシュ値
+ */
+unsigned hashMap(Map *map)
+{
+  int      head[4] = { map->lines, map->colums, map->arriveY, map->arriveX };
+  unsigned hash = 2166136261u;    // FNV-1a
+  size_t   i, n;
+
+  for (i = 0; i < sizeof(head); i++)
+    hash = (hash ^ ((unsigned char *)head)[i]) * 16777619u;
+  if (map->cells != NULL)
+    for (i = 0, n = (size_t)map->lines * map->colums; i < n; i++)
+      hash = (hash ^ map->cells[i]) * 16777619u;
+  if (map->chunks != NULL)
+    for (i = 0; i < sizeof(map->chunks->header.checksum); i++)
+      hash = (hash ^ ((unsigned char *)&map->chunks->header.checksum)[i]) * 16777619u;
+
+  return hash;
+}
+
+/*
+ * マスを表す文字を得る
+ * 引数 :
+ *   cell - マスの値
+ * 戻値 :
+ *   マスを表す文字
+ */
+char mapCellChar(int cell)
+{
+  switch (cell) {
+  case CELL_FLOOR: return ' ';   // なにもない場合
+  case CELL_WARP:  return 'W';   // ワープポイントがある場合
+  case CELL_JUMP:  return '+';   // 飛び越え壁がある場合
+  default:         return '#';   // 壁がある場合
+  }
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * 到着座標がマップの中の床マスかを調べる(連結性インデックスを作らないマップでも
+ * ワープした先が壁の中にならないように, 読み込むときに確かめる).
+ * 到着座標が (-1, -1) なら決めていない(ツールが変換するだけ)ので調べない
+ * 引数 :
+ *   map     - 読み込んだマップ
+ *   mapName - マップファイル名
+ *   error   - 床でなかったときの理由を格納する領域(MAP_ERROR_LEN バイト)
+ * 戻値 :
+ *   床ならマップへのポインタ. そうでなければマップを解放して NULL
+ */
+static Map* checkArrival(Map *map, char *mapName, char *error)
+{
+  if (map->arriveX == -1 && map->arriveY == -1)
+    return map;
+  if (map->arriveX < 0 || map->arriveX >= map->colums ||
+      map->arriveY < 0 || map->arriveY >= map->lines ||
+      getMapCell(map, map->arriveY, map->arriveX) != CELL_FLOOR) {
+    snprintf(error, MAP_ERROR_LEN, "arrival point (%d,%d) is not on floor: %s.",
+             map->arriveX, map->arriveY, mapName);
+    destroyMap(map);
+    return NULL;
+  }
+
+  return map;
+}
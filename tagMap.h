@@ -0,0 +1,151 @@
+/********************************************************************
+                       鬼ごっこマップモジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef TAG_MAP_H
+#define TAG_MAP_H
+
+//--------------------------------------------------------------------
+//   鬼ごっこマップモジュールにおける定数・型の定義
+//--------------------------------------------------------------------
+#define CELL_FLOOR      0      // 床 (' ')
+#define CELL_WALL       1      // 壁 ('#')
+#define CELL_WARP       2      // ワープポイント ('W')
+#define CELL_JUMP       3      // 飛び越え壁 ('+')
+
+#define MAP_ERROR_LEN   256    // tryLoadMap() が返すエラーメッセージの最大長さ
+#define MAP_MAX_CELLS   (1 << 28)  // 1 枚のマップのマス数の上限(2 枚の和が int に収まるように)
+
+struct MapChunkFile;
+
+/*
+ * マップ構造体の定義
+ * マップの大きさはファイルの 1 行目で決まり, 画面の大きさとは関係ない
+ * チャンクファイルから読んだマップは cells を持たず, 必要なチャンクだけを
+ * キャッシュに読み込む
+ */
+typedef struct {
+  int            lines;          // マップの行数
+  int            colums;         // マップの列数
+  int            arriveX;        // このマップへワープしてきたときの到着 X 座標
+  int            arriveY;        // このマップへワープしてきたときの到着 Y 座標
+  unsigned char *cells;          // マス (lines * colums 個, 行優先). チャンクファイルなら NULL
+  struct MapChunkFile *chunks;   // チャンクファイル(テキストファイルなら NULL)
+} Map;
+
+
+//--------------------------------------------------------------------
+//   鬼ごっこマップモジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * マップを読み込む
+ * テキストファイルの 1 行目は "行数,列数" で, 続けて ",到着Y座標,到着X座標" を書くこともできる
+ * チャンクファイルならマス全体は読み込まず, 必要になったチャンクだけを読む
+ * 引数 :
+ *   mapName - マップファイル名
+ *   arriveX - 1 行目に到着座標が無い場合の到着 X 座標
+ *   arriveY - 1 行目に到着座標が無い場合の到着 Y 座標
+ * 戻値 :
+ *   マップへのポインタ
+ */
+Map* loadMap(char *mapName, int arriveX, int arriveY);
+
+/*
+ * マップを読み込む(読めなくても終了しない)
+ * 大きすぎるマップ, 到着座標が床でないマップ, メモリが足りない場合も読めなかったことにする
+ * 引数 :
+ *   mapName - マップファイル名
+ *   arriveX - 1 行目に到着座標が無い場合の到着 X 座標
+ *   arriveY - 1 行目に到着座標が無い場合の到着 Y 座標
+ *   error   - 読めなかった理由を格納する領域(MAP_ERROR_LEN バイト)
+ * 戻値 :
+ *   マップへのポインタ. 読めなければ NULL
+ */
+Map* tryLoadMap(char *mapName, int arriveX, int arriveY, char *error);
+
+/*
+ * マップをチャンクファイルに書き出す
+ * 一時ファイルに書いてから名前を付け替えるので, 読み込み中のマップが途中で変わることはない
+ * 引数 :
+ *   map       - マップへのポインタ
+ *   fileName  - 書き出すファイル名
+ *   chunkSize - チャンク 1 辺のマス数
+ * 戻値 :
+ *   成功すれば 0, 失敗すれば -1
+ */
+int saveMapChunks(Map *map, char *fileName, int chunkSize);
+
+/*
+ * マップをテキストファイルに書き出す(1 行目には到着座標も書く)
+ * 一時ファイルに書いてから名前を付け替える
+ * 引数 :
+ *   map      - マップへのポインタ
+ *   fileName - 書き出すファイル名
+ * 戻値 :
+ *   成功すれば 0, 失敗すれば -1
+ */
+int saveMapText(Map *map, char *fileName);
+
+/*
+ * 移動方向の先にあるマップを先読みする(チャンクファイルのときのみ)
+ * 引数 :
+ *   map - マップへのポインタ
+ *   y   - 現在の Y 座標
+ *   x   - 現在の X 座標
+ *   dy  - Y 方向の移動量
+ *   dx  - X 方向の移動量
+ */
+void prefetchMap(Map *map, int y, int x, int dy, int dx);
+
+/*
+ * チャンクファイルのマップのマスの値を得る(getMapCell() から呼ばれる)
+ */
+int getStreamedMapCell(Map *map, int y, int x);
+
+/*
+ * マップの後始末
+ * 引数 :
+ *   map - マップへのポインタ
+ */
+void destroyMap(Map *map);
+
+/*
+ * マップの中身のハッシュ(同じマップを読み直したかを確かめるのに使う)
+ * チャンクファイルのマップは, マス全体を読まないように大きさと到着座標と,
+ * 書き出したときにヘッダに入れたチャンク全体のハッシュから求める
+ * 引数 :
+ *   map - マップへのポインタ
+ * 戻値 :
+ *   ハッシュ値
+ */
+unsigned hashMap(Map *map);
+
+/*
+ * マスを表す文字を得る
+ * 引数 :
+ *   cell - マスの値
+ * 戻値 :
+ *   マスを表す文字
+ */
+char mapCellChar(int cell);
+
+/*
+ * マスの値を得る(マップの外は壁として扱う)
+ * 引数 :
+ *   map - マップへのポインタ
+ *   y   - Y 座標
+ *   x   - X 座標
+ * 戻値 :
+ *   マスの値 (CELL_FLOOR, CELL_WALL, CELL_WARP, CELL_JUMP)
+ */
+static inline int getMapCell(Map *map, int y, int x)
+{
+  if (y < 0 || y >= map->lines || x < 0 || x >= map->colums)
+    return CELL_WALL;
+  if (map->cells == NULL)
+    return getStreamedMapCell(map, y, x);
+  return map->cells[(long)y * map->colums + x];
+}
+
+#endif
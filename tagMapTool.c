@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tagMap.h"          // 鬼ごっこマップモジュール
+#include "mapChunk.h"        // マップチャンクキャッシュモジュール
+#include "mapIndex.h"        // マップ連結性インデックスモジュール
+#include "mapGen.h"          // マップ生成モジュール
+
+#define VIEW_LINES   18      // walk で描画を真似る範囲の高さ(メインウィンドウの内側)
+#define VIEW_COLUMS  38      // walk で描画を真似る範囲の横幅
+#define WALK_STEPS   100000  // walk の既定の歩数
+#define GEN_WARP_AREA 65536  // generate, sweep で, この面積ごとにワープポイントを 1 つ増やす
+
+static const int sweepSizes[] = { 64, 256, 1024, 2048, 4096 };   // sweep の既定の大きさ
+
+static void usage();
+static int  compileMap(int argc, char *argv[]);
+static int  walkMap(int argc, char *argv[]);
+static int  generateMaps(int argc, char *argv[]);
+static int  sweepMaps(int argc, char *argv[]);
+static void generatePair(int lines, int colums, unsigned seed, Map **mainMap, Map **subMap,
+                         MapGenStats *mainStats, MapGenStats *subStats);
+static int  saveGeneratedMap(Map *map, char *fileName);
+static double now();
+
+int main(int argc, char *argv[])
+{
+  if (argc >= 2 && strcmp(argv[1], "compile") == 0)
+    return compileMap(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "walk") == 0)
+    return walkMap(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "generate") == 0)
+    return generateMaps(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "sweep") == 0)
+    return sweepMaps(argc, argv);
+
+  usage();
+  return 1;
+}
+
+/*
+ * 使い方を表示する
+ */
+static void usage()
+{
+  fprintf(stderr,
+          "usage: tagMapTool compile <map.txt> <map.tmc> [chunkSize]\n"
+          "       tagMapTool walk <map> [steps]\n"
+          "       tagMapTool generate <lines> <colums> <seed> <main> [sub]\n"
+          "       tagMapTool sweep [size...]\n");
+}
+
+/*
+ * テキストファイルのマップをチャンクファイルに変換する
+ */
+static int compileMap(int argc, char *argv[])
+{
+  Map *map;
+  int  chunkSize = MAP_CHUNK_SIZE;
+
+  if (argc < 4) {
+    usage();
+    return 1;
+  }
+  if (argc >= 5)
+    chunkSize = atoi(argv[4]);
+  if (chunkSize <= 0 || chunkSize > MAP_CHUNK_MAX_SIZE) {
+    fprintf(stderr, "Error: bad chunk size\n");
+    return 1;
+  }
+
+  map = loadMap(argv[2], -1, -1);
+  if (saveMapChunks(map, argv[3], chunkSize) < 0) {
+    fprintf(stderr, "Error: cannot write %s\n", argv[3]);
+    return 1;
+  }
+  printf("%s: %d x %d, %d x %d chunks of %d x %d\n", argv[3], map->lines, map->colums,
+         (map->lines + chunkSize - 1) / chunkSize, (map->colums + chunkSize - 1) / chunkSize,
+         chunkSize, chunkSize);
+  destroyMap(map);
+
+  return 0;
+}
+
+/*
+ * マップの上をランダムに歩き, 描画と同じ範囲のマスを参照して
+ * チャンクキャッシュのヒット率と使用メモリを報告する
+ */
+static int walkMap(int argc, char *argv[])
+{
+  static const int dy[4] = { -1, 1, 0, 0 };
+  static const int dx[4] = { 0, 0, -1, 1 };
+  MapChunkStats stats;
+  Map   *map;
+  long   steps = WALK_STEPS, i;
+  int    y, x, d = 3, v, w, sum = 0;
+  double start, elapsed;
+
+  if (argc < 3) {
+    usage();
+    return 1;
+  }
+  if (argc >= 4)
+    steps = atol(argv[3]);
+
+  start = now();
+  map = loadMap(argv[2], 1, 1);
+  printf("load: %.3f ms (%d x %d, %s)\n", (now() - start) * 1000, map->lines, map->colums,
+         map->chunks != NULL ? "chunked" : "in memory");
+
+  y = map->arriveY;
+  x = map->arriveX;
+  srand(1);
+
+  start = now();
+  for (i = 0; i < steps; i++) {
+    // ときどき向きを変えながら, 床の上をまっすぐ歩く
+    if (rand() % 16 == 0 || getMapCell(map, y + dy[d], x + dx[d]) != CELL_FLOOR)
+      d = rand() % 4;
+    if (getMapCell(map, y + dy[d], x + dx[d]) == CELL_FLOOR) {
+      y += dy[d];
+      x += dx[d];
+      prefetchMap(map, y, x, dy[d], dx[d]);
+    }
+
+    // カメラの範囲を描画するのと同じだけマスを参照する
+    for (v = 0; v < VIEW_LINES; v++)
+      for (w = 0; w < VIEW_COLUMS; w++)
+        sum += getMapCell(map, y - VIEW_LINES / 2 + v, x - VIEW_COLUMS / 2 + w);
+  }
+  elapsed = now() - start;
+
+  getMapChunkStats(&stats);
+  printf("walk: %ld steps in %.3f s (%.1f us/step, checksum %d)\n",
+         steps, elapsed, elapsed * 1e6 / steps, sum);
+  if (map->chunks != NULL) {
+    unsigned long total = stats.hits + stats.misses;
+    printf("cache: hit %.2f%% (%lu hits, %lu misses, %lu prefetches, %lu evictions)\n",
+           total ? 100.0 * stats.hits / total : 100.0,
+           stats.hits, stats.misses, stats.prefetches, stats.evictions);
+    printf("resident: %ld KB in %d chunks (map is %ld KB)\n",
+           stats.residentBytes / 1024, stats.residentChunks,
+           (long)map->lines * map->colums / 1024);
+  }
+  destroyMap(map);
+
+  return 0;
+}
+
+/*
+ * マップを生成してファイルに書き出す
+ * サブマップも作るときは, 2 枚ともにワープポイントを置く.
+ * 名前が .tmc で終わればチャンクファイル, そうでなければテキストファイルにする
+ */
+static int generateMaps(int argc, char *argv[])
+{
+  MapGenStats mainStats, subStats;
+  Map   *mainMap, *subMap = NULL;
+  int    lines, colums;
+
+  if (argc < 6) {
+    usage();
+    return 1;
+  }
+  lines  = atoi(argv[2]);
+  colums = atoi(argv[3]);
+
+  if (argc >= 7) {
+    generatePair(lines, colums, (unsigned)strtoul(argv[4], NULL, 0), &mainMap, &subMap,
+                 &mainStats, &subStats);
+  }
+  else {
+    MapGenParams params;
+    initMapGenParams(&params, lines, colums, (unsigned)strtoul(argv[4], NULL, 0));
+    mainMap = generateMap(&params, &mainStats);
+  }
+
+  printf("%s: %d x %d in %.1f ms (maze %.1f, rooms %.1f, connect %.1f), "
+         "%ld rooms, %ld floor, %ld filled, %ld jumps, %d warps, arrive %d,%d\n",
+         argv[5], mainMap->lines, mainMap->colums, mainStats.totalMsec, mainStats.mazeMsec,
+         mainStats.roomMsec, mainStats.connectMsec, mainStats.rooms, mainStats.floorCells,
+         mainStats.removedCells, mainStats.jumps, mainStats.warps,
+         mainMap->arriveY, mainMap->arriveX);
+  if (saveGeneratedMap(mainMap, argv[5]) < 0) {
+    fprintf(stderr, "Error: cannot write %s\n", argv[5]);
+    return 1;
+  }
+  if (subMap != NULL) {
+    printf("%s: %d x %d in %.1f ms, %ld floor, %ld jumps, %d warps, arrive %d,%d\n",
+           argv[6], subMap->lines, subMap->colums, subStats.totalMsec, subStats.floorCells,
+           subStats.jumps, subStats.warps, subMap->arriveY, subMap->arriveX);
+    if (saveGeneratedMap(subMap, argv[6]) < 0) {
+      fprintf(stderr, "Error: cannot write %s\n", argv[6]);
+      return 1;
+    }
+  }
+  destroyMap(mainMap);
+  destroyMap(subMap);
+
+  return 0;
+}
+
+/*
+ * 大きさを変えながらマップの組を生成し, 生成と連結性インデックスの構築にかかる
+ * 時間を測る. 開始位置の 2 人が出会えること, 行けない床が無いことも確かめる
+ */
+static int sweepMaps(int argc, char *argv[])
+{
+  MapGenStats mainStats, subStats;
+  MapIndex *index;
+  Map   *mainMap, *subMap;
+  int    count = argc > 2 ? argc - 2 : (int)(sizeof(sweepSizes) / sizeof(sweepSizes[0]));
+  int    i, size, meet, unreachable, failed = 0;
+  double start, indexMsec;
+
+  printf("%6s %10s %10s %10s %10s %10s %6s %12s\n",
+         "size", "gen ms", "maze ms", "rooms ms", "conn ms", "index ms", "meet", "unreachable");
+  for (i = 0; i < count; i++) {
+    size = argc > 2 ? atoi(argv[i + 2]) : sweepSizes[i];
+    generatePair(size, size, 1, &mainMap, &subMap, &mainStats, &subStats);
+
+    start = now();
+    index = buildMapIndex(mainMap, subMap);
+    indexMsec = (now() - start) * 1000;
+    meet        = canMeet(index, 1, 1, 1, 1, 10, 10);
+    unreachable = countUnreachableCells(index, 1, 1, 1, 1, 10, 10);
+    if (!meet || unreachable != 0)
+      failed = 1;
+
+    printf("%6d %10.1f %10.1f %10.1f %10.1f %10.1f %6s %12d\n",
+           size, mainStats.totalMsec + subStats.totalMsec,
+           mainStats.mazeMsec + subStats.mazeMsec, mainStats.roomMsec + subStats.roomMsec,
+           mainStats.connectMsec + subStats.connectMsec, indexMsec,
+           meet ? "yes" : "NO", unreachable);
+    destroyMapIndex(index);
+    destroyMap(mainMap);
+    destroyMap(subMap);
+  }
+
+  return failed;
+}
+
+/*
+ * メインマップと, その半分の行数のサブマップを, 互いにワープできるように生成する
+ */
+static void generatePair(int lines, int colums, unsigned seed, Map **mainMap, Map **subMap,
+                         MapGenStats *mainStats, MapGenStats *subStats)
+{
+  MapGenParams params;
+  int subLines = lines / 2 > MAPGEN_MIN_SIZE ? lines / 2 : MAPGEN_MIN_SIZE;
+
+  initMapGenParams(&params, lines, colums, seed);
+  params.warps = 1 + (int)((long)lines * colums / GEN_WARP_AREA);
+  *mainMap = generateMap(&params, mainStats);
+
+  initMapGenParams(&params, subLines, colums, seed + 1);
+  params.warps = 1 + (int)((long)subLines * colums / GEN_WARP_AREA);
+  *subMap = generateMap(&params, subStats);
+}
+
+/*
+ * 生成したマップを書き出す(.tmc ならチャンクファイル, そうでなければテキストファイル)
+ */
+static int saveGeneratedMap(Map *map, char *fileName)
+{
+  size_t len = strlen(fileName);
+
+  if (len >= 4 && strcmp(fileName + len - 4, ".tmc") == 0)
+    return saveMapChunks(map, fileName, MAP_CHUNK_SIZE);
+  return saveMapText(map, fileName);
+}
+
+/*
+ * 現在時刻(秒)
+ */
+static double now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
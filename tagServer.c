@@ -1,37 +1,216 @@
-#include "snet.h"           // а̿饤֥
-#include "tagGame.h"        // ä⥸塼
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
-#define PORT       10000    // ǥեȤΥС¦ݡֹ
-#define MY_CHARA   'o'      // ʬɽ饯
-#define MY_SX      1        // ʬγ X ɸ
-#define MY_SY      1        // ʬγ Y ɸ
-#define IT_CHARA   'x'      // ɽ饯
-#define IT_SX      10       // γ X ɸ
-#define IT_SY      10       // γ Y ɸ
+#include "snet.h"           // 一対一通信ライブラリ
+#include "tagGame.h"        // 鬼ごっこモジュール
+#include "roomListener.h"   // 部屋リスナーモジュール
+
+#define PORT       10000    // デフォルトのサーバー側ポート番号
+#define MY_CHARA   'o'      // 自分を表すキャラクタ
+#define MY_SX      1        // 自分の開始 X 座標
+#define MY_SY      1        // 自分の開始 Y 座標
+#define IT_CHARA   'x'      // 相手を表すキャラクタ
+#define IT_SX      10       // 相手の開始 X 座標
+#define IT_SY      10       // 相手の開始 Y 座標
+#define RESULTS    "results.log"  // 既定の試合結果のログファイル
+#define RESUME_WAIT_SEC  30   // 開き直した部屋にクライアントが入り直すのを待つ時間(秒)
+#define FILE_NAME_LEN    64   // チェックポイントのファイル名の最大長
+
+static void printLeaderboard(char *fileName);
+static void printRooms(int port);
 
 int main(int argc, char *argv[]) 
 { 
-  int      s;       // 饤ȤȤβѥǥץ
-  TagGame *game;    // ä
+  int      s;       // クライアントとの会話用デスクリプタ
+  TagGame *game;    // 鬼ごっこゲーム
+  RoomListener *listener;            // 同じポートの他のサーバーと一緒に待ち受ける部屋リスナー
+  int      opt;
+  int      maxRewind = -1;           // -r の値(-1 なら既定のまま)
+  int      inputDelay = 0;           // -L の値
+  int      fogOfWar = FALSE;         // -f が指定されたか
+  char    *name = NULL;              // -u の値
+  char    *results = RESULTS;        // -R の値
+  int      leaderboard = FALSE;      // -l が指定されたか
+  char    *roomName = NULL;          // -N の値
+  int      showRooms = FALSE;        // -s が指定されたか
+  int      restore = FALSE;          // -C が指定されたか
+  int      indexChunked = FALSE;     // -I が指定されたか
+  Checkpoint  *checkpoint = NULL;    // 部屋の状態を書くチェックポイント(NULL なら書かない)
+  int          slot = -1;            // チェックポイントの自分のスロット
+  RoomSnapshot snapshot;             // -C で引き取ったスナップショット
+  char         fileName[FILE_NAME_LEN];
+
+  // -r ティック数 : 捕獲判定で巻き戻す最大ティック数(0 ならラグ補償しない)
+  // -u 名前       : 自分のプレイヤー名(既定はログイン名)
+  // -R ファイル   : 試合結果のログファイル
+  // -l            : 試合結果のログから順位表を表示して終わる
+  // -L ティック数 : ロックステップにして入力だけを交換する(値は入力遅延)
+  // -f            : 霧を有効にする(見えない相手の位置は表示も送信もしない)
+  // -N 部屋名     : 部屋に名前を付ける(クライアントは -N で名指しして入れる)
+  // -s            : 同じポートで動いているサーバー(部屋)の一覧を表示して終わる
+  // -C            : 落ちたサーバーの部屋をチェックポイントから 1 つ引き取って開き直す
+  //                 (設定や部屋名はスナップショットから戻す)
+  // -I            : チャンクマップ(.tmc)にも連結性インデックスを作る(大きなマップでは読み込みに数秒かかる)
+  while ((opt = getopt(argc, argv, "r:u:R:lL:fN:sCI")) != -1) {
+    if (opt == 'r' && atoi(optarg) >= 0) {
+      maxRewind = atoi(optarg);
+    } else if (opt == 'L' && atoi(optarg) >= 1 && atoi(optarg) <= LOCKSTEP_MAX_DELAY) {
+      inputDelay = atoi(optarg);
+    } else if (opt == 'u') {
+      name = optarg;
+    } else if (opt == 'R') {
+      results = optarg;
+    } else if (opt == 'f') {
+      fogOfWar = TRUE;
+    } else if (opt == 'l') {
+      leaderboard = TRUE;
+    } else if (opt == 'N') {
+      roomName = optarg;
+    } else if (opt == 's') {
+      showRooms = TRUE;
+    } else if (opt == 'C') {
+      restore = TRUE;
+    } else if (opt == 'I') {
+      indexChunked = TRUE;
+    } else {
+      fprintf(stderr, "usage: %s [-r maxRewindTicks] [-u name] [-R resultLog] [-l] [-L inputDelayTicks] [-f] [-N room] [-s] [-C] [-I]\n", argv[0]);
+      exit(1);
+    }
+  }
+
+  if (leaderboard) {
+    printLeaderboard(results);
+    return 0;
+  }
+  if (showRooms) {
+    printRooms(PORT);
+    return 0;
+  }
+
+  // 部屋の状態を書くチェックポイントを開く(ロックステップの部屋は書かない)
+  // 開き直すときは, 落ちたサーバーが残したスナップショットを 1 つ引き取り, その部屋名で待ち受ける
+  sprintf(fileName, CHECKPOINT_FILE, PORT);
+  if (restore) {
+    inputDelay = 0;
+    if ((checkpoint = openCheckpoint(fileName, CHECKPOINT_SLOTS)) == NULL ||
+        (slot = claimOrphanSnapshot(checkpoint, 0, &snapshot)) < 0) {
+      fprintf(stderr, "no room to restore\n");
+      closeCheckpoint(checkpoint);
+      return 0;
+    }
+    roomName = snapshot.name;
+  }
+  else if (inputDelay == 0 && (checkpoint = openCheckpoint(fileName, CHECKPOINT_SLOTS)) != NULL &&
+           (slot = acquireCheckpointSlot(checkpoint)) < 0) {
+    closeCheckpoint(checkpoint);
+    checkpoint = NULL;
+  }
 
-  // äν
+  // 同じポートで待ち受ける(他のサーバープロセスと一緒に待ち受け, カーネルが接続を振り分ける)
+  // SIGUSR1 を受けると新しい相手は受け付けず, 試合中なら試合を終えてから終わる
+  listener = openRoomListener(PORT, roomName);
+  if (restore)
+    listener->waitSec = RESUME_WAIT_SEC;
+
+  // 鬼ごっこゲームの初期化
   game = initTagGame(MY_CHARA, MY_SX, MY_SY, IT_CHARA, IT_SX, IT_SY);
+  if (maxRewind >= 0)
+    game->maxRewind = maxRewind;
+  game->inputDelay = inputDelay;
+  game->fogOfWar   = fogOfWar;
+  game->indexChunked = indexChunked;
+  game->listener     = listener;
+  if (name != NULL)
+    strncpy(game->myName, name, MATCH_NAME_LEN - 1);
+
+  // 試合結果を記録する(ログを読み直して成績を作っておく)
+  game->results = openMatchStore(results);
+
+  // マップファイルが書き換えられたら, 新しいラウンドから新しいマップを使う
+  game->watchMaps = TRUE;
+
+  // この部屋に入るクライアントが来るまで待つ。別のプロセスが受け付けた接続も
+  // この部屋を名指ししていれば渡されてくる。クライアントと会話するためのデスクリプタを返す
+  // (開き直した部屋に誰も入り直さなければ, もう開き直さない)
+  if ((s = acceptRoomPlayer(listener)) < 0) {
+    if (checkpoint != NULL)
+      releaseCheckpointSlot(checkpoint, slot);
+    closeRoomListener(listener);
+    destroyTagGame(game);
+    closeCheckpoint(checkpoint);
+    return 0;
+  }
 
-  // С롣饤ȤΥݡȤ³,
-  // 饤ȤȲä뤿Υǥץ֤
-  s = setupServer(PORT);
+  // 部屋の状態をチェックポイントに書く(このプロセスが落ちたら, -C で立ち上げたサーバーが引き取る)
+  if (checkpoint != NULL)
+    enableCheckpoint(game, checkpoint, slot, roomName);
 
-  // äν
+  // 鬼ごっこゲームの準備
   setupTagGame(game, s);
 
-  // äγ
-  playServerTagGame(game);
+  // 鬼ごっこゲームの開始(再戦するあいだは同じクライアントと続ける)
+  // 開き直した部屋なら, 入り直したクライアントと書いておいた状態から続ける
+  if (restore)
+    resumeServerTagGame(game, &snapshot);
+  else
+    playServerTagGame(game);
 
-  // 饤ȤǤʤ "can't bind" ˤʤΤǡԤ
-  sleep(1);
+  // 部屋の登録を消す
+  closeRoomListener(listener);
 
-  // äθ
+  // 鬼ごっこゲームの後始末
   destroyTagGame(game);
+  closeCheckpoint(checkpoint);
 
   return 0;
 }
+
+/*
+ * 試合結果のログから順位表を表示する
+ * 引数 :
+ *   fileName - 試合結果のログファイル名
+ */
+static void printLeaderboard(char *fileName)
+{
+  MatchStore     *store = openMatchStore(fileName);
+  MatchStoreStats stats;
+  PlayerStats     top[MATCH_TOP_K];
+  int             n, i;
+
+  getMatchStoreStats(store, &stats);
+  printf("%lu matches, %d players (replayed in %ld us", stats.replayed, stats.players, stats.replayUsec);
+  if (stats.truncated > 0)
+    printf(", dropped %ld broken bytes", stats.truncated);
+  printf(")\n");
+
+  n = topPlayers(store, top, MATCH_TOP_K);
+  for (i = 0; i < n; i++)
+    printf("%2d. %-15s %4d wins %4d losses %4d quits (%d games)\n",
+           i + 1, top[i].name, top[i].wins, top[i].losses, top[i].quits, top[i].games);
+
+  closeMatchStore(store);
+}
+
+/*
+ * 同じポートで動いているサーバー(部屋)の一覧を表示する
+ * 引数 :
+ *   port - ポート番号
+ */
+static void printRooms(int port)
+{
+  static char   *stateName[] = { "free", "waiting", "playing", "draining" };
+  RoomDirectory *dir = openRoomDirectory(port);
+  RoomEntry      list[ROOM_DIR_SLOTS];
+  int            n, i;
+
+  n = listRooms(dir, list, ROOM_DIR_SLOTS);
+  printf("%d servers on port %d\n", n, port);
+  for (i = 0; i < n; i++)
+    printf("%7d %-8s %-15s %ld s\n", (int)list[i].pid, stateName[list[i].state],
+           list[i].name[0] != '\0' ? list[i].name : "-", (long)time(NULL) - list[i].since);
+
+  closeRoomDirectory(dir);
+}
@@ -0,0 +1,173 @@
+#include <string.h>
+
+#include "timerWheel.h"        // タイマーホイールモジュールヘッダファイル
+
+//--------------------------------------------------------------------
+//  タイマーホイールモジュール内部で使用する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+static void unlinkTimer(TimerWheel *wheel, Timer *timer);
+static Timer* findExpired(Timer *head, long tick);
+
+//--------------------------------------------------------------------
+//  外部に公開する関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * タイマーホイールを初期化する
+ * 引数 :
+ *   wheel    - タイマーホイールへのポインタ
+ *   slotMsec - 1 ティックの長さ(ms. タイマーの精度)
+ *   nowMsec  - 現在時刻(ms)
+ */
+void initTimerWheel(TimerWheel *wheel, int slotMsec, long nowMsec)
+{
+  int i;
+
+  memset(wheel, 0, sizeof(TimerWheel));
+  wheel->slotMsec = slotMsec > 0 ? slotMsec : 1;
+  wheel->tick     = nowMsec / wheel->slotMsec;
+  wheel->nowMsec  = nowMsec;
+  for (i = 0; i < TIMER_SLOTS; i++)
+    wheel->slot[i].next = wheel->slot[i].prev = &wheel->slot[i];
+}
+
+/*
+ * タイマーを登録する(すでに登録されていれば登録し直す)
+ * 期限は最後に時間を進めた時刻から数える(コールバックの中で登録すれば, 期限の時刻から数える)
+ * 引数 :
+ *   wheel     - タイマーホイールへのポインタ
+ *   timer     - タイマー
+ *   delayMsec - 期限までの時間(ms)
+ *   fire      - 期限が来たら呼ぶ関数
+ *   arg       - fire に渡す引数
+ */
+void addTimer(TimerWheel *wheel, Timer *timer, int delayMsec, TimerCallback fire, void *arg)
+{
+  Timer *head;
+
+  if (timer->active)
+    unlinkTimer(wheel, timer);
+
+  // 期限は切り上げる(早く呼ぶことはない). 処理し終えたティックには入れない
+  timer->expire = (wheel->nowMsec + (delayMsec > 0 ? delayMsec : 0) + wheel->slotMsec - 1) / wheel->slotMsec;
+  if (timer->expire <= wheel->tick)
+    timer->expire = wheel->tick + 1;
+  timer->fire   = fire;
+  timer->arg    = arg;
+  timer->active = 1;
+
+  // スロットのリストの末尾につなぐ(同じティックなら登録した順に呼ぶ)
+  head = &wheel->slot[timer->expire & (TIMER_SLOTS - 1)];
+  timer->next = head;
+  timer->prev = head->prev;
+  head->prev->next = timer;
+  head->prev = timer;
+  wheel->active++;
+}
+
+/*
+ * タイマーを取り消す(登録されていなければ何もしない)
+ * 引数 :
+ *   wheel - タイマーホイールへのポインタ
+ *   timer - タイマー
+ */
+void cancelTimer(TimerWheel *wheel, Timer *timer)
+{
+  if (timer->active)
+    unlinkTimer(wheel, timer);
+}
+
+/*
+ * 時間を進め, 期限が来たタイマーの関数を期限の順に呼ぶ
+ * 引数 :
+ *   wheel   - タイマーホイールへのポインタ
+ *   nowMsec - 現在時刻(ms)
+ * 戻値 :
+ *   呼んだタイマーの数
+ */
+int advanceTimerWheel(TimerWheel *wheel, long nowMsec)
+{
+  long   target = nowMsec / wheel->slotMsec;
+  Timer *timer;
+  int    fired = 0;
+
+  while (wheel->tick < target) {
+    // タイマーが無ければ, 過ぎたティックのスロットを見る必要はない
+    if (wheel->active == 0) {
+      wheel->tick = target;
+      break;
+    }
+    wheel->tick++;
+    wheel->nowMsec = wheel->tick * wheel->slotMsec;
+
+    // 関数の中で同じスロットのタイマーを登録・取り消ししてもよいように, 1 つずつ外して呼ぶ
+    // (同じスロットには TIMER_SLOTS ティック後のタイマーもつながっている)
+    while ((timer = findExpired(&wheel->slot[wheel->tick & (TIMER_SLOTS - 1)], wheel->tick)) != NULL) {
+      unlinkTimer(wheel, timer);
+      timer->fire(timer->arg);
+      fired++;
+    }
+  }
+  wheel->nowMsec = nowMsec;
+
+  return fired;
+}
+
+/*
+ * 次のタイマーの期限までの時間
+ * 引数 :
+ *   wheel   - タイマーホイールへのポインタ
+ *   nowMsec - 現在時刻(ms)
+ * 戻値 :
+ *   期限までの時間(ms. 過ぎていれば 0). タイマーが無ければ -1
+ */
+long nextTimerMsec(TimerWheel *wheel, long nowMsec)
+{
+  Timer *timer;
+  long   expire = -1;
+  long   remain;
+  int    i;
+
+  if (wheel->active == 0)
+    return -1;
+
+  // タイマーは多くないので, すべてのスロットを見る
+  for (i = 0; i < TIMER_SLOTS; i++)
+    for (timer = wheel->slot[i].next; timer != &wheel->slot[i]; timer = timer->next)
+      if (expire < 0 || timer->expire < expire)
+        expire = timer->expire;
+
+  remain = expire * wheel->slotMsec - nowMsec;
+  return remain > 0 ? remain : 0;
+}
+
+
+//--------------------------------------------------------------------
+//  外部に公開しない関数の定義
+//--------------------------------------------------------------------
+
+/*
+ * タイマーをスロットのリストから外す
+ */
+static void unlinkTimer(TimerWheel *wheel, Timer *timer)
+{
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = timer->prev = NULL;
+  timer->active = 0;
+  wheel->active--;
+}
+
+/*
+ * スロットのリストから, 期限が来たタイマーを 1 つ探す(無ければ NULL)
+ */
+static Timer* findExpired(Timer *head, long tick)
+{
+  Timer *timer;
+
+  for (timer = head->next; timer != head; timer = timer->next)
+    if (timer->expire <= tick)
+      return timer;
+
+  return NULL;
+}
@@ -0,0 +1,100 @@
+/********************************************************************
+                       タイマーホイールモジュール
+                            ヘッダファイル
+ ********************************************************************/
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+//--------------------------------------------------------------------
+//   タイマーホイールモジュールにおける定数・型の定義
+//--------------------------------------------------------------------
+#define TIMER_SLOTS        64     // ホイールのスロット数(2 のべき乗)
+
+/*
+ * 期限が来たときに呼ぶ関数
+ */
+typedef void (*TimerCallback)(void *arg);
+
+/*
+ * タイマー(使う側の構造体に埋め込む. ホイールは確保も解放もしない)
+ */
+typedef struct Timer {
+  struct Timer *next;            // 同じスロットの次のタイマー
+  struct Timer *prev;            // 同じスロットの前のタイマー
+  long          expire;          // 期限(ホイールのティック)
+  TimerCallback fire;            // 期限が来たら呼ぶ関数
+  void         *arg;             // fire に渡す引数
+  int           active;          // ホイールに入っていれば 1
+} Timer;
+
+/*
+ * タイマーホイール構造体の定義
+ * 時間を slotMsec ごとのティックに区切り, 期限のティックを TIMER_SLOTS で割った
+ * 余りのスロットにタイマーをつなぐ(ハッシュ化したタイマーホイール).
+ * 登録と取り消しは O(1) で, 時間を進めるときは過ぎたティックのスロットだけを見る.
+ * イベントループが select() などで待つ時間は nextTimerMsec() で決める.
+ * スレッドセーフではない(1 つのイベントループから使う)
+ */
+typedef struct {
+  int     slotMsec;              // 1 ティックの長さ(ms)
+  long    tick;                  // 処理し終えたティック
+  long    nowMsec;               // 最後に時間を進めた時刻(ms)
+  int     active;                // 入っているタイマーの数
+  Timer   slot[TIMER_SLOTS];     // スロットごとのリストの番兵
+} TimerWheel;
+
+
+//--------------------------------------------------------------------
+//   タイマーホイールモジュールが外部に公開する関数のプロトタイプ宣言
+//--------------------------------------------------------------------
+
+/*
+ * タイマーホイールを初期化する
+ * 引数 :
+ *   wheel    - タイマーホイールへのポインタ
+ *   slotMsec - 1 ティックの長さ(ms. タイマーの精度)
+ *   nowMsec  - 現在時刻(ms)
+ */
+void initTimerWheel(TimerWheel *wheel, int slotMsec, long nowMsec);
+
+/*
+ * タイマーを登録する(すでに登録されていれば登録し直す)
+ * 期限は最後に時間を進めた時刻から数える(コールバックの中で登録すれば, 期限の時刻から数える)
+ * 引数 :
+ *   wheel     - タイマーホイールへのポインタ
+ *   timer     - タイマー
+ *   delayMsec - 期限までの時間(ms)
+ *   fire      - 期限が来たら呼ぶ関数
+ *   arg       - fire に渡す引数
+ */
+void addTimer(TimerWheel *wheel, Timer *timer, int delayMsec, TimerCallback fire, void *arg);
+
+/*
+ * タイマーを取り消す(登録されていなければ何もしない)
+ * 引数 :
+ *   wheel - タイマーホイールへのポインタ
+ *   timer - タイマー
+ */
+void cancelTimer(TimerWheel *wheel, Timer *timer);
+
+/*
+ * 時間を進め, 期限が来たタイマーの関数を期限の順に呼ぶ
+ * 引数 :
+ *   wheel   - タイマーホイールへのポインタ
+ *   nowMsec - 現在時刻(ms)
+ * 戻値 :
+ *   呼んだタイマーの数
+ */
+int advanceTimerWheel(TimerWheel *wheel, long nowMsec);
+
+/*
+ * 次のタイマーの期限までの時間
+ * 引数 :
+ *   wheel   - タイマーホイールへのポインタ
+ *   nowMsec - 現在時刻(ms)
+ * 戻値 :
+ *   期限までの時間(ms. 過ぎていれば 0). タイマーが無ければ -1
+ */
+long nextTimerMsec(TimerWheel *wheel, long nowMsec);
+
+#endif